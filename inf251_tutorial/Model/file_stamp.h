@@ -0,0 +1,59 @@
+#if !defined(FILE_STAMP_H)
+#define FILE_STAMP_H
+
+#include <cstddef>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+//-----------------------------------------------------------------------------
+// Change detection for the files that cached data is derived from.
+//
+// The model cache and the baked textures record the size, modification time
+// and content hash of their source file. A cache whose size and time still
+// match is used as is. When only the time differs, e.g. after a fresh
+// checkout, the contents are hashed again and decide.
+//
+// The hash is 64-bit FNV-1a. hashBytes() continues a hash over more data,
+// starting from HASH_SEED.
+//-----------------------------------------------------------------------------
+
+const unsigned long long HASH_SEED = 14695981039346656037ull;
+
+inline unsigned long long hashBytes(unsigned long long hash, const void *pData, size_t size)
+{
+    const unsigned char *pBytes = static_cast<const unsigned char *>(pData);
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= pBytes[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+inline unsigned long long hashContents(const void *pData, size_t size)
+{
+    return hashBytes(HASH_SEED, pData, size);
+}
+
+inline bool getFileStamp(const char *pszFilename, unsigned long long &size, long long &time)
+{
+#if defined(_WIN32)
+    struct _stat64 info;
+
+    if (_stat64(pszFilename, &info) != 0)
+        return false;
+#else
+    struct stat info;
+
+    if (stat(pszFilename, &info) != 0)
+        return false;
+#endif
+
+    size = static_cast<unsigned long long>(info.st_size);
+    time = static_cast<long long>(info.st_mtime);
+    return true;
+}
+
+#endif
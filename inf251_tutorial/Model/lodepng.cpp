@@ -32,9 +32,33 @@ Rename this file to lodepng.cpp to use it for C++, or to lodepng.c to use it for
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+/*SSE2 is part of every x64 cpu, SSSE3 and PCLMULQDQ are detected at runtime. Define
+LODEPNG_NO_SIMD to build only the portable code.*/
+#if !defined(LODEPNG_NO_SIMD) && (defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__))
+#define LODEPNG_USE_SSE2
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#if defined(__GNUC__)
+#define LODEPNG_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define LODEPNG_TARGET_PCLMUL __attribute__((target("pclmul")))
+#else
+#define LODEPNG_TARGET_SSSE3
+#define LODEPNG_TARGET_PCLMUL
+#endif
+#endif /*LODEPNG_USE_SSE2*/
 
 #ifdef LODEPNG_COMPILE_CPP
 #include <fstream>
+#include <thread>
+#include <vector>
 #endif /*LODEPNG_COMPILE_CPP*/
 
 #define VERSION_STRING "20121216"
@@ -67,6 +91,243 @@ static void myfree(void* ptr)
   free(ptr);
 }
 
+/*the same with a LodePNGAllocator, a null allocator means the functions above*/
+static void* allocatorMalloc(const LodePNGAllocator* allocator, size_t size)
+{
+  if(!allocator) return mymalloc(size);
+  return allocator->allocate(allocator->context, size);
+}
+
+static void* allocatorRealloc(const LodePNGAllocator* allocator, void* ptr, size_t new_size)
+{
+  if(!allocator) return myrealloc(ptr, new_size);
+  if(!ptr) return allocator->allocate(allocator->context, new_size);
+  return allocator->reallocate(allocator->context, ptr, new_size);
+}
+
+static void allocatorFree(const LodePNGAllocator* allocator, void* ptr)
+{
+  if(!allocator) myfree(ptr);
+  else if(ptr) allocator->deallocate(allocator->context, ptr);
+}
+
+/*
+Every block of an arena starts with a pointer to the block before it, every
+allocation with an ArenaHeader. Both take ARENA_ALIGN bytes, which keeps the
+allocations aligned for SSE. The allocations of the current block form a stack:
+freeing the top pops it and whatever below it was freed before, freeing another
+one only marks it. Blocks before the current one are left as they are until the
+reset.
+*/
+#define ARENA_ALIGN 16u
+
+typedef struct ArenaHeader
+{
+  size_t size; /*bytes asked for*/
+  size_t below; /*offset of the allocation below in the block, 0 if none, +1 once freed*/
+} ArenaHeader;
+
+struct LodePNGArena
+{
+  LodePNGAllocator allocator; /*the functions below, with the arena as context*/
+  unsigned char* block; /*the current block, 0 before the first*/
+  size_t capacity; /*bytes of block*/
+  size_t used; /*bytes of block in use*/
+  size_t top; /*offset of the last allocation in block, 0 if none*/
+  size_t total; /*bytes of all blocks*/
+};
+
+static size_t arenaRound(size_t size)
+{
+  return (size + (ARENA_ALIGN - 1)) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static ArenaHeader* arenaHeader(void* ptr)
+{
+  return (ArenaHeader*)((unsigned char*)ptr - ARENA_ALIGN);
+}
+
+/*the offset of the header of ptr if it lies in the current block, else 0*/
+static size_t arenaOffset(const LodePNGArena* arena, const void* ptr)
+{
+  const unsigned char* p = (const unsigned char*)ptr;
+  if(!arena->block || p < arena->block + 2 * ARENA_ALIGN || p > arena->block + arena->used) return 0;
+  return (size_t)(p - arena->block) - ARENA_ALIGN;
+}
+
+/*adds a block with room for an allocation of size bytes, returns 0 if out of memory*/
+static unsigned arenaAddBlock(LodePNGArena* arena, size_t size)
+{
+  size_t capacity = arena->capacity * 2;
+  unsigned char* block;
+  if(capacity < size + 2 * ARENA_ALIGN) capacity = size + 2 * ARENA_ALIGN;
+  if(capacity < 65536) capacity = 65536;
+  block = (unsigned char*)mymalloc(capacity);
+  if(!block) return 0;
+  *(unsigned char**)block = arena->block;
+  arena->block = block;
+  arena->capacity = capacity;
+  arena->used = ARENA_ALIGN;
+  arena->top = 0;
+  arena->total += capacity;
+  return 1;
+}
+
+static void* arenaAllocate(void* context, size_t size)
+{
+  LodePNGArena* arena = (LodePNGArena*)context;
+  ArenaHeader* header;
+  size_t rounded = arenaRound(size);
+  if(rounded < size || rounded > (size_t)(-1) - 2 * ARENA_ALIGN) return 0; /*overflow*/
+  if(!arena->block || arena->capacity - arena->used < rounded + ARENA_ALIGN)
+  {
+    if(!arenaAddBlock(arena, rounded)) return 0;
+  }
+  header = (ArenaHeader*)(arena->block + arena->used);
+  header->size = size;
+  header->below = arena->top;
+  arena->top = arena->used;
+  arena->used += ARENA_ALIGN + rounded;
+  return (unsigned char*)header + ARENA_ALIGN;
+}
+
+static void arenaDeallocate(void* context, void* ptr)
+{
+  LodePNGArena* arena = (LodePNGArena*)context;
+  size_t offset = arenaOffset(arena, ptr);
+  ArenaHeader* header = arenaHeader(ptr);
+  if(!offset || offset != arena->top)
+  {
+    header->below |= 1; /*offsets are multiples of ARENA_ALIGN, so the bit is free*/
+    return;
+  }
+  arena->used = offset;
+  arena->top = header->below;
+  while(arena->top)
+  {
+    header = (ArenaHeader*)(arena->block + arena->top);
+    if(!(header->below & 1)) break;
+    arena->used = arena->top;
+    arena->top = header->below & ~(size_t)1;
+  }
+}
+
+static void* arenaReallocate(void* context, void* ptr, size_t size)
+{
+  LodePNGArena* arena = (LodePNGArena*)context;
+  ArenaHeader* header = arenaHeader(ptr);
+  size_t offset = arenaOffset(arena, ptr);
+  size_t rounded = arenaRound(size);
+  void* result;
+
+  if(size <= header->size)
+  {
+    header->size = size;
+    if(offset && offset == arena->top) arena->used = offset + ARENA_ALIGN + rounded;
+    return ptr;
+  }
+  if(offset && offset == arena->top && rounded >= size && arena->capacity - offset - ARENA_ALIGN >= rounded)
+  {
+    header->size = size;
+    arena->used = offset + ARENA_ALIGN + rounded;
+    return ptr;
+  }
+  result = arenaAllocate(context, size);
+  if(!result) return 0;
+  memcpy(result, ptr, header->size);
+  arenaDeallocate(context, ptr);
+  return result;
+}
+
+static void arenaFreeBlocks(unsigned char* block)
+{
+  while(block)
+  {
+    unsigned char* below = *(unsigned char**)block;
+    myfree(block);
+    block = below;
+  }
+}
+
+LodePNGArena* lodepng_arena_new(size_t capacity)
+{
+  LodePNGArena* arena = (LodePNGArena*)mymalloc(sizeof(LodePNGArena));
+  if(!arena) return 0;
+  arena->allocator.allocate = arenaAllocate;
+  arena->allocator.reallocate = arenaReallocate;
+  arena->allocator.deallocate = arenaDeallocate;
+  arena->allocator.context = arena;
+  arena->block = 0;
+  arena->capacity = arena->used = arena->top = arena->total = 0;
+  if(capacity && !arenaAddBlock(arena, capacity))
+  {
+    myfree(arena);
+    return 0;
+  }
+  return arena;
+}
+
+void lodepng_arena_delete(LodePNGArena* arena)
+{
+  if(!arena) return;
+  arenaFreeBlocks(arena->block);
+  myfree(arena);
+}
+
+void lodepng_arena_reset(LodePNGArena* arena)
+{
+  if(arena->block && *(unsigned char**)arena->block)
+  {
+    /*it took several blocks, next time one will do*/
+    size_t total = arena->total;
+    arenaFreeBlocks(arena->block);
+    arena->block = 0;
+    arena->capacity = arena->total = 0;
+    arenaAddBlock(arena, total - 2 * ARENA_ALIGN);
+  }
+  arena->used = ARENA_ALIGN;
+  arena->top = 0;
+}
+
+const LodePNGAllocator* lodepng_arena_allocator(LodePNGArena* arena)
+{
+  return &arena->allocator;
+}
+
+#ifdef LODEPNG_USE_SSE2
+/*The cpuid flags are read once, cpuid can take microseconds in a virtual machine.
+Threads racing to read them all store the same value. Bit 31 (hypervisor) is
+reused to mark the flags as known.*/
+static unsigned cpu_features = 0;
+
+static unsigned cpuFeatures(void)
+{
+  if(!cpu_features)
+  {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    cpu_features = (unsigned)info[2] | 0x80000000u;
+#else
+    unsigned eax, ebx, ecx = 0, edx;
+    __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+    cpu_features = ecx | 0x80000000u;
+#endif
+  }
+  return cpu_features;
+}
+
+static int cpuHasSSSE3(void)
+{
+  return (cpuFeatures() >> 9) & 1;
+}
+
+static int cpuHasPCLMUL(void)
+{
+  return (cpuFeatures() >> 1) & 1;
+}
+#endif /*LODEPNG_USE_SSE2*/
+
 /* ////////////////////////////////////////////////////////////////////////// */
 /* ////////////////////////////////////////////////////////////////////////// */
 /* // Tools for C, and common code for PNG and Zlib.                       // */
@@ -119,12 +380,13 @@ typedef struct uivector
   unsigned* data;
   size_t size; /*size in number of unsigned longs*/
   size_t allocsize; /*allocated size in bytes*/
+  const LodePNGAllocator* allocator; /*null for mymalloc*/
 } uivector;
 
 static void uivector_cleanup(void* p)
 {
   ((uivector*)p)->size = ((uivector*)p)->allocsize = 0;
-  myfree(((uivector*)p)->data);
+  allocatorFree(((uivector*)p)->allocator, ((uivector*)p)->data);
   ((uivector*)p)->data = NULL;
 }
 
@@ -134,7 +396,7 @@ static unsigned uivector_resize(uivector* p, size_t size)
   if(size * sizeof(unsigned) > p->allocsize)
   {
     size_t newsize = size * sizeof(unsigned) * 2;
-    void* data = myrealloc(p->data, newsize);
+    void* data = allocatorRealloc(p->allocator, p->data, newsize);
     if(data)
     {
       p->allocsize = newsize;
@@ -160,6 +422,7 @@ static void uivector_init(uivector* p)
 {
   p->data = NULL;
   p->size = p->allocsize = 0;
+  p->allocator = 0;
 }
 
 #ifdef LODEPNG_COMPILE_ENCODER
@@ -184,9 +447,11 @@ static void uivector_swap(uivector* p, uivector* q)
 {
   size_t tmp;
   unsigned* tmpp;
+  const LodePNGAllocator* allocator;
   tmp = p->size; p->size = q->size; q->size = tmp;
   tmp = p->allocsize; p->allocsize = q->allocsize; q->allocsize = tmp;
   tmpp = p->data; p->data = q->data; q->data = tmpp;
+  allocator = p->allocator; p->allocator = q->allocator; q->allocator = allocator;
 }
 #endif /*LODEPNG_COMPILE_ENCODER*/
 #endif /*LODEPNG_COMPILE_ZLIB*/
@@ -199,6 +464,7 @@ typedef struct ucvector
   unsigned char* data;
   size_t size; /*used size*/
   size_t allocsize; /*allocated size*/
+  const LodePNGAllocator* allocator; /*null for mymalloc*/
 } ucvector;
 
 /*returns 1 if success, 0 if failure ==> nothing done*/
@@ -207,7 +473,7 @@ static unsigned ucvector_resize(ucvector* p, size_t size)
   if(size * sizeof(unsigned char) > p->allocsize)
   {
     size_t newsize = size * sizeof(unsigned char) * 2;
-    void* data = myrealloc(p->data, newsize);
+    void* data = allocatorRealloc(p->allocator, p->data, newsize);
     if(data)
     {
       p->allocsize = newsize;
@@ -225,7 +491,7 @@ static unsigned ucvector_resize(ucvector* p, size_t size)
 static void ucvector_cleanup(void* p)
 {
   ((ucvector*)p)->size = ((ucvector*)p)->allocsize = 0;
-  myfree(((ucvector*)p)->data);
+  allocatorFree(((ucvector*)p)->allocator, ((ucvector*)p)->data);
   ((ucvector*)p)->data = NULL;
 }
 
@@ -233,6 +499,7 @@ static void ucvector_init(ucvector* p)
 {
   p->data = NULL;
   p->size = p->allocsize = 0;
+  p->allocator = 0;
 }
 
 #ifdef LODEPNG_COMPILE_DECODER
@@ -254,6 +521,7 @@ static void ucvector_init_buffer(ucvector* p, unsigned char* buffer, size_t size
 {
   p->data = buffer;
   p->allocsize = p->size = size;
+  p->allocator = 0;
 }
 #endif /*LODEPNG_COMPILE_ZLIB*/
 
@@ -417,25 +685,91 @@ static void addBitsToStreamReversed(size_t* bitpointer, ucvector* bitstream, uns
 
 #ifdef LODEPNG_COMPILE_DECODER
 
-#define READBIT(bitpointer, bitstream) ((bitstream[bitpointer >> 3] >> (bitpointer & 0x7)) & (unsigned char)1)
+/*
+Reads the deflate bit stream, least significant bit first. Up to 64 bits are
+buffered, so that after a refill a whole length/distance pair with its extra
+bits can be read without further checks. Reading past the end of the data
+yields zero bits; BitReader_overrun tells whether that happened.
+*/
+typedef struct BitReader
+{
+  const unsigned char* data;
+  size_t size; /*size of data in bytes*/
+  size_t pos; /*next byte to load into the buffer, may go past size*/
+  unsigned long long buffer; /*the next bits of the stream, starting at the lsb*/
+  unsigned count; /*number of valid bits in buffer*/
+} BitReader;
 
-static unsigned char readBitFromStream(size_t* bitpointer, const unsigned char* bitstream)
+static void BitReader_init(BitReader* reader, const unsigned char* data, size_t size)
 {
-  unsigned char result = (unsigned char)(READBIT(*bitpointer, bitstream));
-  (*bitpointer)++;
-  return result;
+  reader->data = data;
+  reader->size = size;
+  reader->pos = 0;
+  reader->buffer = 0;
+  reader->count = 0;
 }
 
-static unsigned readBitsFromStream(size_t* bitpointer, const unsigned char* bitstream, size_t nbits)
+/*makes sure that at least 56 bits are in the buffer*/
+static void BitReader_refill(BitReader* reader)
 {
-  unsigned result = 0, i;
-  for(i = 0; i < nbits; i++)
+  if(reader->pos + 8 <= reader->size)
+  {
+    /*load 8 bytes at once. Bytes that don't fit are loaded again by the next
+    refill, at the same position, so or-ing them in twice does no harm*/
+    const unsigned char* p = &reader->data[reader->pos];
+    unsigned long long word = (unsigned long long)p[0] | ((unsigned long long)p[1] << 8)
+                            | ((unsigned long long)p[2] << 16) | ((unsigned long long)p[3] << 24)
+                            | ((unsigned long long)p[4] << 32) | ((unsigned long long)p[5] << 40)
+                            | ((unsigned long long)p[6] << 48) | ((unsigned long long)p[7] << 56);
+    reader->buffer |= word << reader->count;
+    reader->pos += (63 - reader->count) >> 3;
+    reader->count |= 56;
+  }
+  else
   {
-    result += ((unsigned)READBIT(*bitpointer, bitstream)) << i;
-    (*bitpointer)++;
+    while(reader->count <= 56)
+    {
+      if(reader->pos < reader->size)
+      {
+        reader->buffer |= (unsigned long long)reader->data[reader->pos] << reader->count;
+      }
+      reader->pos++;
+      reader->count += 8;
+    }
   }
+}
+
+/*the next nbits bits, nbits must be smaller than 32 and at most the number of buffered bits*/
+static unsigned BitReader_peek(const BitReader* reader, unsigned nbits)
+{
+  return (unsigned)reader->buffer & ((1u << nbits) - 1u);
+}
+
+static void BitReader_skip(BitReader* reader, unsigned nbits)
+{
+  reader->buffer >>= nbits;
+  reader->count -= nbits;
+}
+
+static unsigned readBits(BitReader* reader, unsigned nbits)
+{
+  unsigned result;
+  if(reader->count < nbits) BitReader_refill(reader);
+  result = BitReader_peek(reader, nbits);
+  BitReader_skip(reader, nbits);
   return result;
 }
+
+/*the number of bits read so far*/
+static size_t BitReader_position(const BitReader* reader)
+{
+  return reader->pos * 8 - reader->count;
+}
+
+static int BitReader_overrun(const BitReader* reader)
+{
+  return reader->pos > reader->size && BitReader_position(reader) > reader->size * 8;
+}
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 /* ////////////////////////////////////////////////////////////////////////// */
@@ -483,11 +817,13 @@ Huffman tree struct, containing multiple representations of the tree
 */
 typedef struct HuffmanTree
 {
-  unsigned* tree2d;
+  unsigned char* table_len; /*the decoder's lookup tables, see HuffmanTree_makeTable*/
+  unsigned short* table_value;
   unsigned* tree1d;
   unsigned* lengths; /*the lengths of the codes of the 1d-tree*/
   unsigned maxbitlen; /*maximum number of bits a single code can get*/
   unsigned numcodes; /*number of symbols in the alphabet = number of codes*/
+  const LodePNGAllocator* allocator; /*allocates the arrays above, null for mymalloc*/
 } HuffmanTree;
 
 /*function used for debug purposes to draw the tree in ascii art with C++*/
@@ -505,73 +841,138 @@ static void HuffmanTree_draw(HuffmanTree* tree)
 
 static void HuffmanTree_init(HuffmanTree* tree)
 {
-  tree->tree2d = 0;
+  tree->table_len = 0;
+  tree->table_value = 0;
   tree->tree1d = 0;
   tree->lengths = 0;
+  tree->allocator = 0;
 }
 
 static void HuffmanTree_cleanup(HuffmanTree* tree)
 {
-  myfree(tree->tree2d);
-  myfree(tree->tree1d);
-  myfree(tree->lengths);
+  allocatorFree(tree->allocator, tree->table_len);
+  allocatorFree(tree->allocator, tree->table_value);
+  allocatorFree(tree->allocator, tree->tree1d);
+  allocatorFree(tree->allocator, tree->lengths);
 }
 
-/*the tree representation used by the decoder. return value is error*/
-static unsigned HuffmanTree_make2DTree(HuffmanTree* tree)
+/*the primary lookup table of the decoder resolves codes of up to this many bits*/
+#define FIRSTBITS 9u
+
+/*the symbol of lookup table entries that no code leads to*/
+#define INVALIDSYMBOL 65535u
+
+static unsigned reverseBits(unsigned bits, unsigned num)
 {
-  unsigned nodefilled = 0; /*up to which node it is filled*/
-  unsigned treepos = 0; /*position in the tree (1 of the numcodes columns)*/
-  unsigned n, i;
+  unsigned i, result = 0;
+  for(i = 0; i < num; i++) result |= ((bits >> (num - i - 1u)) & 1u) << i;
+  return result;
+}
 
-  tree->tree2d = (unsigned*)mymalloc(tree->numcodes * 2 * sizeof(unsigned));
-  if(!tree->tree2d) return 83; /*alloc fail*/
+/*
+the lookup tables used by the decoder. return value is error.
+Codes are stored most significant bit first but read from the stream lsb
+first, so the tables are indexed by the reversed codes. The primary table has
+an entry for every FIRSTBITS-bit value: a code of up to FIRSTBITS bits fills
+all entries it is a prefix of with its length and symbol. Where longer codes
+start, the entry holds the greatest length among them and the offset of a
+secondary table, which the remaining bits index. Entries no code leads to
+consume FIRSTBITS bits (0 in a secondary table) and give INVALIDSYMBOL.
+*/
+static unsigned HuffmanTree_makeTable(HuffmanTree* tree)
+{
+  static const unsigned headsize = 1u << FIRSTBITS;
+  static const unsigned mask = (1u << FIRSTBITS) - 1u;
+  size_t i, size, pointer;
+  unsigned* maxlens;
+  unsigned long kraft = 0;
 
-  /*
-  convert tree1d[] to tree2d[][]. In the 2D array, a value of 32767 means
-  uninited, a value >= numcodes is an address to another bit, a value < numcodes
-  is a code. The 2 rows are the 2 possible bit values (0 or 1), there are as
-  many columns as codes - 1.
-  A good huffmann tree has N * 2 - 1 nodes, of which N - 1 are internal nodes.
-  Here, the internal nodes are stored (what their 0 and 1 option point to).
-  There is only memory for such good tree currently, if there are more nodes
-  (due to too long length codes), error 55 will happen
-  */
-  for(n = 0; n < tree->numcodes * 2; n++)
+  /*the codes must not claim more than the whole code space (the Kraft sum of
+  a complete code is 1). Incomplete codes are allowed, deflate uses them for
+  a single distance code*/
+  for(i = 0; i < tree->numcodes; i++)
+  {
+    if(tree->lengths[i] > 15) return 55;
+    if(tree->lengths[i] != 0) kraft += 1ul << (15 - tree->lengths[i]);
+  }
+  if(kraft > (1ul << 15)) return 55; /*oversubscribed, see comment in lodepng_error_text*/
+
+  maxlens = (unsigned*)allocatorMalloc(tree->allocator, headsize * sizeof(unsigned));
+  if(!maxlens) return 83; /*alloc fail*/
+
+  /*compute the longest code for each primary entry, to size the secondary tables*/
+  for(i = 0; i < headsize; i++) maxlens[i] = 0;
+  for(i = 0; i < tree->numcodes; i++)
+  {
+    unsigned l = tree->lengths[i];
+    unsigned index;
+    if(l <= FIRSTBITS) continue;
+    index = reverseBits(tree->tree1d[i] >> (l - FIRSTBITS), FIRSTBITS);
+    if(l > maxlens[index]) maxlens[index] = l;
+  }
+
+  size = headsize;
+  for(i = 0; i < headsize; i++)
+  {
+    if(maxlens[i] > FIRSTBITS) size += (size_t)1 << (maxlens[i] - FIRSTBITS);
+  }
+
+  tree->table_len = (unsigned char*)allocatorMalloc(tree->allocator, size * sizeof(unsigned char));
+  tree->table_value = (unsigned short*)allocatorMalloc(tree->allocator, size * sizeof(unsigned short));
+  if(!tree->table_len || !tree->table_value)
+  {
+    allocatorFree(tree->allocator, maxlens);
+    return 83; /*alloc fail*/
+  }
+
+  for(i = 0; i < size; i++)
   {
-    tree->tree2d[n] = 32767; /*32767 here means the tree2d isn't filled there yet*/
+    tree->table_len[i] = FIRSTBITS;
+    tree->table_value[i] = INVALIDSYMBOL;
   }
 
-  for(n = 0; n < tree->numcodes; n++) /*the codes*/
+  pointer = headsize;
+  for(i = 0; i < headsize; i++)
   {
-    for(i = 0; i < tree->lengths[n]; i++) /*the bits for this code*/
+    unsigned l = maxlens[i];
+    if(l <= FIRSTBITS) continue;
+    tree->table_len[i] = (unsigned char)l;
+    tree->table_value[i] = (unsigned short)pointer;
+    pointer += (size_t)1 << (l - FIRSTBITS);
+  }
+  allocatorFree(tree->allocator, maxlens);
+
+  /*fill in the codes*/
+  for(i = 0; i < tree->numcodes; i++)
+  {
+    unsigned l = tree->lengths[i];
+    unsigned reverse, num, j;
+    if(l == 0) continue;
+    reverse = reverseBits(tree->tree1d[i], l);
+    if(l <= FIRSTBITS)
     {
-      unsigned char bit = (unsigned char)((tree->tree1d[n] >> (tree->lengths[n] - i - 1)) & 1);
-      if(treepos > tree->numcodes - 2) return 55; /*oversubscribed, see comment in lodepng_error_text*/
-      if(tree->tree2d[2 * treepos + bit] == 32767) /*not yet filled in*/
+      num = 1u << (FIRSTBITS - l);
+      for(j = 0; j < num; j++)
       {
-        if(i + 1 == tree->lengths[n]) /*last bit*/
-        {
-          tree->tree2d[2 * treepos + bit] = n; /*put the current code in it*/
-          treepos = 0;
-        }
-        else
-        {
-          /*put address of the next step in here, first that address has to be found of course
-          (it's just nodefilled + 1)...*/
-          nodefilled++;
-          /*addresses encoded with numcodes added to it*/
-          tree->tree2d[2 * treepos + bit] = nodefilled + tree->numcodes;
-          treepos = nodefilled;
-        }
+        unsigned index = reverse | (j << l);
+        tree->table_len[index] = (unsigned char)l;
+        tree->table_value[index] = (unsigned short)i;
+      }
+    }
+    else
+    {
+      unsigned index = reverse & mask;
+      unsigned tablelen = tree->table_len[index] - FIRSTBITS;
+      unsigned start = tree->table_value[index];
+      unsigned reverse2 = reverse >> FIRSTBITS;
+      num = 1u << (tablelen - (l - FIRSTBITS));
+      for(j = 0; j < num; j++)
+      {
+        unsigned index2 = start + (reverse2 | (j << (l - FIRSTBITS)));
+        tree->table_len[index2] = (unsigned char)l;
+        tree->table_value[index2] = (unsigned short)i;
       }
-      else treepos = tree->tree2d[2 * treepos + bit] - tree->numcodes;
     }
-  }
-
-  for(n = 0;  n < tree->numcodes * 2; n++)
-  {
-    if(tree->tree2d[n] == 32767) tree->tree2d[n] = 0; /*remove possible remaining 32767's*/
   }
 
   return 0;
@@ -590,8 +991,9 @@ static unsigned HuffmanTree_makeFromLengths2(HuffmanTree* tree)
 
   uivector_init(&blcount);
   uivector_init(&nextcode);
+  blcount.allocator = nextcode.allocator = tree->allocator;
 
-  tree->tree1d = (unsigned*)mymalloc(tree->numcodes * sizeof(unsigned));
+  tree->tree1d = (unsigned*)allocatorMalloc(tree->allocator, tree->numcodes * sizeof(unsigned));
   if(!tree->tree1d) error = 83; /*alloc fail*/
 
   if(!uivector_resizev(&blcount, tree->maxbitlen + 1, 0)
@@ -617,7 +1019,7 @@ static unsigned HuffmanTree_makeFromLengths2(HuffmanTree* tree)
   uivector_cleanup(&blcount);
   uivector_cleanup(&nextcode);
 
-  if(!error) return HuffmanTree_make2DTree(tree);
+  if(!error) return HuffmanTree_makeTable(tree);
   else return error;
 }
 
@@ -630,7 +1032,7 @@ static unsigned HuffmanTree_makeFromLengths(HuffmanTree* tree, const unsigned* b
                                             size_t numcodes, unsigned maxbitlen)
 {
   unsigned i;
-  tree->lengths = (unsigned*)mymalloc(numcodes * sizeof(unsigned));
+  tree->lengths = (unsigned*)allocatorMalloc(tree->allocator, numcodes * sizeof(unsigned));
   if(!tree->lengths) return 83; /*alloc fail*/
   for(i = 0; i < numcodes; i++) tree->lengths[i] = bitlen[i];
   tree->numcodes = (unsigned)numcodes; /*number of symbols*/
@@ -853,7 +1255,7 @@ static unsigned HuffmanTree_makeFromFrequencies(HuffmanTree* tree, const unsigne
   while(!frequencies[numcodes - 1] && numcodes > mincodes) numcodes--; /*trim zeroes*/
   tree->maxbitlen = maxbitlen;
   tree->numcodes = (unsigned)numcodes; /*number of symbols*/
-  tree->lengths = (unsigned*)myrealloc(tree->lengths, numcodes * sizeof(unsigned));
+  tree->lengths = (unsigned*)allocatorRealloc(tree->allocator, tree->lengths, numcodes * sizeof(unsigned));
   if(!tree->lengths) return 83; /*alloc fail*/
   /*initialize all lengths to 0*/
   memset(tree->lengths, 0, numcodes * sizeof(unsigned));
@@ -878,7 +1280,7 @@ static unsigned HuffmanTree_getLength(const HuffmanTree* tree, unsigned index)
 static unsigned generateFixedLitLenTree(HuffmanTree* tree)
 {
   unsigned i, error = 0;
-  unsigned* bitlen = (unsigned*)mymalloc(NUM_DEFLATE_CODE_SYMBOLS * sizeof(unsigned));
+  unsigned* bitlen = (unsigned*)allocatorMalloc(tree->allocator, NUM_DEFLATE_CODE_SYMBOLS * sizeof(unsigned));
   if(!bitlen) return 83; /*alloc fail*/
 
   /*288 possible codes: 0-255=literals, 256=endcode, 257-285=lengthcodes, 286-287=unused*/
@@ -889,7 +1291,7 @@ static unsigned generateFixedLitLenTree(HuffmanTree* tree)
 
   error = HuffmanTree_makeFromLengths(tree, bitlen, NUM_DEFLATE_CODE_SYMBOLS, 15);
 
-  myfree(bitlen);
+  allocatorFree(tree->allocator, bitlen);
   return error;
 }
 
@@ -897,40 +1299,40 @@ static unsigned generateFixedLitLenTree(HuffmanTree* tree)
 static unsigned generateFixedDistanceTree(HuffmanTree* tree)
 {
   unsigned i, error = 0;
-  unsigned* bitlen = (unsigned*)mymalloc(NUM_DISTANCE_SYMBOLS * sizeof(unsigned));
+  unsigned* bitlen = (unsigned*)allocatorMalloc(tree->allocator, NUM_DISTANCE_SYMBOLS * sizeof(unsigned));
   if(!bitlen) return 83; /*alloc fail*/
 
   /*there are 32 distance codes, but 30-31 are unused*/
   for(i = 0; i < NUM_DISTANCE_SYMBOLS; i++) bitlen[i] = 5;
   error = HuffmanTree_makeFromLengths(tree, bitlen, NUM_DISTANCE_SYMBOLS, 15);
 
-  myfree(bitlen);
+  allocatorFree(tree->allocator, bitlen);
   return error;
 }
 
 #ifdef LODEPNG_COMPILE_DECODER
 
 /*
-returns the code, or (unsigned)(-1) if error happened
-inbitlength is the length of the complete buffer, in bits (so its byte length times 8)
+returns the symbol, or INVALIDSYMBOL for a code that isn't in the tree.
+The reader must hold at least 15 bits, the longest code length.
 */
-static unsigned huffmanDecodeSymbol(const unsigned char* in, size_t* bp,
-                                    const HuffmanTree* codetree, size_t inbitlength)
+static unsigned huffmanDecodeSymbol(BitReader* reader, const HuffmanTree* codetree)
 {
-  unsigned treepos = 0, ct;
-  for(;;)
+  unsigned code = BitReader_peek(reader, FIRSTBITS);
+  unsigned l = codetree->table_len[code];
+  unsigned value = codetree->table_value[code];
+  if(l <= FIRSTBITS)
   {
-    if(*bp >= inbitlength) return (unsigned)(-1); /*error: end of input memory reached without endcode*/
-    /*
-    decode the symbol from the tree. The "readBitFromStream" code is inlined in
-    the expression below because this is the biggest bottleneck while decoding
-    */
-    ct = codetree->tree2d[(treepos << 1) + READBIT(*bp, in)];
-    (*bp)++;
-    if(ct < codetree->numcodes) return ct; /*the symbol is decoded, return it*/
-    else treepos = ct - codetree->numcodes; /*symbol not yet decoded, instead move tree position*/
-
-    if(treepos >= codetree->numcodes) return (unsigned)(-1); /*error: it appeared outside the codetree*/
+    BitReader_skip(reader, l);
+    return value;
+  }
+  else
+  {
+    unsigned index2;
+    BitReader_skip(reader, FIRSTBITS);
+    index2 = value + BitReader_peek(reader, l - FIRSTBITS);
+    BitReader_skip(reader, codetree->table_len[index2] - FIRSTBITS);
+    return codetree->table_value[index2];
   }
 }
 #endif /*LODEPNG_COMPILE_DECODER*/
@@ -942,21 +1344,18 @@ static unsigned huffmanDecodeSymbol(const unsigned char* in, size_t* bp,
 /* ////////////////////////////////////////////////////////////////////////// */
 
 /*get the tree of a deflated block with fixed tree, as specified in the deflate specification*/
-static void getTreeInflateFixed(HuffmanTree* tree_ll, HuffmanTree* tree_d)
+static unsigned getTreeInflateFixed(HuffmanTree* tree_ll, HuffmanTree* tree_d)
 {
-  /*TODO: check for out of memory errors*/
-  generateFixedLitLenTree(tree_ll);
-  generateFixedDistanceTree(tree_d);
+  CERROR_TRY_RETURN(generateFixedLitLenTree(tree_ll));
+  return generateFixedDistanceTree(tree_d);
 }
 
 /*get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree*/
-static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
-                                      const unsigned char* in, size_t* bp, size_t inlength)
+static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d, BitReader* reader)
 {
   /*make sure that length values that aren't filled in will be 0, or a wrong tree will be generated*/
   unsigned error = 0;
   unsigned n, HLIT, HDIST, HCLEN, i;
-  size_t inbitlength = inlength * 8;
 
   /*see comments in deflateDynamic for explanation of the context and these variables, it is analogous*/
   unsigned* bitlen_ll = 0; /*lit,len code lengths*/
@@ -965,27 +1364,29 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
   unsigned* bitlen_cl = 0;
   HuffmanTree tree_cl; /*the code tree for code length codes (the huffman tree for compressed huffman trees)*/
 
-  if((*bp) >> 3 >= inlength - 2) return 49; /*error: the bit pointer is or will go past the memory*/
+  /*error: the bit pointer is or will go past the memory*/
+  if((BitReader_position(reader) >> 3) + 2 >= reader->size) return 49;
 
   /*number of literal/length codes + 257. Unlike the spec, the value 257 is added to it here already*/
-  HLIT =  readBitsFromStream(bp, in, 5) + 257;
+  HLIT =  readBits(reader, 5) + 257;
   /*number of distance codes. Unlike the spec, the value 1 is added to it here already*/
-  HDIST = readBitsFromStream(bp, in, 5) + 1;
+  HDIST = readBits(reader, 5) + 1;
   /*number of code length codes. Unlike the spec, the value 4 is added to it here already*/
-  HCLEN = readBitsFromStream(bp, in, 4) + 4;
+  HCLEN = readBits(reader, 4) + 4;
 
   HuffmanTree_init(&tree_cl);
+  tree_cl.allocator = tree_ll->allocator;
 
   while(!error)
   {
     /*read the code length codes out of 3 * (amount of code length codes) bits*/
 
-    bitlen_cl = (unsigned*)mymalloc(NUM_CODE_LENGTH_CODES * sizeof(unsigned));
+    bitlen_cl = (unsigned*)allocatorMalloc(tree_cl.allocator, NUM_CODE_LENGTH_CODES * sizeof(unsigned));
     if(!bitlen_cl) ERROR_BREAK(83 /*alloc fail*/);
 
     for(i = 0; i < NUM_CODE_LENGTH_CODES; i++)
     {
-      if(i < HCLEN) bitlen_cl[CLCL_ORDER[i]] = readBitsFromStream(bp, in, 3);
+      if(i < HCLEN) bitlen_cl[CLCL_ORDER[i]] = readBits(reader, 3);
       else bitlen_cl[CLCL_ORDER[i]] = 0; /*if not, it must stay 0*/
     }
 
@@ -993,8 +1394,8 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
     if(error) break;
 
     /*now we can use this tree to read the lengths for the tree that this function will return*/
-    bitlen_ll = (unsigned*)mymalloc(NUM_DEFLATE_CODE_SYMBOLS * sizeof(unsigned));
-    bitlen_d = (unsigned*)mymalloc(NUM_DISTANCE_SYMBOLS * sizeof(unsigned));
+    bitlen_ll = (unsigned*)allocatorMalloc(tree_cl.allocator, NUM_DEFLATE_CODE_SYMBOLS * sizeof(unsigned));
+    bitlen_d = (unsigned*)allocatorMalloc(tree_cl.allocator, NUM_DISTANCE_SYMBOLS * sizeof(unsigned));
     if(!bitlen_ll || !bitlen_d) ERROR_BREAK(83 /*alloc fail*/);
     for(i = 0; i < NUM_DEFLATE_CODE_SYMBOLS; i++) bitlen_ll[i] = 0;
     for(i = 0; i < NUM_DISTANCE_SYMBOLS; i++) bitlen_d[i] = 0;
@@ -1003,7 +1404,10 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
     i = 0;
     while(i < HLIT + HDIST)
     {
-      unsigned code = huffmanDecodeSymbol(in, bp, &tree_cl, inbitlength);
+      unsigned code;
+      BitReader_refill(reader);
+      code = huffmanDecodeSymbol(reader, &tree_cl);
+      if(BitReader_overrun(reader)) ERROR_BREAK(10); /*error: end of input memory reached*/
       if(code <= 15) /*a length code*/
       {
         if(i < HLIT) bitlen_ll[i] = code;
@@ -1015,10 +1419,10 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
         unsigned replength = 3; /*read in the 2 bits that indicate repeat length (3-6)*/
         unsigned value; /*set value to the previous code*/
 
-        if(*bp >= inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
         if (i == 0) ERROR_BREAK(54); /*can't repeat previous if i is 0*/
 
-        replength += readBitsFromStream(bp, in, 2);
+        replength += readBits(reader, 2);
+        if(BitReader_overrun(reader)) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
 
         if(i < HLIT + 1) value = bitlen_ll[i - 1];
         else value = bitlen_d[i - HLIT - 1];
@@ -1034,9 +1438,9 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
       else if(code == 17) /*repeat "0" 3-10 times*/
       {
         unsigned replength = 3; /*read in the bits that indicate repeat length*/
-        if(*bp >= inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
 
-        replength += readBitsFromStream(bp, in, 3);
+        replength += readBits(reader, 3);
+        if(BitReader_overrun(reader)) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
 
         /*repeat this value in the next lengths*/
         for(n = 0; n < replength; n++)
@@ -1051,9 +1455,9 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
       else if(code == 18) /*repeat "0" 11-138 times*/
       {
         unsigned replength = 11; /*read in the bits that indicate repeat length*/
-        if(*bp >= inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
 
-        replength += readBitsFromStream(bp, in, 7);
+        replength += readBits(reader, 7);
+        if(BitReader_overrun(reader)) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
 
         /*repeat this value in the next lengths*/
         for(n = 0; n < replength; n++)
@@ -1065,14 +1469,9 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
           i++;
         }
       }
-      else /*if(code == (unsigned)(-1))*/ /*huffmanDecodeSymbol returns (unsigned)(-1) in case of error*/
+      else /*if(code == INVALIDSYMBOL)*/
       {
-        if(code == (unsigned)(-1))
-        {
-          /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
-          (10=no endcode, 11=wrong jump outside of tree)*/
-          error = (*bp) > inbitlength ? 10 : 11;
-        }
+        if(code == INVALIDSYMBOL) error = 11; /*error: the code isn't in the tree*/
         else error = 16; /*unexisting code, this can never happen*/
         break;
       }
@@ -1089,67 +1488,245 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
     break; /*end of error-while*/
   }
 
-  myfree(bitlen_cl);
-  myfree(bitlen_ll);
-  myfree(bitlen_d);
   HuffmanTree_cleanup(&tree_cl);
+  allocatorFree(tree_cl.allocator, bitlen_d);
+  allocatorFree(tree_cl.allocator, bitlen_ll);
+  allocatorFree(tree_cl.allocator, bitlen_cl);
 
   return error;
 }
 
-/*inflate a block with dynamic of fixed Huffman tree*/
-static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size_t* bp,
-                                    size_t* pos, size_t inlength, unsigned btype)
-{
-  unsigned error = 0;
+/*what an Inflater decodes next*/
+#define INFLATE_BLOCK 0 /*the header of a block*/
+#define INFLATE_STORED 1 /*the data of a stored block*/
+#define INFLATE_HUFFMAN 2 /*the symbols of a block with fixed or dynamic Huffman trees*/
+#define INFLATE_DONE 3 /*nothing, the final block has ended*/
+
+/*
+Deflate decoder that can be suspended when it runs out of input or has
+produced outlimit bytes, and resumed later with more input or room. It decodes
+in units that it either completes or rolls back: block headers, runs of stored
+bytes, and single literals or length/distance pairs. lodepng_inflate runs it
+once over the whole input, the streaming PNG decoder each time IDAT data
+arrives.
+*/
+typedef struct Inflater
+{
+  BitReader reader;
+  BitReader checkpoint; /*the reader at the start of the current unit*/
+  unsigned more; /*more input may follow the reader's data, suspend at its end instead of failing*/
+  unsigned suspended; /*Inflater_run returned before the end, for want of input or room*/
+  unsigned mode; /*one of the INFLATE_ values*/
+  unsigned final; /*BFINAL of the current block*/
+  size_t stored; /*bytes left of the current stored block*/
   HuffmanTree tree_ll; /*the huffman tree for literal and length codes*/
   HuffmanTree tree_d; /*the huffman tree for distance codes*/
-  size_t inbitlength = inlength * 8;
+  ucvector* out; /*the output, at least the last 32K of it must be kept between runs*/
+  size_t pos; /*bytes of out that are decoded, out->size may be larger*/
+  size_t outlimit; /*suspend once pos reaches this, 0 for no limit*/
+} Inflater;
 
-  HuffmanTree_init(&tree_ll);
-  HuffmanTree_init(&tree_d);
+static void Inflater_init(Inflater* inflater, ucvector* out, const unsigned char* in, size_t insize)
+{
+  BitReader_init(&inflater->reader, in, insize);
+  inflater->checkpoint = inflater->reader;
+  inflater->more = 0;
+  inflater->suspended = 0;
+  inflater->mode = INFLATE_BLOCK;
+  inflater->final = 0;
+  inflater->stored = 0;
+  HuffmanTree_init(&inflater->tree_ll);
+  HuffmanTree_init(&inflater->tree_d);
+  inflater->tree_ll.allocator = inflater->tree_d.allocator = out->allocator;
+  inflater->out = out;
+  inflater->pos = 0;
+  inflater->outlimit = 0;
+}
+
+static void Inflater_cleanup(Inflater* inflater)
+{
+  HuffmanTree_cleanup(&inflater->tree_ll);
+  HuffmanTree_cleanup(&inflater->tree_d);
+}
+
+/*
+the current unit reached the end of the input. Rolls it back and suspends if
+more input may follow, else returns the error.
+*/
+static unsigned Inflater_endOfInput(Inflater* inflater, unsigned error)
+{
+  if(!inflater->more) return error;
+  inflater->reader = inflater->checkpoint;
+  inflater->suspended = 1;
+  return 0;
+}
+
+static unsigned Inflater_readBlockHeader(Inflater* inflater)
+{
+  BitReader* reader = &inflater->reader;
+  unsigned BTYPE, error = 0;
+
+  /*error, bit pointer will jump past memory*/
+  if(BitReader_position(reader) + 2 >= reader->size * 8) return Inflater_endOfInput(inflater, 52);
+  inflater->final = readBits(reader, 1);
+  BTYPE = readBits(reader, 2);
+
+  HuffmanTree_cleanup(&inflater->tree_ll);
+  HuffmanTree_cleanup(&inflater->tree_d);
+  HuffmanTree_init(&inflater->tree_ll);
+  HuffmanTree_init(&inflater->tree_d);
+  inflater->tree_ll.allocator = inflater->tree_d.allocator = inflater->out->allocator;
+
+  if(BTYPE == 3) return 20; /*error: invalid BTYPE*/
+  else if(BTYPE == 0) /*no compression*/
+  {
+    /*go to first boundary of byte*/
+    size_t p = (BitReader_position(reader) + 7) / 8; /*byte position*/
+    const unsigned char* in = reader->data;
+    unsigned LEN, NLEN;
+
+    /*read LEN (2 bytes) and NLEN (2 bytes)*/
+    if(p + 4 >= reader->size) return Inflater_endOfInput(inflater, 52); /*error, bit pointer will jump past memory*/
+    LEN = in[p] + 256 * in[p + 1]; p += 2;
+    NLEN = in[p] + 256 * in[p + 1]; p += 2;
+
+    /*check if 16-bit NLEN is really the one's complement of LEN*/
+    if(LEN + NLEN != 65535) return 21; /*error: NLEN is not one's complement of LEN*/
+
+    /*continue reading the data from the byte after NLEN*/
+    reader->pos = p;
+    reader->buffer = 0;
+    reader->count = 0;
+    inflater->stored = LEN;
+    inflater->mode = INFLATE_STORED;
+  }
+  else /*compression, BTYPE 01 or 10*/
+  {
+    if(BTYPE == 1) error = getTreeInflateFixed(&inflater->tree_ll, &inflater->tree_d);
+    else error = getTreeInflateDynamic(&inflater->tree_ll, &inflater->tree_d, reader);
+    /*reading zero bits past the end of the input can give any of the tree errors*/
+    if(error) return BitReader_overrun(reader) || error == 49 ? Inflater_endOfInput(inflater, error) : error;
+    inflater->mode = INFLATE_HUFFMAN;
+  }
+
+  return 0;
+}
+
+static unsigned Inflater_copyStored(Inflater* inflater)
+{
+  BitReader* reader = &inflater->reader;
+  ucvector* out = inflater->out;
+  size_t available = reader->size - reader->pos;
+  size_t n = inflater->stored;
+
+  if(n > available)
+  {
+    /*read the literal data that is there, the rest follows in the next run*/
+    if(!inflater->more) return 23; /*error: reading outside of in buffer*/
+    n = available;
+  }
+  if(inflater->outlimit && n > inflater->outlimit - inflater->pos) n = inflater->outlimit - inflater->pos;
+
+  if(inflater->pos + n >= out->size)
+  {
+    if(!ucvector_resize(out, inflater->pos + n)) return 83; /*alloc fail*/
+  }
+  if(n) memcpy(&out->data[inflater->pos], &reader->data[reader->pos], n);
+  inflater->pos += n;
+  reader->pos += n;
+  inflater->stored -= n;
+  inflater->checkpoint = *reader;
+
+  if(inflater->stored == 0) inflater->mode = inflater->final ? INFLATE_DONE : INFLATE_BLOCK;
+  else inflater->suspended = 1;
+  return 0;
+}
+
+/*
+copies length bytes that start distance bytes before dst to dst. The ranges
+overlap when distance < length, repeating the last distance bytes.
+*/
+static void copyMatch(unsigned char* dst, size_t distance, size_t length)
+{
+  const unsigned char* src = dst - distance;
+  if(distance >= length) memcpy(dst, src, length);
+  else if(distance == 1) memset(dst, *src, length);
+  else
+  {
+    /*every copied chunk doubles the pattern available to the next one*/
+    size_t chunk = distance;
+    while(length > 0)
+    {
+      size_t n = chunk < length ? chunk : length;
+      memcpy(dst, src, n);
+      dst += n;
+      length -= n;
+      chunk += n;
+    }
+  }
+}
 
-  if(btype == 1) getTreeInflateFixed(&tree_ll, &tree_d);
-  else if(btype == 2) error = getTreeInflateDynamic(&tree_ll, &tree_d, in, bp, inlength);
+/*decodes the symbols of a block with dynamic or fixed Huffman trees*/
+static unsigned Inflater_decodeSymbols(Inflater* inflater)
+{
+  BitReader* reader = &inflater->reader;
+  ucvector* out = inflater->out;
+  size_t pos = inflater->pos;
+  unsigned error = 0;
 
-  while(!error) /*decode all symbols until end reached, breaks at end code*/
+  for(;;) /*decode all symbols until end reached, breaks at end code*/
   {
     /*code_ll is literal, length or end code*/
-    unsigned code_ll = huffmanDecodeSymbol(in, bp, &tree_ll, inbitlength);
+    unsigned code_ll;
+
+    if(inflater->outlimit && pos >= inflater->outlimit)
+    {
+      inflater->suspended = 1;
+      break;
+    }
+
+    inflater->checkpoint = *reader;
+    /*a single refill holds the longest length/distance pair: 15 + 5 + 15 + 13 bits*/
+    BitReader_refill(reader);
+    code_ll = huffmanDecodeSymbol(reader, &inflater->tree_ll);
     if(code_ll <= 255) /*literal symbol*/
     {
-      if((*pos) >= out->size)
+      /*the end code must be found before the input ends*/
+      if(BitReader_overrun(reader))
+      {
+        error = Inflater_endOfInput(inflater, 10);
+        break;
+      }
+      if(pos >= out->size)
       {
         /*reserve more room at once*/
-        if(!ucvector_resize(out, ((*pos) + 1) * 2)) ERROR_BREAK(83 /*alloc fail*/);
+        if(!ucvector_resize(out, (pos + 1) * 2)) ERROR_BREAK(83 /*alloc fail*/);
       }
-      out->data[(*pos)] = (unsigned char)(code_ll);
-      (*pos)++;
+      out->data[pos] = (unsigned char)(code_ll);
+      pos++;
     }
     else if(code_ll >= FIRST_LENGTH_CODE_INDEX && code_ll <= LAST_LENGTH_CODE_INDEX) /*length code*/
     {
       unsigned code_d, distance;
       unsigned numextrabits_l, numextrabits_d; /*extra bits for length and distance*/
-      size_t start, forward, backward, length;
+      size_t length;
 
       /*part 1: get length base*/
       length = LENGTHBASE[code_ll - FIRST_LENGTH_CODE_INDEX];
 
       /*part 2: get extra bits and add the value of that to length*/
       numextrabits_l = LENGTHEXTRA[code_ll - FIRST_LENGTH_CODE_INDEX];
-      if(*bp >= inbitlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
-      length += readBitsFromStream(bp, in, numextrabits_l);
+      length += BitReader_peek(reader, numextrabits_l);
+      BitReader_skip(reader, numextrabits_l);
 
       /*part 3: get distance code*/
-      code_d = huffmanDecodeSymbol(in, bp, &tree_d, inbitlength);
+      code_d = huffmanDecodeSymbol(reader, &inflater->tree_d);
       if(code_d > 29)
       {
-        if(code_ll == (unsigned)(-1)) /*huffmanDecodeSymbol returns (unsigned)(-1) in case of error*/
-        {
-          /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
-          (10=no endcode, 11=wrong jump outside of tree)*/
-          error = (*bp) > inlength * 8 ? 10 : 11;
-        }
+        /*return error code 10 if the end of the input was reached, else 11 or 18
+        (10=no endcode, 11=wrong jump outside of tree, 18=invalid distance code)*/
+        if(BitReader_overrun(reader)) error = Inflater_endOfInput(inflater, 10);
+        else if(code_d == INVALIDSYMBOL) error = 11;
         else error = 18; /*error: invalid distance code (30-31 are never used)*/
         break;
       }
@@ -1157,74 +1734,62 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
 
       /*part 4: get extra bits from distance*/
       numextrabits_d = DISTANCEEXTRA[code_d];
-      if(*bp >= inbitlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
-
-      distance += readBitsFromStream(bp, in, numextrabits_d);
+      distance += BitReader_peek(reader, numextrabits_d);
+      BitReader_skip(reader, numextrabits_d);
+      if(BitReader_overrun(reader))
+      {
+        error = Inflater_endOfInput(inflater, 51); /*error, bit pointer will jump past memory*/
+        break;
+      }
 
       /*part 5: fill in all the out[n] values based on the length and dist*/
-      start = (*pos);
-      if(distance > start) ERROR_BREAK(52); /*too long backward distance*/
-      backward = start - distance;
-      if((*pos) + length >= out->size)
+      if(distance > pos) ERROR_BREAK(52); /*too long backward distance*/
+      if(pos + length >= out->size)
       {
         /*reserve more room at once*/
-        if(!ucvector_resize(out, ((*pos) + length) * 2)) ERROR_BREAK(83 /*alloc fail*/);
+        if(!ucvector_resize(out, (pos + length) * 2)) ERROR_BREAK(83 /*alloc fail*/);
       }
 
-      for(forward = 0; forward < length; forward++)
-      {
-        out->data[(*pos)] = out->data[backward];
-        (*pos)++;
-        backward++;
-        if(backward >= start) backward = start - distance;
-      }
+      copyMatch(&out->data[pos], distance, length);
+      pos += length;
     }
     else if(code_ll == 256)
     {
+      if(BitReader_overrun(reader))
+      {
+        error = Inflater_endOfInput(inflater, 10);
+        break;
+      }
+      inflater->checkpoint = *reader;
+      inflater->mode = inflater->final ? INFLATE_DONE : INFLATE_BLOCK;
       break; /*end code, break the loop*/
     }
-    else /*if(code == (unsigned)(-1))*/ /*huffmanDecodeSymbol returns (unsigned)(-1) in case of error*/
+    else /*if(code_ll == INVALIDSYMBOL)*/
     {
-      /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
+      /*return error code 10 or 11 depending on whether the end of the input was reached
       (10=no endcode, 11=wrong jump outside of tree)*/
-      error = (*bp) > inlength * 8 ? 10 : 11;
+      if(BitReader_overrun(reader)) error = Inflater_endOfInput(inflater, 10);
+      else error = 11;
       break;
     }
   }
 
-  HuffmanTree_cleanup(&tree_ll);
-  HuffmanTree_cleanup(&tree_d);
-
+  inflater->pos = pos;
   return error;
 }
 
-static unsigned inflateNoCompression(ucvector* out, const unsigned char* in, size_t* bp, size_t* pos, size_t inlength)
+/*decodes until the end of the deflate data, or until the inflater suspends*/
+static unsigned Inflater_run(Inflater* inflater)
 {
-  /*go to first boundary of byte*/
-  size_t p;
-  unsigned LEN, NLEN, n, error = 0;
-  while(((*bp) & 0x7) != 0) (*bp)++;
-  p = (*bp) / 8; /*byte position*/
-
-  /*read LEN (2 bytes) and NLEN (2 bytes)*/
-  if(p >= inlength - 4) return 52; /*error, bit pointer will jump past memory*/
-  LEN = in[p] + 256 * in[p + 1]; p += 2;
-  NLEN = in[p] + 256 * in[p + 1]; p += 2;
-
-  /*check if 16-bit NLEN is really the one's complement of LEN*/
-  if(LEN + NLEN != 65535) return 21; /*error: NLEN is not one's complement of LEN*/
-
-  if((*pos) + LEN >= out->size)
+  unsigned error = 0;
+  inflater->suspended = 0;
+  while(!error && !inflater->suspended && inflater->mode != INFLATE_DONE)
   {
-    if(!ucvector_resize(out, (*pos) + LEN)) return 83; /*alloc fail*/
+    inflater->checkpoint = inflater->reader;
+    if(inflater->mode == INFLATE_BLOCK) error = Inflater_readBlockHeader(inflater);
+    else if(inflater->mode == INFLATE_STORED) error = Inflater_copyStored(inflater);
+    else error = Inflater_decodeSymbols(inflater);
   }
-
-  /*read the literal data: LEN bytes are now stored in the out buffer*/
-  if(p + LEN > inlength) return 23; /*error: reading outside of in buffer*/
-  for(n = 0; n < LEN; n++) out->data[(*pos)++] = in[p++];
-
-  (*bp) = p * 8;
-
   return error;
 }
 
@@ -1232,33 +1797,18 @@ static unsigned lodepng_inflatev(ucvector* out,
                                  const unsigned char* in, size_t insize,
                                  const LodePNGDecompressSettings* settings)
 {
-  /*bit pointer in the "in" data, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte)*/
-  size_t bp = 0;
-  unsigned BFINAL = 0;
-  size_t pos = 0; /*byte position in the out buffer*/
-
-  unsigned error = 0;
+  Inflater inflater;
+  unsigned error;
 
   (void)settings;
 
-  while(!BFINAL)
-  {
-    unsigned BTYPE;
-    if(bp + 2 >= insize * 8) return 52; /*error, bit pointer will jump past memory*/
-    BFINAL = readBitFromStream(&bp, in);
-    BTYPE = 1 * readBitFromStream(&bp, in);
-    BTYPE += 2 * readBitFromStream(&bp, in);
-
-    if(BTYPE == 3) return 20; /*error: invalid BTYPE*/
-    else if(BTYPE == 0) error = inflateNoCompression(out, in, &bp, &pos, insize); /*no compression*/
-    else error = inflateHuffmanBlock(out, in, &bp, &pos, insize, BTYPE); /*compression, BTYPE 01 or 10*/
-
-    if(error) return error;
-  }
+  Inflater_init(&inflater, out, in, insize);
+  error = Inflater_run(&inflater);
 
   /*Only now we know the true size of out, resize it to that*/
-  if(!ucvector_resize(out, pos)) error = 83; /*alloc fail*/
+  if(!error && !ucvector_resize(out, inflater.pos)) error = 83; /*alloc fail*/
 
+  Inflater_cleanup(&inflater);
   return error;
 }
 
@@ -1269,6 +1819,7 @@ unsigned lodepng_inflate(unsigned char** out, size_t* outsize,
   unsigned error;
   ucvector v;
   ucvector_init_buffer(&v, *out, *outsize);
+  v.allocator = settings->allocator;
   error = lodepng_inflatev(&v, in, insize, settings);
   *out = v.data;
   *outsize = v.size;
@@ -1362,6 +1913,17 @@ combinations of bytes can give, the higher it is the more memory is needed, but
 if it's too low the advantage of hashing is gone.
 */
 
+/*the match finders of LodePNGCompressSettings.matchfinder*/
+#define MATCHFINDER_CHAINS 0
+#define MATCHFINDER_FAST 1
+#define MATCHFINDER_TREE 2
+#define MATCHFINDER_RUNS 3
+
+/*
+The hash chains use all four arrays. The fast match finder only uses head, with
+absolute positions, and the binary trees use head, with absolute positions, and son.
+The runs need no hash at all.
+*/
 typedef struct Hash
 {
   int* head; /*hash value to head circular pos*/
@@ -1369,22 +1931,46 @@ typedef struct Hash
   /*circular pos to prev circular pos*/
   unsigned short* chain;
   unsigned short* zeros;
+  int* son; /*circular pos to the positions of its two children in the binary tree*/
 } Hash;
 
-static unsigned hash_init(Hash* hash, unsigned windowsize)
+static void hash_reset(Hash* hash, unsigned windowsize, unsigned matchfinder)
 {
   unsigned i;
+  if(matchfinder == MATCHFINDER_RUNS) return;
+  for(i = 0; i < HASH_NUM_VALUES; i++) hash->head[i] = -1;
+  if(matchfinder != MATCHFINDER_CHAINS) return; /*only positions reachable from head are ever read*/
+  for(i = 0; i < windowsize; i++) hash->val[i] = -1;
+  for(i = 0; i < windowsize; i++) hash->chain[i] = i; /*same value as index indicates uninitialized*/
+}
+
+static unsigned hash_init(Hash* hash, unsigned windowsize, unsigned matchfinder)
+{
+  hash->head = 0;
+  hash->val = 0;
+  hash->chain = 0;
+  hash->zeros = 0;
+  hash->son = 0;
+
+  if(matchfinder == MATCHFINDER_RUNS) return 0;
   hash->head = (int*)mymalloc(sizeof(int) * HASH_NUM_VALUES);
-  hash->val = (int*)mymalloc(sizeof(int) * windowsize);
-  hash->chain = (unsigned short*)mymalloc(sizeof(unsigned short) * windowsize);
-  hash->zeros = (unsigned short*)mymalloc(sizeof(unsigned short) * windowsize);
 
-  if(!hash->head || !hash->val || !hash->chain || !hash->zeros) return 83; /*alloc fail*/
+  if(matchfinder == MATCHFINDER_CHAINS)
+  {
+    hash->val = (int*)mymalloc(sizeof(int) * windowsize);
+    hash->chain = (unsigned short*)mymalloc(sizeof(unsigned short) * windowsize);
+    hash->zeros = (unsigned short*)mymalloc(sizeof(unsigned short) * windowsize);
+    if(!hash->val || !hash->chain || !hash->zeros) return 83; /*alloc fail*/
+  }
+  else if(matchfinder == MATCHFINDER_TREE)
+  {
+    hash->son = (int*)mymalloc(sizeof(int) * 2 * windowsize);
+    if(!hash->son) return 83; /*alloc fail*/
+  }
+  if(!hash->head) return 83; /*alloc fail*/
 
   /*initialize hash table*/
-  for(i = 0; i < HASH_NUM_VALUES; i++) hash->head[i] = -1;
-  for(i = 0; i < windowsize; i++) hash->val[i] = -1;
-  for(i = 0; i < windowsize; i++) hash->chain[i] = i; /*same value as index indicates uninitialized*/
+  hash_reset(hash, windowsize, matchfinder);
 
   return 0;
 }
@@ -1395,6 +1981,7 @@ static void hash_cleanup(Hash* hash)
   myfree(hash->val);
   myfree(hash->chain);
   myfree(hash->zeros);
+  myfree(hash->son);
 }
 
 static unsigned getHash(const unsigned char* data, size_t size, size_t pos)
@@ -1427,6 +2014,304 @@ static void updateHashChain(Hash* hash, size_t pos, int hashval, unsigned window
   hash->head[hashval] = wpos;
 }
 
+/*returns how many bytes a and b have in common, from the first length that are known to be equal up to limit*/
+static size_t countMatch(const unsigned char* a, const unsigned char* b, size_t length, size_t limit)
+{
+#ifdef LODEPNG_USE_SSE2
+  while(length + 16 <= limit)
+  {
+    __m128i equal = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + length)),
+                                   _mm_loadu_si128((const __m128i*)(b + length)));
+    unsigned differ = (unsigned)_mm_movemask_epi8(equal) ^ 0xffffu;
+    if(differ)
+    {
+      while(!(differ & 1)) /*at most 15 steps, and it saves a compiler specific bit scan*/
+      {
+        differ >>= 1;
+        length++;
+      }
+      return length;
+    }
+    length += 16;
+  }
+#endif /*LODEPNG_USE_SSE2*/
+  while(length < limit && a[length] == b[length]) length++;
+  return length;
+}
+
+/*
+The fast match finder looks up one position per hash of 4 bytes, the last one
+with that hash. It finds no matches of length 3, nor any whose position was
+replaced by a later one with the same hash, but it does very little work per byte.
+*/
+static unsigned getHash4(const unsigned char* data)
+{
+  unsigned value = data[0] | ((unsigned)data[1] << 8) | ((unsigned)data[2] << 16) | ((unsigned)data[3] << 24);
+  return ((value * 2654435761u) & 0xffffffffu) >> 16;
+}
+
+static unsigned encodeLZ77Fast(uivector* out, Hash* hash,
+                               const unsigned char* in, size_t inpos, size_t insize, unsigned windowsize,
+                               unsigned minmatch)
+{
+  size_t pos = inpos;
+  /*positions from which 4 bytes can be hashed*/
+  size_t hashend = insize >= 4 ? insize - 3 : 0;
+
+  while(pos < insize)
+  {
+    size_t length = 0, offset = 0;
+    if(pos < hashend)
+    {
+      unsigned hashval = getHash4(&in[pos]);
+      int candidate = hash->head[hashval];
+      hash->head[hashval] = (int)pos;
+      if(candidate >= 0 && pos - candidate <= windowsize && in[candidate] == in[pos]
+         && in[candidate + 1] == in[pos + 1] && in[candidate + 2] == in[pos + 2] && in[candidate + 3] == in[pos + 3])
+      {
+        size_t limit = insize - pos;
+        if(limit > MAX_SUPPORTED_DEFLATE_LENGTH) limit = MAX_SUPPORTED_DEFLATE_LENGTH;
+        length = countMatch(&in[candidate], &in[pos], 4, limit);
+        offset = pos - candidate;
+      }
+    }
+
+    if(length >= 4 && length >= minmatch)
+    {
+      size_t end = pos + length;
+      addLengthDistance(out, length, offset);
+      for(pos++; pos < end; pos++)
+      {
+        if(pos < hashend) hash->head[getHash4(&in[pos])] = (int)pos;
+      }
+    }
+    else
+    {
+      if(!uivector_push_back(out, in[pos])) return 83; /*alloc fail*/
+      pos++;
+    }
+  }
+
+  return 0;
+}
+
+/*
+The run match finder only looks at distance 1: it encodes repeats of the previous
+byte, like zlib's Z_RLE strategy. Filtered images are mostly runs of zeros where
+they are flat, and little else repeats at such a short distance.
+*/
+static size_t countRun(const unsigned char* in, size_t pos, size_t insize)
+{
+  size_t limit = insize - pos;
+  if(limit > MAX_SUPPORTED_DEFLATE_LENGTH) limit = MAX_SUPPORTED_DEFLATE_LENGTH;
+  /*the bytes from pos on repeat in[pos - 1] as long as they equal the byte before them*/
+  return countMatch(&in[pos - 1], &in[pos], 0, limit);
+}
+
+static unsigned encodeLZ77Runs(uivector* out, const unsigned char* in, size_t inpos, size_t insize,
+                               unsigned minmatch)
+{
+  size_t pos = inpos;
+  while(pos < insize)
+  {
+    size_t length = pos > 0 && in[pos] == in[pos - 1] ? countRun(in, pos, insize) : 0;
+    if(length >= 3 && length >= minmatch)
+    {
+      addLengthDistance(out, length, 1);
+      pos += length;
+    }
+    else
+    {
+      if(!uivector_push_back(out, in[pos])) return 83; /*alloc fail*/
+      pos++;
+    }
+  }
+
+  return 0;
+}
+
+/*
+The binary tree match finder, as bt3 of LZMA. The positions with the same hash of
+3 bytes form a binary search tree, ordered by the bytes that follow them, with the
+latest position as root. Inserting a position walks from the root towards where
+the new string belongs, which passes the strings that share the longest prefix
+with it, and rebuilds the tree with the new position as root on the way. son holds
+the smaller and the larger child of every circular position. Strings that are
+equal up to the nice match length count as equal, and walks stop after
+TREE_MAX_DEPTH nodes or at nodes that are outside of the window. Positions closer
+to the end of the data than the nice length are looked up without being inserted:
+their strings are cut shorter than the others, which would break the order.
+*/
+static const unsigned TREE_MAX_DEPTH = 32;
+
+static unsigned getHash3(const unsigned char* data)
+{
+  unsigned value = data[0] | ((unsigned)data[1] << 8) | ((unsigned)data[2] << 16);
+  return ((value * 2654435761u) & 0xffffffffu) >> 16;
+}
+
+/*inserts the string at pos, which must have at least 3 bytes, into its tree, and returns
+the length of the longest match found on the way, with its distance in offset*/
+static unsigned tree_insert(Hash* hash, const unsigned char* in, size_t pos, size_t insize,
+                            unsigned windowsize, unsigned nicematch, size_t* offset)
+{
+  const unsigned char* cur = &in[pos];
+  unsigned hashval = getHash3(cur);
+  int candidate = hash->head[hashval];
+  size_t wpos = pos % windowsize;
+  int* smaller = &hash->son[2 * wpos]; /*where the next string smaller than cur goes*/
+  int* larger = &hash->son[2 * wpos + 1];
+  size_t smallerlength = 0, largerlength = 0; /*bytes that cur shares with those strings*/
+  size_t limit = nicematch < 3 ? 3 : nicematch, bestlength = 0;
+  unsigned depth = TREE_MAX_DEPTH;
+  int insert;
+
+  if(limit > MAX_SUPPORTED_DEFLATE_LENGTH) limit = MAX_SUPPORTED_DEFLATE_LENGTH;
+  insert = insize - pos >= limit;
+  if(!insert) limit = insize - pos;
+  else hash->head[hashval] = (int)pos;
+
+  for(;;)
+  {
+    size_t distance, length;
+    int* children;
+    if(candidate < 0 || (distance = pos - (size_t)candidate) >= windowsize || depth-- == 0)
+    {
+      if(insert) *smaller = *larger = -1;
+      break;
+    }
+    children = &hash->son[2 * (wpos >= distance ? wpos - distance : wpos + windowsize - distance)];
+    length = smallerlength < largerlength ? smallerlength : largerlength;
+    if(in[candidate + length] == cur[length])
+    {
+      length = countMatch(&in[candidate], cur, length + 1, limit);
+      if(length > bestlength)
+      {
+        bestlength = length;
+        *offset = distance;
+      }
+      if(length == limit)
+      {
+        /*equal strings: pos takes the place of the candidate in the tree*/
+        if(insert)
+        {
+          *smaller = children[0];
+          *larger = children[1];
+        }
+        break;
+      }
+    }
+    if(in[candidate + length] < cur[length])
+    {
+      if(insert) *smaller = candidate;
+      smaller = &children[1];
+      candidate = *smaller;
+      smallerlength = length;
+    }
+    else
+    {
+      if(insert) *larger = candidate;
+      larger = &children[0];
+      candidate = *larger;
+      largerlength = length;
+    }
+  }
+
+  return (unsigned)bestlength;
+}
+
+/*inserts pos into the tree and returns the longest usable match, with matches that
+reached the nice length extended up to the maximum length*/
+static unsigned findTreeMatch(Hash* hash, const unsigned char* in, size_t pos, size_t insize,
+                              unsigned windowsize, unsigned minmatch, unsigned nicematch, size_t* offset)
+{
+  size_t length, limit = insize - pos;
+  if(limit < 3) return 0;
+  length = tree_insert(hash, in, pos, insize, windowsize, nicematch, offset);
+  if(limit > MAX_SUPPORTED_DEFLATE_LENGTH) limit = MAX_SUPPORTED_DEFLATE_LENGTH;
+  if(length >= nicematch)
+  {
+    length = countMatch(&in[pos - *offset], &in[pos], length, limit);
+  }
+  /*as in encodeLZ77, a length of 3 isn't worth a long distance*/
+  if(length < minmatch || (length == 3 && *offset > 4096)) return 0;
+  return (unsigned)length;
+}
+
+static unsigned encodeLZ77Tree(uivector* out, Hash* hash,
+                               const unsigned char* in, size_t inpos, size_t insize, unsigned windowsize,
+                               unsigned minmatch, unsigned nicematch, unsigned lazymatching)
+{
+  size_t pos = inpos, i, offset = 0, nextoffset = 0;
+  unsigned length, nextlength;
+
+  length = pos < insize ? findTreeMatch(hash, in, pos, insize, windowsize, minmatch, nicematch, &offset) : 0;
+  while(pos < insize)
+  {
+    /*the position after the match start, from which the positions covered by the match must be inserted*/
+    size_t next = pos + 1;
+    if(length >= 3 && lazymatching && length < nicematch && pos + 1 < insize)
+    {
+      /*lazy matching: a longer match at the next byte is worth a literal*/
+      nextlength = findTreeMatch(hash, in, pos + 1, insize, windowsize, minmatch, nicematch, &nextoffset);
+      if(nextlength > length)
+      {
+        if(!uivector_push_back(out, in[pos])) return 83; /*alloc fail*/
+        pos++;
+        length = nextlength;
+        offset = nextoffset;
+        continue;
+      }
+      next = pos + 2;
+    }
+
+    if(length >= 3)
+    {
+      addLengthDistance(out, length, offset);
+      for(i = next; i < pos + length; i++)
+      {
+        if(insize - i >= 3) tree_insert(hash, in, i, insize, windowsize, nicematch, &nextoffset);
+      }
+      pos += length;
+    }
+    else
+    {
+      if(!uivector_push_back(out, in[pos])) return 83; /*alloc fail*/
+      pos++;
+    }
+    if(pos < insize) length = findTreeMatch(hash, in, pos, insize, windowsize, minmatch, nicematch, &offset);
+  }
+
+  return 0;
+}
+
+/*adds the positions start..end-1 to the hash without encoding them, so that
+the data after them can refer back to them as the match finder would have*/
+static void hash_prime(Hash* hash, const unsigned char* in, size_t start, size_t end,
+                       size_t insize, const LodePNGCompressSettings* settings)
+{
+  unsigned windowsize = settings->windowsize;
+  size_t pos, offset;
+  if(settings->matchfinder == MATCHFINDER_RUNS) return; /*a run only refers to the byte before it*/
+  for(pos = start; pos < end; pos++)
+  {
+    if(settings->matchfinder == MATCHFINDER_FAST)
+    {
+      if(insize - pos >= 4) hash->head[getHash4(&in[pos])] = (int)pos;
+    }
+    else if(settings->matchfinder == MATCHFINDER_TREE)
+    {
+      if(insize - pos >= 3) tree_insert(hash, in, pos, insize, windowsize, settings->nicematch, &offset);
+    }
+    else
+    {
+      unsigned hashval = getHash(in, insize, pos);
+      updateHashChain(hash, pos, hashval, windowsize);
+      if(windowsize >= 8192 && hashval == 0) hash->zeros[pos % windowsize] = countZeros(in, insize, pos);
+    }
+  }
+}
+
 /*
 LZ77-encode the data. Return value is error code. The input are raw bytes, the output
 is in the form of unsigned integers with codes representing for example literal bytes, or
@@ -1592,6 +2477,27 @@ static unsigned encodeLZ77(uivector* out, Hash* hash,
   return error;
 }
 
+/*LZ77-encodes in[inpos..insize-1] with the match finder of the settings*/
+static unsigned findMatches(uivector* out, Hash* hash, const unsigned char* in, size_t inpos, size_t insize,
+                            const LodePNGCompressSettings* settings)
+{
+  if(settings->matchfinder == MATCHFINDER_FAST)
+  {
+    return encodeLZ77Fast(out, hash, in, inpos, insize, settings->windowsize, settings->minmatch);
+  }
+  else if(settings->matchfinder == MATCHFINDER_TREE)
+  {
+    return encodeLZ77Tree(out, hash, in, inpos, insize, settings->windowsize,
+                          settings->minmatch, settings->nicematch, settings->lazymatching);
+  }
+  else if(settings->matchfinder == MATCHFINDER_RUNS)
+  {
+    return encodeLZ77Runs(out, in, inpos, insize, settings->minmatch);
+  }
+  return encodeLZ77(out, hash, in, inpos, insize, settings->windowsize,
+                    settings->minmatch, settings->nicematch, settings->lazymatching);
+}
+
 /* /////////////////////////////////////////////////////////////////////////// */
 
 static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize)
@@ -1726,14 +2632,13 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
   {
     if(settings->use_lz77)
     {
-      error = encodeLZ77(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
-                         settings->minmatch, settings->nicematch, settings->lazymatching);
+      error = findMatches(&lz77_encoded, hash, data, datapos, dataend, settings);
       if(error) break;
     }
     else
     {
       if(!uivector_resize(&lz77_encoded, datasize)) ERROR_BREAK(83 /*alloc fail*/);
-      for(i = datapos; i < dataend; i++) lz77_encoded.data[i] = data[i]; /*no LZ77, but still will be Huffman compressed*/
+      for(i = datapos; i < dataend; i++) lz77_encoded.data[i - datapos] = data[i]; /*no LZ77, but still will be Huffman compressed*/
     }
 
     if(!uivector_resizev(&frequencies_ll, 286, 0)) ERROR_BREAK(83 /*alloc fail*/);
@@ -1936,8 +2841,7 @@ static unsigned deflateFixed(ucvector* out, size_t* bp, Hash* hash,
   {
     uivector lz77_encoded;
     uivector_init(&lz77_encoded);
-    error = encodeLZ77(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
-                       settings->minmatch, settings->nicematch, settings->lazymatching);
+    error = findMatches(&lz77_encoded, hash, data, datapos, dataend, settings);
     if(!error) writeLZ77data(bp, out, &lz77_encoded, &tree_ll, &tree_d);
     uivector_cleanup(&lz77_encoded);
   }
@@ -1958,110 +2862,457 @@ static unsigned deflateFixed(ucvector* out, size_t* bp, Hash* hash,
   return error;
 }
 
-static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t insize,
-                                 const LodePNGCompressSettings* settings)
+/*the room deflateFixedRuns needs: a literal takes at most 9 bits, and it writes up to 4 bytes ahead*/
+static size_t deflateFixedRunsBound(size_t insize)
+{
+  return (insize * 9 + 3 + 7 + 7) / 8 + 4;
+}
+
+/*
+Moves the lowest 32 bits of buffer to out if it has that many. Its 4 bytes are
+written either way, which avoids a branch that the mix of 8 and 9 bit codes
+makes unpredictable. Returns where the next bytes go.
+*/
+static unsigned char* flushBits32(unsigned char* out, unsigned long long* buffer, unsigned* count)
+{
+  unsigned full = *count >> 5; /*at most 63 bits are buffered, so this is 0 or 1*/
+  out[0] = (unsigned char)*buffer;
+  out[1] = (unsigned char)(*buffer >> 8);
+  out[2] = (unsigned char)(*buffer >> 16);
+  out[3] = (unsigned char)(*buffer >> 24);
+  *buffer >>= full * 32;
+  *count -= full * 32;
+  return &out[full * 4];
+}
+
+/*returns the first position from pos on, and after 0, where a run of at least 3 bytes repeating the
+one before it starts, or insize*/
+static size_t findRun(const unsigned char* in, size_t pos, size_t insize)
+{
+  if(pos == 0) pos = 1;
+#ifdef LODEPNG_USE_SSE2
+  while(pos + 18 <= insize)
+  {
+    __m128i before = _mm_loadu_si128((const __m128i*)&in[pos - 1]);
+    __m128i at = _mm_loadu_si128((const __m128i*)&in[pos]);
+    __m128i next = _mm_loadu_si128((const __m128i*)&in[pos + 1]);
+    __m128i last = _mm_loadu_si128((const __m128i*)&in[pos + 2]);
+    unsigned run = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(before, at),
+                                                                            _mm_cmpeq_epi8(at, next)),
+                                                              _mm_cmpeq_epi8(next, last)));
+    if(run)
+    {
+      while(!(run & 1))
+      {
+        run >>= 1;
+        pos++;
+      }
+      return pos;
+    }
+    pos += 16;
+  }
+#endif /*LODEPNG_USE_SSE2*/
+  for(; pos + 3 <= insize; pos++)
+  {
+    if(in[pos] == in[pos - 1] && in[pos + 1] == in[pos - 1] && in[pos + 2] == in[pos - 1]) return pos;
+  }
+  return insize;
+}
+
+/*
+Does what deflateFixed does with the run match finder, for the same bits, but
+writes them straight to out instead of through an LZ77 vector and bit by bit, from
+tables of the reversed fixed codes. It is the fast path for images that are mostly
+flat, such as screenshots. out must have room for deflateFixedRunsBound(insize)
+bytes. Returns how many bytes it wrote.
+*/
+static size_t deflateFixedRuns(unsigned char* out, const unsigned char* in, size_t insize, unsigned minmatch)
+{
+  /*the lsb first bits of every literal, and of every run length followed by distance code 0
+  (distance 1), with the amount of bits in the highest byte*/
+  unsigned literals[256], runs[MAX_SUPPORTED_DEFLATE_LENGTH + 1];
+  unsigned long long buffer = 3; /*BFINAL 1, BTYPE 01*/
+  unsigned count = 3; /*bits in buffer*/
+  unsigned char* begin = out;
+  size_t pos = 0, i, lengthcode = 0;
+
+  for(i = 0; i <= MAX_SUPPORTED_DEFLATE_LENGTH + 253; i++)
+  {
+    /*the fixed tree: 0-143 are 8 bit, 144-255 9 bit, 256-279 7 bit and 280-287 8 bit codes*/
+    size_t length = i - 253; /*3 to 258 from i = 256 on*/
+    unsigned symbol, code, bits, reversed = 0, b;
+    if(i < 256) symbol = (unsigned)i;
+    else
+    {
+      while(lengthcode < 28 && LENGTHBASE[lengthcode + 1] <= length) lengthcode++;
+      symbol = (unsigned)lengthcode + FIRST_LENGTH_CODE_INDEX;
+    }
+    if(symbol <= 143) { code = 48 + symbol; bits = 8; }
+    else if(symbol <= 255) { code = 400 + symbol - 144; bits = 9; }
+    else if(symbol <= 279) { code = symbol - 256; bits = 7; }
+    else { code = 192 + symbol - 280; bits = 8; }
+    for(b = 0; b < bits; b++) reversed |= ((code >> (bits - 1 - b)) & 1) << b;
+
+    if(i < 256) literals[i] = reversed | (bits << 24);
+    else
+    {
+      reversed |= (unsigned)((length - LENGTHBASE[lengthcode]) << bits);
+      runs[length] = reversed | ((bits + LENGTHEXTRA[lengthcode] + 5) << 24);
+    }
+  }
+  if(minmatch < 3) minmatch = 3;
+
+  while(pos < insize)
+  {
+    /*literals up to the next run, without looking for runs in between*/
+    size_t end = findRun(in, pos, insize);
+    unsigned symbol;
+    for(; pos + 3 <= end; pos += 3)
+    {
+      /*three literals of at most 9 bits fit after the at most 31 bits left by a flush*/
+      unsigned symbol0 = literals[in[pos]], symbol1 = literals[in[pos + 1]], symbol2 = literals[in[pos + 2]];
+      buffer |= (unsigned long long)(symbol0 & 0xffffffu) << count;
+      count += symbol0 >> 24;
+      buffer |= (unsigned long long)(symbol1 & 0xffffffu) << count;
+      count += symbol1 >> 24;
+      buffer |= (unsigned long long)(symbol2 & 0xffffffu) << count;
+      count += symbol2 >> 24;
+      out = flushBits32(out, &buffer, &count);
+    }
+    for(; pos < end; pos++)
+    {
+      symbol = literals[in[pos]];
+      buffer |= (unsigned long long)(symbol & 0xffffffu) << count;
+      count += symbol >> 24;
+      out = flushBits32(out, &buffer, &count);
+    }
+    if(pos == insize) break;
+
+    i = countRun(in, pos, insize);
+    if(i >= minmatch)
+    {
+      symbol = runs[i];
+      pos += i;
+    }
+    else symbol = literals[in[pos++]];
+    buffer |= (unsigned long long)(symbol & 0xffffffu) << count;
+    count += symbol >> 24;
+    out = flushBits32(out, &buffer, &count);
+  }
+
+  count += 7; /*the end code 256 is 7 zero bits*/
+  while(count > 0)
+  {
+    *out++ = (unsigned char)buffer;
+    buffer >>= 8;
+    count = count > 8 ? count - 8 : 0;
+  }
+
+  return (size_t)(out - begin);
+}
+
+/*
+Compresses in[start..end-1] as one or more blocks with the hash, which must be
+empty. The window before start is added to the hash first, so matches can refer
+back across the start. If the segment isn't the final one it ends with an empty
+stored block, which pads it to a whole byte: segments compressed separately
+can then be concatenated into one deflate stream, as pigz does.
+*/
+static unsigned deflateSegment(ucvector* out, Hash* hash, const unsigned char* in,
+                               size_t start, size_t end, const LodePNGCompressSettings* settings, int final)
 {
   unsigned error = 0;
   size_t i, blocksize, numdeflateblocks;
   size_t bp = 0; /*the bit pointer*/
-  Hash hash;
+  size_t size = end - start;
 
-  if(settings->btype > 2) return 61;
-  else if(settings->btype == 0) return deflateNoCompression(out, in, insize);
-  else if(settings->btype == 1) blocksize = insize;
+  if(settings->btype == 1) blocksize = size ? size : 1; /*one block, also for empty input*/
   else /*if(settings->btype == 2)*/
   {
-    blocksize = insize / 8 + 8;
+    blocksize = size / 8 + 8;
     if(blocksize < 65535) blocksize = 65535;
   }
 
-  numdeflateblocks = (insize + blocksize - 1) / blocksize;
+  numdeflateblocks = (size + blocksize - 1) / blocksize;
   if(numdeflateblocks == 0) numdeflateblocks = 1;
 
-  error = hash_init(&hash, settings->windowsize);
-  if(error) return error;
+  if(settings->use_lz77 && start > 0)
+  {
+    hash_prime(hash, in, start > settings->windowsize ? start - settings->windowsize : 0, start,
+               end, settings);
+  }
 
   for(i = 0; i < numdeflateblocks && !error; i++)
   {
-    int final = i == numdeflateblocks - 1;
-    size_t start = i * blocksize;
-    size_t end = start + blocksize;
-    if(end > insize) end = insize;
+    int finalblock = final && i == numdeflateblocks - 1;
+    size_t blockstart = start + i * blocksize;
+    size_t blockend = blockstart + blocksize;
+    if(blockend > end) blockend = end;
 
-    if(settings->btype == 1) error = deflateFixed(out, &bp, &hash, in, start, end, settings, final);
-    else if(settings->btype == 2) error = deflateDynamic(out, &bp, &hash, in, start, end, settings, final);
+    if(settings->btype == 1) error = deflateFixed(out, &bp, hash, in, blockstart, blockend, settings, finalblock);
+    else error = deflateDynamic(out, &bp, hash, in, blockstart, blockend, settings, finalblock);
   }
 
-  hash_cleanup(&hash);
+  if(!error && !final)
+  {
+    addBitsToStream(&bp, out, 0, 3); /*BFINAL 0, BTYPE 00*/
+    if(!ucvector_push_back(out, 0) || !ucvector_push_back(out, 0)
+       || !ucvector_push_back(out, 255) || !ucvector_push_back(out, 255)) error = 83; /*alloc fail*/
+  }
 
   return error;
 }
 
-unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
-                         const unsigned char* in, size_t insize,
-                         const LodePNGCompressSettings* settings)
-{
-  unsigned error;
-  ucvector v;
-  ucvector_init_buffer(&v, *out, *outsize);
-  error = lodepng_deflatev(&v, in, insize, settings);
-  *out = v.data;
-  *outsize = v.size;
-  return error;
-}
+/*amount of input per independently compressed segment when compressing on several threads*/
+static const size_t DEFLATE_SEGMENT_SIZE = 131072;
 
-static unsigned deflate(unsigned char** out, size_t* outsize,
-                        const unsigned char* in, size_t insize,
-                        const LodePNGCompressSettings* settings)
+/*the segments of a multithreaded deflate, each compressed into its own vector*/
+typedef struct DeflateSegments
 {
-  if(settings->custom_deflate)
-  {
-    return settings->custom_deflate(out, outsize, in, insize, settings);
-  }
-  else
-  {
-    return lodepng_deflate(out, outsize, in, insize, settings);
-  }
-}
-
-#endif /*LODEPNG_COMPILE_DECODER*/
-
-/* ////////////////////////////////////////////////////////////////////////// */
-/* / Adler32                                                                  */
-/* ////////////////////////////////////////////////////////////////////////// */
+  const unsigned char* in;
+  size_t insize;
+  const LodePNGCompressSettings* settings;
+  size_t numsegments;
+  ucvector* out;
+  unsigned* error;
+} DeflateSegments;
 
-static unsigned update_adler32(unsigned adler, const unsigned char* data, unsigned len)
+/*compresses the segments first, first + step, first + 2 * step, ... reusing one hash*/
+static void deflateSegments(DeflateSegments* segments, size_t first, size_t step)
 {
-   unsigned s1 = adler & 0xffff;
-   unsigned s2 = (adler >> 16) & 0xffff;
+  Hash hash;
+  size_t i;
+  unsigned error = hash_init(&hash, segments->settings->windowsize, segments->settings->matchfinder);
 
-  while(len > 0)
+  for(i = first; i < segments->numsegments; i += step)
   {
-    /*at least 5550 sums can be done before the sums overflow, saving a lot of module divisions*/
-    unsigned amount = len > 5550 ? 5550 : len;
-    len -= amount;
-    while(amount > 0)
+    size_t start = i * DEFLATE_SEGMENT_SIZE;
+    size_t end = start + DEFLATE_SEGMENT_SIZE;
+    if(end > segments->insize) end = segments->insize;
+
+    if(!error)
     {
-      s1 += (*data++);
-      s2 += s1;
-      amount--;
+      if(i != first) hash_reset(&hash, segments->settings->windowsize, segments->settings->matchfinder);
+      segments->error[i] = deflateSegment(&segments->out[i], &hash, segments->in, start, end,
+                                          segments->settings, i == segments->numsegments - 1);
     }
-    s1 %= 65521;
-    s2 %= 65521;
+    else segments->error[i] = error;
   }
 
-  return (s2 << 16) | s1;
+  hash_cleanup(&hash);
 }
 
-/*Return the adler32 of the bytes data[0..len-1]*/
-static unsigned adler32(const unsigned char* data, unsigned len)
+/*
+Splits the input into segments of DEFLATE_SEGMENT_SIZE that are compressed in
+parallel and joined. The output only depends on the input and the settings, not
+on the amount of threads. Without the C++ version there are no threads and the
+segments are compressed one after another.
+*/
+static unsigned deflateParallel(ucvector* out, const unsigned char* in, size_t insize,
+                                const LodePNGCompressSettings* settings)
 {
-  return update_adler32(1L, data, len);
-}
+  unsigned error = 0;
+  size_t i, outsize;
+  DeflateSegments segments;
+  size_t numthreads = settings->numthreads;
+
+  segments.in = in;
+  segments.insize = insize;
+  segments.settings = settings;
+  segments.numsegments = (insize + DEFLATE_SEGMENT_SIZE - 1) / DEFLATE_SEGMENT_SIZE;
+  segments.out = (ucvector*)mymalloc(segments.numsegments * sizeof(ucvector));
+  segments.error = (unsigned*)mymalloc(segments.numsegments * sizeof(unsigned));
+  if(!segments.out || !segments.error)
+  {
+    myfree(segments.out);
+    myfree(segments.error);
+    return 83; /*alloc fail*/
+  }
+  for(i = 0; i < segments.numsegments; i++) ucvector_init(&segments.out[i]);
+  if(numthreads > segments.numsegments) numthreads = segments.numsegments;
 
-/* ////////////////////////////////////////////////////////////////////////// */
-/* / Zlib                                                                   / */
-/* ////////////////////////////////////////////////////////////////////////// */
+#ifdef LODEPNG_COMPILE_CPP
+  {
+    /*the calling thread takes the first share, and the others as well if threads can't be started*/
+    std::vector<std::thread> workers;
+    size_t started = 1;
+    for(i = 1; i < numthreads; i++)
+    {
+      try
+      {
+        workers.push_back(std::thread(deflateSegments, &segments, i, numthreads));
+        started++;
+      }
+      catch(...)
+      {
+        break;
+      }
+    }
+    deflateSegments(&segments, 0, numthreads);
+    for(i = started; i < numthreads; i++) deflateSegments(&segments, i, numthreads);
+    for(i = 0; i < workers.size(); i++) workers[i].join();
+  }
+#else /*LODEPNG_COMPILE_CPP*/
+  for(i = 0; i < numthreads; i++) deflateSegments(&segments, i, numthreads);
+#endif /*LODEPNG_COMPILE_CPP*/
+
+  outsize = out->size;
+  for(i = 0; i < segments.numsegments; i++)
+  {
+    if(!error) error = segments.error[i];
+    outsize += segments.out[i].size;
+  }
+  if(!error && !ucvector_resize(out, outsize)) error = 83; /*alloc fail*/
+  if(!error)
+  {
+    unsigned char* pos = out->data + outsize;
+    for(i = segments.numsegments; i > 0; i--)
+    {
+      pos -= segments.out[i - 1].size;
+      if(segments.out[i - 1].size) memcpy(pos, segments.out[i - 1].data, segments.out[i - 1].size);
+    }
+  }
+
+  for(i = 0; i < segments.numsegments; i++) ucvector_cleanup(&segments.out[i]);
+  myfree(segments.out);
+  myfree(segments.error);
+
+  return error;
+}
+
+static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t insize,
+                                 const LodePNGCompressSettings* settings)
+{
+  unsigned error = 0;
+  Hash hash;
+
+  if(settings->btype > 2) return 61;
+  else if(settings->matchfinder > MATCHFINDER_RUNS) return 91;
+  else if(settings->btype == 0) return deflateNoCompression(out, in, insize);
+
+  if(settings->btype == 1 && settings->use_lz77 && settings->matchfinder == MATCHFINDER_RUNS)
+  {
+    size_t size = out->size;
+    if(!ucvector_resize(out, size + deflateFixedRunsBound(insize))) return 83; /*alloc fail*/
+    out->size = size + deflateFixedRuns(&out->data[size], in, insize, settings->minmatch);
+    return 0;
+  }
+  if(settings->numthreads > 1 && insize > DEFLATE_SEGMENT_SIZE) return deflateParallel(out, in, insize, settings);
+
+  error = hash_init(&hash, settings->windowsize, settings->matchfinder);
+  if(!error) error = deflateSegment(out, &hash, in, 0, insize, settings, 1);
+
+  hash_cleanup(&hash);
+
+  return error;
+}
+
+unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
+                         const unsigned char* in, size_t insize,
+                         const LodePNGCompressSettings* settings)
+{
+  unsigned error;
+  ucvector v;
+  ucvector_init_buffer(&v, *out, *outsize);
+  error = lodepng_deflatev(&v, in, insize, settings);
+  *out = v.data;
+  *outsize = v.size;
+  return error;
+}
+
+static unsigned deflate(unsigned char** out, size_t* outsize,
+                        const unsigned char* in, size_t insize,
+                        const LodePNGCompressSettings* settings)
+{
+  if(settings->custom_deflate)
+  {
+    return settings->custom_deflate(out, outsize, in, insize, settings);
+  }
+  else
+  {
+    return lodepng_deflate(out, outsize, in, insize, settings);
+  }
+}
+
+#endif /*LODEPNG_COMPILE_DECODER*/
+
+/* ////////////////////////////////////////////////////////////////////////// */
+/* / Adler32                                                                  */
+/* ////////////////////////////////////////////////////////////////////////// */
+
+#ifdef LODEPNG_USE_SSE2
+/*
+Adds numblocks blocks of 16 bytes to the unreduced sums. Per block, s2 grows by
+16 times s1 plus the bytes weighted 16 down to 1: the weighted sums are kept per
+lane, and the running s1 before each block is accumulated in ps to be multiplied
+by 16 at the end. The caller keeps the amount within the bound of the scalar loop.
+*/
+static void update_adler32_sse2(unsigned* s1, unsigned* s2, const unsigned char* data, size_t numblocks)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i weights_lo = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+  const __m128i weights_hi = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+  __m128i vs1 = zero, vs2 = zero, ps = zero;
+  size_t i;
+  unsigned sum1[4], sum2[4], sumps[4];
+
+  for(i = 0; i < numblocks; i++)
+  {
+    __m128i bytes = _mm_loadu_si128((const __m128i*)(data + i * 16));
+    ps = _mm_add_epi32(ps, vs1);
+    vs1 = _mm_add_epi32(vs1, _mm_sad_epu8(bytes, zero));
+    vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_unpacklo_epi8(bytes, zero), weights_lo));
+    vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_unpackhi_epi8(bytes, zero), weights_hi));
+  }
+
+  _mm_storeu_si128((__m128i*)sum1, vs1);
+  _mm_storeu_si128((__m128i*)sum2, vs2);
+  _mm_storeu_si128((__m128i*)sumps, ps);
+  *s2 += (unsigned)(numblocks * 16) * *s1 + 16 * (sumps[0] + sumps[2]) + sum2[0] + sum2[1] + sum2[2] + sum2[3];
+  *s1 += sum1[0] + sum1[2];
+}
+#endif /*LODEPNG_USE_SSE2*/
+
+static unsigned update_adler32(unsigned adler, const unsigned char* data, unsigned len)
+{
+   unsigned s1 = adler & 0xffff;
+   unsigned s2 = (adler >> 16) & 0xffff;
+
+  while(len > 0)
+  {
+    /*at most 5552 sums can be done before the sums overflow, saving a lot of module divisions*/
+    unsigned amount = len > 5552 ? 5552 : len;
+    len -= amount;
+#ifdef LODEPNG_USE_SSE2
+    if(amount >= 16)
+    {
+      update_adler32_sse2(&s1, &s2, data, amount / 16);
+      data += amount & ~15u;
+      amount &= 15;
+    }
+#endif /*LODEPNG_USE_SSE2*/
+    while(amount > 0)
+    {
+      s1 += (*data++);
+      s2 += s1;
+      amount--;
+    }
+    s1 %= 65521;
+    s2 %= 65521;
+  }
+
+  return (s2 << 16) | s1;
+}
+
+/*Return the adler32 of the bytes data[0..len-1]*/
+static unsigned adler32(const unsigned char* data, unsigned len)
+{
+  return update_adler32(1L, data, len);
+}
+
+/* ////////////////////////////////////////////////////////////////////////// */
+/* / Zlib                                                                   / */
+/* ////////////////////////////////////////////////////////////////////////// */
 
 #ifdef LODEPNG_COMPILE_DECODER
 
@@ -2218,13 +3469,15 @@ void lodepng_compress_settings_init(LodePNGCompressSettings* settings)
   settings->minmatch = 3;
   settings->nicematch = 128;
   settings->lazymatching = 1;
+  settings->matchfinder = 0;
+  settings->numthreads = 0;
 
   settings->custom_zlib = 0;
   settings->custom_deflate = 0;
   settings->custom_context = 0;
 }
 
-const LodePNGCompressSettings lodepng_default_compress_settings = {2, 1, DEFAULT_WINDOWSIZE, 3, 128, 1, 0, 0, 0};
+const LodePNGCompressSettings lodepng_default_compress_settings = {2, 1, DEFAULT_WINDOWSIZE, 3, 128, 1, 0, 0, 0, 0, 0};
 
 
 #endif /*LODEPNG_COMPILE_ENCODER*/
@@ -2238,9 +3491,10 @@ void lodepng_decompress_settings_init(LodePNGDecompressSettings* settings)
   settings->custom_zlib = 0;
   settings->custom_inflate = 0;
   settings->custom_context = 0;
+  settings->allocator = 0;
 }
 
-const LodePNGDecompressSettings lodepng_default_decompress_settings = {0, 0, 0, 0};
+const LodePNGDecompressSettings lodepng_default_decompress_settings = {0, 0, 0, 0, 0};
 
 #endif /*LODEPNG_COMPILE_DECODER*/
 
@@ -2256,38 +3510,495 @@ const LodePNGDecompressSettings lodepng_default_decompress_settings = {0, 0, 0,
 /* / CRC32                                                                  / */
 /* ////////////////////////////////////////////////////////////////////////// */
 
-static unsigned Crc32_crc_table_computed = 0;
-static unsigned Crc32_crc_table[256];
-
-/*Make the table for a fast CRC.*/
-static void Crc32_make_crc_table(void)
-{
-  unsigned c, k, n;
-  for(n = 0; n < 256; n++)
-  {
-    c = n;
-    for(k = 0; k < 8; k++)
-    {
-      if(c & 1) c = 0xedb88320L ^ (c >> 1);
-      else c = c >> 1;
-    }
-    Crc32_crc_table[n] = c;
+/*CRC polynomial: 0xedb88320. The tables are constant so that several threads
+can decode at the same time. Table k holds the CRC of a byte followed by k zero
+bytes, so that eight bytes can be processed at once ("slicing-by-8").*/
+static const unsigned Crc32_crc_table[8][256] = {
+  {
+    0u, 1996959894u, 3993919788u, 2567524794u, 124634137u, 1886057615u,
+    3915621685u, 2657392035u, 249268274u, 2044508324u, 3772115230u, 2547177864u,
+    162941995u, 2125561021u, 3887607047u, 2428444049u, 498536548u, 1789927666u,
+    4089016648u, 2227061214u, 450548861u, 1843258603u, 4107580753u, 2211677639u,
+    325883990u, 1684777152u, 4251122042u, 2321926636u, 335633487u, 1661365465u,
+    4195302755u, 2366115317u, 997073096u, 1281953886u, 3579855332u, 2724688242u,
+    1006888145u, 1258607687u, 3524101629u, 2768942443u, 901097722u, 1119000684u,
+    3686517206u, 2898065728u, 853044451u, 1172266101u, 3705015759u, 2882616665u,
+    651767980u, 1373503546u, 3369554304u, 3218104598u, 565507253u, 1454621731u,
+    3485111705u, 3099436303u, 671266974u, 1594198024u, 3322730930u, 2970347812u,
+    795835527u, 1483230225u, 3244367275u, 3060149565u, 1994146192u, 31158534u,
+    2563907772u, 4023717930u, 1907459465u, 112637215u, 2680153253u, 3904427059u,
+    2013776290u, 251722036u, 2517215374u, 3775830040u, 2137656763u, 141376813u,
+    2439277719u, 3865271297u, 1802195444u, 476864866u, 2238001368u, 4066508878u,
+    1812370925u, 453092731u, 2181625025u, 4111451223u, 1706088902u, 314042704u,
+    2344532202u, 4240017532u, 1658658271u, 366619977u, 2362670323u, 4224994405u,
+    1303535960u, 984961486u, 2747007092u, 3569037538u, 1256170817u, 1037604311u,
+    2765210733u, 3554079995u, 1131014506u, 879679996u, 2909243462u, 3663771856u,
+    1141124467u, 855842277u, 2852801631u, 3708648649u, 1342533948u, 654459306u,
+    3188396048u, 3373015174u, 1466479909u, 544179635u, 3110523913u, 3462522015u,
+    1591671054u, 702138776u, 2966460450u, 3352799412u, 1504918807u, 783551873u,
+    3082640443u, 3233442989u, 3988292384u, 2596254646u, 62317068u, 1957810842u,
+    3939845945u, 2647816111u, 81470997u, 1943803523u, 3814918930u, 2489596804u,
+    225274430u, 2053790376u, 3826175755u, 2466906013u, 167816743u, 2097651377u,
+    4027552580u, 2265490386u, 503444072u, 1762050814u, 4150417245u, 2154129355u,
+    426522225u, 1852507879u, 4275313526u, 2312317920u, 282753626u, 1742555852u,
+    4189708143u, 2394877945u, 397917763u, 1622183637u, 3604390888u, 2714866558u,
+    953729732u, 1340076626u, 3518719985u, 2797360999u, 1068828381u, 1219638859u,
+    3624741850u, 2936675148u, 906185462u, 1090812512u, 3747672003u, 2825379669u,
+    829329135u, 1181335161u, 3412177804u, 3160834842u, 628085408u, 1382605366u,
+    3423369109u, 3138078467u, 570562233u, 1426400815u, 3317316542u, 2998733608u,
+    733239954u, 1555261956u, 3268935591u, 3050360625u, 752459403u, 1541320221u,
+    2607071920u, 3965973030u, 1969922972u, 40735498u, 2617837225u, 3943577151u,
+    1913087877u, 83908371u, 2512341634u, 3803740692u, 2075208622u, 213261112u,
+    2463272603u, 3855990285u, 2094854071u, 198958881u, 2262029012u, 4057260610u,
+    1759359992u, 534414190u, 2176718541u, 4139329115u, 1873836001u, 414664567u,
+    2282248934u, 4279200368u, 1711684554u, 285281116u, 2405801727u, 4167216745u,
+    1634467795u, 376229701u, 2685067896u, 3608007406u, 1308918612u, 956543938u,
+    2808555105u, 3495958263u, 1231636301u, 1047427035u, 2932959818u,
+    3654703836u, 1088359270u, 936918000u, 2847714899u, 3736837829u, 1202900863u,
+    817233897u, 3183342108u, 3401237130u, 1404277552u, 615818150u, 3134207493u,
+    3453421203u, 1423857449u, 601450431u, 3009837614u, 3294710456u, 1567103746u,
+    711928724u, 3020668471u, 3272380065u, 1510334235u, 755167117u
+  },
+  {
+    0u, 421212481u, 842424962u, 724390851u, 1684849924u, 2105013317u,
+    1448781702u, 1329698503u, 3369699848u, 3519200073u, 4210026634u,
+    3824474571u, 2897563404u, 3048111693u, 2659397006u, 2274893007u,
+    1254232657u, 1406739216u, 2029285587u, 1643069842u, 783210325u, 934667796u,
+    479770071u, 92505238u, 2182846553u, 2600511768u, 2955803355u, 2838940570u,
+    3866582365u, 4285295644u, 3561045983u, 3445231262u, 2508465314u,
+    2359236067u, 2813478432u, 3198777185u, 4058571174u, 3908292839u,
+    3286139684u, 3670389349u, 1566420650u, 1145479147u, 1869335592u,
+    1987116393u, 959540142u, 539646703u, 185010476u, 303839341u, 3745920755u,
+    3327985586u, 3983561841u, 4100678960u, 3140154359u, 2721170102u,
+    2300350837u, 2416418868u, 396344571u, 243568058u, 631889529u, 1018359608u,
+    1945336319u, 1793607870u, 1103436669u, 1490954812u, 4034481925u,
+    3915546180u, 3259968903u, 3679722694u, 2484439553u, 2366552896u,
+    2787371139u, 3208174018u, 950060301u, 565965900u, 177645455u, 328046286u,
+    1556873225u, 1171730760u, 1861902987u, 2011255754u, 3132841300u,
+    2745199637u, 2290958294u, 2442530455u, 3738671184u, 3352078609u,
+    3974232786u, 4126854035u, 1919080284u, 1803150877u, 1079293406u,
+    1498383519u, 370020952u, 253043481u, 607678682u, 1025720731u, 1711106983u,
+    2095471334u, 1472923941u, 1322268772u, 26324643u, 411738082u, 866634785u,
+    717028704u, 2904875439u, 3024081134u, 2668790573u, 2248782444u, 3376948395u,
+    3495106026u, 4219356713u, 3798300520u, 792689142u, 908347575u, 487136116u,
+    68299317u, 1263779058u, 1380486579u, 2036719216u, 1618931505u, 3890672638u,
+    4278043327u, 3587215740u, 3435896893u, 2206873338u, 2593195963u,
+    2981909624u, 2829542713u, 998479947u, 580430090u, 162921161u, 279890824u,
+    1609522511u, 1190423566u, 1842954189u, 1958874764u, 4082766403u,
+    3930137346u, 3245109441u, 3631694208u, 2536953671u, 2385372678u,
+    2768287173u, 3155920004u, 1900120602u, 1750776667u, 1131931800u,
+    1517083097u, 355290910u, 204897887u, 656092572u, 1040194781u, 3113746450u,
+    2692952403u, 2343461520u, 2461357009u, 3723805974u, 3304059991u,
+    4022511508u, 4141455061u, 2919742697u, 3072101800u, 2620513899u,
+    2234183466u, 3396041197u, 3547351212u, 4166851439u, 3779471918u,
+    1725839073u, 2143618976u, 1424512099u, 1307796770u, 45282277u, 464110244u,
+    813994343u, 698327078u, 3838160568u, 4259225593u, 3606301754u, 3488152955u,
+    2158586812u, 2578602749u, 2996767038u, 2877569151u, 740041904u, 889656817u,
+    506086962u, 120682355u, 1215357364u, 1366020341u, 2051441462u, 1667084919u,
+    3422213966u, 3538019855u, 4190942668u, 3772220557u, 2945847882u,
+    3062702859u, 2644537544u, 2226864521u, 52649286u, 439905287u, 823476164u,
+    672009861u, 1733269570u, 2119477507u, 1434057408u, 1281543041u, 2167981343u,
+    2552493150u, 3004082077u, 2853541596u, 3847487515u, 4233048410u,
+    3613549209u, 3464057816u, 1239502615u, 1358593622u, 2077699477u,
+    1657543892u, 764250643u, 882293586u, 532408465u, 111204816u, 1585378284u,
+    1197851309u, 1816695150u, 1968414767u, 974272232u, 587794345u, 136598634u,
+    289367339u, 2527558116u, 2411481253u, 2760973158u, 3179948583u, 4073438432u,
+    3956313505u, 3237863010u, 3655790371u, 347922877u, 229101820u, 646611775u,
+    1066513022u, 1892689081u, 1774917112u, 1122387515u, 1543337850u,
+    3697634229u, 3313392372u, 3998419255u, 4148705398u, 3087642289u,
+    2702352368u, 2319436851u, 2468674930u
+  },
+  {
+    0u, 29518391u, 59036782u, 38190681u, 118073564u, 114017003u, 76381362u,
+    89069189u, 236147128u, 265370511u, 228034006u, 206958561u, 152762724u,
+    148411219u, 178138378u, 190596925u, 472294256u, 501532999u, 530741022u,
+    509615401u, 456068012u, 451764635u, 413917122u, 426358261u, 305525448u,
+    334993663u, 296822438u, 275991697u, 356276756u, 352202787u, 381193850u,
+    393929805u, 944588512u, 965684439u, 1003065998u, 973863097u, 1061482044u,
+    1049003019u, 1019230802u, 1023561829u, 912136024u, 933002607u, 903529270u,
+    874031361u, 827834244u, 815125939u, 852716522u, 856752605u, 611050896u,
+    631869351u, 669987326u, 640506825u, 593644876u, 580921211u, 551983394u,
+    556069653u, 712553512u, 733666847u, 704405574u, 675154545u, 762387700u,
+    749958851u, 787859610u, 792175277u, 1889177024u, 1901651959u, 1931368878u,
+    1927033753u, 2006131996u, 1985040171u, 1947726194u, 1976933189u,
+    2122964088u, 2135668303u, 2098006038u, 2093965857u, 2038461604u,
+    2017599123u, 2047123658u, 2076625661u, 1824272048u, 1836991623u,
+    1866005214u, 1861914857u, 1807058540u, 1786244187u, 1748062722u,
+    1777547317u, 1655668488u, 1668093247u, 1630251878u, 1625932113u,
+    1705433044u, 1684323811u, 1713505210u, 1742760333u, 1222101792u,
+    1226154263u, 1263738702u, 1251046777u, 1339974652u, 1310460363u,
+    1281013650u, 1301863845u, 1187289752u, 1191637167u, 1161842422u,
+    1149379777u, 1103966788u, 1074747507u, 1112139306u, 1133218845u,
+    1425107024u, 1429406311u, 1467333694u, 1454888457u, 1408811148u,
+    1379576507u, 1350309090u, 1371438805u, 1524775400u, 1528845279u,
+    1499917702u, 1487177649u, 1575719220u, 1546255107u, 1584350554u,
+    1605185389u, 3778354048u, 3774312887u, 3803303918u, 3816007129u,
+    3862737756u, 3892238699u, 3854067506u, 3833203973u, 4012263992u,
+    4007927823u, 3970080342u, 3982554209u, 3895452388u, 3924658387u,
+    3953866378u, 3932773565u, 4245928176u, 4241609415u, 4271336606u,
+    4283762345u, 4196012076u, 4225268251u, 4187931714u, 4166823541u,
+    4076923208u, 4072833919u, 4035198246u, 4047918865u, 4094247316u,
+    4123732899u, 4153251322u, 4132437965u, 3648544096u, 3636082519u,
+    3673983246u, 3678331705u, 3732010428u, 3753090955u, 3723829714u,
+    3694611429u, 3614117080u, 3601426159u, 3572488374u, 3576541825u,
+    3496125444u, 3516976691u, 3555094634u, 3525581405u, 3311336976u,
+    3298595879u, 3336186494u, 3340255305u, 3260503756u, 3281337595u,
+    3251864226u, 3222399125u, 3410866088u, 3398419871u, 3368647622u,
+    3372945905u, 3427010420u, 3448139075u, 3485520666u, 3456284973u,
+    2444203584u, 2423127159u, 2452308526u, 2481530905u, 2527477404u,
+    2539934891u, 2502093554u, 2497740997u, 2679949304u, 2659102159u,
+    2620920726u, 2650438049u, 2562027300u, 2574714131u, 2603727690u,
+    2599670141u, 2374579504u, 2353749767u, 2383274334u, 2412743529u,
+    2323684844u, 2336421851u, 2298759554u, 2294686645u, 2207933576u,
+    2186809023u, 2149495014u, 2178734801u, 2224278612u, 2236720739u,
+    2266437690u, 2262135309u, 2850214048u, 2820717207u, 2858812622u,
+    2879680249u, 2934667388u, 2938704459u, 2909776914u, 2897069605u,
+    2817622296u, 2788420399u, 2759153014u, 2780249921u, 2700618180u,
+    2704950259u, 2742877610u, 2730399645u, 3049550800u, 3020298727u,
+    3057690558u, 3078802825u, 2999835404u, 3004150075u, 2974355298u,
+    2961925461u, 3151438440u, 3121956959u, 3092510214u, 3113327665u,
+    3168701108u, 3172786307u, 3210370778u, 3197646061u
+  },
+  {
+    0u, 3099354981u, 2852767883u, 313896942u, 2405603159u, 937357362u,
+    627793884u, 2648127673u, 3316918511u, 2097696650u, 1874714724u, 3607201537u,
+    1255587768u, 4067088605u, 3772741427u, 1482887254u, 1343838111u,
+    3903140090u, 4195393300u, 1118632049u, 3749429448u, 1741137837u,
+    1970407491u, 3452858150u, 2511175536u, 756094997u, 1067759611u, 2266550430u,
+    449832999u, 2725482306u, 2965774508u, 142231497u, 2687676222u, 412010587u,
+    171665333u, 2995192016u, 793786473u, 2548850444u, 2237264098u, 1038456711u,
+    1703315409u, 3711623348u, 3482275674u, 1999841343u, 3940814982u,
+    1381529571u, 1089329165u, 4166106984u, 4029413537u, 1217896388u,
+    1512189994u, 3802027855u, 2135519222u, 3354724499u, 3577784189u,
+    1845280792u, 899665998u, 2367928107u, 2677414085u, 657096608u, 3137160985u,
+    37822588u, 284462994u, 2823350519u, 2601801789u, 598228824u, 824021174u,
+    2309093331u, 343330666u, 2898962447u, 3195996129u, 113467524u, 1587572946u,
+    3860600759u, 4104763481u, 1276501820u, 3519211397u, 1769898208u,
+    2076913422u, 3279374443u, 3406630818u, 1941006535u, 1627703081u,
+    3652755532u, 1148164341u, 4241751952u, 3999682686u, 1457141531u, 247015245u,
+    3053797416u, 2763059142u, 470583459u, 2178658330u, 963106687u, 735213713u,
+    2473467892u, 992409347u, 2207944806u, 2435792776u, 697522413u, 3024379988u,
+    217581361u, 508405983u, 2800865210u, 4271038444u, 1177467017u, 1419450215u,
+    3962007554u, 1911572667u, 3377213406u, 3690561584u, 1665525589u,
+    1799331996u, 3548628985u, 3241568279u, 2039091058u, 3831314379u,
+    1558270126u, 1314193216u, 4142438437u, 2928380019u, 372764438u, 75645176u,
+    3158189981u, 568925988u, 2572515393u, 2346768303u, 861712586u, 3982079547u,
+    1441124702u, 1196457648u, 4293663189u, 1648042348u, 3666298377u,
+    3358779879u, 1888390786u, 686661332u, 2421291441u, 2196002399u, 978858298u,
+    2811169155u, 523464422u, 226935048u, 3040519789u, 3175145892u, 100435649u,
+    390670639u, 2952089162u, 841119475u, 2325614998u, 2553003640u, 546822429u,
+    2029308235u, 3225988654u, 3539796416u, 1782671013u, 4153826844u,
+    1328167289u, 1570739863u, 3844338162u, 1298864389u, 4124540512u,
+    3882013070u, 1608431339u, 3255406162u, 2058742071u, 1744848601u,
+    3501990332u, 2296328682u, 811816591u, 584513889u, 2590678532u, 129869501u,
+    3204563416u, 2914283062u, 352848211u, 494030490u, 2781751807u, 3078325777u,
+    264757620u, 2450577869u, 715964072u, 941166918u, 2158327331u, 3636881013u,
+    1618608400u, 1926213374u, 3396585883u, 1470427426u, 4011365959u,
+    4255988137u, 1158766284u, 1984818694u, 3471935843u, 3695453837u,
+    1693991400u, 4180638033u, 1100160564u, 1395044826u, 3952793279u,
+    3019491049u, 189112716u, 435162722u, 2706139399u, 1016811966u, 2217162459u,
+    2526189877u, 774831696u, 643086745u, 2666061564u, 2354934034u, 887166583u,
+    2838900430u, 294275499u, 54519365u, 3145957664u, 3823145334u, 1532818963u,
+    1240029693u, 4048895640u, 1820460577u, 3560857924u, 3331051178u,
+    2117577167u, 3598663992u, 1858283101u, 2088143283u, 3301633750u,
+    1495127663u, 3785470218u, 4078182116u, 1269332353u, 332098007u, 2876706482u,
+    3116540252u, 25085497u, 2628386432u, 605395429u, 916469259u, 2384220526u,
+    2254837415u, 1054503362u, 745528876u, 2496903497u, 151290352u, 2981684885u,
+    2735556987u, 464596510u, 1137851976u, 4218313005u, 3923506883u, 1365741990u,
+    3434129695u, 1946996346u, 1723425172u, 3724871409u
+  },
+  {
+    0u, 1029712304u, 2059424608u, 1201699536u, 4118849216u, 3370159984u,
+    2403399072u, 2988497936u, 812665793u, 219177585u, 1253054625u, 2010132753u,
+    3320900865u, 4170237105u, 3207642721u, 2186319825u, 1625331586u,
+    1568718386u, 438355170u, 658566482u, 2506109250u, 2818578674u, 4020265506u,
+    3535817618u, 1351670851u, 1844508147u, 709922595u, 389064339u, 2769320579u,
+    2557498163u, 3754961379u, 3803185235u, 3250663172u, 4238411444u,
+    3137436772u, 2254525908u, 876710340u, 153198708u, 1317132964u, 1944187668u,
+    4054934725u, 3436268917u, 2339452837u, 3054575125u, 70369797u, 961670069u,
+    2129760613u, 1133623509u, 2703341702u, 2621542710u, 3689016294u,
+    3867263574u, 1419845190u, 1774270454u, 778128678u, 318858390u, 2438067015u,
+    2888948471u, 3952189479u, 3606153623u, 1691440519u, 1504803895u, 504432359u,
+    594620247u, 1492342857u, 1704161785u, 573770537u, 525542041u, 2910060169u,
+    2417219385u, 3618876905u, 3939730521u, 1753420680u, 1440954936u, 306397416u,
+    790849880u, 2634265928u, 2690882808u, 3888375336u, 3668168600u, 940822475u,
+    91481723u, 1121164459u, 2142483739u, 3448989963u, 4042473659u, 3075684971u,
+    2318603227u, 140739594u, 889433530u, 1923340138u, 1338244826u, 4259521226u,
+    3229813626u, 2267247018u, 3124975642u, 2570221389u, 2756861693u,
+    3824297005u, 3734113693u, 1823658381u, 1372780605u, 376603373u, 722643805u,
+    2839690380u, 2485261628u, 3548540908u, 4007806556u, 1556257356u,
+    1638052860u, 637716780u, 459464860u, 4191346895u, 3300051327u, 2199040943u,
+    3195181599u, 206718479u, 825388991u, 1989285231u, 1274166495u, 3382881038u,
+    4106388158u, 3009607790u, 2382549470u, 1008864718u, 21111934u, 1189240494u,
+    2072147742u, 2984685714u, 2357631266u, 3408323570u, 4131834434u,
+    1147541074u, 2030452706u, 1051084082u, 63335554u, 2174155603u, 3170292451u,
+    4216760371u, 3325460867u, 1947622803u, 1232499747u, 248909555u, 867575619u,
+    3506841360u, 3966111392u, 2881909872u, 2527485376u, 612794832u, 434546784u,
+    1581699760u, 1663499008u, 3782634705u, 3692447073u, 2612412337u,
+    2799048193u, 351717905u, 697754529u, 1849071985u, 1398190273u, 1881644950u,
+    1296545318u, 182963446u, 931652934u, 2242328918u, 3100053734u, 4284967478u,
+    3255255942u, 1079497815u, 2100821479u, 983009079u, 133672583u, 3050795671u,
+    2293717799u, 3474399735u, 4067887175u, 281479188u, 765927844u, 1778867060u,
+    1466397380u, 3846680276u, 3626469220u, 2676489652u, 2733102084u, 548881365u,
+    500656741u, 1517752501u, 1729575173u, 3577210133u, 3898068133u, 2952246901u,
+    2459410373u, 3910527195u, 3564487019u, 2480257979u, 2931134987u, 479546907u,
+    569730987u, 1716854139u, 1530213579u, 3647316762u, 3825568426u, 2745561210u,
+    2663766474u, 753206746u, 293940330u, 1445287610u, 1799716618u, 2314567513u,
+    3029685993u, 4080348217u, 3461678473u, 2088098201u, 1091956777u, 112560889u,
+    1003856713u, 3112514712u, 2229607720u, 3276105720u, 4263857736u,
+    1275433560u, 1902492648u, 918929720u, 195422344u, 685033439u, 364179055u,
+    1377080511u, 1869921551u, 3713294623u, 3761522863u, 2811507327u,
+    2599689167u, 413436958u, 633644462u, 1650777982u, 1594160846u, 3978570462u,
+    3494118254u, 2548332990u, 2860797966u, 1211387997u, 1968470509u, 854852413u,
+    261368461u, 3182753437u, 2161434413u, 3346310653u, 4195650637u, 2017729436u,
+    1160000044u, 42223868u, 1071931724u, 2378480988u, 2963576044u, 4144295484u,
+    3395602316u
+  },
+  {
+    0u, 3411858341u, 1304994059u, 2257875630u, 2609988118u, 1355649459u,
+    3596215069u, 486879416u, 3964895853u, 655315400u, 2711298918u, 1791488195u,
+    2009251963u, 3164476382u, 973758832u, 4048990933u, 64357019u, 3364540734u,
+    1310630800u, 2235723829u, 2554806413u, 1394316072u, 3582976390u, 517157411u,
+    4018503926u, 618222419u, 2722963965u, 1762783832u, 1947517664u, 3209171269u,
+    970744811u, 4068520014u, 128714038u, 3438335635u, 1248109629u, 2167961496u,
+    2621261600u, 1466012805u, 3522553387u, 447296910u, 3959392091u, 547575038u,
+    2788632144u, 1835791861u, 1886307661u, 3140622056u, 1034314822u,
+    4143626211u, 75106221u, 3475428360u, 1236444838u, 2196665603u, 2682996155u,
+    1421317662u, 3525567664u, 427767573u, 3895035328u, 594892389u, 2782995659u,
+    1857943406u, 1941489622u, 3101955187u, 1047553757u, 4113347960u, 257428076u,
+    3288652233u, 1116777319u, 2311878850u, 2496219258u, 1603640287u,
+    3640781169u, 308099796u, 3809183745u, 676813732u, 2932025610u, 1704983215u,
+    2023410199u, 3016104370u, 894593820u, 4262377657u, 210634999u, 3352484690u,
+    1095150076u, 2316991065u, 2535410401u, 1547934020u, 3671583722u, 294336591u,
+    3772615322u, 729897279u, 2903845777u, 1716123700u, 2068629644u, 2953845545u,
+    914647431u, 4258839074u, 150212442u, 3282623743u, 1161604689u, 2388688372u,
+    2472889676u, 1480171241u, 3735940167u, 368132066u, 3836185911u, 805002898u,
+    2842635324u, 1647574937u, 2134298401u, 3026852996u, 855535146u, 4188192143u,
+    186781121u, 3229539940u, 1189784778u, 2377547631u, 2427670487u, 1542429810u,
+    3715886812u, 371670393u, 3882979244u, 741170185u, 2864262823u, 1642462466u,
+    2095107514u, 3082559007u, 824732849u, 4201955092u, 514856152u, 3589064573u,
+    1400419795u, 2552522358u, 2233554638u, 1316849003u, 3370776517u, 62202976u,
+    4075001525u, 968836368u, 3207280574u, 1954014235u, 1769133219u, 2720925446u,
+    616199592u, 4024870413u, 493229635u, 3594175974u, 1353627464u, 2616354029u,
+    2264355925u, 1303087088u, 3409966430u, 6498043u, 4046820398u, 979978123u,
+    3170710821u, 2007099008u, 1789187640u, 2717386141u, 661419827u, 3962610838u,
+    421269998u, 3527459403u, 1423225061u, 2676515648u, 2190300152u, 1238466653u,
+    3477467891u, 68755798u, 4115633027u, 1041448998u, 3095868040u, 1943789869u,
+    1860096405u, 2776760880u, 588673182u, 3897205563u, 449450869u, 3516317904u,
+    1459794558u, 2623431131u, 2170245475u, 1242006214u, 3432247400u, 131015629u,
+    4137259288u, 1036337853u, 3142660115u, 1879958454u, 1829294862u,
+    2790523051u, 549483013u, 3952910752u, 300424884u, 3669282065u, 1545650111u,
+    2541513754u, 2323209378u, 1092980487u, 3350330793u, 216870412u, 4256931033u,
+    921128828u, 2960342482u, 2066738807u, 1714085583u, 2910195050u, 736264132u,
+    3770592353u, 306060335u, 3647131530u, 1610005796u, 2494197377u, 2309971513u,
+    1123257756u, 3295149874u, 255536279u, 4268596802u, 892423655u, 3013951305u,
+    2029645036u, 1711070292u, 2929725425u, 674528607u, 3815288570u, 373562242u,
+    3709388839u, 1535949449u, 2429577516u, 2379569556u, 1183418929u,
+    3223189663u, 188820282u, 4195850735u, 827017802u, 3084859620u, 2089020225u,
+    1636228089u, 2866415708u, 743340786u, 3876759895u, 361896217u, 3738094268u,
+    1482340370u, 2466671543u, 2382584591u, 1163888810u, 3284924932u, 144124321u,
+    4190215028u, 849168593u, 3020503679u, 2136336858u, 1649465698u, 2836138695u,
+    798521449u, 3838094284u
+  },
+  {
+    0u, 2792819636u, 2543784233u, 837294749u, 4098827283u, 1379413927u,
+    1674589498u, 3316072078u, 871321191u, 2509784531u, 2758827854u, 34034938u,
+    3349178996u, 1641505216u, 1346337629u, 4131942633u, 1742642382u,
+    3249117050u, 4030828007u, 1446413907u, 2475800797u, 904311657u, 68069876u,
+    2725880384u, 1412551337u, 4064729373u, 3283010432u, 1708771380u,
+    2692675258u, 101317902u, 937551763u, 2442587175u, 3485284764u, 1774858792u,
+    1478633653u, 4266992385u, 1005723023u, 2642744891u, 2892827814u, 169477906u,
+    4233263099u, 1512406095u, 1808623314u, 3451546982u, 136139752u, 2926205020u,
+    2676114113u, 972376437u, 2825102674u, 236236518u, 1073525883u, 2576072655u,
+    1546420545u, 4200303349u, 3417542760u, 1841601500u, 2609703733u,
+    1039917185u, 202635804u, 2858742184u, 1875103526u, 3384067218u, 4166835727u,
+    1579931067u, 1141601657u, 3799809741u, 3549717584u, 1977839588u,
+    2957267306u, 372464350u, 668680259u, 2175552503u, 2011446046u, 3516084394u,
+    3766168119u, 1175200131u, 2209029901u, 635180217u, 338955812u, 2990736784u,
+    601221559u, 2242044419u, 3024812190u, 306049834u, 3617246628u, 1911408144u,
+    1074125965u, 3866285881u, 272279504u, 3058543716u, 2275784441u, 567459149u,
+    3832906691u, 1107462263u, 1944752874u, 3583875422u, 2343980261u, 767641425u,
+    472473036u, 3126744696u, 2147051766u, 3649987394u, 3899029983u, 1309766251u,
+    3092841090u, 506333494u, 801510315u, 2310084639u, 1276520081u, 3932237093u,
+    3683203000u, 2113813516u, 3966292011u, 1243601823u, 2079834370u,
+    3716205238u, 405271608u, 3192979340u, 2411259153u, 701492901u, 3750207052u,
+    2045810168u, 1209569125u, 4000285905u, 734575199u, 2378150379u, 3159862134u,
+    438345922u, 2283203314u, 778166598u, 529136603u, 3120492655u, 2086260449u,
+    3660498261u, 3955679176u, 1303499900u, 3153699989u, 495890209u, 744928700u,
+    2316418568u, 1337360518u, 3921775410u, 3626602927u, 2120129051u,
+    4022892092u, 1237286280u, 2018993941u, 3726666913u, 461853231u, 3186645403u,
+    2350400262u, 711936178u, 3693557851u, 2052076527u, 1270360434u, 3989775046u,
+    677911624u, 2384402428u, 3220639073u, 427820757u, 1202443118u, 3789347034u,
+    3493118535u, 1984154099u, 3018127229u, 362020041u, 612099668u, 2181885408u,
+    1950653705u, 3526596285u, 3822816288u, 1168934804u, 2148251930u, 645706414u,
+    395618355u, 2984485767u, 544559008u, 2248295444u, 3085590153u, 295523645u,
+    3560598451u, 1917673479u, 1134918298u, 3855773998u, 328860103u, 3052210803u,
+    2214924526u, 577903450u, 3889505748u, 1101147744u, 1883911421u, 3594338121u,
+    3424493451u, 1785369663u, 1535282850u, 4260726038u, 944946072u, 2653270060u,
+    2949491377u, 163225861u, 4294103532u, 1501944408u, 1752023237u, 3457862513u,
+    196998655u, 2915761739u, 2619532502u, 978710370u, 2881684293u, 229902577u,
+    1012666988u, 2586515928u, 1603020630u, 4193987810u, 3356702335u,
+    1852063179u, 2553040162u, 1046169238u, 263412747u, 2848217023u, 1818454321u,
+    3390333573u, 4227627032u, 1569420204u, 60859927u, 2782375331u, 2487203646u,
+    843627658u, 4159668740u, 1368951216u, 1617990445u, 3322386585u, 810543216u,
+    2520310724u, 2815490393u, 27783917u, 3288386659u, 1652017111u, 1402985802u,
+    4125677310u, 1685994201u, 3255382381u, 4091620336u, 1435902020u,
+    2419138250u, 910562686u, 128847843u, 2715354199u, 1469150398u, 4058414858u,
+    3222168983u, 1719234083u, 2749255853u, 94984985u, 876691844u, 2453031472u
+  },
+  {
+    0u, 3433693342u, 1109723005u, 2391738339u, 2219446010u, 1222643300u,
+    3329165703u, 180685081u, 3555007413u, 525277995u, 2445286600u, 1567235158u,
+    1471092047u, 2600801745u, 361370162u, 3642757804u, 2092642603u, 2953916853u,
+    1050555990u, 4063508168u, 4176560081u, 878395215u, 3134470316u, 1987983410u,
+    2942184094u, 1676945920u, 3984272867u, 567356797u, 722740324u, 3887998202u,
+    1764827929u, 2778407815u, 4185285206u, 903635656u, 3142804779u, 2012833205u,
+    2101111980u, 2979425330u, 1058630609u, 4088621903u, 714308067u, 3862526333u,
+    1756790430u, 2753330688u, 2933487385u, 1651734407u, 3975966820u, 542535930u,
+    2244825981u, 1231508451u, 3353891840u, 188896414u, 25648519u, 3442302233u,
+    1134713594u, 2399689316u, 1445480648u, 2592229462u, 336416693u, 3634843435u,
+    3529655858u, 516441772u, 2420588879u, 1559052753u, 698204909u, 3845636723u,
+    1807271312u, 2803025166u, 2916600855u, 1635634313u, 4025666410u, 593021940u,
+    4202223960u, 919787974u, 3093159461u, 1962401467u, 2117261218u, 2996361020u,
+    1008193759u, 4038971457u, 1428616134u, 2576151384u, 386135227u, 3685348389u,
+    3513580860u, 499580322u, 2471098945u, 1608776415u, 2260985971u, 1248454893u,
+    3303468814u, 139259792u, 42591881u, 3458459159u, 1085071860u, 2349261162u,
+    3505103035u, 474062885u, 2463016902u, 1583654744u, 1419882049u, 2550902495u,
+    377792828u, 3660491170u, 51297038u, 3483679632u, 1093385331u, 2374089965u,
+    2269427188u, 1273935210u, 3311514249u, 164344343u, 2890961296u, 1627033870u,
+    4000683757u, 585078387u, 672833386u, 3836780532u, 1782552599u, 2794821769u,
+    2142603813u, 3005188795u, 1032883544u, 4047146438u, 4227826911u, 928351297u,
+    3118105506u, 1970307900u, 1396409818u, 2677114180u, 287212199u, 3719594553u,
+    3614542624u, 467372990u, 2505346141u, 1509854403u, 2162073199u, 1282711281u,
+    3271268626u, 240228748u, 76845205u, 3359543307u, 1186043880u, 2317064054u,
+    796964081u, 3811226735u, 1839575948u, 2702160658u, 2882189835u, 1734392469u,
+    3924802934u, 625327592u, 4234522436u, 818917338u, 3191908409u, 1927981223u,
+    2016387518u, 3028656416u, 973776579u, 4137723485u, 2857232268u, 1726474002u,
+    3899187441u, 616751215u, 772270454u, 3803048424u, 1814228491u, 2693328533u,
+    2041117753u, 3036871847u, 999160644u, 4146592730u, 4259508931u, 826864221u,
+    3217552830u, 1936586016u, 3606501031u, 442291769u, 2496909786u, 1484378436u,
+    1388107869u, 2652297411u, 278519584u, 3694387134u, 85183762u, 3384397196u,
+    1194773103u, 2342308593u, 2170143720u, 1307820918u, 3279733909u, 265733131u,
+    2057717559u, 3054258089u, 948125770u, 4096344276u, 4276898253u, 843467091u,
+    3167309488u, 1885556270u, 2839764098u, 1709792284u, 3949353983u, 667704161u,
+    755585656u, 3785577190u, 1865176325u, 2743489947u, 102594076u, 3401021058u,
+    1144549729u, 2291298815u, 2186770662u, 1325234296u, 3228729243u, 215514885u,
+    3589828009u, 424832311u, 2547870420u, 1534552650u, 1370645331u, 2635621325u,
+    328688686u, 3745342640u, 2211456353u, 1333405183u, 3254067740u, 224338562u,
+    127544219u, 3408931589u, 1170156774u, 2299866232u, 1345666772u, 2627681866u,
+    303053225u, 3736746295u, 3565105198u, 416624816u, 2522494803u, 1525692365u,
+    4285207626u, 868291796u, 3176010551u, 1910772649u, 2065767088u, 3079346734u,
+    956571085u, 4121828691u, 747507711u, 3760459617u, 1856702594u, 2717976604u,
+    2831417605u, 1684930971u, 3940615800u, 642451174u
   }
-  Crc32_crc_table_computed = 1;
-}
+};
 
 /*Update a running CRC with the bytes buf[0..len-1]--the CRC should be
 initialized to all 1's, and the transmitted value is the 1's complement of the
 final running CRC (see the crc() routine below).*/
+#ifdef LODEPNG_USE_SSE2
+/*
+Folds len bytes, a multiple of 16 and at least 64, into the running CRC with
+carry-less multiplications, as in "Fast CRC Computation for Generic Polynomials
+Using PCLMULQDQ Instruction" (Intel, 2009). Four 128-bit lanes are folded forward
+by 64 bytes at a time, then into one lane, which is reduced to 32 bits with a
+Barrett reduction. The constants are those of the paper for the bit-reflected
+polynomial 0xedb88320.
+*/
+LODEPNG_TARGET_PCLMUL
+static unsigned Crc32_update_crc_pclmul(const unsigned char* buf, unsigned crc, size_t len)
+{
+  const __m128i k1k2 = _mm_set_epi32(0x00000001, 0xc6e41596, 0x00000001, 0x54442bd4);
+  const __m128i k3k4 = _mm_set_epi32(0x00000000, 0xccaa009e, 0x00000001, 0x751997d0);
+  const __m128i k5 = _mm_set_epi32(0, 0, 0x00000001, 0x63cd6124);
+  const __m128i poly = _mm_set_epi32(0x00000001, 0xf7011641, 0x00000001, 0xdb710641);
+  const __m128i mask32 = _mm_setr_epi32(-1, 0, -1, 0);
+  __m128i x0, x1, x2, x3, t0, t1, t2, t3;
+
+  x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)buf), _mm_cvtsi32_si128((int)crc));
+  x1 = _mm_loadu_si128((const __m128i*)(buf + 16));
+  x2 = _mm_loadu_si128((const __m128i*)(buf + 32));
+  x3 = _mm_loadu_si128((const __m128i*)(buf + 48));
+  buf += 64;
+  len -= 64;
+
+  while(len >= 64)
+  {
+    t0 = _mm_clmulepi64_si128(x0, k1k2, 0x00);
+    t1 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+    t2 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+    t3 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+    x0 = _mm_clmulepi64_si128(x0, k1k2, 0x11);
+    x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+    x0 = _mm_xor_si128(_mm_xor_si128(x0, t0), _mm_loadu_si128((const __m128i*)buf));
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, t1), _mm_loadu_si128((const __m128i*)(buf + 16)));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, t2), _mm_loadu_si128((const __m128i*)(buf + 32)));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, t3), _mm_loadu_si128((const __m128i*)(buf + 48)));
+    buf += 64;
+    len -= 64;
+  }
+
+  /*fold the four lanes into x0, then the remaining 16-byte blocks*/
+  t0 = _mm_clmulepi64_si128(x0, k3k4, 0x00);
+  x0 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x0, k3k4, 0x11), t0), x1);
+  t0 = _mm_clmulepi64_si128(x0, k3k4, 0x00);
+  x0 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x0, k3k4, 0x11), t0), x2);
+  t0 = _mm_clmulepi64_si128(x0, k3k4, 0x00);
+  x0 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x0, k3k4, 0x11), t0), x3);
+  while(len >= 16)
+  {
+    t0 = _mm_clmulepi64_si128(x0, k3k4, 0x00);
+    x0 = _mm_clmulepi64_si128(x0, k3k4, 0x11);
+    x0 = _mm_xor_si128(_mm_xor_si128(x0, t0), _mm_loadu_si128((const __m128i*)buf));
+    buf += 16;
+    len -= 16;
+  }
+
+  /*128 to 64 bits*/
+  t0 = _mm_clmulepi64_si128(x0, k3k4, 0x10);
+  x0 = _mm_xor_si128(_mm_srli_si128(x0, 8), t0);
+  t0 = _mm_srli_si128(x0, 4);
+  x0 = _mm_clmulepi64_si128(_mm_and_si128(x0, mask32), k5, 0x00);
+  x0 = _mm_xor_si128(x0, t0);
+
+  /*Barrett reduction to 32 bits*/
+  t0 = _mm_clmulepi64_si128(_mm_and_si128(x0, mask32), poly, 0x10);
+  t0 = _mm_clmulepi64_si128(_mm_and_si128(t0, mask32), poly, 0x00);
+  x0 = _mm_xor_si128(x0, t0);
+  return (unsigned)_mm_cvtsi128_si32(_mm_srli_si128(x0, 4));
+}
+#endif /*LODEPNG_USE_SSE2*/
+
 static unsigned Crc32_update_crc(const unsigned char* buf, unsigned crc, size_t len)
 {
   unsigned c = crc;
-  size_t n;
 
-  if(!Crc32_crc_table_computed) Crc32_make_crc_table();
-  for(n = 0; n < len; n++)
+#ifdef LODEPNG_USE_SSE2
+  if(len >= 64 && cpuHasPCLMUL())
+  {
+    size_t amount = len & ~(size_t)15;
+    c = Crc32_update_crc_pclmul(buf, c, amount);
+    buf += amount;
+    len -= amount;
+  }
+#endif /*LODEPNG_USE_SSE2*/
+
+  while(len >= 8)
+  {
+    c ^= buf[0] | ((unsigned)buf[1] << 8) | ((unsigned)buf[2] << 16) | ((unsigned)buf[3] << 24);
+    c = Crc32_crc_table[7][c & 0xff] ^ Crc32_crc_table[6][(c >> 8) & 0xff]
+      ^ Crc32_crc_table[5][(c >> 16) & 0xff] ^ Crc32_crc_table[4][c >> 24]
+      ^ Crc32_crc_table[3][buf[4]] ^ Crc32_crc_table[2][buf[5]]
+      ^ Crc32_crc_table[1][buf[6]] ^ Crc32_crc_table[0][buf[7]];
+    buf += 8;
+    len -= 8;
+  }
+  while(len > 0)
   {
-    c = Crc32_crc_table[(c ^ buf[n]) & 0xff] ^ (c >> 8);
+    c = Crc32_crc_table[0][(c ^ *buf++) & 0xff] ^ (c >> 8);
+    len--;
   }
   return c;
 }
@@ -3348,27 +5059,141 @@ static unsigned getPixelColorRGBA16(unsigned short* r, unsigned short* g, unsign
   return 0; /*no error*/
 }
 
+#ifdef LODEPNG_USE_SSE2
+LODEPNG_TARGET_SSSE3
+static size_t convertRGB8ToRGBA8SSSE3(unsigned char* out, const unsigned char* in, size_t numpixels)
+{
+  size_t i = 0;
+  const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i alpha = _mm_set1_epi32((int)0xff000000u);
+  /*every load reads 16 bytes for 4 pixels, stop while that stays inside the input*/
+  for(; i + 6 <= numpixels; i += 4)
+  {
+    __m128i rgb = _mm_loadu_si128((const __m128i*)&in[i * 3]);
+    _mm_storeu_si128((__m128i*)&out[i * 4], _mm_or_si128(_mm_shuffle_epi8(rgb, shuffle), alpha));
+  }
+  return i;
+}
+
+LODEPNG_TARGET_SSSE3
+static size_t convertRGBA8ToRGB8SSSE3(unsigned char* out, const unsigned char* in, size_t numpixels)
+{
+  size_t i = 0;
+  const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  /*every store writes 16 bytes for 4 pixels, the last 4 are overwritten by the next one*/
+  for(; i + 6 <= numpixels; i += 4)
+  {
+    __m128i rgba = _mm_loadu_si128((const __m128i*)&in[i * 4]);
+    _mm_storeu_si128((__m128i*)&out[i * 3], _mm_shuffle_epi8(rgba, shuffle));
+  }
+  return i;
+}
+
+static size_t convertGrey8ToRGBA8SSE2(unsigned char* out, const unsigned char* in, size_t numpixels)
+{
+  size_t i = 0;
+  const __m128i alpha = _mm_set1_epi8((char)255);
+  for(; i + 16 <= numpixels; i += 16)
+  {
+    __m128i grey = _mm_loadu_si128((const __m128i*)&in[i]);
+    __m128i gg_lo = _mm_unpacklo_epi8(grey, grey), gg_hi = _mm_unpackhi_epi8(grey, grey);
+    __m128i ga_lo = _mm_unpacklo_epi8(grey, alpha), ga_hi = _mm_unpackhi_epi8(grey, alpha);
+    _mm_storeu_si128((__m128i*)&out[i * 4 + 0], _mm_unpacklo_epi16(gg_lo, ga_lo));
+    _mm_storeu_si128((__m128i*)&out[i * 4 + 16], _mm_unpackhi_epi16(gg_lo, ga_lo));
+    _mm_storeu_si128((__m128i*)&out[i * 4 + 32], _mm_unpacklo_epi16(gg_hi, ga_hi));
+    _mm_storeu_si128((__m128i*)&out[i * 4 + 48], _mm_unpackhi_epi16(gg_hi, ga_hi));
+  }
+  return i;
+}
+#endif /*LODEPNG_USE_SSE2*/
+
 /*
-converts from any color type to 24-bit or 32-bit (later maybe more supported). return value = LodePNG error code
-the out buffer must have (w * h * bpp + 7) / 8 bytes, where bpp is the bits per pixel of the output color type
-(lodepng_get_bpp) for < 8 bpp images, there may _not_ be padding bits at the end of scanlines.
+Converts the most common pairs of 8-bit color types without a color key: RGB
+to RGBA, RGBA to RGB, palette to RGBA and grey to RGBA. Returns 0 if it
+converted the pixels, 1 if the pair is not one of those, or an error code.
+The SIMD kernels convert the bulk of the pixels, the loops the remainder.
 */
-unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
-                         LodePNGColorMode* mode_out, LodePNGColorMode* mode_in,
-                         unsigned w, unsigned h)
+static unsigned convertPixelsFast(unsigned char* out, const unsigned char* in,
+                                  const LodePNGColorMode* mode_out, const LodePNGColorMode* mode_in,
+                                  size_t numpixels, int ssse3)
+{
+  size_t i = 0;
+  if(mode_out->bitdepth != 8 || mode_in->bitdepth != 8 || mode_in->key_defined) return 1;
+  (void)ssse3;
+
+  if(mode_in->colortype == LCT_RGB && mode_out->colortype == LCT_RGBA)
+  {
+#ifdef LODEPNG_USE_SSE2
+    if(ssse3) i = convertRGB8ToRGBA8SSSE3(out, in, numpixels);
+#endif /*LODEPNG_USE_SSE2*/
+    for(; i < numpixels; i++)
+    {
+      out[i * 4 + 0] = in[i * 3 + 0];
+      out[i * 4 + 1] = in[i * 3 + 1];
+      out[i * 4 + 2] = in[i * 3 + 2];
+      out[i * 4 + 3] = 255;
+    }
+  }
+  else if(mode_in->colortype == LCT_RGBA && mode_out->colortype == LCT_RGB)
+  {
+#ifdef LODEPNG_USE_SSE2
+    if(ssse3) i = convertRGBA8ToRGB8SSSE3(out, in, numpixels);
+#endif /*LODEPNG_USE_SSE2*/
+    for(; i < numpixels; i++)
+    {
+      out[i * 3 + 0] = in[i * 4 + 0];
+      out[i * 3 + 1] = in[i * 4 + 1];
+      out[i * 3 + 2] = in[i * 4 + 2];
+    }
+  }
+  else if(mode_in->colortype == LCT_PALETTE && mode_out->colortype == LCT_RGBA)
+  {
+    /*the palette is stored as RGBA already, copy whole entries*/
+    for(; i < numpixels; i++)
+    {
+      if(in[i] >= mode_in->palettesize) return 47; /*index out of palette*/
+      memcpy(&out[i * 4], &mode_in->palette[in[i] * 4], 4);
+    }
+  }
+  else if(mode_in->colortype == LCT_GREY && mode_out->colortype == LCT_RGBA)
+  {
+#ifdef LODEPNG_USE_SSE2
+    i = convertGrey8ToRGBA8SSE2(out, in, numpixels);
+#endif /*LODEPNG_USE_SSE2*/
+    for(; i < numpixels; i++)
+    {
+      out[i * 4 + 0] = out[i * 4 + 1] = out[i * 4 + 2] = in[i];
+      out[i * 4 + 3] = 255;
+    }
+  }
+  else return 1;
+
+  return 0;
+}
+
+/*
+converts numpixels pixels, see lodepng_convert. Since pixels of less than 8
+bits are packed, converting a part of an image must start at a byte.
+*/
+static unsigned convertPixels(unsigned char* out, const unsigned char* in,
+                              const LodePNGColorMode* mode_out, const LodePNGColorMode* mode_in,
+                              size_t numpixels, int ssse3)
 {
   unsigned error = 0;
   size_t i;
   ColorTree tree;
-  size_t numpixels = w * h;
 
   if(lodepng_color_mode_equal(mode_out, mode_in))
   {
-    size_t numbytes = lodepng_get_raw_size(w, h, mode_in);
-    for(i = 0; i < numbytes; i++) out[i] = in[i];
+    size_t numbytes = (numpixels * lodepng_get_bpp(mode_in) + 7) / 8;
+    memcpy(out, in, numbytes);
     return error;
   }
 
+  error = convertPixelsFast(out, in, mode_out, mode_in, numpixels, ssse3);
+  if(error != 1) return error;
+  error = 0;
+
   if(mode_out->colortype == LCT_PALETTE)
   {
     size_t palsize = 1 << mode_out->bitdepth;
@@ -3376,7 +5201,7 @@ unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
     color_tree_init(&tree);
     for(i = 0; i < palsize; i++)
     {
-      unsigned char* p = &mode_out->palette[i * 4];
+      const unsigned char* p = &mode_out->palette[i * 4];
       color_tree_add(&tree, p[0], p[1], p[2], p[3], i);
     }
   }
@@ -3420,6 +5245,22 @@ unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
   return error;
 }
 
+/*
+converts from any color type to 24-bit or 32-bit (later maybe more supported). return value = LodePNG error code
+the out buffer must have (w * h * bpp + 7) / 8 bytes, where bpp is the bits per pixel of the output color type
+(lodepng_get_bpp) for < 8 bpp images, there may _not_ be padding bits at the end of scanlines.
+*/
+unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
+                         LodePNGColorMode* mode_out, LodePNGColorMode* mode_in,
+                         unsigned w, unsigned h)
+{
+  int ssse3 = 0;
+#ifdef LODEPNG_USE_SSE2
+  ssse3 = cpuHasSSSE3();
+#endif /*LODEPNG_USE_SSE2*/
+  return convertPixels(out, in, mode_out, mode_in, (size_t)w * h, ssse3);
+}
+
 #ifdef LODEPNG_COMPILE_ENCODER
 
 typedef struct ColorProfile
@@ -3840,6 +5681,18 @@ static unsigned char paethPredictor(short a, short b, short c)
   else return (unsigned char)a;
 }
 
+#ifdef LODEPNG_USE_SSE2
+/*picks a, b or c with the same tie breaking as paethPredictor, on 16-bit lanes*/
+static __m128i paethSelect(__m128i a, __m128i b, __m128i c, __m128i pa, __m128i pb, __m128i pc)
+{
+  __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+  __m128i isb = _mm_cmpeq_epi16(smallest, pb);
+  __m128i bc = _mm_or_si128(_mm_and_si128(isb, b), _mm_andnot_si128(isb, c));
+  __m128i isa = _mm_cmpeq_epi16(smallest, pa);
+  return _mm_or_si128(_mm_and_si128(isa, a), _mm_andnot_si128(isa, bc));
+}
+#endif /*LODEPNG_USE_SSE2*/
+
 /*shared values used by multiple Adam7 related functions*/
 
 static const unsigned ADAM7_IX[7] = { 0, 4, 0, 2, 0, 1, 0 }; /*x start values*/
@@ -3954,8 +5807,129 @@ unsigned lodepng_inspect(unsigned* w, unsigned* h, LodePNGState* state,
   return state->error;
 }
 
+#ifdef LODEPNG_USE_SSE2
+
+/*
+The kernels below unfilter scanlines of 3 or 4 byte pixels one pixel per
+iteration, since every pixel depends on the one to its left. A pixel is
+loaded into the low bytes of a register; loads and stores touch exactly
+bytewidth bytes, so recon and scanline may still be the same memory.
+*/
+static __m128i loadPixel(const unsigned char* p, size_t bytewidth)
+{
+  int v;
+  if(bytewidth == 4) memcpy(&v, p, 4);
+  else v = p[0] | (p[1] << 8) | (p[2] << 16);
+  return _mm_cvtsi32_si128(v);
+}
+
+static void storePixel(unsigned char* p, __m128i pixel, size_t bytewidth)
+{
+  int v = _mm_cvtsi128_si32(pixel);
+  if(bytewidth == 4) memcpy(p, &v, 4);
+  else
+  {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+  }
+}
+
+static void unfilterSubSSE2(unsigned char* recon, const unsigned char* scanline, size_t bytewidth, size_t length)
+{
+  size_t i;
+  __m128i a = _mm_setzero_si128();
+  for(i = 0; i < length; i += bytewidth)
+  {
+    a = _mm_add_epi8(loadPixel(&scanline[i], bytewidth), a);
+    storePixel(&recon[i], a, bytewidth);
+  }
+}
+
+static void unfilterAverageSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                size_t bytewidth, size_t length)
+{
+  size_t i;
+  const __m128i one = _mm_set1_epi8(1);
+  __m128i a = _mm_setzero_si128();
+  for(i = 0; i < length; i += bytewidth)
+  {
+    __m128i b = loadPixel(&precon[i], bytewidth);
+    /*_mm_avg_epu8 rounds up, the filter rounds down*/
+    __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+    a = _mm_add_epi8(loadPixel(&scanline[i], bytewidth), average);
+    storePixel(&recon[i], a, bytewidth);
+  }
+}
+
+static void unfilterPaethSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                              size_t bytewidth, size_t length)
+{
+  size_t i;
+  const __m128i zero = _mm_setzero_si128();
+  __m128i a = zero, c = zero;
+  for(i = 0; i < length; i += bytewidth)
+  {
+    __m128i b = _mm_unpacklo_epi8(loadPixel(&precon[i], bytewidth), zero);
+    __m128i pa = _mm_sub_epi16(b, c);
+    __m128i pb = _mm_sub_epi16(a, c);
+    __m128i pc = _mm_add_epi16(pa, pb);
+    /*absolute values as max(x, -x)*/
+    pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+    pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+    pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+    /*adding bytes keeps the high byte of every lane zero*/
+    a = _mm_add_epi8(paethSelect(a, b, c, pa, pb, pc), _mm_unpacklo_epi8(loadPixel(&scanline[i], bytewidth), zero));
+    storePixel(&recon[i], _mm_packus_epi16(a, a), bytewidth);
+    c = b;
+  }
+}
+
+LODEPNG_TARGET_SSSE3
+static void unfilterPaethSSSE3(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                               size_t bytewidth, size_t length)
+{
+  size_t i;
+  const __m128i zero = _mm_setzero_si128();
+  __m128i a = zero, c = zero;
+  for(i = 0; i < length; i += bytewidth)
+  {
+    __m128i b = _mm_unpacklo_epi8(loadPixel(&precon[i], bytewidth), zero);
+    __m128i pa = _mm_sub_epi16(b, c);
+    __m128i pb = _mm_sub_epi16(a, c);
+    __m128i pc = _mm_add_epi16(pa, pb);
+    pa = _mm_abs_epi16(pa);
+    pb = _mm_abs_epi16(pb);
+    pc = _mm_abs_epi16(pc);
+    a = _mm_add_epi8(paethSelect(a, b, c, pa, pb, pc), _mm_unpacklo_epi8(loadPixel(&scanline[i], bytewidth), zero));
+    storePixel(&recon[i], _mm_packus_epi16(a, a), bytewidth);
+    c = b;
+  }
+}
+
+/*
+unfilters a scanline of 3 or 4 byte pixels with the SIMD kernels if they
+handle its filter type. Returns 0 if the portable code must do it.
+*/
+static int unfilterScanlineSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                size_t bytewidth, unsigned char filterType, size_t length, int ssse3)
+{
+  if(bytewidth != 3 && bytewidth != 4) return 0;
+  if(filterType == 1) unfilterSubSSE2(recon, scanline, bytewidth, length);
+  else if(filterType == 3 && precon) unfilterAverageSSE2(recon, scanline, precon, bytewidth, length);
+  else if(filterType == 4 && precon && ssse3) unfilterPaethSSSE3(recon, scanline, precon, bytewidth, length);
+  else if(filterType == 4 && precon) unfilterPaethSSE2(recon, scanline, precon, bytewidth, length);
+  else return 0;
+  return 1;
+}
+
+#endif /*LODEPNG_USE_SSE2*/
+
+/*
+ssse3 tells whether the cpu supports SSSE3, it is ignored without LODEPNG_USE_SSE2
+*/
 static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
-                                 size_t bytewidth, unsigned char filterType, size_t length)
+                                 size_t bytewidth, unsigned char filterType, size_t length, int ssse3)
 {
   /*
   For PNG filter method 0
@@ -3967,6 +5941,11 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
   */
 
   size_t i;
+#ifdef LODEPNG_USE_SSE2
+  if(unfilterScanlineSSE2(recon, scanline, precon, bytewidth, filterType, length, ssse3)) return 0;
+#else
+  (void)ssse3;
+#endif /*LODEPNG_USE_SSE2*/
   switch(filterType)
   {
     case 0:
@@ -4040,18 +6019,24 @@ static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w
 
   unsigned y;
   unsigned char* prevline = 0;
+  int ssse3 = 0;
 
   /*bytewidth is used for filtering, is 1 when bpp < 8, number of bytes per pixel otherwise*/
   size_t bytewidth = (bpp + 7) / 8;
   size_t linebytes = (w * bpp + 7) / 8;
 
+#ifdef LODEPNG_USE_SSE2
+  ssse3 = cpuHasSSSE3();
+#endif /*LODEPNG_USE_SSE2*/
+
   for(y = 0; y < h; y++)
   {
     size_t outindex = linebytes * y;
     size_t inindex = (1 + linebytes) * y; /*the extra filterbyte added to each row*/
     unsigned char filterType = in[inindex];
 
-    CERROR_TRY_RETURN(unfilterScanline(&out[outindex], &in[inindex + 1], prevline, bytewidth, filterType, linebytes));
+    CERROR_TRY_RETURN(unfilterScanline(&out[outindex], &in[inindex + 1], prevline, bytewidth, filterType, linebytes,
+                                        ssse3));
 
     prevline = &out[outindex];
   }
@@ -4060,20 +6045,58 @@ static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w
 }
 
 /*
-in: Adam7 interlaced image, with no padding bits between scanlines, but between
- reduced images so that each reduced image starts at a byte.
-out: the same pixels, but re-ordered so that they're now a non-interlaced image with size w*h
-bpp: bits per pixel
-out has the following size in bits: w * h * bpp.
-in is possibly bigger due to padding bits between reduced images.
-out must be big enough AND must be 0 everywhere if bpp < 8 in the current implementation
-(because that's likely a little bit faster)
-NOTE: comments about padding bits are only relevant if bpp < 8
+Like unfilter, but converts every scanline to the color type of mode_out as soon
+as it is unfiltered, so that the image in the PNG's color type is never stored
+whole. The scanlines are unfiltered in place in the in buffer, out gets the
+converted image. mode_out must not be a palette or have less than 8 bits per pixel.
 */
-static void Adam7_deinterlace(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp)
+static unsigned unfilterAndConvert(unsigned char* out, unsigned char* in, unsigned w, unsigned h,
+                                   const LodePNGColorMode* mode_out, const LodePNGColorMode* mode_in)
 {
-  unsigned passw[7], passh[7];
-  size_t filter_passstart[8], padded_passstart[8], passstart[8];
+  unsigned y;
+  unsigned char* prevline = 0;
+  int ssse3 = 0;
+
+  unsigned bpp = lodepng_get_bpp(mode_in);
+  size_t bytewidth = (bpp + 7) / 8;
+  size_t linebytes = (w * bpp + 7) / 8;
+  size_t outlinebytes = lodepng_get_raw_size(w, 1, mode_out);
+
+#ifdef LODEPNG_USE_SSE2
+  ssse3 = cpuHasSSSE3();
+#endif /*LODEPNG_USE_SSE2*/
+
+  for(y = 0; y < h; y++)
+  {
+    /*the unfiltered scanline overwrites the filtered one and its filter type byte*/
+    unsigned char* line = &in[linebytes * y];
+    size_t inindex = (1 + linebytes) * y;
+    unsigned char filterType = in[inindex];
+
+    CERROR_TRY_RETURN(unfilterScanline(line, &in[inindex + 1], prevline, bytewidth, filterType, linebytes, ssse3));
+    CERROR_TRY_RETURN(convertPixels(&out[outlinebytes * y], line, mode_out, mode_in, w, ssse3));
+
+    prevline = line;
+  }
+
+  return 0;
+}
+
+/*
+in: Adam7 interlaced image, with no padding bits between scanlines, but between
+ reduced images so that each reduced image starts at a byte.
+out: the same pixels, but re-ordered so that they're now a non-interlaced image with size w*h
+bpp: bits per pixel
+out has the following size in bits: w * h * bpp.
+in is possibly bigger due to padding bits between reduced images.
+out must be big enough AND must be 0 everywhere if bpp < 8 in the current implementation
+(because that's likely a little bit faster)
+NOTE: comments about padding bits are only relevant if bpp < 8
+*/
+static void Adam7_deinterlace(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp)
+{
+  unsigned passw[7], passh[7];
+  size_t filter_passstart[8], padded_passstart[8], passstart[8];
   unsigned i;
 
   Adam7_getpassvalues(passw, passh, filter_passstart, padded_passstart, passstart, w, h, bpp);
@@ -4348,6 +6371,7 @@ static unsigned readChunk_zTXt(LodePNGInfo* info, const LodePNGDecompressSetting
   ucvector decoded;
 
   ucvector_init(&decoded);
+  decoded.allocator = zlibsettings->allocator;
 
   while(!error) /*not really a while loop, only used to break on error*/
   {
@@ -4396,6 +6420,7 @@ static unsigned readChunk_iTXt(LodePNGInfo* info, const LodePNGDecompressSetting
   char *key = 0, *langtag = 0, *transkey = 0;
   ucvector decoded;
   ucvector_init(&decoded);
+  decoded.allocator = zlibsettings->allocator;
 
   while(!error) /*not really a while loop, only used to break on error*/
   {
@@ -4508,6 +6533,114 @@ static unsigned readChunk_pHYs(LodePNGInfo* info, const unsigned char* data, siz
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
 
 /*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
+/*
+reads a chunk other than IDAT and IEND into state->info_png. unknown is set if
+the decoder doesn't implement the chunk type. critical_pos is the critical
+chunk the chunk comes after (1 = IHDR, 2 = PLTE, 3 = IDAT), a PLTE chunk
+advances it. The CRC is left to the caller. return value is error.
+*/
+static unsigned readChunk(LodePNGState* state, const unsigned char* chunk, unsigned* critical_pos, unsigned* unknown)
+{
+  unsigned error = 0;
+  unsigned chunkLength = lodepng_chunk_length(chunk);
+  const unsigned char* data = lodepng_chunk_data_const(chunk);
+
+  /*palette chunk (PLTE)*/
+  if(lodepng_chunk_type_equals(chunk, "PLTE"))
+  {
+    error = readChunk_PLTE(&state->info_png.color, data, chunkLength);
+    *critical_pos = 2;
+  }
+  /*palette transparency chunk (tRNS)*/
+  else if(lodepng_chunk_type_equals(chunk, "tRNS"))
+  {
+    error = readChunk_tRNS(&state->info_png.color, data, chunkLength);
+  }
+#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
+  /*background color chunk (bKGD)*/
+  else if(lodepng_chunk_type_equals(chunk, "bKGD"))
+  {
+    error = readChunk_bKGD(&state->info_png, data, chunkLength);
+  }
+  /*text chunk (tEXt)*/
+  else if(lodepng_chunk_type_equals(chunk, "tEXt"))
+  {
+    if(state->decoder.read_text_chunks)
+    {
+      error = readChunk_tEXt(&state->info_png, data, chunkLength);
+    }
+  }
+  /*compressed text chunk (zTXt)*/
+  else if(lodepng_chunk_type_equals(chunk, "zTXt"))
+  {
+    if(state->decoder.read_text_chunks)
+    {
+      error = readChunk_zTXt(&state->info_png, &state->decoder.zlibsettings, data, chunkLength);
+    }
+  }
+  /*international text chunk (iTXt)*/
+  else if(lodepng_chunk_type_equals(chunk, "iTXt"))
+  {
+    if(state->decoder.read_text_chunks)
+    {
+      error = readChunk_iTXt(&state->info_png, &state->decoder.zlibsettings, data, chunkLength);
+    }
+  }
+  else if(lodepng_chunk_type_equals(chunk, "tIME"))
+  {
+    error = readChunk_tIME(&state->info_png, data, chunkLength);
+  }
+  else if(lodepng_chunk_type_equals(chunk, "pHYs"))
+  {
+    error = readChunk_pHYs(&state->info_png, data, chunkLength);
+  }
+#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
+  else /*it's not an implemented chunk type, so ignore it: skip over the data*/
+  {
+    /*error: unknown critical chunk (5th bit of first byte of chunk type is 0)*/
+    if(!lodepng_chunk_ancillary(chunk)) return 69;
+
+    *unknown = 1;
+#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
+    if(state->decoder.remember_unknown_chunks)
+    {
+      error = lodepng_chunk_append(&state->info_png.unknown_chunks_data[*critical_pos - 1],
+                                   &state->info_png.unknown_chunks_size[*critical_pos - 1], chunk);
+    }
+#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
+  }
+
+  return error;
+}
+
+/*
+whether decodeGeneric converts the scanlines to info_raw while unfiltering them.
+Interlaced images are deinterlaced first and palette output needs a lookup tree,
+so those are converted afterwards by lodepng_decode.
+*/
+static int convertsScanlines(const LodePNGState* state)
+{
+  const LodePNGColorMode* mode_out = &state->info_raw;
+  if(!state->decoder.color_convert || lodepng_color_mode_equal(mode_out, &state->info_png.color)) return 0;
+  if(state->info_png.interlace_method != 0 || mode_out->colortype == LCT_PALETTE) return 0;
+  /*the conversions lodepng_decode supports, see there*/
+  return mode_out->colortype == LCT_RGB || mode_out->colortype == LCT_RGBA || mode_out->bitdepth == 8;
+}
+
+/*whether the image decodeGeneric gives is the final one, which lodepng_decode needn't convert*/
+static int decodesFinalImage(const LodePNGState* state)
+{
+  return convertsScanlines(state) || !state->decoder.color_convert
+      || lodepng_color_mode_equal(&state->info_raw, &state->info_png.color);
+}
+
+/*the buffer for the final image: out_buffer if given, else a new one. Returns 0 if out of memory*/
+static unsigned char* allocateImage(const LodePNGState* state, size_t size)
+{
+  if(state->decoder.out_buffer) return state->decoder.out_buffer;
+  return (unsigned char*)allocatorMalloc(state->decoder.zlibsettings.allocator, size);
+}
+
 static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
                           LodePNGState* state,
                           const unsigned char* in, size_t insize)
@@ -4516,12 +6649,11 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   const unsigned char* chunk;
   size_t i;
   ucvector idat; /*the data from idat chunks*/
+  const LodePNGAllocator* allocator = state->decoder.zlibsettings.allocator;
 
   /*for unknown chunk order*/
   unsigned unknown = 0;
-#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   unsigned critical_pos = 1; /*1 = after IHDR, 2 = after PLTE, 3 = after IDAT*/
-#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
 
   /*provide some proper output values if error will happen*/
   *out = 0;
@@ -4529,7 +6661,18 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   state->error = lodepng_inspect(w, h, state, in, insize); /*reads header and resets other parameters in state->info_png*/
   if(state->error) return;
 
+  if(state->decoder.out_buffer)
+  {
+    const LodePNGColorMode* mode_out = state->decoder.color_convert ? &state->info_raw : &state->info_png.color;
+    if(state->decoder.out_buffer_size < lodepng_get_raw_size(*w, *h, mode_out))
+    {
+      state->error = 92; /*error: the output buffer is too small for the image*/
+      return;
+    }
+  }
+
   ucvector_init(&idat);
+  idat.allocator = allocator;
   chunk = &in[33]; /*first byte of the first chunk after the header*/
 
   /*loop through the chunks, ignoring unknown chunks and stopping at IEND chunk.
@@ -4560,196 +6703,606 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
       size_t oldsize = idat.size;
       if(!ucvector_resize(&idat, oldsize + chunkLength)) CERROR_BREAK(state->error, 83 /*alloc fail*/);
       for(i = 0; i < chunkLength; i++) idat.data[oldsize + i] = data[i];
-#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
       critical_pos = 3;
-#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
     }
     /*IEND chunk*/
     else if(lodepng_chunk_type_equals(chunk, "IEND"))
     {
       IEND = 1;
     }
-    /*palette chunk (PLTE)*/
-    else if(lodepng_chunk_type_equals(chunk, "PLTE"))
+    else
     {
-      state->error = readChunk_PLTE(&state->info_png.color, data, chunkLength);
+      state->error = readChunk(state, chunk, &critical_pos, &unknown);
       if(state->error) break;
-#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
-      critical_pos = 2;
-#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
     }
-    /*palette transparency chunk (tRNS)*/
-    else if(lodepng_chunk_type_equals(chunk, "tRNS"))
+
+    if(!state->decoder.ignore_crc && !unknown) /*check CRC if wanted, only on known chunk types*/
     {
-      state->error = readChunk_tRNS(&state->info_png.color, data, chunkLength);
-      if(state->error) break;
+      if(lodepng_chunk_check_crc(chunk)) CERROR_BREAK(state->error, 57); /*invalid CRC*/
     }
-#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
-    /*background color chunk (bKGD)*/
-    else if(lodepng_chunk_type_equals(chunk, "bKGD"))
+
+    if(!IEND) chunk = lodepng_chunk_next_const(chunk);
+  }
+
+  if(!state->error)
+  {
+    ucvector scanlines;
+    ucvector_init(&scanlines);
+    scanlines.allocator = allocator;
+
+    /*maximum final image length is already reserved in the vector's length - this is not really necessary*/
+    if(!ucvector_resize(&scanlines, lodepng_get_raw_size(*w, *h, &state->info_png.color) + *h))
     {
-      state->error = readChunk_bKGD(&state->info_png, data, chunkLength);
-      if(state->error) break;
+      state->error = 83; /*alloc fail*/
     }
-    /*text chunk (tEXt)*/
-    else if(lodepng_chunk_type_equals(chunk, "tEXt"))
+    if(!state->error)
     {
-      if(state->decoder.read_text_chunks)
-      {
-        state->error = readChunk_tEXt(&state->info_png, data, chunkLength);
-        if(state->error) break;
-      }
+      /*decompress with the Zlib decompressor*/
+      state->error = zlib_decompress(&scanlines.data, &scanlines.size, idat.data,
+                                     idat.size, &state->decoder.zlibsettings);
     }
-    /*compressed text chunk (zTXt)*/
-    else if(lodepng_chunk_type_equals(chunk, "zTXt"))
+
+    if(!state->error && convertsScanlines(state))
     {
-      if(state->decoder.read_text_chunks)
-      {
-        state->error = readChunk_zTXt(&state->info_png, &state->decoder.zlibsettings, data, chunkLength);
-        if(state->error) break;
-      }
+      *out = allocateImage(state, lodepng_get_raw_size(*w, *h, &state->info_raw));
+      if(!(*out)) state->error = 83; /*alloc fail*/
+      else state->error = unfilterAndConvert(*out, scanlines.data, *w, *h,
+                                             &state->info_raw, &state->info_png.color);
     }
-    /*international text chunk (iTXt)*/
-    else if(lodepng_chunk_type_equals(chunk, "iTXt"))
+    else if(!state->error)
     {
-      if(state->decoder.read_text_chunks)
+      size_t outsize = lodepng_get_raw_size(*w, *h, &state->info_png.color);
+      /*an image lodepng_decode still converts doesn't go to out_buffer*/
+      if(decodesFinalImage(state)) *out = allocateImage(state, outsize);
+      else *out = (unsigned char*)allocatorMalloc(allocator, outsize);
+      if(!(*out)) state->error = 83; /*alloc fail*/
+      else
       {
-        state->error = readChunk_iTXt(&state->info_png, &state->decoder.zlibsettings, data, chunkLength);
-        if(state->error) break;
+        memset(*out, 0, outsize);
+        state->error = postProcessScanlines(*out, scanlines.data, *w, *h, &state->info_png);
       }
     }
-    else if(lodepng_chunk_type_equals(chunk, "tIME"))
+    ucvector_cleanup(&scanlines);
+  }
+
+  ucvector_cleanup(&idat);
+}
+
+unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
+                        LodePNGState* state,
+                        const unsigned char* in, size_t insize)
+{
+  *out = 0;
+  decodeGeneric(out, w, h, state, in, insize);
+  if(state->error) return state->error;
+  if(convertsScanlines(state))
+  {
+    /*already converted while unfiltering*/
+  }
+  else if(decodesFinalImage(state))
+  {
+    /*same color type, no copying or converting of data needed*/
+    /*store the info_png color settings on the info_raw so that the info_raw still reflects what colortype
+    the raw image has to the end user*/
+    if(!state->decoder.color_convert)
     {
-      state->error = readChunk_tIME(&state->info_png, data, chunkLength);
-      if(state->error) break;
+      state->error = lodepng_color_mode_copy(&state->info_raw, &state->info_png.color);
+      if(state->error) return state->error;
     }
-    else if(lodepng_chunk_type_equals(chunk, "pHYs"))
+  }
+  else
+  {
+    /*color conversion needed; sort of copy of the data*/
+    unsigned char* data = *out;
+    size_t outsize;
+
+    /*TODO: check if this works according to the statement in the documentation: "The converter can convert
+    from greyscale input color type, to 8-bit greyscale or greyscale with alpha"*/
+    if(!(state->info_raw.colortype == LCT_RGB || state->info_raw.colortype == LCT_RGBA)
+       && !(state->info_raw.bitdepth == 8))
     {
-      state->error = readChunk_pHYs(&state->info_png, data, chunkLength);
-      if(state->error) break;
+      return 56; /*unsupported color mode conversion*/
     }
-#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
-    else /*it's not an implemented chunk type, so ignore it: skip over the data*/
-    {
-      /*error: unknown critical chunk (5th bit of first byte of chunk type is 0)*/
-      if(!lodepng_chunk_ancillary(chunk)) CERROR_BREAK(state->error, 69);
 
-      unknown = 1;
-#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
-      if(state->decoder.remember_unknown_chunks)
-      {
-        state->error = lodepng_chunk_append(&state->info_png.unknown_chunks_data[critical_pos - 1],
-                                            &state->info_png.unknown_chunks_size[critical_pos - 1], chunk);
-        if(state->error) break;
-      }
-#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
+    outsize = lodepng_get_raw_size(*w, *h, &state->info_raw);
+    *out = allocateImage(state, outsize);
+    if(!(*out))
+    {
+      state->error = 83; /*alloc fail*/
     }
+    else state->error = lodepng_convert(*out, data, &state->info_raw, &state->info_png.color, *w, *h);
+    allocatorFree(state->decoder.zlibsettings.allocator, data);
+  }
+  return state->error;
+}
 
-    if(!state->decoder.ignore_crc && !unknown) /*check CRC if wanted, only on known chunk types*/
+unsigned lodepng_decode_memory(unsigned char** out, unsigned* w, unsigned* h, const unsigned char* in,
+                               size_t insize, LodePNGColorType colortype, unsigned bitdepth)
+{
+  unsigned error;
+  LodePNGState state;
+  lodepng_state_init(&state);
+  state.info_raw.colortype = colortype;
+  state.info_raw.bitdepth = bitdepth;
+  error = lodepng_decode(out, w, h, &state, in, insize);
+  lodepng_state_cleanup(&state);
+  return error;
+}
+
+unsigned lodepng_decode32(unsigned char** out, unsigned* w, unsigned* h, const unsigned char* in, size_t insize)
+{
+  return lodepng_decode_memory(out, w, h, in, insize, LCT_RGBA, 8);
+}
+
+unsigned lodepng_decode24(unsigned char** out, unsigned* w, unsigned* h, const unsigned char* in, size_t insize)
+{
+  return lodepng_decode_memory(out, w, h, in, insize, LCT_RGB, 8);
+}
+
+/*what a LodePNGStreamDecoder reads next*/
+#define STREAM_HEADER 0 /*the signature and the IHDR chunk*/
+#define STREAM_CHUNK 1 /*the length and type of a chunk*/
+#define STREAM_IDAT 2 /*the data of an IDAT chunk*/
+#define STREAM_IDAT_CRC 3 /*the CRC of an IDAT chunk*/
+#define STREAM_DATA 4 /*the data and CRC of a chunk other than IDAT*/
+#define STREAM_END 5 /*nothing, the IEND chunk was read*/
+
+/*the streaming decoder inflates at most this many bytes before handing out the finished scanlines*/
+#define STREAM_INFLATE_STEP 32768u
+
+struct LodePNGStreamDecoder
+{
+  LodePNGState* state;
+  LodePNGRowCallback callback;
+  void* user;
+  const LodePNGAllocator* allocator; /*of the settings when the decoder was made*/
+  unsigned error;
+  unsigned mode; /*one of the STREAM_ values*/
+  unsigned w, h;
+  ucvector chunk; /*the header, or the chunk being read without the data of IDAT chunks*/
+  size_t chunkend; /*size of chunk once it is complete*/
+  size_t idatleft; /*bytes left of the data of the current IDAT chunk*/
+  unsigned crc; /*CRC of the current IDAT chunk so far*/
+  unsigned critical_pos; /*1 = after IHDR, 2 = after PLTE, 3 = after IDAT*/
+  unsigned unknown; /*an unknown chunk was read, see decodeGeneric*/
+
+  unsigned started; /*the image data started, the fields below are set up*/
+  unsigned buffered; /*the IDAT data is collected and decoded at the IEND chunk*/
+  unsigned convert; /*rows are converted from info_png.color to info_raw*/
+  int ssse3;
+  size_t linebytes; /*bytes of a scanline in the PNG, without filter type*/
+  unsigned char* prevline; /*previous unfiltered scanline, or 0 before the first*/
+  unsigned char* line; /*the scanline being unfiltered*/
+  unsigned char* converted; /*the scanline converted to info_raw*/
+  unsigned y; /*the next row to hand out*/
+  ucvector idat; /*all IDAT data if buffered, else the part the inflater hasn't consumed*/
+#ifdef LODEPNG_COMPILE_ZLIB
+  unsigned char zlibheader[2];
+  unsigned zlibheadersize;
+  Inflater inflater;
+  size_t bitpos; /*bit position of the inflater in idat*/
+  ucvector window; /*the inflated data, the part before consumed is only kept as history*/
+  size_t consumed; /*bytes of window handed out as scanlines*/
+  size_t checked; /*bytes of window added to the adler32*/
+  unsigned adler;
+#endif /*LODEPNG_COMPILE_ZLIB*/
+};
+
+static void stream_emitRow(LodePNGStreamDecoder* stream, const unsigned char* row)
+{
+  LodePNGState* state = stream->state;
+  if(stream->convert)
+  {
+    stream->error = convertPixels(stream->converted, row, &state->info_raw, &state->info_png.color,
+                                  stream->w, stream->ssse3);
+    row = stream->converted;
+  }
+  if(!stream->error) stream->error = stream->callback(stream->user, stream->y, row);
+  stream->y++;
+}
+
+/*sets up the decoding of the image data, once the chunks before it are read*/
+static void stream_start(LodePNGStreamDecoder* stream)
+{
+  LodePNGState* state = stream->state;
+  unsigned bpp = lodepng_get_bpp(&state->info_png.color);
+  size_t outlinebytes;
+
+  stream->started = 1;
+  if(!state->decoder.color_convert)
+  {
+    stream->error = lodepng_color_mode_copy(&state->info_raw, &state->info_png.color);
+    if(stream->error) return;
+  }
+  else if(!lodepng_color_mode_equal(&state->info_raw, &state->info_png.color))
+  {
+    /*the conversions lodepng_decode supports*/
+    if(!(state->info_raw.colortype == LCT_RGB || state->info_raw.colortype == LCT_RGBA)
+       && !(state->info_raw.bitdepth == 8))
     {
-      if(lodepng_chunk_check_crc(chunk)) CERROR_BREAK(state->error, 57); /*invalid CRC*/
+      stream->error = 56; /*unsupported color mode conversion*/
+      return;
     }
+    stream->convert = 1;
+  }
 
-    if(!IEND) chunk = lodepng_chunk_next_const(chunk);
+  stream->buffered = state->info_png.interlace_method != 0
+                  || state->decoder.zlibsettings.custom_zlib || state->decoder.zlibsettings.custom_inflate;
+#ifndef LODEPNG_COMPILE_ZLIB
+  stream->buffered = 1;
+#endif /*LODEPNG_COMPILE_ZLIB*/
+#ifdef LODEPNG_USE_SSE2
+  stream->ssse3 = cpuHasSSSE3();
+#endif /*LODEPNG_USE_SSE2*/
+
+  stream->linebytes = (stream->w * bpp + 7) / 8;
+  outlinebytes = lodepng_get_raw_size(stream->w, 1, &state->info_raw);
+  stream->prevline = (unsigned char*)allocatorMalloc(stream->allocator, stream->linebytes);
+  stream->line = (unsigned char*)allocatorMalloc(stream->allocator, stream->linebytes);
+  stream->converted = (unsigned char*)allocatorMalloc(stream->allocator, outlinebytes);
+  if(!stream->prevline || !stream->line || !stream->converted) stream->error = 83; /*alloc fail*/
+}
+
+#ifdef LODEPNG_COMPILE_ZLIB
+/*unfilters and hands out the scanlines that are completely inflated*/
+static void stream_emitRows(LodePNGStreamDecoder* stream)
+{
+  size_t bytewidth = (lodepng_get_bpp(&stream->state->info_png.color) + 7) / 8;
+  while(!stream->error && stream->y < stream->h
+        && stream->inflater.pos - stream->consumed >= stream->linebytes + 1)
+  {
+    const unsigned char* scanline = &stream->window.data[stream->consumed];
+    unsigned char* swap;
+    stream->error = unfilterScanline(stream->line, &scanline[1], stream->y ? stream->prevline : 0, bytewidth,
+                                     scanline[0], stream->linebytes, stream->ssse3);
+    if(stream->error) break;
+    stream->consumed += stream->linebytes + 1;
+    stream_emitRow(stream, stream->line);
+    swap = stream->prevline;
+    stream->prevline = stream->line;
+    stream->line = swap;
   }
+}
 
-  if(!state->error)
+/*adds the inflated data to the adler32 and drops what is neither needed as history nor handed out*/
+static void stream_slideWindow(LodePNGStreamDecoder* stream)
+{
+  Inflater* inflater = &stream->inflater;
+  size_t drop = inflater->pos > 32768 ? inflater->pos - 32768 : 0;
+  if(drop > stream->consumed) drop = stream->consumed;
+
+  if(!stream->state->decoder.zlibsettings.ignore_adler32)
   {
-    ucvector scanlines;
-    ucvector_init(&scanlines);
+    stream->adler = update_adler32(stream->adler, &stream->window.data[stream->checked],
+                                   (unsigned)(inflater->pos - stream->checked));
+  }
+  stream->checked = inflater->pos;
 
-    /*maximum final image length is already reserved in the vector's length - this is not really necessary*/
-    if(!ucvector_resize(&scanlines, lodepng_get_raw_size(*w, *h, &state->info_png.color) + *h))
-    {
-      state->error = 83; /*alloc fail*/
-    }
-    if(!state->error)
+  /*moving the data only once a full window can be dropped keeps the copying linear*/
+  if(drop < 32768) return;
+  memmove(stream->window.data, &stream->window.data[drop], inflater->pos - drop);
+  inflater->pos -= drop;
+  stream->consumed -= drop;
+  stream->checked -= drop;
+}
+
+/*runs the inflater over the IDAT data received so far. last tells that no more follows*/
+static void stream_inflate(LodePNGStreamDecoder* stream, unsigned last)
+{
+  Inflater* inflater = &stream->inflater;
+  size_t bytepos;
+
+  if(stream->zlibheadersize < 2)
+  {
+    if(last) stream->error = 53; /*error, size of zlib data too small*/
+    return;
+  }
+
+  while(!stream->error && inflater->mode != INFLATE_DONE)
+  {
+    unsigned waiting;
+    /*the data may have moved, and bits the reader read past its end may have arrived since*/
+    BitReader_init(&inflater->reader, stream->idat.data, stream->idat.size);
+    inflater->reader.pos = stream->bitpos >> 3;
+    readBits(&inflater->reader, (unsigned)(stream->bitpos & 7));
+    inflater->more = !last;
+    inflater->outlimit = inflater->pos + STREAM_INFLATE_STEP;
+
+    stream->error = Inflater_run(inflater);
+    stream->bitpos = BitReader_position(&inflater->reader);
+    if(stream->error) break;
+    /*the inflater waits for input rather than for room*/
+    waiting = inflater->suspended && inflater->pos < inflater->outlimit;
+
+    stream_emitRows(stream);
+    stream_slideWindow(stream);
+    if(waiting) break;
+  }
+
+  /*drop the data the inflater is done with, but keep the adler32 after the deflate data*/
+  bytepos = stream->bitpos >> 3;
+  if(inflater->mode == INFLATE_DONE) bytepos = (stream->bitpos + 7) >> 3;
+  if(bytepos > 0 && bytepos <= stream->idat.size)
+  {
+    memmove(stream->idat.data, &stream->idat.data[bytepos], stream->idat.size - bytepos);
+    stream->idat.size -= bytepos;
+    stream->bitpos -= bytepos * 8;
+    if(inflater->mode == INFLATE_DONE) stream->bitpos = 0;
+  }
+}
+#endif /*LODEPNG_COMPILE_ZLIB*/
+
+/*receives the data of IDAT chunks*/
+static void stream_addData(LodePNGStreamDecoder* stream, const unsigned char* data, size_t size)
+{
+  size_t oldsize;
+#ifdef LODEPNG_COMPILE_ZLIB
+  if(!stream->buffered)
+  {
+    /*read information from zlib header, see lodepng_zlib_decompress*/
+    while(size > 0 && stream->zlibheadersize < 2)
     {
-      /*decompress with the Zlib decompressor*/
-      state->error = zlib_decompress(&scanlines.data, &scanlines.size, idat.data,
-                                     idat.size, &state->decoder.zlibsettings);
+      stream->zlibheader[stream->zlibheadersize++] = *data++;
+      size--;
+      if(stream->zlibheadersize == 2)
+      {
+        const unsigned char* in = stream->zlibheader;
+        /*error: 256 * in[0] + in[1] must be a multiple of 31, the FCHECK value is supposed to be made that way*/
+        if((in[0] * 256 + in[1]) % 31 != 0) stream->error = 24;
+        /*error: only compression method 8: inflate with sliding window of 32k is supported by the PNG spec*/
+        else if((in[0] & 15) != 8 || ((in[0] >> 4) & 15) > 7) stream->error = 25;
+        /*error: the PNG spec doesn't allow a preset dictionary*/
+        else if(((in[1] >> 5) & 1) != 0) stream->error = 26;
+        if(stream->error) return;
+      }
     }
+  }
+#endif /*LODEPNG_COMPILE_ZLIB*/
 
-    if(!state->error)
+  oldsize = stream->idat.size;
+  if(!ucvector_resize(&stream->idat, oldsize + size))
+  {
+    stream->error = 83; /*alloc fail*/
+    return;
+  }
+  if(size) memcpy(&stream->idat.data[oldsize], data, size);
+
+#ifdef LODEPNG_COMPILE_ZLIB
+  if(!stream->buffered) stream_inflate(stream, 0);
+#endif /*LODEPNG_COMPILE_ZLIB*/
+}
+
+/*copies nbits bits, starting at bit inbitpos of in, to the start of out*/
+static void copyBits(unsigned char* out, const unsigned char* in, size_t inbitpos, size_t nbits)
+{
+  size_t i, outbitpos = 0;
+  for(i = 0; i < nbits; i++)
+  {
+    unsigned char bit = readBitFromReversedStream(&inbitpos, in);
+    setBitOfReversedStream(&outbitpos, out, bit);
+  }
+}
+
+/*decodes the collected image data at the IEND chunk, see decodeGeneric*/
+static void stream_decodeBuffered(LodePNGStreamDecoder* stream)
+{
+  LodePNGState* state = stream->state;
+  ucvector scanlines, image;
+  unsigned bpp = lodepng_get_bpp(&state->info_png.color);
+
+  ucvector_init(&scanlines);
+  ucvector_init(&image);
+  scanlines.allocator = image.allocator = stream->allocator;
+  if(!ucvector_resize(&scanlines, lodepng_get_raw_size(stream->w, stream->h, &state->info_png.color) + stream->h)
+     || !ucvector_resizev(&image, lodepng_get_raw_size(stream->w, stream->h, &state->info_png.color), 0))
+  {
+    stream->error = 83; /*alloc fail*/
+  }
+  if(!stream->error)
+  {
+    stream->error = zlib_decompress(&scanlines.data, &scanlines.size, stream->idat.data,
+                                    stream->idat.size, &state->decoder.zlibsettings);
+  }
+  if(!stream->error) stream->error = postProcessScanlines(image.data, scanlines.data, stream->w, stream->h, &state->info_png);
+
+  while(!stream->error && stream->y < stream->h)
+  {
+    if(bpp >= 8) stream_emitRow(stream, &image.data[stream->y * stream->linebytes]);
+    else
     {
-      ucvector outv;
-      ucvector_init(&outv);
-      if(!ucvector_resizev(&outv,
-          lodepng_get_raw_size(*w, *h, &state->info_png.color), 0)) state->error = 83; /*alloc fail*/
-      if(!state->error) state->error = postProcessScanlines(outv.data, scanlines.data, *w, *h, &state->info_png);
-      *out = outv.data;
+      /*rows of less than 8 bits per pixel don't start at a byte in the image*/
+      copyBits(stream->line, image.data, (size_t)stream->y * stream->w * bpp, (size_t)stream->w * bpp);
+      stream_emitRow(stream, stream->line);
     }
-    ucvector_cleanup(&scanlines);
   }
-
-  ucvector_cleanup(&idat);
+
+  ucvector_cleanup(&scanlines);
+  ucvector_cleanup(&image);
+}
+
+/*finishes the image data at the IEND chunk*/
+static void stream_end(LodePNGStreamDecoder* stream)
+{
+  if(!stream->started) stream_start(stream);
+  if(stream->error) return;
+
+  if(stream->buffered)
+  {
+    stream_decodeBuffered(stream);
+    return;
+  }
+
+#ifdef LODEPNG_COMPILE_ZLIB
+  /*without more input, the inflater reports why it can't finish*/
+  stream_inflate(stream, 1);
+  if(stream->error) return;
+
+  if(!stream->state->decoder.zlibsettings.ignore_adler32)
+  {
+    /*error, adler checksum not correct, data must be corrupted*/
+    if(stream->idat.size < 4 || lodepng_read32bitInt(stream->idat.data) != stream->adler) stream->error = 58;
+  }
+  if(!stream->error && stream->y < stream->h) stream->error = 90; /*error: the image data is too short*/
+#endif /*LODEPNG_COMPILE_ZLIB*/
+}
+
+LodePNGStreamDecoder* lodepng_stream_new(LodePNGState* state, LodePNGRowCallback callback, void* user)
+{
+  const LodePNGAllocator* allocator = state->decoder.zlibsettings.allocator;
+  LodePNGStreamDecoder* stream = (LodePNGStreamDecoder*)allocatorMalloc(allocator, sizeof(LodePNGStreamDecoder));
+  if(!stream) return 0;
+  memset(stream, 0, sizeof(LodePNGStreamDecoder));
+  stream->state = state;
+  stream->callback = callback;
+  stream->user = user;
+  stream->allocator = allocator;
+  stream->mode = STREAM_HEADER;
+  stream->chunkend = 33; /*the signature and the IHDR chunk with its length, type and CRC*/
+  stream->critical_pos = 1;
+  ucvector_init(&stream->chunk);
+  ucvector_init(&stream->idat);
+  stream->chunk.allocator = stream->idat.allocator = allocator;
+#ifdef LODEPNG_COMPILE_ZLIB
+  ucvector_init(&stream->window);
+  stream->window.allocator = allocator;
+  Inflater_init(&stream->inflater, &stream->window, 0, 0);
+  stream->adler = 1;
+#endif /*LODEPNG_COMPILE_ZLIB*/
+  return stream;
+}
+
+void lodepng_stream_delete(LodePNGStreamDecoder* stream)
+{
+  if(!stream) return;
+  ucvector_cleanup(&stream->chunk);
+  ucvector_cleanup(&stream->idat);
+#ifdef LODEPNG_COMPILE_ZLIB
+  ucvector_cleanup(&stream->window);
+  Inflater_cleanup(&stream->inflater);
+#endif /*LODEPNG_COMPILE_ZLIB*/
+  allocatorFree(stream->allocator, stream->prevline);
+  allocatorFree(stream->allocator, stream->line);
+  allocatorFree(stream->allocator, stream->converted);
+  allocatorFree(stream->allocator, stream);
+}
+
+/*moves bytes of in to the chunk buffer until it has size bytes, returns how many*/
+static size_t stream_gather(LodePNGStreamDecoder* stream, const unsigned char* in, size_t insize, size_t size)
+{
+  size_t oldsize = stream->chunk.size;
+  size_t n = size - oldsize < insize ? size - oldsize : insize;
+  if(!ucvector_resize(&stream->chunk, oldsize + n))
+  {
+    stream->error = 83; /*alloc fail*/
+    return 0;
+  }
+  if(n) memcpy(&stream->chunk.data[oldsize], in, n);
+  return n;
 }
 
-unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
-                        LodePNGState* state,
-                        const unsigned char* in, size_t insize)
+unsigned lodepng_stream_push(LodePNGStreamDecoder* stream, const unsigned char* in, size_t insize)
 {
-  *out = 0;
-  decodeGeneric(out, w, h, state, in, insize);
-  if(state->error) return state->error;
-  if(!state->decoder.color_convert || lodepng_color_mode_equal(&state->info_raw, &state->info_png.color))
+  LodePNGState* state = stream->state;
+
+  while(!stream->error && stream->mode != STREAM_END && insize > 0)
   {
-    /*same color type, no copying or converting of data needed*/
-    /*store the info_png color settings on the info_raw so that the info_raw still reflects what colortype
-    the raw image has to the end user*/
-    if(!state->decoder.color_convert)
+    size_t n;
+    if(stream->mode == STREAM_IDAT)
     {
-      state->error = lodepng_color_mode_copy(&state->info_raw, &state->info_png.color);
-      if(state->error) return state->error;
+      /*IDAT data goes to the inflater without being gathered*/
+      n = stream->idatleft < insize ? stream->idatleft : insize;
+      if(!state->decoder.ignore_crc) stream->crc = Crc32_update_crc(in, stream->crc, n);
+      stream->idatleft -= n;
+      if(!stream->started) stream_start(stream);
+      if(!stream->error) stream_addData(stream, in, n);
+      if(stream->idatleft == 0) stream->mode = STREAM_IDAT_CRC;
+      in += n;
+      insize -= n;
+      continue;
     }
-  }
-  else
-  {
-    /*color conversion needed; sort of copy of the data*/
-    unsigned char* data = *out;
-    size_t outsize;
 
-    /*TODO: check if this works according to the statement in the documentation: "The converter can convert
-    from greyscale input color type, to 8-bit greyscale or greyscale with alpha"*/
-    if(!(state->info_raw.colortype == LCT_RGB || state->info_raw.colortype == LCT_RGBA)
-       && !(state->info_raw.bitdepth == 8))
+    n = stream_gather(stream, in, insize, stream->chunkend);
+    in += n;
+    insize -= n;
+    if(stream->error || stream->chunk.size < stream->chunkend) break;
+
+    if(stream->mode == STREAM_HEADER)
     {
-      return 56; /*unsupported color mode conversion*/
+      stream->error = lodepng_inspect(&stream->w, &stream->h, state, stream->chunk.data, stream->chunk.size);
+      stream->mode = STREAM_CHUNK;
+      stream->chunk.size = 0;
+      stream->chunkend = 8;
     }
-
-    outsize = lodepng_get_raw_size(*w, *h, &state->info_raw);
-    *out = (unsigned char*)mymalloc(outsize);
-    if(!(*out))
+    else if(stream->mode == STREAM_CHUNK)
     {
-      state->error = 83; /*alloc fail*/
+      /*length of the data of the chunk, excluding the length bytes, chunk type and CRC bytes*/
+      unsigned chunkLength = lodepng_chunk_length(stream->chunk.data);
+      /*error: chunk length larger than the max PNG chunk size*/
+      if(chunkLength > 2147483647) stream->error = 63;
+      else if(lodepng_chunk_type_equals(stream->chunk.data, "IDAT"))
+      {
+        stream->crc = Crc32_update_crc(&stream->chunk.data[4], 0xffffffffu, 4);
+        stream->idatleft = chunkLength;
+        stream->critical_pos = 3;
+        stream->mode = chunkLength ? STREAM_IDAT : STREAM_IDAT_CRC;
+        stream->chunkend = 12;
+      }
+      else
+      {
+        stream->mode = STREAM_DATA;
+        stream->chunkend = (size_t)chunkLength + 12;
+      }
+    }
+    else if(stream->mode == STREAM_IDAT_CRC)
+    {
+      if(!state->decoder.ignore_crc && !stream->unknown) /*check CRC if wanted, only on known chunk types*/
+      {
+        if(lodepng_read32bitInt(&stream->chunk.data[8]) != (stream->crc ^ 0xffffffffu)) stream->error = 57;
+      }
+      stream->mode = STREAM_CHUNK;
+      stream->chunk.size = 0;
+      stream->chunkend = 8;
+    }
+    else /*STREAM_DATA*/
+    {
+      unsigned IEND = lodepng_chunk_type_equals(stream->chunk.data, "IEND");
+      if(!IEND) stream->error = readChunk(state, stream->chunk.data, &stream->critical_pos, &stream->unknown);
+      if(!stream->error && !state->decoder.ignore_crc && !stream->unknown)
+      {
+        if(lodepng_chunk_check_crc(stream->chunk.data)) stream->error = 57; /*invalid CRC*/
+      }
+      if(!stream->error && IEND)
+      {
+        stream_end(stream);
+        stream->mode = STREAM_END;
+      }
+      else
+      {
+        stream->mode = STREAM_CHUNK;
+        stream->chunk.size = 0;
+        stream->chunkend = 8;
+      }
     }
-    else state->error = lodepng_convert(*out, data, &state->info_raw, &state->info_png.color, *w, *h);
-    myfree(data);
   }
-  return state->error;
-}
 
-unsigned lodepng_decode_memory(unsigned char** out, unsigned* w, unsigned* h, const unsigned char* in,
-                               size_t insize, LodePNGColorType colortype, unsigned bitdepth)
-{
-  unsigned error;
-  LodePNGState state;
-  lodepng_state_init(&state);
-  state.info_raw.colortype = colortype;
-  state.info_raw.bitdepth = bitdepth;
-  error = lodepng_decode(out, w, h, &state, in, insize);
-  lodepng_state_cleanup(&state);
-  return error;
+  state->error = stream->error;
+  return stream->error;
 }
 
-unsigned lodepng_decode32(unsigned char** out, unsigned* w, unsigned* h, const unsigned char* in, size_t insize)
+unsigned lodepng_stream_finish(LodePNGStreamDecoder* stream)
 {
-  return lodepng_decode_memory(out, w, h, in, insize, LCT_RGBA, 8);
+  /*error: the data ended before the IEND chunk*/
+  if(!stream->error && stream->mode != STREAM_END) stream->error = 30;
+  stream->state->error = stream->error;
+  return stream->error;
 }
 
-unsigned lodepng_decode24(unsigned char** out, unsigned* w, unsigned* h, const unsigned char* in, size_t insize)
+unsigned lodepng_stream_get_size(const LodePNGStreamDecoder* stream, unsigned* w, unsigned* h)
 {
-  return lodepng_decode_memory(out, w, h, in, insize, LCT_RGB, 8);
+  if(stream->mode == STREAM_HEADER || stream->error) return 0;
+  *w = stream->w;
+  *h = stream->h;
+  return 1;
 }
 
 #ifdef LODEPNG_COMPILE_DISK
@@ -4779,6 +7332,8 @@ unsigned lodepng_decode24_file(unsigned char** out, unsigned* w, unsigned* h, co
 void lodepng_decoder_settings_init(LodePNGDecoderSettings* settings)
 {
   settings->color_convert = 1;
+  settings->out_buffer = 0;
+  settings->out_buffer_size = 0;
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   settings->read_text_chunks = 1;
   settings->remember_unknown_chunks = 0;
@@ -5178,6 +7733,274 @@ static float flog2(float f)
   return result + 1.442695f * (f * f * f / 3 - 3 * f * f / 2 + 3 * f - 1.83333f);
 }
 
+/*filters byte i with all five filter types, see filterScanlineAll*/
+static void filterByteAll(unsigned char* out[5], size_t sum[5], size_t i,
+                          unsigned char x, unsigned char a, unsigned char b, unsigned char c)
+{
+  unsigned type;
+  out[0][i] = x;
+  out[1][i] = x - a;
+  out[2][i] = x - b;
+  out[3][i] = x - (a + b) / 2;
+  out[4][i] = x - paethPredictor(a, b, c);
+  sum[0] += x;
+  for(type = 1; type < 5; type++)
+  {
+    signed char s = (signed char)out[type][i];
+    sum[type] += s < 0 ? -s : s;
+  }
+}
+
+#ifdef LODEPNG_USE_SSE2
+/*
+Unlike unfiltering, filtering only looks at the unfiltered bytes, so from the
+second pixel on, 16 bytes are filtered per iteration. Returns the position
+where the portable code has to continue.
+*/
+static size_t filterScanlineAllSSE2(unsigned char* out[5], size_t sum[5], const unsigned char* scanline,
+                                    const unsigned char* prevline, size_t length, size_t bytewidth)
+{
+  size_t i;
+  unsigned type;
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi8(1);
+  __m128i acc[5];
+  for(type = 0; type < 5; type++) acc[type] = zero;
+  for(i = bytewidth; i + 16 <= length; i += 16)
+  {
+    __m128i f[5];
+    __m128i x = _mm_loadu_si128((const __m128i*)&scanline[i]);
+    __m128i a = _mm_loadu_si128((const __m128i*)&scanline[i - bytewidth]);
+    __m128i b = prevline ? _mm_loadu_si128((const __m128i*)&prevline[i]) : zero;
+    __m128i c = prevline ? _mm_loadu_si128((const __m128i*)&prevline[i - bytewidth]) : zero;
+    __m128i al = _mm_unpacklo_epi8(a, zero), bl = _mm_unpacklo_epi8(b, zero), cl = _mm_unpacklo_epi8(c, zero);
+    __m128i ah = _mm_unpackhi_epi8(a, zero), bh = _mm_unpackhi_epi8(b, zero), ch = _mm_unpackhi_epi8(c, zero);
+    __m128i pal = _mm_sub_epi16(bl, cl), pbl = _mm_sub_epi16(al, cl), pcl = _mm_add_epi16(pal, pbl);
+    __m128i pah = _mm_sub_epi16(bh, ch), pbh = _mm_sub_epi16(ah, ch), pch = _mm_add_epi16(pah, pbh);
+    /*absolute values as max(x, -x)*/
+    pal = _mm_max_epi16(pal, _mm_sub_epi16(zero, pal));
+    pbl = _mm_max_epi16(pbl, _mm_sub_epi16(zero, pbl));
+    pcl = _mm_max_epi16(pcl, _mm_sub_epi16(zero, pcl));
+    pah = _mm_max_epi16(pah, _mm_sub_epi16(zero, pah));
+    pbh = _mm_max_epi16(pbh, _mm_sub_epi16(zero, pbh));
+    pch = _mm_max_epi16(pch, _mm_sub_epi16(zero, pch));
+
+    f[0] = x;
+    f[1] = _mm_sub_epi8(x, a);
+    f[2] = _mm_sub_epi8(x, b);
+    /*_mm_avg_epu8 rounds up, the filter rounds down*/
+    f[3] = _mm_sub_epi8(x, _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one)));
+    f[4] = _mm_sub_epi8(x, _mm_packus_epi16(paethSelect(al, bl, cl, pal, pbl, pcl),
+                                            paethSelect(ah, bh, ch, pah, pbh, pch)));
+
+    acc[0] = _mm_add_epi64(acc[0], _mm_sad_epu8(x, zero));
+    _mm_storeu_si128((__m128i*)&out[0][i], x);
+    for(type = 1; type < 5; type++)
+    {
+      /*the absolute value of a signed byte is the smallest of it and its negation as unsigned bytes*/
+      __m128i abs = _mm_min_epu8(f[type], _mm_sub_epi8(zero, f[type]));
+      acc[type] = _mm_add_epi64(acc[type], _mm_sad_epu8(abs, zero));
+      _mm_storeu_si128((__m128i*)&out[type][i], f[type]);
+    }
+  }
+  for(type = 0; type < 5; type++)
+  {
+    sum[type] += (unsigned)_mm_cvtsi128_si32(acc[type]) + (unsigned)_mm_cvtsi128_si32(_mm_srli_si128(acc[type], 8));
+  }
+  return i;
+}
+#endif /*LODEPNG_USE_SSE2*/
+
+/*
+Filters a scanline with all five filter types in one pass: out[type] gets the
+scanline filtered with that type, and sum[type] the sum of its bytes as used by
+the minimum sum heuristic. Gives the same bytes as filterScanline.
+*/
+static void filterScanlineAll(unsigned char* out[5], size_t sum[5], const unsigned char* scanline,
+                              const unsigned char* prevline, size_t length, size_t bytewidth)
+{
+  size_t i;
+  for(i = 0; i < 5; i++) sum[i] = 0;
+  /*the first pixel has no left neighbour, and without prevline there is no upper row: both are zero*/
+  for(i = 0; i < bytewidth && i < length; i++) filterByteAll(out, sum, i, scanline[i], 0, prevline ? prevline[i] : 0, 0);
+#ifdef LODEPNG_USE_SSE2
+  i = filterScanlineAllSSE2(out, sum, scanline, prevline, length, bytewidth);
+#endif /*LODEPNG_USE_SSE2*/
+  if(prevline)
+  {
+    for(; i < length; i++)
+    {
+      filterByteAll(out, sum, i, scanline[i], scanline[i - bytewidth], prevline[i], prevline[i - bytewidth]);
+    }
+  }
+  else
+  {
+    for(; i < length; i++) filterByteAll(out, sum, i, scanline[i], scanline[i - bytewidth], 0, 0);
+  }
+}
+
+/*
+Chooses the filter type of the scanlines first until last with the minimum sum or
+the entropy heuristic. A scanline is filtered based on the unfiltered one above it
+only, so ranges of scanlines can be done independently of each other.
+*/
+static unsigned filterAdaptive(unsigned char* out, const unsigned char* in, size_t linebytes, size_t bytewidth,
+                               unsigned first, unsigned last, int entropy)
+{
+  unsigned char* attempt[5]; /*five filtering attempts, one for each filter type*/
+  size_t sum[5];
+  unsigned count[5][256];
+  float* clog2c = 0; /*c * log2(c) for every count c a byte value can have in a scanline*/
+  unsigned char* buffer = (unsigned char*)mymalloc(linebytes * 5 + 1);
+  unsigned type, x, y;
+
+  if(!buffer) return 83; /*alloc fail*/
+  for(type = 0; type < 5; type++) attempt[type] = &buffer[type * linebytes];
+
+  if(entropy)
+  {
+    clog2c = (float*)mymalloc((linebytes + 2) * sizeof(float));
+    if(!clog2c)
+    {
+      myfree(buffer);
+      return 83; /*alloc fail*/
+    }
+    clog2c[0] = 0;
+    for(x = 1; x < linebytes + 2; x++) clog2c[x] = x * flog2((float)x);
+  }
+
+  for(y = first; y < last; y++)
+  {
+    unsigned bestType = 0;
+    const unsigned char* prevline = y ? &in[(y - 1) * linebytes] : 0;
+    filterScanlineAll(attempt, sum, &in[y * linebytes], prevline, linebytes, bytewidth);
+
+    if(entropy)
+    {
+      /*The Shannon entropy of a scanline of n bytes is log2(n) - sum(c * log2(c)) / n over the counts c of
+      its byte values. Every attempt has the same n, so the smallest entropy has the largest sum.*/
+      float largest = 0;
+      for(type = 0; type < 5; type++)
+      {
+        memset(count[type], 0, sizeof(count[type]));
+        count[type][type]++; /*the filter type itself is part of the scanline*/
+      }
+      for(x = 0; x < linebytes; x++)
+      {
+        count[0][attempt[0][x]]++;
+        count[1][attempt[1][x]]++;
+        count[2][attempt[2][x]]++;
+        count[3][attempt[3][x]]++;
+        count[4][attempt[4][x]]++;
+      }
+      for(type = 0; type < 5; type++)
+      {
+        float total = 0;
+        for(x = 0; x < 256; x++) total += clog2c[count[type][x]];
+        /*check if this is the largest sum (or if type == 0 it's the first case so always store the values)*/
+        if(type == 0 || total > largest)
+        {
+          bestType = type;
+          largest = total;
+        }
+      }
+    }
+    else
+    {
+      for(type = 1; type < 5; type++) if(sum[type] < sum[bestType]) bestType = type;
+    }
+
+    /*now fill the out values*/
+    out[y * (linebytes + 1)] = bestType; /*the first byte of a scanline will be the filter type*/
+    memcpy(&out[y * (linebytes + 1) + 1], attempt[bestType], linebytes);
+  }
+
+  myfree(buffer);
+  myfree(clog2c);
+  return 0;
+}
+
+/*smallest amount of image bytes worth filtering on a thread of its own*/
+static const size_t FILTER_BAND_SIZE = 65536;
+
+/*the bands of scanlines of a multithreaded adaptive filter, see filterAdaptive*/
+typedef struct FilterBands
+{
+  unsigned char* out;
+  const unsigned char* in;
+  size_t linebytes;
+  size_t bytewidth;
+  unsigned h;
+  int entropy;
+  size_t numbands;
+  unsigned* error;
+} FilterBands;
+
+static void filterBand(FilterBands* bands, size_t band)
+{
+  unsigned first = (unsigned)(bands->h * band / bands->numbands);
+  unsigned last = (unsigned)(bands->h * (band + 1) / bands->numbands);
+  bands->error[band] = filterAdaptive(bands->out, bands->in, bands->linebytes, bands->bytewidth,
+                                      first, last, bands->entropy);
+}
+
+/*
+Splits the scanlines into one band per thread, each filtered with filterAdaptive.
+The result is the same as with one thread. Compiled as C, the bands are filtered
+one after another.
+*/
+static unsigned filterParallel(unsigned char* out, const unsigned char* in, size_t linebytes, size_t bytewidth,
+                               unsigned h, int entropy, unsigned numthreads)
+{
+  unsigned error = 0;
+  size_t i;
+  FilterBands bands;
+
+  if(numthreads > h) numthreads = h;
+  if(numthreads > linebytes * h / FILTER_BAND_SIZE) numthreads = (unsigned)(linebytes * h / FILTER_BAND_SIZE);
+  if(numthreads <= 1) return filterAdaptive(out, in, linebytes, bytewidth, 0, h, entropy);
+
+  bands.out = out;
+  bands.in = in;
+  bands.linebytes = linebytes;
+  bands.bytewidth = bytewidth;
+  bands.h = h;
+  bands.entropy = entropy;
+  bands.numbands = numthreads;
+  bands.error = (unsigned*)mymalloc(numthreads * sizeof(unsigned));
+  if(!bands.error) return 83; /*alloc fail*/
+
+#ifdef LODEPNG_COMPILE_CPP
+  {
+    /*the calling thread takes the first band, and the others as well if threads can't be started*/
+    std::vector<std::thread> workers;
+    size_t started = 1;
+    for(i = 1; i < numthreads; i++)
+    {
+      try
+      {
+        workers.push_back(std::thread(filterBand, &bands, i));
+        started++;
+      }
+      catch(...)
+      {
+        break;
+      }
+    }
+    filterBand(&bands, 0);
+    for(i = started; i < numthreads; i++) filterBand(&bands, i);
+    for(i = 0; i < workers.size(); i++) workers[i].join();
+  }
+#else /*LODEPNG_COMPILE_CPP*/
+  for(i = 0; i < numthreads; i++) filterBand(&bands, i);
+#endif /*LODEPNG_COMPILE_CPP*/
+
+  for(i = 0; i < numthreads; i++) if(!error) error = bands.error[i];
+  myfree(bands.error);
+
+  return error;
+}
+
 static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h,
                        const LodePNGColorMode* info, const LodePNGEncoderSettings* settings)
 {
@@ -5226,110 +8049,10 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
       prevline = &in[inindex];
     }
   }
-  else if(strategy == LFS_MINSUM)
+  else if(strategy == LFS_MINSUM || strategy == LFS_ENTROPY)
   {
     /*adaptive filtering*/
-    size_t sum[5];
-    ucvector attempt[5]; /*five filtering attempts, one for each filter type*/
-    size_t smallest = 0;
-    unsigned type, bestType = 0;
-
-    for(type = 0; type < 5; type++)
-    {
-      ucvector_init(&attempt[type]);
-      if(!ucvector_resize(&attempt[type], linebytes)) return 83; /*alloc fail*/
-    }
-
-    if(!error)
-    {
-      for(y = 0; y < h; y++)
-      {
-        /*try the 5 filter types*/
-        for(type = 0; type < 5; type++)
-        {
-          filterScanline(attempt[type].data, &in[y * linebytes], prevline, linebytes, bytewidth, type);
-
-          /*calculate the sum of the result*/
-          sum[type] = 0;
-          if(type == 0)
-          {
-            for(x = 0; x < linebytes; x++) sum[type] += (unsigned char)(attempt[type].data[x]);
-          }
-          else
-          {
-            for(x = 0; x < linebytes; x++)
-            {
-              /*For differences, each byte should be treated as signed, values above 127 are negative
-              (converted to signed char). Filtertype 0 isn't a difference though, so use unsigned there.
-              This means filtertype 0 is almost never chosen, but that is justified.*/
-              signed char s = (signed char)(attempt[type].data[x]);
-              sum[type] += s < 0 ? -s : s;
-            }
-          }
-
-          /*check if this is smallest sum (or if type == 0 it's the first case so always store the values)*/
-          if(type == 0 || sum[type] < smallest)
-          {
-            bestType = type;
-            smallest = sum[type];
-          }
-        }
-
-        prevline = &in[y * linebytes];
-
-        /*now fill the out values*/
-        out[y * (linebytes + 1)] = bestType; /*the first byte of a scanline will be the filter type*/
-        for(x = 0; x < linebytes; x++) out[y * (linebytes + 1) + 1 + x] = attempt[bestType].data[x];
-      }
-    }
-
-    for(type = 0; type < 5; type++) ucvector_cleanup(&attempt[type]);
-  }
-  else if(strategy == LFS_ENTROPY)
-  {
-    float sum[5];
-    ucvector attempt[5]; /*five filtering attempts, one for each filter type*/
-    float smallest = 0;
-    unsigned type, bestType = 0;
-    unsigned count[256];
-
-    for(type = 0; type < 5; type++)
-    {
-      ucvector_init(&attempt[type]);
-      if(!ucvector_resize(&attempt[type], linebytes)) return 83; /*alloc fail*/
-    }
-
-    for(y = 0; y < h; y++)
-    {
-      /*try the 5 filter types*/
-      for(type = 0; type < 5; type++)
-      {
-        filterScanline(attempt[type].data, &in[y * linebytes], prevline, linebytes, bytewidth, type);
-        for(x = 0; x < 256; x++) count[x] = 0;
-        for(x = 0; x < linebytes; x++) count[attempt[type].data[x]]++;
-        count[type]++; /*the filter type itself is part of the scanline*/
-        sum[type] = 0;
-        for(x = 0; x < 256; x++)
-        {
-          float p = count[x] / (float)(linebytes + 1);
-          sum[type] += count[x] == 0 ? 0 : flog2(1 / p) * p;
-        }
-        /*check if this is smallest sum (or if type == 0 it's the first case so always store the values)*/
-        if(type == 0 || sum[type] < smallest)
-        {
-          bestType = type;
-          smallest = sum[type];
-        }
-      }
-
-      prevline = &in[y * linebytes];
-
-      /*now fill the out values*/
-      out[y * (linebytes + 1)] = bestType; /*the first byte of a scanline will be the filter type*/
-      for(x = 0; x < linebytes; x++) out[y * (linebytes + 1) + 1 + x] = attempt[bestType].data[x];
-    }
-
-    for(type = 0; type < 5; type++) ucvector_cleanup(&attempt[type]);
+    error = filterParallel(out, in, linebytes, bytewidth, h, strategy == LFS_ENTROPY, settings->filter_numthreads);
   }
   else if(strategy == LFS_PREDEFINED)
   {
@@ -5801,6 +8524,136 @@ unsigned lodepng_encode(unsigned char** out, size_t* outsize,
   return state->error;
 }
 
+#ifdef LODEPNG_COMPILE_ZLIB
+
+/*the filter type of every scanline of a frame: Sub costs a subtraction per byte, and turns the flat and
+the horizontally stretched parts of rendered frames into runs of zeros*/
+static const unsigned char FRAME_FILTER = 1;
+
+struct LodePNGFrameEncoder
+{
+  unsigned error; /*from lodepng_frame_encoder_new, every frame returns it*/
+  unsigned w, h;
+  unsigned bpp;
+  size_t linebytes; /*bytes of a scanline in the PNG, without filter type*/
+  size_t bytewidth;
+  unsigned char* padded; /*the frame with its scanlines padded to whole bytes, if bpp < 8 requires it*/
+  unsigned char* filtered; /*the scanlines with their filter type byte*/
+  size_t filteredsize;
+  unsigned char* png; /*the signature and IHDR, followed by the IDAT and IEND chunks of the last frame*/
+};
+
+LodePNGFrameEncoder* lodepng_frame_encoder_new(unsigned w, unsigned h, LodePNGColorType colortype, unsigned bitdepth)
+{
+  LodePNGFrameEncoder* encoder = (LodePNGFrameEncoder*)mymalloc(sizeof(LodePNGFrameEncoder));
+  LodePNGColorMode color;
+  ucvector header;
+  size_t idatsize;
+
+  if(!encoder) return 0;
+  memset(encoder, 0, sizeof(LodePNGFrameEncoder));
+  encoder->w = w;
+  encoder->h = h;
+  encoder->error = checkColorValidity(colortype, bitdepth);
+  if(!encoder->error && colortype == LCT_PALETTE) encoder->error = 68; /*there is no palette for the indices*/
+  /*an empty scanline has no room for the first pixel of filterScanline, and IHDR forbids 0*/
+  if(!encoder->error && (w == 0 || h == 0)) encoder->error = 93;
+  if(encoder->error) return encoder;
+
+  lodepng_color_mode_init(&color);
+  color.colortype = colortype;
+  color.bitdepth = bitdepth;
+  encoder->bpp = lodepng_get_bpp(&color);
+  encoder->linebytes = ((size_t)w * encoder->bpp + 7) / 8;
+  encoder->bytewidth = (encoder->bpp + 7) / 8;
+  encoder->filteredsize = h * (encoder->linebytes + 1);
+  /*the zlib header and adler32 take 6 bytes besides the deflate data*/
+  idatsize = deflateFixedRunsBound(encoder->filteredsize) + 6;
+  if(idatsize > 2147483647)
+  {
+    encoder->error = 63; /*the frame may not fit in one IDAT chunk*/
+    return encoder;
+  }
+
+  encoder->filtered = (unsigned char*)mymalloc(encoder->filteredsize);
+  encoder->png = (unsigned char*)mymalloc(33 + 12 + idatsize + 12);
+  if(encoder->bpp < 8 && (size_t)w * encoder->bpp != encoder->linebytes * 8)
+  {
+    encoder->padded = (unsigned char*)mymalloc(h * encoder->linebytes);
+    if(!encoder->padded) encoder->error = 83; /*alloc fail*/
+  }
+  if(!encoder->filtered || !encoder->png) encoder->error = 83; /*alloc fail*/
+
+  /*the signature and IHDR chunk are the same for every frame*/
+  ucvector_init(&header);
+  if(!encoder->error)
+  {
+    writeSignature(&header);
+    encoder->error = addChunk_IHDR(&header, w, h, colortype, bitdepth, 0);
+  }
+  if(!encoder->error) memcpy(encoder->png, header.data, 33);
+  ucvector_cleanup(&header);
+
+  return encoder;
+}
+
+void lodepng_frame_encoder_delete(LodePNGFrameEncoder* encoder)
+{
+  if(!encoder) return;
+  myfree(encoder->padded);
+  myfree(encoder->filtered);
+  myfree(encoder->png);
+  myfree(encoder);
+}
+
+unsigned lodepng_frame_encode(LodePNGFrameEncoder* encoder, const unsigned char** out, size_t* outsize,
+                              const unsigned char* image)
+{
+  const unsigned char* in = image;
+  unsigned char* chunk;
+  size_t linebytes = encoder->linebytes, datasize;
+  unsigned y;
+
+  *out = 0;
+  *outsize = 0;
+  if(encoder->error) return encoder->error;
+
+  if(encoder->padded)
+  {
+    addPaddingBits(encoder->padded, image, linebytes * 8, (size_t)encoder->w * encoder->bpp, encoder->h);
+    in = encoder->padded;
+  }
+  for(y = 0; y < encoder->h; y++)
+  {
+    unsigned char* line = &encoder->filtered[y * (linebytes + 1)];
+    line[0] = FRAME_FILTER;
+    filterScanline(&line[1], &in[y * linebytes], y ? &in[(y - 1) * linebytes] : 0,
+                   linebytes, encoder->bytewidth, FRAME_FILTER);
+  }
+
+  /*the IDAT chunk holds the zlib header that lodepng_zlib_compress writes, the deflate data and the adler32*/
+  chunk = &encoder->png[33];
+  chunk[8] = 120;
+  chunk[9] = 1;
+  datasize = 2 + deflateFixedRuns(&chunk[10], encoder->filtered, encoder->filteredsize, 3);
+  lodepng_set32bitInt(&chunk[8 + datasize], adler32(encoder->filtered, (unsigned)encoder->filteredsize));
+  datasize += 4;
+  lodepng_set32bitInt(chunk, (unsigned)datasize);
+  memcpy(&chunk[4], "IDAT", 4);
+  lodepng_chunk_generate_crc(chunk);
+
+  chunk = &chunk[12 + datasize];
+  lodepng_set32bitInt(chunk, 0);
+  memcpy(&chunk[4], "IEND", 4);
+  lodepng_chunk_generate_crc(chunk);
+
+  *out = encoder->png;
+  *outsize = (size_t)(&chunk[12] - encoder->png);
+  return 0;
+}
+
+#endif /*LODEPNG_COMPILE_ZLIB*/
+
 unsigned lodepng_encode_memory(unsigned char** out, size_t* outsize, const unsigned char* image,
                                unsigned w, unsigned h, LodePNGColorType colortype, unsigned bitdepth)
 {
@@ -5855,6 +8708,7 @@ void lodepng_encoder_settings_init(LodePNGEncoderSettings* settings)
   lodepng_compress_settings_init(&settings->zlibsettings);
   settings->filter_palette_zero = 1;
   settings->filter_strategy = LFS_MINSUM;
+  settings->filter_numthreads = 0;
   settings->auto_convert = LAC_AUTO;
   settings->force_palette = 0;
   settings->predefined_filters = 0;
@@ -5969,6 +8823,10 @@ const char* lodepng_error_text(unsigned code)
     case 87: return "must provide custom zlib function pointer if LODEPNG_COMPILE_ZLIB is not defined";
     case 88: return "invalid filter strategy given for LodePNGEncoderSettings.filter_strategy";
     case 89: return "text chunk keyword too short or long: must have size 1-79";
+    case 90: return "the image data ends before the last scanline";
+    case 91: return "invalid match finder given in the settings of the encoder (only 0, 1, 2 and 3 are allowed)";
+    case 92: return "the output buffer given in the decoder settings is too small for the image";
+    case 93: return "zero width or height is invalid";
   }
   return "unknown error code";
 }
@@ -6019,7 +8877,7 @@ unsigned decompress(std::vector<unsigned char>& out, const unsigned char* in, si
   if(buffer)
   {
     out.insert(out.end(), &buffer[0], &buffer[buffersize]);
-    myfree(buffer);
+    allocatorFree(settings.allocator, buffer);
   }
   return error;
 }
@@ -6114,8 +8972,8 @@ unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h,
   {
     size_t buffersize = lodepng_get_raw_size(w, h, &state.info_raw);
     out.insert(out.end(), &buffer[0], &buffer[buffersize]);
-    myfree(buffer);
   }
+  if(buffer != state.decoder.out_buffer) allocatorFree(state.decoder.zlibsettings.allocator, buffer);
   return error;
 }
 
@@ -0,0 +1,33 @@
+#if !defined(BENCH_COMMON_H)
+#define BENCH_COMMON_H
+
+#include <cstddef>
+#include "file_stamp.h"
+#include "model_obj.h"
+
+//-----------------------------------------------------------------------------
+// Helpers shared by the OBJ import drivers.
+//
+// hashModel() returns a checksum of the vertex attributes and the index
+// buffer of an imported model, so that different loaders, thread counts or
+// builds can be checked for identical output.
+//-----------------------------------------------------------------------------
+
+inline unsigned long long hashModel(const ModelOBJ &model)
+{
+    unsigned long long hash = HASH_SEED;
+
+    for (int i = 0; i < model.getNumberOfVertices(); ++i)
+    {
+        const ModelOBJ::Vertex &vertex = model.getVertex(i);
+
+        hash = hashBytes(hash, vertex.position, sizeof(vertex.position));
+        hash = hashBytes(hash, vertex.texCoord, sizeof(vertex.texCoord));
+        hash = hashBytes(hash, vertex.normal, sizeof(vertex.normal));
+    }
+
+    return hashBytes(hash, model.getIndexBuffer(),
+        model.getNumberOfIndices() * sizeof(int));
+}
+
+#endif
@@ -0,0 +1,175 @@
+//-----------------------------------------------------------------------------
+// Timing driver for lodepng's inflate.
+//
+// Extracts the zlib stream from the IDAT chunks of each PNG file given on
+// the command line (the House textures by default) and decompresses all of
+// them several times with lodepng_zlib_decompress. Prints the best time,
+// the throughput and a checksum of the decompressed data, so two builds can
+// be checked for identical output. A full lodepng::decode of the same files
+// is timed as well.
+//
+// Build and run from inf251_tutorial/:
+//
+//   g++ -std=c++11 -O2 -I. bench/inflate_bench.cpp lodepng.cpp
+//
+// To compare with the inflate that walked the Huffman tree one bit at a
+// time, build the same driver against lodepng before the lookup tables:
+//
+//   mkdir legacy
+//   git show cabc5e4^:inf251_tutorial/lodepng.h > legacy/lodepng.h
+//   git show cabc5e4^:inf251_tutorial/lodepng.cpp > legacy/lodepng.cpp
+//   g++ -std=c++11 -O2 -Ilegacy -I. bench/inflate_bench.cpp legacy/lodepng.cpp
+//-----------------------------------------------------------------------------
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "file_stamp.h"
+#include "lodepng.h"
+
+namespace
+{
+    const int NUMBER_OF_RUNS = 5;
+
+    const char *DEFAULT_FILES[] =
+    {
+        "House-Model/House/Formica_Speckled_Grey.png",
+        "House-Model/House/M_20160830_1.png",
+        "House-Model/House/M_20160906_161400.png",
+        "House-Model/House/M_20160906_161400___Copy.png",
+        "House-Model/House/M_20160906_161428___Copy.png",
+        "House-Model/House/M_20160906_161505___Copy__2_.png",
+        "House-Model/House/M_20160906_162044___Copy.png",
+        "House-Model/House/Metal_Aluminum_Anodized.png",
+        "House-Model/House/Metal_Rough.png",
+        "House-Model/House/Roofing_Shingles_GAF_Estates.png",
+        "House-Model/House/Stone_Brushed_Khaki.png",
+        "House-Model/House/Translucent_Glass_Gold.png",
+        "House-Model/House/Translucent_Glass_Tinted.png",
+        "House-Model/House/basic_realistic.png",
+        "House-Model/House/basic_realistic1.png",
+        "House-Model/House/basic_realistic2.png",
+        "House-Model/House/realistic2_2.png",
+        "House-Model/House/texture_brick_shadowed.png"
+    };
+
+    struct PngFile
+    {
+        const char *pszFilename;
+        std::vector<unsigned char> png;
+        std::vector<unsigned char> zlib;    // concatenated IDAT data
+    };
+
+    bool loadPng(const char *pszFilename, PngFile &file)
+    {
+        file.pszFilename = pszFilename;
+
+        lodepng::load_file(file.png, pszFilename);
+
+        if (file.png.size() < 8)
+            return false;
+
+        unsigned char *pChunk = &file.png[8];
+        unsigned char *pEnd = &file.png[0] + file.png.size();
+
+        while (pEnd - pChunk >= 12)
+        {
+            size_t length = lodepng_chunk_length(pChunk);
+
+            if (length > static_cast<size_t>(pEnd - pChunk) - 12)
+                return false;
+
+            if (lodepng_chunk_type_equals(pChunk, "IDAT"))
+                file.zlib.insert(file.zlib.end(), pChunk + 8, pChunk + 8 + length);
+
+            if (lodepng_chunk_type_equals(pChunk, "IEND"))
+                break;
+
+            pChunk = lodepng_chunk_next(pChunk);
+        }
+
+        return !file.zlib.empty();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<PngFile> files;
+    int numFiles = (argc > 1) ? argc - 1 : static_cast<int>(sizeof(DEFAULT_FILES) / sizeof(DEFAULT_FILES[0]));
+
+    for (int i = 0; i < numFiles; ++i)
+    {
+        PngFile file;
+        const char *pszFilename = (argc > 1) ? argv[i + 1] : DEFAULT_FILES[i];
+
+        if (!loadPng(pszFilename, file))
+        {
+            std::printf("%s: no IDAT data\n", pszFilename);
+            return 1;
+        }
+
+        files.push_back(file);
+    }
+
+    double bestInflate = 0.0;
+    double bestDecode = 0.0;
+    size_t totalSize = 0;
+    unsigned long long hash = HASH_SEED;
+
+    for (int run = 0; run < NUMBER_OF_RUNS; ++run)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        totalSize = 0;
+
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            unsigned char *pOut = 0;
+            size_t outSize = 0;
+            unsigned error = lodepng_zlib_decompress(&pOut, &outSize, &files[i].zlib[0],
+                files[i].zlib.size(), &lodepng_default_decompress_settings);
+
+            if (error)
+            {
+                std::printf("%s: %s\n", files[i].pszFilename, lodepng_error_text(error));
+                return 1;
+            }
+
+            if (run == 0)
+                hash = hashBytes(hash, pOut, outSize);
+
+            totalSize += outSize;
+            free(pOut);
+        }
+
+        double ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+
+        if (run == 0 || ms < bestInflate)
+            bestInflate = ms;
+
+        start = std::chrono::steady_clock::now();
+
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            std::vector<unsigned char> image;
+            unsigned width = 0;
+            unsigned height = 0;
+
+            lodepng::decode(image, width, height, files[i].png);
+        }
+
+        ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+
+        if (run == 0 || ms < bestDecode)
+            bestDecode = ms;
+    }
+
+    std::printf("%d files: inflate %.1f ms (best of %d), %.1f MB out, %.0f MB/s, checksum %016llx\n",
+        numFiles, bestInflate, NUMBER_OF_RUNS, totalSize / 1048576.0,
+        totalSize / 1048576.0 / (bestInflate / 1000.0), hash);
+    std::printf("%d files: full decode %.1f ms (best of %d)\n", numFiles, bestDecode, NUMBER_OF_RUNS);
+    return 0;
+}
@@ -0,0 +1,88 @@
+//-----------------------------------------------------------------------------
+// Timing driver for ModelOBJ::import.
+//
+// Imports each OBJ file given on the command line (House.obj and
+// capsule.obj by default) several times on one thread and prints the best
+// time. The binary cache is disabled, so the OBJ file is parsed every time.
+// The checksum covers the vertex attributes and the index buffer, so both
+// loaders can be checked for identical output.
+//
+// Build and run from inf251_tutorial/:
+//
+//   g++ -std=c++11 -O2 -I. bench/obj_import_bench.cpp model_obj.cpp -pthread
+//
+// To compare with the two-pass fscanf loader that the single-pass importer
+// replaced, build the same driver against the loader of the baseline:
+//
+//   mkdir legacy
+//   git show 2201935:inf251_tutorial/model_obj.h > legacy/model_obj.h
+//   git show 2201935:inf251_tutorial/model_obj.cpp > legacy/model_obj.cpp
+//   g++ -std=c++11 -O2 -DOBJ_BENCH_LEGACY -Ilegacy -I. bench/obj_import_bench.cpp legacy/model_obj.cpp
+//-----------------------------------------------------------------------------
+
+#include <chrono>
+#include <cstdio>
+#include "bench_common.h"
+
+namespace
+{
+    const int NUMBER_OF_RUNS = 5;
+
+    bool benchmark(const char *pszFilename)
+    {
+        double best = 0.0;
+        unsigned long long hash = 0;
+        int vertices = 0;
+        int triangles = 0;
+
+        for (int run = 0; run < NUMBER_OF_RUNS; ++run)
+        {
+            ModelOBJ model;
+
+#if !defined(OBJ_BENCH_LEGACY)
+            model.setBinaryCacheEnabled(false);
+#endif
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+            if (!model.import(pszFilename))
+            {
+                std::printf("%s: import failed\n", pszFilename);
+                return false;
+            }
+
+            double ms = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+
+            if (run == 0 || ms < best)
+                best = ms;
+
+            hash = hashModel(model);
+            vertices = model.getNumberOfVertices();
+            triangles = model.getNumberOfTriangles();
+        }
+
+        std::printf("%s: %.1f ms (best of %d), %d vertices, %d triangles, checksum %016llx\n",
+            pszFilename, best, NUMBER_OF_RUNS, vertices, triangles, hash);
+        return true;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *defaultFiles[] = { "House-Model/House.obj", "capsule/capsule.obj" };
+    bool ok = true;
+
+    if (argc > 1)
+    {
+        for (int i = 1; i < argc; ++i)
+            ok = benchmark(argv[i]) && ok;
+    }
+    else
+    {
+        for (int i = 0; i < 2; ++i)
+            ok = benchmark(defaultFiles[i]) && ok;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,106 @@
+//-----------------------------------------------------------------------------
+// Thread scaling driver for the parallel OBJ import.
+//
+// Imports each OBJ file given on the command line (House.obj by default)
+// with 1, 2, 4, ... threads up to the number of hardware threads and prints
+// the best time of each count with its speedup over one thread. The binary
+// cache is disabled, so the OBJ file is parsed every time. Every count must
+// give the same checksum as the serial import.
+//
+// Build and run from inf251_tutorial/:
+//
+//   g++ -std=c++11 -O2 -I. bench/obj_threads_bench.cpp model_obj.cpp -pthread
+//-----------------------------------------------------------------------------
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include "bench_common.h"
+
+namespace
+{
+    const int NUMBER_OF_RUNS = 5;
+
+    // Returns the best time in milliseconds, or a negative value on failure.
+    double importBest(const char *pszFilename, int numThreads, unsigned long long &hash)
+    {
+        double best = -1.0;
+
+        for (int run = 0; run < NUMBER_OF_RUNS; ++run)
+        {
+            ModelOBJ model;
+            model.setBinaryCacheEnabled(false);
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+            if (!model.import(pszFilename, false, numThreads))
+                return -1.0;
+
+            double ms = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+
+            if (best < 0.0 || ms < best)
+                best = ms;
+
+            hash = hashModel(model);
+        }
+
+        return best;
+    }
+
+    bool benchmark(const char *pszFilename)
+    {
+        int maxThreads = std::max(2, static_cast<int>(std::thread::hardware_concurrency()));
+        unsigned long long serialHash = 0;
+        double serial = importBest(pszFilename, 1, serialHash);
+        bool identical = true;
+
+        if (serial < 0.0)
+        {
+            std::printf("%s: import failed\n", pszFilename);
+            return false;
+        }
+
+        std::printf("%s\n  threads  1: %8.1f ms\n", pszFilename, serial);
+
+        for (int numThreads = 2; numThreads <= maxThreads; numThreads *= 2)
+        {
+            unsigned long long hash = 0;
+            double ms = importBest(pszFilename, numThreads, hash);
+
+            if (ms < 0.0)
+            {
+                std::printf("  threads %2d: import failed\n", numThreads);
+                return false;
+            }
+
+            std::printf("  threads %2d: %8.1f ms  %.2fx%s\n", numThreads, ms, serial / ms,
+                hash == serialHash ? "" : "  OUTPUT DIFFERS");
+            identical = identical && hash == serialHash;
+
+            // Also measure every hardware thread if that isn't a power of two.
+            if (numThreads < maxThreads && numThreads * 2 > maxThreads)
+                numThreads = maxThreads / 2;
+        }
+
+        return identical;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    bool ok = true;
+
+    if (argc > 1)
+    {
+        for (int i = 1; i < argc; ++i)
+            ok = benchmark(argv[i]) && ok;
+    }
+    else
+    {
+        ok = benchmark("House-Model/House.obj");
+    }
+
+    return ok ? 0 : 1;
+}
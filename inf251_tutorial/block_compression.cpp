@@ -0,0 +1,1074 @@
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include "block_compression.h"
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define BLOCK_COMPRESSION_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    // The texels of a block, one array per channel so that four texels can
+    // be processed at once with SSE.
+    struct Block
+    {
+        float channels[4][16];
+    };
+
+    // Interpolation weights of the palette entries, from the first endpoint
+    // (0) to the second (1).
+    // A negative weight marks a fixed palette entry (black, 0 or 255) that
+    // doesn't lie between the endpoints.
+    const float BC1_WEIGHTS[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+    const float BC1_THREE_COLOR_WEIGHTS[4] = {0.0f, 1.0f, 0.5f, -1.0f};
+    const float BC3_ALPHA_WEIGHTS[8] =
+    {
+        0.0f, 1.0f, 1.0f / 7.0f, 2.0f / 7.0f, 3.0f / 7.0f, 4.0f / 7.0f, 5.0f / 7.0f, 6.0f / 7.0f
+    };
+    const float BC3_SIX_ALPHA_WEIGHTS[8] =
+    {
+        0.0f, 1.0f, 1.0f / 5.0f, 2.0f / 5.0f, 3.0f / 5.0f, 4.0f / 5.0f, -1.0f, -1.0f
+    };
+
+    // Quality levels that add a step beyond one more least squares
+    // refinement.
+    const int QUALITY_EXTRA_MODES = 3;
+    const int QUALITY_PERTURB = 4;
+
+    // Rounds of the endpoint search at QUALITY_PERTURB.
+    const int PERTURB_ROUNDS = 8;
+    const int BC7_WEIGHTS[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+    template <typename Func>
+    void parallelFor(int numThreads, int count, Func func)
+    {
+        std::atomic<int> next(0);
+        std::vector<std::thread> workers;
+
+        auto worker = [&]()
+        {
+            for (int i = next++; i < count; i = next++)
+                func(i);
+        };
+
+        for (int i = 1; i < std::min(numThreads, count); ++i)
+            workers.push_back(std::thread(worker));
+
+        worker();
+
+        for (size_t i = 0; i < workers.size(); ++i)
+            workers[i].join();
+    }
+
+    float clampColor(float value)
+    {
+        return std::min(std::max(value, 0.0f), 255.0f);
+    }
+
+    //-------------------------------------------------------------------------
+    // Endpoint fitting shared by all formats.
+    //-------------------------------------------------------------------------
+
+    // Fits a line through the texels along their principal axis and returns
+    // the extent of their projections onto it.
+    void computeRange(const Block &block, int channels, float *pStart, float *pEnd)
+    {
+        float mean[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+
+        for (int c = 0; c < channels; ++c)
+        {
+            for (int i = 0; i < 16; ++i)
+                mean[c] += block.channels[c][i];
+
+            mean[c] /= 16.0f;
+        }
+
+        float covariance[4][4] = {};
+
+        for (int i = 0; i < 16; ++i)
+        {
+            for (int c = 0; c < channels; ++c)
+            {
+                for (int d = c; d < channels; ++d)
+                {
+                    covariance[c][d] += (block.channels[c][i] - mean[c])
+                        * (block.channels[d][i] - mean[d]);
+                }
+            }
+        }
+
+        for (int c = 0; c < channels; ++c)
+        {
+            for (int d = 0; d < c; ++d)
+                covariance[c][d] = covariance[d][c];
+        }
+
+        // Power iteration, starting from the diagonal so that a block with a
+        // gradient in a single channel converges at once.
+
+        float axis[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+
+        for (int c = 0; c < channels; ++c)
+            axis[c] = covariance[c][c];
+
+        for (int iteration = 0; iteration < 8; ++iteration)
+        {
+            float next[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+            float length = 0.0f;
+
+            for (int c = 0; c < channels; ++c)
+            {
+                for (int d = 0; d < channels; ++d)
+                    next[c] += covariance[c][d] * axis[d];
+
+                length = std::max(length, fabsf(next[c]));
+            }
+
+            if (length < FLT_EPSILON)
+                break;
+
+            for (int c = 0; c < channels; ++c)
+                axis[c] = next[c] / length;
+        }
+
+        float length = 0.0f;
+
+        for (int c = 0; c < channels; ++c)
+            length += axis[c] * axis[c];
+
+        float low = 0.0f;
+        float high = 0.0f;
+
+        if (length > FLT_EPSILON)
+        {
+            length = 1.0f / sqrtf(length);
+
+            for (int c = 0; c < channels; ++c)
+                axis[c] *= length;
+
+            low = FLT_MAX;
+            high = -FLT_MAX;
+
+            for (int i = 0; i < 16; ++i)
+            {
+                float t = 0.0f;
+
+                for (int c = 0; c < channels; ++c)
+                    t += (block.channels[c][i] - mean[c]) * axis[c];
+
+                low = std::min(low, t);
+                high = std::max(high, t);
+            }
+        }
+
+        for (int c = 0; c < channels; ++c)
+        {
+            pStart[c] = clampColor(mean[c] + low * axis[c]);
+            pEnd[c] = clampColor(mean[c] + high * axis[c]);
+        }
+    }
+
+    // Picks the nearest palette entry for every texel and returns the sum of
+    // the squared errors.
+    float selectIndices(const Block &block, const float (*pPalette)[4], int paletteSize,
+                        int channels, unsigned char *pIndices)
+    {
+        float error = 0.0f;
+
+#if defined(BLOCK_COMPRESSION_USE_SSE2)
+        for (int i = 0; i < 16; i += 4)
+        {
+            __m128 texels[4];
+
+            for (int c = 0; c < channels; ++c)
+                texels[c] = _mm_loadu_ps(&block.channels[c][i]);
+
+            __m128 best = _mm_set1_ps(FLT_MAX);
+            __m128i bestIndex = _mm_setzero_si128();
+
+            for (int j = 0; j < paletteSize; ++j)
+            {
+                __m128 distance = _mm_setzero_ps();
+
+                for (int c = 0; c < channels; ++c)
+                {
+                    __m128 delta = _mm_sub_ps(texels[c], _mm_set1_ps(pPalette[j][c]));
+                    distance = _mm_add_ps(distance, _mm_mul_ps(delta, delta));
+                }
+
+                __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+
+                best = _mm_min_ps(best, distance);
+                bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(j)),
+                    _mm_andnot_si128(closer, bestIndex));
+            }
+
+            float distances[4];
+            int indices[4];
+
+            _mm_storeu_ps(distances, best);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(indices), bestIndex);
+
+            for (int k = 0; k < 4; ++k)
+            {
+                pIndices[i + k] = static_cast<unsigned char>(indices[k]);
+                error += distances[k];
+            }
+        }
+#else
+        for (int i = 0; i < 16; ++i)
+        {
+            float best = FLT_MAX;
+
+            for (int j = 0; j < paletteSize; ++j)
+            {
+                float distance = 0.0f;
+
+                for (int c = 0; c < channels; ++c)
+                {
+                    float delta = block.channels[c][i] - pPalette[j][c];
+                    distance += delta * delta;
+                }
+
+                if (distance < best)
+                {
+                    best = distance;
+                    pIndices[i] = static_cast<unsigned char>(j);
+                }
+            }
+
+            error += best;
+        }
+#endif
+
+        return error;
+    }
+
+    // Solves for the endpoints that best reproduce the texels with the given
+    // indices in the least squares sense. Texels whose index has a negative
+    // weight are left out. Returns false if all other texels use the same
+    // weight.
+    bool refineEndpoints(const Block &block, int firstChannel, int channels,
+                         const unsigned char *pIndices, const float *pWeights,
+                         float *pStart, float *pEnd)
+    {
+        float aa = 0.0f;
+        float bb = 0.0f;
+        float ab = 0.0f;
+        float ax[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        float bx[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+
+        for (int i = 0; i < 16; ++i)
+        {
+            float b = pWeights[pIndices[i]];
+            float a = 1.0f - b;
+
+            if (b < 0.0f)
+                continue;
+
+            aa += a * a;
+            bb += b * b;
+            ab += a * b;
+
+            for (int c = 0; c < channels; ++c)
+            {
+                ax[c] += a * block.channels[firstChannel + c][i];
+                bx[c] += b * block.channels[firstChannel + c][i];
+            }
+        }
+
+        float det = aa * bb - ab * ab;
+
+        if (fabsf(det) < 1e-6f)
+            return false;
+
+        det = 1.0f / det;
+
+        for (int c = 0; c < channels; ++c)
+        {
+            pStart[c] = clampColor((ax[c] * bb - bx[c] * ab) * det);
+            pEnd[c] = clampColor((bx[c] * aa - ax[c] * ab) * det);
+        }
+
+        return true;
+    }
+
+    //-------------------------------------------------------------------------
+    // BC1 color blocks.
+    //-------------------------------------------------------------------------
+
+    unsigned short packColor(const float *pColor)
+    {
+        int r = static_cast<int>(pColor[0] * 31.0f / 255.0f + 0.5f);
+        int g = static_cast<int>(pColor[1] * 63.0f / 255.0f + 0.5f);
+        int b = static_cast<int>(pColor[2] * 31.0f / 255.0f + 0.5f);
+
+        return static_cast<unsigned short>((r << 11) | (g << 5) | b);
+    }
+
+    void unpackColor(unsigned short color, int *pColor)
+    {
+        int r = (color >> 11) & 31;
+        int g = (color >> 5) & 63;
+        int b = color & 31;
+
+        pColor[0] = (r << 3) | (r >> 2);
+        pColor[1] = (g << 2) | (g >> 4);
+        pColor[2] = (b << 3) | (b >> 2);
+    }
+
+    // The four colors of a block, with the third and fourth interpolated
+    // when color0 > color1. Otherwise the third is the average and the
+    // fourth is black.
+    void getColorPalette(unsigned short color0, unsigned short color1, bool fourColors,
+                         int (*pPalette)[4])
+    {
+        unpackColor(color0, pPalette[0]);
+        unpackColor(color1, pPalette[1]);
+
+        for (int c = 0; c < 3; ++c)
+        {
+            int c0 = pPalette[0][c];
+            int c1 = pPalette[1][c];
+
+            if (fourColors)
+            {
+                pPalette[2][c] = (2 * c0 + c1) / 3;
+                pPalette[3][c] = (c0 + 2 * c1) / 3;
+            }
+            else
+            {
+                pPalette[2][c] = (c0 + c1) / 2;
+                pPalette[3][c] = 0;
+            }
+        }
+    }
+
+    // Selects the indices for a pair of colors in the four color mode or
+    // in the three color mode, whose fourth entry is black.
+    float evaluateColors(const Block &block, unsigned short color0, unsigned short color1,
+                         bool threeColors, unsigned char *pIndices)
+    {
+        int palette[4][4];
+        float paletteValues[4][4];
+
+        getColorPalette(color0, color1, !threeColors, palette);
+
+        for (int j = 0; j < 4; ++j)
+        {
+            for (int c = 0; c < 3; ++c)
+                paletteValues[j][c] = static_cast<float>(palette[j][c]);
+        }
+
+        return selectIndices(block, paletteValues, 4, 3, pIndices);
+    }
+
+    // Fits the colors of a mode from the principal axis, followed by up to
+    // numRefinements least squares refinements. Keeps the result if it
+    // beats bestError.
+    bool fitColors(const Block &block, bool threeColors, int numRefinements,
+                   unsigned short &best0, unsigned short &best1,
+                   unsigned char *pBestIndices, float &bestError)
+    {
+        const float *pWeights = threeColors ? BC1_THREE_COLOR_WEIGHTS : BC1_WEIGHTS;
+        float start[4];
+        float end[4];
+        unsigned char indices[16];
+        bool improved = false;
+
+        computeRange(block, 3, start, end);
+
+        for (int pass = 0; pass <= numRefinements; ++pass)
+        {
+            unsigned short color0 = packColor(start);
+            unsigned short color1 = packColor(end);
+            float error = evaluateColors(block, color0, color1, threeColors, indices);
+
+            if (error < bestError)
+            {
+                bestError = error;
+                best0 = color0;
+                best1 = color1;
+                memcpy(pBestIndices, indices, sizeof(indices));
+                improved = true;
+            }
+
+            if (bestError == 0.0f || !refineEndpoints(block, 0, 3, indices, pWeights, start, end))
+                break;
+        }
+
+        return improved;
+    }
+
+    // Moves each channel of each endpoint one step up and down and keeps
+    // every change that lowers the error, until none does.
+    void perturbColors(const Block &block, bool threeColors, unsigned short &best0,
+                       unsigned short &best1, unsigned char *pBestIndices, float &bestError)
+    {
+        static const int SHIFTS[3] = {11, 5, 0};
+        static const int MASKS[3] = {31, 63, 31};
+        bool improved = true;
+
+        for (int round = 0; round < PERTURB_ROUNDS && improved && bestError > 0.0f; ++round)
+        {
+            improved = false;
+
+            for (int k = 0; k < 12; ++k)
+            {
+                unsigned short colors[2] = {best0, best1};
+                int e = k / 6;
+                int c = (k / 2) % 3;
+                int value = ((colors[e] >> SHIFTS[c]) & MASKS[c]) + ((k & 1) ? 1 : -1);
+
+                if (value < 0 || value > MASKS[c])
+                    continue;
+
+                colors[e] = static_cast<unsigned short>((colors[e] & ~(MASKS[c] << SHIFTS[c]))
+                    | (value << SHIFTS[c]));
+
+                unsigned char indices[16];
+                float error = evaluateColors(block, colors[0], colors[1], threeColors, indices);
+
+                if (error < bestError)
+                {
+                    bestError = error;
+                    best0 = colors[0];
+                    best1 = colors[1];
+                    memcpy(pBestIndices, indices, sizeof(indices));
+                    improved = true;
+                }
+            }
+        }
+    }
+
+    // BC3 color blocks always decode with four colors, so the three color
+    // mode is only allowed for BC1.
+    void encodeColorBlock(const Block &block, int quality, bool allowThreeColors,
+                          unsigned char *pOut)
+    {
+        unsigned char bestIndices[16];
+        unsigned short best0 = 0;
+        unsigned short best1 = 0;
+        float bestError = FLT_MAX;
+        bool threeColors = false;
+
+        fitColors(block, false, quality, best0, best1, bestIndices, bestError);
+
+        if (quality >= QUALITY_EXTRA_MODES && allowThreeColors && bestError > 0.0f)
+        {
+            threeColors = fitColors(block, true, quality, best0, best1, bestIndices, bestError);
+        }
+
+        if (quality >= QUALITY_PERTURB)
+            perturbColors(block, threeColors, best0, best1, bestIndices, bestError);
+
+        // The interpolated palette needs color0 > color1 and the three color
+        // palette color0 <= color1. Swapping the endpoints swaps indices 0
+        // and 1, and in the four color mode also 2 and 3.
+
+        if (threeColors)
+        {
+            if (best0 > best1)
+            {
+                std::swap(best0, best1);
+
+                for (int i = 0; i < 16; ++i)
+                {
+                    if (bestIndices[i] < 2)
+                        bestIndices[i] ^= 1;
+                }
+            }
+        }
+        else if (best0 < best1)
+        {
+            std::swap(best0, best1);
+
+            for (int i = 0; i < 16; ++i)
+                bestIndices[i] ^= 1;
+        }
+        else if (best0 == best1)
+        {
+            memset(bestIndices, 0, sizeof(bestIndices));
+        }
+
+        unsigned int bits = 0;
+
+        for (int i = 0; i < 16; ++i)
+            bits |= bestIndices[i] << (i * 2);
+
+        pOut[0] = static_cast<unsigned char>(best0);
+        pOut[1] = static_cast<unsigned char>(best0 >> 8);
+        pOut[2] = static_cast<unsigned char>(best1);
+        pOut[3] = static_cast<unsigned char>(best1 >> 8);
+
+        for (int i = 0; i < 4; ++i)
+            pOut[4 + i] = static_cast<unsigned char>(bits >> (i * 8));
+    }
+
+    void decodeColorBlock(const unsigned char *pIn, bool alwaysFourColors, unsigned char *pRgba)
+    {
+        unsigned short color0 = static_cast<unsigned short>(pIn[0] | (pIn[1] << 8));
+        unsigned short color1 = static_cast<unsigned short>(pIn[2] | (pIn[3] << 8));
+        unsigned int bits = pIn[4] | (pIn[5] << 8) | (pIn[6] << 16)
+            | (static_cast<unsigned int>(pIn[7]) << 24);
+        int palette[4][4];
+
+        getColorPalette(color0, color1, alwaysFourColors || color0 > color1, palette);
+
+        for (int i = 0; i < 16; ++i)
+        {
+            const int *pColor = palette[(bits >> (i * 2)) & 3];
+
+            pRgba[i * 4 + 0] = static_cast<unsigned char>(pColor[0]);
+            pRgba[i * 4 + 1] = static_cast<unsigned char>(pColor[1]);
+            pRgba[i * 4 + 2] = static_cast<unsigned char>(pColor[2]);
+            pRgba[i * 4 + 3] = 255;
+        }
+    }
+
+    //-------------------------------------------------------------------------
+    // BC3 alpha blocks.
+    //-------------------------------------------------------------------------
+
+    // The eight alpha values of a block: interpolated in seven steps when
+    // alpha0 > alpha1, otherwise in five steps followed by 0 and 255.
+    void getAlphaPalette(int alpha0, int alpha1, int *pPalette)
+    {
+        pPalette[0] = alpha0;
+        pPalette[1] = alpha1;
+
+        if (alpha0 > alpha1)
+        {
+            for (int i = 1; i < 7; ++i)
+                pPalette[i + 1] = ((7 - i) * alpha0 + i * alpha1) / 7;
+        }
+        else
+        {
+            for (int i = 1; i < 5; ++i)
+                pPalette[i + 1] = ((5 - i) * alpha0 + i * alpha1) / 5;
+
+            pPalette[6] = 0;
+            pPalette[7] = 255;
+        }
+    }
+
+    float evaluateAlpha(const float *pAlpha, int alpha0, int alpha1, unsigned char *pIndices)
+    {
+        int palette[8];
+        float error = 0.0f;
+
+        getAlphaPalette(alpha0, alpha1, palette);
+
+        for (int i = 0; i < 16; ++i)
+        {
+            float nearest = FLT_MAX;
+
+            for (int j = 0; j < 8; ++j)
+            {
+                float delta = pAlpha[i] - palette[j];
+
+                if (delta * delta < nearest)
+                {
+                    nearest = delta * delta;
+                    pIndices[i] = static_cast<unsigned char>(j);
+                }
+            }
+
+            error += nearest;
+        }
+
+        return error;
+    }
+
+    // Fits alpha0 > alpha1 for the seven step mode, or alpha0 <= alpha1 for
+    // the five step mode with 0 and 255, from start and end followed by up
+    // to numRefinements least squares refinements.
+    void fitAlpha(const Block &block, bool sevenSteps, int numRefinements, float start, float end,
+                  int &best0, int &best1, unsigned char *pBestIndices, float &bestError)
+    {
+        const float *pWeights = sevenSteps ? BC3_ALPHA_WEIGHTS : BC3_SIX_ALPHA_WEIGHTS;
+        unsigned char indices[16];
+
+        for (int pass = 0; pass <= numRefinements; ++pass)
+        {
+            int alpha0 = static_cast<int>(start + 0.5f);
+            int alpha1 = static_cast<int>(end + 0.5f);
+
+            if ((alpha0 > alpha1) != sevenSteps)
+                break;
+
+            float error = evaluateAlpha(block.channels[3], alpha0, alpha1, indices);
+
+            if (error < bestError)
+            {
+                bestError = error;
+                best0 = alpha0;
+                best1 = alpha1;
+                memcpy(pBestIndices, indices, sizeof(indices));
+            }
+
+            if (bestError == 0.0f
+                || !refineEndpoints(block, 3, 1, indices, pWeights, &start, &end))
+                break;
+
+            if ((start < end) == sevenSteps)
+                std::swap(start, end);
+        }
+    }
+
+    void encodeAlphaBlock(const Block &block, int quality, unsigned char *pOut)
+    {
+        const float *pAlpha = block.channels[3];
+        float start = *std::max_element(pAlpha, pAlpha + 16);
+        float end = *std::min_element(pAlpha, pAlpha + 16);
+        unsigned char bestIndices[16];
+        int best0 = static_cast<int>(start);
+        int best1 = best0;
+        float bestError = evaluateAlpha(pAlpha, best0, best1, bestIndices);
+
+        if (start != end)
+        {
+            fitAlpha(block, true, quality, start, end, best0, best1, bestIndices, bestError);
+        }
+
+        // The five step mode spends its endpoints on the texels between 0
+        // and 255, which it represents exactly.
+
+        if (quality >= QUALITY_EXTRA_MODES && bestError > 0.0f)
+        {
+            float low = 255.0f;
+            float high = 0.0f;
+
+            for (int i = 0; i < 16; ++i)
+            {
+                if (pAlpha[i] > 0.0f && pAlpha[i] < 255.0f)
+                {
+                    low = std::min(low, pAlpha[i]);
+                    high = std::max(high, pAlpha[i]);
+                }
+            }
+
+            if (low > high)
+                low = high = 0.0f;
+
+            fitAlpha(block, false, quality, low, high, best0, best1, bestIndices, bestError);
+        }
+
+        if (quality >= QUALITY_PERTURB)
+        {
+            bool sevenSteps = best0 > best1;
+            bool improved = true;
+
+            for (int round = 0; round < PERTURB_ROUNDS && improved && bestError > 0.0f; ++round)
+            {
+                improved = false;
+
+                for (int k = 0; k < 4; ++k)
+                {
+                    int alpha[2] = {best0, best1};
+                    unsigned char indices[16];
+
+                    alpha[k / 2] += (k & 1) ? 1 : -1;
+
+                    if (alpha[k / 2] < 0 || alpha[k / 2] > 255 || (alpha[0] > alpha[1]) != sevenSteps)
+                        continue;
+
+                    float error = evaluateAlpha(pAlpha, alpha[0], alpha[1], indices);
+
+                    if (error < bestError)
+                    {
+                        bestError = error;
+                        best0 = alpha[0];
+                        best1 = alpha[1];
+                        memcpy(bestIndices, indices, sizeof(indices));
+                        improved = true;
+                    }
+                }
+            }
+        }
+
+        unsigned long long bits = 0;
+
+        for (int i = 0; i < 16; ++i)
+            bits |= static_cast<unsigned long long>(bestIndices[i]) << (i * 3);
+
+        pOut[0] = static_cast<unsigned char>(best0);
+        pOut[1] = static_cast<unsigned char>(best1);
+
+        for (int i = 0; i < 6; ++i)
+            pOut[2 + i] = static_cast<unsigned char>(bits >> (i * 8));
+    }
+
+    void decodeAlphaBlock(const unsigned char *pIn, unsigned char *pRgba)
+    {
+        unsigned long long bits = 0;
+        int palette[8];
+
+        for (int i = 0; i < 6; ++i)
+            bits |= static_cast<unsigned long long>(pIn[2 + i]) << (i * 8);
+
+        getAlphaPalette(pIn[0], pIn[1], palette);
+
+        for (int i = 0; i < 16; ++i)
+            pRgba[i * 4 + 3] = static_cast<unsigned char>(palette[(bits >> (i * 3)) & 7]);
+    }
+
+    //-------------------------------------------------------------------------
+    // BC7 mode 6 blocks: 7 bit RGBA endpoints with a shared low bit (p-bit)
+    // each and 4 bit indices.
+    //-------------------------------------------------------------------------
+
+    // Quantizes an endpoint to 7 bits per channel for the given p-bit and
+    // returns the squared error.
+    float quantizeEndpoint(const float *pColor, int pBit, int *pQuantized)
+    {
+        float error = 0.0f;
+
+        for (int c = 0; c < 4; ++c)
+        {
+            int q = static_cast<int>((pColor[c] - pBit) * 0.5f + 0.5f);
+
+            pQuantized[c] = std::min(std::max(q, 0), 127);
+
+            float delta = pColor[c] - ((pQuantized[c] << 1) | pBit);
+            error += delta * delta;
+        }
+
+        return error;
+    }
+
+    // Quantizes an endpoint with the p-bit that fits it best.
+    void quantizeEndpoint(const float *pColor, int *pQuantized, int &pBit)
+    {
+        int quantized[4];
+
+        pBit = (quantizeEndpoint(pColor, 1, quantized) < quantizeEndpoint(pColor, 0, pQuantized))
+            ? 1 : 0;
+
+        if (pBit == 1)
+            memcpy(pQuantized, quantized, sizeof(quantized));
+    }
+
+    void getBC7Palette(const int *pEndpoint0, const int *pEndpoint1, float (*pPalette)[4])
+    {
+        for (int j = 0; j < 16; ++j)
+        {
+            for (int c = 0; c < 4; ++c)
+            {
+                pPalette[j][c] = static_cast<float>(((64 - BC7_WEIGHTS[j]) * pEndpoint0[c]
+                    + BC7_WEIGHTS[j] * pEndpoint1[c] + 32) >> 6);
+            }
+        }
+    }
+
+    // Writes the low count bits of value at the given bit offset.
+    void writeBits(unsigned char *pOut, int &offset, unsigned int value, int count)
+    {
+        for (int i = 0; i < count; ++i, ++offset)
+        {
+            if (value & (1u << i))
+                pOut[offset >> 3] |= static_cast<unsigned char>(1 << (offset & 7));
+        }
+    }
+
+    unsigned int readBits(const unsigned char *pIn, int &offset, int count)
+    {
+        unsigned int value = 0;
+
+        for (int i = 0; i < count; ++i, ++offset)
+            value |= ((pIn[offset >> 3] >> (offset & 7)) & 1u) << i;
+
+        return value;
+    }
+
+    float evaluateBC7(const Block &block, const int (*pEndpoints)[4], const int *pPBits,
+                      unsigned char *pIndices)
+    {
+        int expanded[2][4];
+        float palette[16][4];
+
+        for (int e = 0; e < 2; ++e)
+        {
+            for (int c = 0; c < 4; ++c)
+                expanded[e][c] = (pEndpoints[e][c] << 1) | pPBits[e];
+        }
+
+        getBC7Palette(expanded[0], expanded[1], palette);
+
+        return selectIndices(block, palette, 16, 4, pIndices);
+    }
+
+    void encodeBC7Block(const Block &block, int quality, unsigned char *pOut)
+    {
+        float weights[16];
+
+        for (int j = 0; j < 16; ++j)
+            weights[j] = BC7_WEIGHTS[j] / 64.0f;
+
+        float start[4];
+        float end[4];
+        unsigned char indices[16];
+        unsigned char bestIndices[16];
+        int bestEndpoints[2][4];
+        int bestPBits[2] = {0, 0};
+        float bestError = FLT_MAX;
+
+        computeRange(block, 4, start, end);
+
+        for (int pass = 0; pass <= quality; ++pass)
+        {
+            int endpoints[2][4];
+            int pBits[2];
+
+            quantizeEndpoint(start, endpoints[0], pBits[0]);
+            quantizeEndpoint(end, endpoints[1], pBits[1]);
+
+            float error = evaluateBC7(block, endpoints, pBits, indices);
+
+            if (error < bestError)
+            {
+                bestError = error;
+                memcpy(bestEndpoints, endpoints, sizeof(endpoints));
+                memcpy(bestPBits, pBits, sizeof(pBits));
+                memcpy(bestIndices, indices, sizeof(indices));
+            }
+
+            // Quality 3 also tries every pair of p-bits, which the
+            // nearest endpoint alone doesn't decide well for the palette.
+
+            for (int p = 0; quality >= QUALITY_EXTRA_MODES && p < 4 && bestError > 0.0f; ++p)
+            {
+                pBits[0] = p & 1;
+                pBits[1] = p >> 1;
+                quantizeEndpoint(start, pBits[0], endpoints[0]);
+                quantizeEndpoint(end, pBits[1], endpoints[1]);
+
+                unsigned char pBitIndices[16];
+                float pBitError = evaluateBC7(block, endpoints, pBits, pBitIndices);
+
+                if (pBitError < bestError)
+                {
+                    bestError = pBitError;
+                    memcpy(bestEndpoints, endpoints, sizeof(endpoints));
+                    memcpy(bestPBits, pBits, sizeof(pBits));
+                    memcpy(bestIndices, pBitIndices, sizeof(pBitIndices));
+                }
+            }
+
+            if (bestError == 0.0f || !refineEndpoints(block, 0, 4, indices, weights, start, end))
+                break;
+        }
+
+        // Quality 4 moves each channel of each endpoint one step up and
+        // down and keeps every change that lowers the error.
+
+        bool improved = quality >= QUALITY_PERTURB;
+
+        for (int round = 0; round < PERTURB_ROUNDS && improved && bestError > 0.0f; ++round)
+        {
+            improved = false;
+
+            for (int k = 0; k < 16; ++k)
+            {
+                int endpoints[2][4];
+                int &value = endpoints[k / 8][(k / 2) % 4];
+
+                memcpy(endpoints, bestEndpoints, sizeof(endpoints));
+                value += (k & 1) ? 1 : -1;
+
+                if (value < 0 || value > 127)
+                    continue;
+
+                float error = evaluateBC7(block, endpoints, bestPBits, indices);
+
+                if (error < bestError)
+                {
+                    bestError = error;
+                    memcpy(bestEndpoints, endpoints, sizeof(endpoints));
+                    memcpy(bestIndices, indices, sizeof(indices));
+                    improved = true;
+                }
+            }
+        }
+
+        // The first index is stored without its top bit, which therefore
+        // has to be 0. Swapping the endpoints mirrors the indices.
+
+        if (bestIndices[0] & 8)
+        {
+            for (int c = 0; c < 4; ++c)
+                std::swap(bestEndpoints[0][c], bestEndpoints[1][c]);
+
+            std::swap(bestPBits[0], bestPBits[1]);
+
+            for (int i = 0; i < 16; ++i)
+                bestIndices[i] = static_cast<unsigned char>(15 - bestIndices[i]);
+        }
+
+        int offset = 0;
+
+        memset(pOut, 0, 16);
+        writeBits(pOut, offset, 1 << 6, 7);
+
+        for (int c = 0; c < 4; ++c)
+        {
+            writeBits(pOut, offset, bestEndpoints[0][c], 7);
+            writeBits(pOut, offset, bestEndpoints[1][c], 7);
+        }
+
+        writeBits(pOut, offset, bestPBits[0], 1);
+        writeBits(pOut, offset, bestPBits[1], 1);
+
+        for (int i = 0; i < 16; ++i)
+            writeBits(pOut, offset, bestIndices[i], (i == 0) ? 3 : 4);
+    }
+
+    void decodeBC7Block(const unsigned char *pIn, unsigned char *pRgba)
+    {
+        int offset = 0;
+
+        if (readBits(pIn, offset, 7) != (1 << 6))
+        {
+            // Not mode 6. Decode as transparent black, like reserved modes.
+            memset(pRgba, 0, 64);
+            return;
+        }
+
+        int endpoints[2][4];
+        float palette[16][4];
+
+        for (int c = 0; c < 4; ++c)
+        {
+            endpoints[0][c] = readBits(pIn, offset, 7);
+            endpoints[1][c] = readBits(pIn, offset, 7);
+        }
+
+        for (int e = 0; e < 2; ++e)
+        {
+            int pBit = readBits(pIn, offset, 1);
+
+            for (int c = 0; c < 4; ++c)
+                endpoints[e][c] = (endpoints[e][c] << 1) | pBit;
+        }
+
+        getBC7Palette(endpoints[0], endpoints[1], palette);
+
+        for (int i = 0; i < 16; ++i)
+        {
+            int index = readBits(pIn, offset, (i == 0) ? 3 : 4);
+
+            for (int c = 0; c < 4; ++c)
+                pRgba[i * 4 + c] = static_cast<unsigned char>(palette[index][c]);
+        }
+    }
+
+    //-------------------------------------------------------------------------
+
+    void loadBlock(const unsigned char *pRgba, unsigned int width, unsigned int height,
+                   unsigned int x, unsigned int y, Block &block)
+    {
+        for (int i = 0; i < 16; ++i)
+        {
+            unsigned int tx = std::min(x + (i & 3), width - 1);
+            unsigned int ty = std::min(y + (i >> 2), height - 1);
+            const unsigned char *pTexel = &pRgba[(ty * width + tx) * 4];
+
+            for (int c = 0; c < 4; ++c)
+                block.channels[c][i] = pTexel[c];
+        }
+    }
+}
+
+size_t getBlockSize(BlockFormat format)
+{
+    return (format == BLOCK_FORMAT_BC1) ? 8 : 16;
+}
+
+size_t getCompressedSize(BlockFormat format, unsigned int width, unsigned int height)
+{
+    return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * getBlockSize(format);
+}
+
+void compressImage(const unsigned char *pRgba, unsigned int width, unsigned int height,
+                   BlockFormat format, int quality, int numThreads, unsigned char *pBlocks)
+{
+    unsigned int blocksX = (width + 3) / 4;
+    unsigned int blocksY = (height + 3) / 4;
+    size_t blockSize = getBlockSize(format);
+
+    quality = std::min(std::max(quality, 0), BLOCK_QUALITY_MAX);
+
+    parallelFor(numThreads, static_cast<int>(blocksY), [&](int row)
+    {
+        unsigned char *pOut = pBlocks + row * blocksX * blockSize;
+        Block block;
+
+        for (unsigned int x = 0; x < blocksX; ++x, pOut += blockSize)
+        {
+            loadBlock(pRgba, width, height, x * 4, row * 4, block);
+
+            switch (format)
+            {
+            case BLOCK_FORMAT_BC1:
+                encodeColorBlock(block, quality, true, pOut);
+                break;
+
+            case BLOCK_FORMAT_BC3:
+                encodeAlphaBlock(block, quality, pOut);
+                encodeColorBlock(block, quality, false, pOut + 8);
+                break;
+
+            case BLOCK_FORMAT_BC7:
+                encodeBC7Block(block, quality, pOut);
+                break;
+            }
+        }
+    });
+}
+
+void decompressImage(const unsigned char *pBlocks, unsigned int width, unsigned int height,
+                     BlockFormat format, unsigned char *pRgba)
+{
+    unsigned int blocksX = (width + 3) / 4;
+    unsigned int blocksY = (height + 3) / 4;
+    size_t blockSize = getBlockSize(format);
+    unsigned char texels[64];
+
+    for (unsigned int y = 0; y < blocksY; ++y)
+    {
+        for (unsigned int x = 0; x < blocksX; ++x, pBlocks += blockSize)
+        {
+            switch (format)
+            {
+            case BLOCK_FORMAT_BC1:
+                decodeColorBlock(pBlocks, false, texels);
+                break;
+
+            case BLOCK_FORMAT_BC3:
+                decodeColorBlock(pBlocks + 8, true, texels);
+                decodeAlphaBlock(pBlocks, texels);
+                break;
+
+            case BLOCK_FORMAT_BC7:
+                decodeBC7Block(pBlocks, texels);
+                break;
+            }
+
+            // Crop the blocks at the right and bottom edges.
+
+            for (unsigned int i = 0; i < 16; ++i)
+            {
+                unsigned int tx = x * 4 + (i & 3);
+                unsigned int ty = y * 4 + (i >> 2);
+
+                if (tx < width && ty < height)
+                    memcpy(&pRgba[(ty * width + tx) * 4], &texels[i * 4], 4);
+            }
+        }
+    }
+}
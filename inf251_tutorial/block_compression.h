@@ -0,0 +1,50 @@
+#if !defined(BLOCK_COMPRESSION_H)
+#define BLOCK_COMPRESSION_H
+
+#include <cstddef>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// CPU encoder and decoder for the BC1, BC3 and BC7 block compressed texture
+// formats. Images are 8-bit RGBA and are split into 4x4 texel blocks; blocks
+// that reach past the right or bottom edge repeat the last column or row.
+//
+// BC1 stores opaque RGB in 8 bytes per block, BC3 adds an 8 byte alpha
+// block to it. BC7 blocks are 16 bytes; the encoder writes mode 6 only (one
+// RGBA endpoint pair with 16 interpolation steps), which suits textures
+// whose alpha follows their color, such as tinted glass. The decoder
+// handles the same mode.
+//
+// The quality ranges from 0 (fastest, endpoints from the principal axis of
+// the block) to BLOCK_QUALITY_MAX. Each step adds a least squares
+// refinement of the endpoints. Quality 3 also tries the three color mode of
+// BC1, the BC3 alpha mode with exact 0 and 255, and every pair of BC7
+// p-bits. Quality 4 then searches the neighbouring quantized endpoints.
+//-----------------------------------------------------------------------------
+
+enum BlockFormat
+{
+    BLOCK_FORMAT_BC1,
+    BLOCK_FORMAT_BC3,
+    BLOCK_FORMAT_BC7
+};
+
+const int BLOCK_QUALITY_MAX = 4;
+
+// Bytes per 4x4 block.
+size_t getBlockSize(BlockFormat format);
+
+// Bytes of a compressed image.
+size_t getCompressedSize(BlockFormat format, unsigned int width, unsigned int height);
+
+// Compresses an RGBA image, one row of blocks at a time on up to numThreads
+// threads.
+void compressImage(const unsigned char *pRgba, unsigned int width, unsigned int height,
+    BlockFormat format, int quality, int numThreads, unsigned char *pBlocks);
+
+// Decodes a compressed image into RGBA. BC1 texels decode with an alpha
+// of 255.
+void decompressImage(const unsigned char *pBlocks, unsigned int width, unsigned int height,
+    BlockFormat format, unsigned char *pRgba);
+
+#endif
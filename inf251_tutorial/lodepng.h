@@ -238,6 +238,40 @@ unsigned encode(const std::string& filename,
 const char* lodepng_error_text(unsigned code);
 #endif /*LODEPNG_COMPILE_ERROR_TEXT*/
 
+/*
+Functions the decoder allocates its buffers with instead of malloc, realloc and
+free, see the allocator field of LodePNGDecompressSettings. context is passed to
+them as is. reallocate and deallocate are never given a null pointer.
+*/
+typedef struct LodePNGAllocator
+{
+  void* (*allocate)(void* context, size_t size);
+  void* (*reallocate)(void* context, void* ptr, size_t size);
+  void (*deallocate)(void* context, void* ptr);
+  void* context;
+} LodePNGAllocator;
+
+/*
+Arena (bump) allocator, for a thread that decodes one image after another. It
+hands out memory from one large block by moving a pointer. Freeing the most
+recent allocation takes it back, and reallocating it grows it in place, so a
+buffer growing at the end of the arena is never copied. Other memory is only
+released by lodepng_arena_reset, which makes the whole arena available again
+and keeps the memory allocated. When the block is full, another one is added;
+the next reset merges them into one block of their total size, so after the
+first few images it no longer allocates at all. An arena is not thread safe,
+give every thread its own.
+*/
+typedef struct LodePNGArena LodePNGArena;
+
+/*capacity is the initial size of the block, it may be 0. Returns 0 if out of memory.*/
+LodePNGArena* lodepng_arena_new(size_t capacity);
+void lodepng_arena_delete(LodePNGArena* arena);
+/*Releases everything allocated from the arena, e.g. after an image is used.*/
+void lodepng_arena_reset(LodePNGArena* arena);
+/*The allocator to put in the settings, valid as long as the arena.*/
+const LodePNGAllocator* lodepng_arena_allocator(LodePNGArena* arena);
+
 #ifdef LODEPNG_COMPILE_DECODER
 /*Settings for zlib decompression*/
 typedef struct LodePNGDecompressSettings LodePNGDecompressSettings;
@@ -257,6 +291,11 @@ struct LodePNGDecompressSettings
                              const LodePNGDecompressSettings*);
 
   void* custom_context; /*optional custom settings for custom functions*/
+
+  /*allocate the buffers of the decoder with these functions instead of malloc (default: null).
+  The buffers handed out, such as *out of lodepng_inflate and the image of lodepng_decode, then
+  come from it too and must be freed with it, as must *out of custom_zlib and custom_inflate.*/
+  const LodePNGAllocator* allocator;
 };
 
 extern const LodePNGDecompressSettings lodepng_default_decompress_settings;
@@ -278,6 +317,12 @@ struct LodePNGCompressSettings /*deflate = compress*/
   unsigned minmatch; /*mininum lz77 length. 3 is normally best, 6 can be better for some PNGs. Default: 0*/
   unsigned nicematch; /*stop searching if >= this length found. Set to 258 for best compression. Default: 128*/
   unsigned lazymatching; /*use lazy matching: better compression but a bit slower. Default: true*/
+  /*the LZ77 match finder. 0: hash chains. 1: fast, one probe per position. 2: binary trees,
+  for a better ratio in less time than 0 with a large window. 3: only runs of a repeated byte,
+  fastest with btype 1. Default: 0*/
+  unsigned matchfinder;
+  /*compress independent 128 KB segments on this many threads (C++ only). 0 or 1: one thread. Default: 0*/
+  unsigned numthreads;
 
   /*use custom zlib encoder instead of built in one (default: null)*/
   unsigned (*custom_zlib)(unsigned char**, size_t*,
@@ -507,9 +552,17 @@ typedef struct LodePNGDecoderSettings
 {
   LodePNGDecompressSettings zlibsettings; /*in here is the setting to ignore Adler32 checksums*/
 
-  unsigned ignore_crc; /*ignore CRC checksums*/
+  /*ignore CRC checksums, they are then not computed either. For files that are known
+  to be intact, such as assets from a cache that is itself verified.*/
+  unsigned ignore_crc;
   unsigned color_convert; /*whether to convert the PNG to the color type you want. Default: yes*/
 
+  /*lodepng_decode decodes the image straight into this buffer instead of allocating it (default:
+  null), e.g. into a mapped staging buffer. It must have room for lodepng_get_raw_size of the decoded image,
+  out_buffer_size tells its size, else decoding fails with error 92. *out is then out_buffer.*/
+  unsigned char* out_buffer;
+  size_t out_buffer_size;
+
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   unsigned read_text_chunks; /*if false but remember_unknown_chunks is true, they're stored in the unknown chunks*/
   /*store all bytes from unknown chunks in the LodePNGInfo (off by default, useful for a png editor)*/
@@ -583,6 +636,9 @@ typedef struct LodePNGEncoderSettings
   have to cleanup this buffer, LodePNG will never free it. Don't forget that filter_palette_zero
   must be set to 0 to ensure this is also used on palette or low bitdepth images.*/
   unsigned char* predefined_filters;
+  /*filter the scanlines on this many threads with LFS_MINSUM and LFS_ENTROPY. The result
+  does not depend on it. 0 or 1: only the calling thread. Default: 0*/
+  unsigned filter_numthreads;
 
   /*force creating a PLTE chunk if colortype is 2 or 6 (= a suggested palette).
   If colortype is 3, PLTE is _always_ created.*/
@@ -641,6 +697,36 @@ information is placed in the info_png field of the LodePNGState.
 unsigned lodepng_inspect(unsigned* w, unsigned* h,
                          LodePNGState* state,
                          const unsigned char* in, size_t insize);
+
+/*
+Streaming decoder, for PNG data that arrives in pieces, e.g. from a read() loop.
+IDAT data is inflated as it arrives and every scanline is handed to the row
+callback as soon as it is decoded, so neither the compressed nor the decoded
+image is ever stored whole: memory use is a few scanlines plus the 32 KB
+deflate window. Interlaced (Adam7) images, and settings with a custom_zlib or
+custom_inflate function, fall back to buffering the IDAT data and decoding it
+at the IEND chunk, after which all their rows are handed out at once.
+Rows are converted to state->info_raw as with lodepng_decode, unless
+state->decoder.color_convert is off. Unlike the image of lodepng_decode, every
+row starts at a byte: it has lodepng_get_raw_size(w, 1, &state->info_raw) bytes.
+The callback may copy the row to wherever the image goes, it is only valid during
+the call. Returning a non-zero value stops decoding, the value becomes the error.
+*/
+typedef struct LodePNGStreamDecoder LodePNGStreamDecoder;
+typedef unsigned (*LodePNGRowCallback)(void* user, unsigned y, const unsigned char* row);
+
+/*The state holds the settings and receives the info, it must outlive the decoder. Returns 0 if out of memory.*/
+LodePNGStreamDecoder* lodepng_stream_new(LodePNGState* state, LodePNGRowCallback callback, void* user);
+void lodepng_stream_delete(LodePNGStreamDecoder* stream);
+
+/*Decodes the next insize bytes of the PNG. The first error sticks, later calls return it too.*/
+unsigned lodepng_stream_push(LodePNGStreamDecoder* stream, const unsigned char* in, size_t insize);
+
+/*Call after the last byte was pushed. Returns an error if the PNG ended before its IEND chunk.*/
+unsigned lodepng_stream_finish(LodePNGStreamDecoder* stream);
+
+/*Gets the image size once the header is decoded. Returns 0 if it isn't yet.*/
+unsigned lodepng_stream_get_size(const LodePNGStreamDecoder* stream, unsigned* w, unsigned* h);
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 
@@ -649,6 +735,31 @@ unsigned lodepng_inspect(unsigned* w, unsigned* h,
 unsigned lodepng_encode(unsigned char** out, size_t* outsize,
                         const unsigned char* image, unsigned w, unsigned h,
                         LodePNGState* state);
+
+#ifdef LODEPNG_COMPILE_ZLIB
+/*
+Fast encoder for sequences of frames of one size and color type, such as screenshots
+or recordings of a window, at many times the speed of lodepng_encode. The raw color
+type is written as is, without looking for a smaller one, and no palette is
+possible. Every scanline gets filter type Sub, and the deflate data is one block
+with the fixed tree and only runs of repeated bytes as matches, as with btype 1
+and matchfinder 3 in LodePNGCompressSettings. The buffers are allocated once, for
+the largest possible frame, so encoding a frame allocates nothing.
+*/
+typedef struct LodePNGFrameEncoder LodePNGFrameEncoder;
+
+/*Returns 0 if out of memory. Errors in the arguments, such as a width or height of 0 (error 93),
+are returned by every lodepng_frame_encode.*/
+LodePNGFrameEncoder* lodepng_frame_encoder_new(unsigned w, unsigned h, LodePNGColorType colortype, unsigned bitdepth);
+void lodepng_frame_encoder_delete(LodePNGFrameEncoder* encoder);
+
+/*
+Encodes a frame of w * h pixels into a PNG that belongs to the encoder: *out stays
+valid until the next frame or until the encoder is deleted, don't free it.
+*/
+unsigned lodepng_frame_encode(LodePNGFrameEncoder* encoder, const unsigned char** out, size_t* outsize,
+                              const unsigned char* image);
+#endif /*LODEPNG_COMPILE_ZLIB*/
 #endif /*LODEPNG_COMPILE_ENCODER*/
 
 /*
@@ -1083,6 +1194,26 @@ is done, the resulting data will be as it was in the PNG (after decompression)
 and you'll have to puzzle the colors of the pixels together yourself using the
 color type information in the LodePNGInfo.
 
+To decode many images without going to the heap for every buffer, set
+zlibsettings.allocator, e.g. to the allocator of a LodePNGArena. All buffers of
+the decoder then come from it, including the image lodepng_decode gives, which
+must be released with it too (for an arena, by resetting it once the image is
+used). The palette, texts and unknown chunks in the LodePNGInfo are still
+allocated with malloc, as lodepng_state_cleanup frees them. With out_buffer set,
+the image is decoded into that buffer instead, so it can go to its destination,
+such as a texture upload buffer, without a copy:
+
+LodePNGArena* arena = lodepng_arena_new(0); //one per loading thread
+...
+lodepng_state_init(&state);
+state.decoder.zlibsettings.allocator = lodepng_arena_allocator(arena);
+lodepng_inspect(&w, &h, &state, in, insize);
+state.decoder.out_buffer = stagingBuffer(lodepng_get_raw_size(w, h, &state.info_raw));
+state.decoder.out_buffer_size = lodepng_get_raw_size(w, h, &state.info_raw);
+error = lodepng_decode(&image, &w, &h, &state, in, insize);
+lodepng_state_cleanup(&state);
+lodepng_arena_reset(arena);
+
 
 5. Encoding
 -----------
@@ -1147,6 +1278,22 @@ can encode the colors of all pixels without information loss.
    true for proper compression.
 *) windowsize: the window size used by the LZ77 encoder (1 - 32768). Has value
    2048 by default, but can be set to 32768 for better, but slow, compression.
+*) matchfinder: how LZ77 finds matches. 0 (default) walks hash chains, which gets
+   very slow with a large window. 1 looks up a single earlier position per hash of
+   4 bytes, several times faster than 0, for a few percent larger output. 2 keeps
+   binary trees of earlier positions, which gives the ratio of 0 in much less time
+   with a large window, so it is best combined with a windowsize of 32768. 3 only
+   encodes runs of the same byte, which is enough for flat images. With btype 1
+   it takes a fast path that writes the codes directly.
+*) numthreads: compress on several threads. The input is split into segments
+   of 128 KB, each of which is compressed on its own with the window before it as
+   history, and the results are joined, so the output stays a single deflate
+   stream. It is a few bytes larger per segment than with one thread, but it is
+   the same for any amount of threads above 1. Compiled as C, the segments are
+   compressed one after another.
+*) filter_numthreads: choose the filter types of LFS_MINSUM and LFS_ENTROPY on
+   several threads, each taking a band of scanlines. Unlike numthreads, this
+   does not change the output. Compiled as C, the bands are done one after another.
 *) force_palette: if colortype is 2 or 6, you can make the encoder write a PLTE
    chunk if force_palette is true. This can used as suggested palette to convert
    to by viewers that don't support more than 256 colors (if those still exist)
@@ -2,13 +2,23 @@
 #include <gl/glut.h>
 #include <gl/GL.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <condition_variable>
 #include <cstdio>
+#include <deque>
 #include <fstream>
 #include <iostream>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "lodepng.h"
 #include "model_obj.h"
+#include "texture_cache.h"
 #include "Vector3.h"
 #include "Matrix4.h"
 
@@ -29,6 +39,7 @@ struct Camera {
 	float zoom; // extra scaling param
 };
 
+
 // --- OpenGL callbacks ---------------------------------------------------------------------------
 void display();
 void idle();
@@ -38,9 +49,19 @@ void motion(int, int);
 
 // --- Other methods ------------------------------------------------------------------------------
 bool initMesh();
+bool updateMesh();
+bool finishMesh();
+void initTextures();
+void queueTexture(int, const ModelOBJ::Material&);
+void decodeTextures();
+bool updateTextures();
+void createColorTexture(int, const unsigned char*);
+int bakeTextures();
+bool importProgress(float, void*);
 bool initShaders();
 string readTextFile(const string&);
 void printString(float, float, string);
+void setVertexAttribute(GLint, const ModelOBJ::VertexAttributeFormat&, int);
 
 
 // --- Global variables ---------------------------------------------------------------------------
@@ -48,12 +69,33 @@ void printString(float, float, string);
 ModelOBJ Model;		///< A 3D model
 GLuint VBO = 0;		///< A vertex buffer object
 GLuint IBO = 0;		///< An index buffer object
-
-					// Texture
-GLuint TextureObject = 0;				///< A texture object
-unsigned int TextureWidth = 0;			///< The width of the current texture
-unsigned int TextureHeight = 0;			///< The height of the current texture
-unsigned char *TextureData = nullptr;	///< the array where the texture image will be stored
+ModelOBJ::VertexFormat VertexFormat;	///< Layout of the vertices in the VBO
+GLenum IndexType = GL_UNSIGNED_INT;	///< Type of the indices in the IBO
+vector<ModelOBJ::IndexRange> IndexRanges;	///< Ranges of the IBO with their base vertex
+
+					// Streaming import
+bool MeshReady = false;				///< True once the whole model has been imported
+atomic<int> ImportProgress(0);		///< Percentage of the OBJ file imported so far
+vector<float> StreamVertices;		///< Positions and texture coordinates received so far
+vector<unsigned int> StreamIndices;	///< Indices received so far
+float StreamMin[3], StreamMax[3];	///< Bounds of the vertices received so far
+
+					// Textures
+vector<GLuint> MaterialTextures;		///< One texture object per material
+bool TexturesReady = false;				///< True once every texture has been uploaded
+vector<thread> TextureWorkers;			///< Threads decoding the texture files
+mutex TextureMutex;						///< Guards the texture queues below
+condition_variable TextureQueued;		///< Wakes up the workers when a file is queued
+deque<pair<int, string>> TextureJobs;	///< Materials and texture files waiting to be decoded
+deque<pair<int, TextureCache::Image>> TexturesDecoded;	///< Loaded images waiting to be uploaded
+bool TextureJobsClosed = false;			///< No more files will be queued
+int TexturesPending = 0;				///< Files queued but not uploaded yet
+
+					// Loading times
+chrono::steady_clock::time_point LoadStart;	///< When the model import started
+double ParseTime = 0.0;		///< Milliseconds until the OBJ file was imported
+double DecodeTime = 0.0;	///< Milliseconds spent loading textures, summed over the workers
+double UploadTime = 0.0;	///< Milliseconds spent uploading textures
 
 										// Shaders
 GLuint ShaderProgram = 0;	///< A shader program
@@ -75,6 +117,10 @@ Camera Cam;
 /// The entry point of the application
 int main(int argc, char **argv) {
 
+	// "--bake" only writes the baked mip chains of the model's textures
+	if (argc > 1 && string(argv[1]) == "--bake")
+		return bakeTextures();
+
 	// Initialize glut and create a simple window
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA);
@@ -132,10 +178,6 @@ int main(int argc, char **argv) {
 	// Start the main event loop
 	glutMainLoop();
 
-	// clean-up before exit
-	if (TextureData != nullptr)
-		free(TextureData);
-
 	return 0;
 }
 
@@ -169,48 +211,77 @@ void display() {
 	assert(ShaderProgram != 0);
 	glUseProgram(ShaderProgram);
 
-	// Set the uniform variable for the vertex transformation
+	// Set the uniform variable for the vertex transformation. The last two
+	// matrices expand the quantized vertex positions to model coordinates.
 	Matrix4f transformation =
 		Matrix4f::createTranslation(Translation) *
 		RotationX * RotationY *
-		Matrix4f::createScaling(Scaling, Scaling, Scaling);
+		Matrix4f::createScaling(Scaling, Scaling, Scaling) *
+		Matrix4f::createTranslation(Vector3f(VertexFormat.positionBias[0],
+			VertexFormat.positionBias[1], VertexFormat.positionBias[2])) *
+		Matrix4f::createScaling(VertexFormat.positionScale[0],
+			VertexFormat.positionScale[1], VertexFormat.positionScale[2]);
 	glUniformMatrix4fv(TrLoc, 1, GL_FALSE, transformation.get());
 
 	// Set the uniform variable for the texture unit (texture unit 0)
 	glUniform1i(SamplerLoc, 0);
 
-	// Enable the vertex attributes and set their format
-	GLint posLoc = glGetAttribLocation(ShaderProgram, "position");
-	glEnableVertexAttribArray(posLoc);
-	GLint texLoc = glGetAttribLocation(ShaderProgram, "tex_coords");
-	glEnableVertexAttribArray(texLoc);
-	glVertexAttribPointer(posLoc, 3, GL_FLOAT, GL_FALSE,
-		sizeof(ModelOBJ::Vertex),
-		reinterpret_cast<const GLvoid*>(0));
-	glVertexAttribPointer(texLoc, 2, GL_FLOAT, GL_FALSE,
-		sizeof(ModelOBJ::Vertex),
-		reinterpret_cast<const GLvoid*>(3 * sizeof(float)));
-
-	// Enable texture unit 0 and bind the texture to it
+	// Enable texture unit 0, the textures are bound per index range
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, TextureObject);
+	glBindTexture(GL_TEXTURE_2D, 0);
 
 	// Bind the buffers
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IBO);
 
-	// Draw the elements on the GPU
-	glDrawElements(
-		GL_TRIANGLES,
-		Model.getNumberOfIndices(),
-		GL_UNSIGNED_INT,
-		0);
+	// Enable the vertex attributes and set their format
+	GLint posLoc = glGetAttribLocation(ShaderProgram, "position");
+	glEnableVertexAttribArray(posLoc);
+	GLint texLoc = glGetAttribLocation(ShaderProgram, "tex_coords");
+	glEnableVertexAttribArray(texLoc);
+	setVertexAttribute(posLoc,
+		VertexFormat.attributes[ModelOBJ::ATTRIBUTE_POSITION], VertexFormat.stride);
+	setVertexAttribute(texLoc,
+		VertexFormat.attributes[ModelOBJ::ATTRIBUTE_TEXCOORD], VertexFormat.stride);
+
+	// Draw the elements on the GPU, one call per index range with the
+	// texture of its material (only the batches received so far while the
+	// model is still loading)
+	if (MeshReady) {
+		size_t indexSize = (IndexType == GL_UNSIGNED_SHORT) ? sizeof(unsigned short) : sizeof(unsigned int);
+		GLuint boundTexture = 0;
+		for (size_t i = 0; i < IndexRanges.size(); ++i) {
+			const ModelOBJ::IndexRange& range = IndexRanges[i];
+			int material = static_cast<int>(Model.getMesh(range.firstMesh).pMaterial - &Model.getMaterial(0));
+			GLuint texture = (material < static_cast<int>(MaterialTextures.size())) ? MaterialTextures[material] : 0;
+			if (texture != boundTexture) {
+				glBindTexture(GL_TEXTURE_2D, texture);
+				boundTexture = texture;
+			}
+			glDrawElementsBaseVertex(
+				GL_TRIANGLES,
+				range.indexCount,
+				IndexType,
+				reinterpret_cast<GLvoid*>(range.startIndex * indexSize),
+				range.baseVertex);
+		}
+	}
+	else {
+		glDrawElements(
+			GL_TRIANGLES,
+			static_cast<GLsizei>(StreamIndices.size()),
+			GL_UNSIGNED_INT,
+			0);
+	}
 
 	string s = "House coord: /n 11 \n";
 	s += "AAAAA";
 
 	printString(-0.9,0.9, s);
 
+	if (!MeshReady)
+		printString(-0.9, 0.8, "Loading model... " + to_string(ImportProgress.load()) + "%");
+
 	// Disable the "position" vertex attribute (not necessary but recommended)
 	glDisableVertexAttribArray(posLoc);
 	glDisableVertexAttribArray(texLoc);
@@ -224,6 +295,14 @@ void display() {
 
 /// Called at regular intervals (can be used for animations)
 void idle() {
+	// Pick up the geometry imported and the textures decoded in the background
+	if (!MeshReady && !updateMesh()) {
+		cerr << "An error occurred, press Enter to quit ..." << endl;
+		getchar();
+		exit(-1);
+	}
+	if (!TexturesReady)
+		TexturesReady = updateTextures();
 }
 
 /// Called whenever a keyboard button is pressed (only ASCII characters)
@@ -285,86 +364,329 @@ void motion(int x, int y) {
 
 // ************************************************************************************************
 // *** Other methods implementation ***************************************************************
-/// Initialize buffer objects
+/// Initialize buffer objects and start loading the model
 bool initMesh() {
-	// Load the OBJ model
-	if (!Model.import("House-Model\\House.obj")) {
+	// Load the OBJ model on a worker thread. updateMesh() draws the
+	// batches as they arrive.
+	LoadStart = chrono::steady_clock::now();
+	Model.beginImport("House-Model\\House.obj", false, 0, importProgress, nullptr);
+
+	// Block compress the textures into the formats the GL can sample
+	if (!GLEW_EXT_texture_compression_s3tc)
+		TextureCache::instance().setCompression(TEXTURE_COMPRESSION_NONE, 0);
+	else if (!GLEW_ARB_texture_compression_bptc)
+		TextureCache::instance().setCompression(TEXTURE_COMPRESSION_BC3, 2);
+
+	// Decode the textures while the geometry is being parsed
+	initTextures();
+
+	// Until the import has finished the VBO holds float positions and
+	// texture coordinates
+	ModelOBJ::createVertexFormat(VertexFormat,
+		ModelOBJ::ENCODING_FLOAT, ModelOBJ::ENCODING_FLOAT);
+	for (int i = 0; i < 3; ++i) {
+		StreamMin[i] = FLT_MAX;
+		StreamMax[i] = -FLT_MAX;
+	}
+
+	glGenBuffers(1, &VBO);
+	glGenBuffers(1, &IBO);
+
+	return true;
+} /* initMesh() */
+
+
+/// Upload the batches imported since the last frame. Return false if the import failed
+bool updateMesh() {
+	// Batches are published before the import finishes, so drain them after
+	// checking the status
+	bool done = Model.getImportStatus() != ModelOBJ::IMPORT_RUNNING;
+	bool updated = false;
+	ModelOBJ::Batch batch;
+	ModelOBJ::Material material;
+
+	// The materials arrive before the batches using them
+	while (Model.pollMaterial(material))
+		queueTexture(static_cast<int>(MaterialTextures.size()), material);
+
+	while (Model.pollBatch(batch)) {
+		for (size_t i = 0; i < batch.vertices.size(); ++i) {
+			const ModelOBJ::Vertex& v = batch.vertices[i];
+			for (int j = 0; j < 3; ++j) {
+				StreamMin[j] = min(StreamMin[j], v.position[j]);
+				StreamMax[j] = max(StreamMax[j], v.position[j]);
+			}
+			StreamVertices.insert(StreamVertices.end(), v.position, v.position + 3);
+			StreamVertices.insert(StreamVertices.end(), v.texCoord, v.texCoord + 2);
+		}
+		StreamIndices.insert(StreamIndices.end(), batch.indices.begin(), batch.indices.end());
+		updated = true;
+	}
+
+	if (updated) {
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER,
+			StreamVertices.size() * sizeof(float),
+			StreamVertices.empty() ? nullptr : &StreamVertices[0],
+			GL_STREAM_DRAW);
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+			StreamIndices.size() * sizeof(unsigned int),
+			StreamIndices.empty() ? nullptr : &StreamIndices[0],
+			GL_STREAM_DRAW);
+
+		// Center and scale the partial model like normalize() does
+		float radius = max(max(StreamMax[0] - StreamMin[0], StreamMax[1] - StreamMin[1]),
+			StreamMax[2] - StreamMin[2]);
+		float scale = (radius > 0.0f) ? 1.0f / radius : 1.0f;
+		for (int j = 0; j < 3; ++j) {
+			VertexFormat.positionScale[j] = scale;
+			VertexFormat.positionBias[j] = -0.5f * (StreamMin[j] + StreamMax[j]) * scale;
+		}
+
+		glutPostRedisplay();
+	}
+
+	return done ? finishMesh() : true;
+} /* updateMesh() */
+
+
+/// Replace the streamed geometry with the final model once the import has finished
+bool finishMesh() {
+	MeshReady = true;
+	vector<float>().swap(StreamVertices);
+	vector<unsigned int>().swap(StreamIndices);
+
+	bool imported = Model.endImport();
+	ParseTime = chrono::duration<double, milli>(chrono::steady_clock::now() - LoadStart).count();
+
+	// All materials have been handed out, let the workers finish
+	{
+		lock_guard<mutex> lock(TextureMutex);
+		TextureJobsClosed = true;
+	}
+	TextureQueued.notify_all();
+
+	if (!imported) {
 		cerr << "Error: cannot load model." << endl;
 		return false;
 	}
 
+	// Reorder the triangles for the vertex cache
+	ModelOBJ::VertexCacheStatistics cacheStats = Model.analyzeVertexCache();
+	cout << "vertex cache ACMR = " << cacheStats.acmr
+		<< ", ATVR = " << cacheStats.atvr << " before optimize()" << endl;
+	Model.optimize(0.0f);
+	cacheStats = Model.analyzeVertexCache();
+	cout << "vertex cache ACMR = " << cacheStats.acmr
+		<< ", ATVR = " << cacheStats.atvr << " after optimize()" << endl;
+
 	Model.normalize();
 
+	// Pack only what the shaders read: 16-bit quantized positions and
+	// half float texture coordinates (12 bytes instead of 60 per vertex)
+	vector<unsigned char> vertices;
+	ModelOBJ::createVertexFormat(VertexFormat,
+		ModelOBJ::ENCODING_UNORM16, ModelOBJ::ENCODING_HALF);
+	Model.packVertices(VertexFormat, vertices);
+
 	// VBO
-	glGenBuffers(1, &VBO);
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
 	glBufferData(GL_ARRAY_BUFFER,
-		Model.getNumberOfVertices() * sizeof(ModelOBJ::Vertex),
-		Model.getVertexBuffer(),
+		vertices.size(),
+		vertices.empty() ? nullptr : &vertices[0],
 		GL_STATIC_DRAW);
 
-	// IBO
-	glGenBuffers(1, &IBO);
+	// IBO: 16-bit indices relative to a base vertex per range. Every range
+	// belongs to a single mesh so that it can be drawn with the texture of
+	// its material. Fall back to 32-bit indices drawn mesh by mesh if the
+	// model can't be split that way.
+	vector<unsigned short> indices;
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-		Model.getNumberOfIndices() * sizeof(unsigned int),
-		Model.getIndexBuffer(),
-		GL_STATIC_DRAW);
+	if (Model.packIndices(indices, IndexRanges)) {
+		IndexType = GL_UNSIGNED_SHORT;
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+			indices.size() * sizeof(unsigned short),
+			indices.empty() ? nullptr : &indices[0],
+			GL_STATIC_DRAW);
+	}
+	else {
+		IndexType = GL_UNSIGNED_INT;
+		IndexRanges.clear();
+		for (int i = 0; i < Model.getNumberOfMeshes(); ++i) {
+			const ModelOBJ::Mesh& mesh = Model.getMesh(i);
+			ModelOBJ::IndexRange range = { i, 1, mesh.startIndex, mesh.triangleCount * 3, 0 };
+			IndexRanges.push_back(range);
+		}
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+			Model.getNumberOfIndices() * sizeof(unsigned int),
+			Model.getIndexBuffer(),
+			GL_STATIC_DRAW);
+	}
+	cout << "index ranges = " << IndexRanges.size() << endl;
 
+	glutPostRedisplay();
 
-	cout << "number of materials = " << Model.getNumberOfMaterials() << endl;
-	// Check the materials for the texture
-	for (int i = 0; i < Model.getNumberOfMaterials(); ++i) {
+	return true;
+} /* finishMesh() */
 
-		// if the current material has a texture
-		if (Model.getMaterial(i).colorMapFilename != "") {
-
-			// Load the texture
-			if (TextureData != nullptr)
-				free(TextureData);
-
-			cout << "round " << i << " trying to load @ file path " << "House-Model\\House\\" << Model.getMaterial(i).colorMapFilename.c_str() << endl;
-			unsigned int fail = lodepng_decode_file(&TextureData, &TextureWidth, &TextureHeight,
-				("House-Model\\" + Model.getMaterial(i).colorMapFilename).c_str(),
-				LCT_RGB, 24); // Remember to check the last 2 parameters
-			if (fail != 0) {
-				cerr << "Error: cannot load texture file "
-					<< Model.getMaterial(i).colorMapFilename << endl;
-				return false;
-			}
 
-			// Create the texture object
-			if (TextureObject != 0)
-				glDeleteTextures(1, &TextureObject);
-			glGenTextures(1, &TextureObject);
-
-			// Bind it as a 2D texture (note that other types of textures are supported as well)
-			glBindTexture(GL_TEXTURE_2D, TextureObject);
-
-			// Set the texture data
-			glTexImage2D(
-				GL_TEXTURE_2D,
-				0,
-				GL_RGB,			// remember to check this
-				TextureWidth,
-				TextureHeight,
-				0,
-				GL_RGB,			// remember to check this
-				GL_UNSIGNED_BYTE,
-				TextureData
-			);
-
-			// Configure texture parameter
-			glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-			// For the moment, assumes there is only one texture to be loaded
-			// break;
+/// Called by the importer thread whenever a part of the model has been imported
+bool importProgress(float progress, void*) {
+	ImportProgress = static_cast<int>(progress * 100.0f);
+	return true; // keep going
+}
+
+
+/// Start the threads decoding the texture files
+void initTextures() {
+	unsigned int numThreads = max(1u, thread::hardware_concurrency());
+	for (unsigned int i = 0; i < numThreads; ++i)
+		TextureWorkers.push_back(thread(decodeTextures));
+} /* initTextures() */
+
+
+/// Look up the texture of a material. Its texture file is loaded through the texture
+/// cache in the background, materials without one get a single texel of their diffuse color
+void queueTexture(int material, const ModelOBJ::Material& mat) {
+	MaterialTextures.push_back(0);
+
+	if (mat.colorMapFilename.empty()) {
+		unsigned char color[3];
+		for (int i = 0; i < 3; ++i)
+			color[i] = static_cast<unsigned char>(min(max(mat.diffuse[i], 0.0f), 1.0f) * 255.0f + 0.5f);
+		createColorTexture(material, color);
+		return;
+	}
+
+	{
+		lock_guard<mutex> lock(TextureMutex);
+		TextureJobs.push_back(make_pair(material, "House-Model\\" + mat.colorMapFilename));
+		++TexturesPending;
+	}
+	TextureQueued.notify_one();
+} /* queueTexture() */
+
+
+/// Worker thread: load queued texture files until the queue is closed. Files whose
+/// contents are cached already are only read and hashed, not decoded
+void decodeTextures() {
+	for (;;) {
+		pair<int, string> job;
+		{
+			unique_lock<mutex> lock(TextureMutex);
+			TextureQueued.wait(lock, [] { return !TextureJobs.empty() || TextureJobsClosed; });
+			if (TextureJobs.empty())
+				return;
+			job = TextureJobs.front();
+			TextureJobs.pop_front();
 		}
+
+		TextureCache::Image image;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		if (!TextureCache::instance().load(job.second, image))
+			cerr << "Error: cannot load texture file " << job.second
+				<< " (" << lodepng_error_text(image.error) << ")" << endl;
+		double time = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+		lock_guard<mutex> lock(TextureMutex);
+		DecodeTime += time;
+		TexturesDecoded.push_back(make_pair(job.first, move(image)));
 	}
+} /* decodeTextures() */
 
-	return true;
-} /* initBuffers() */
+
+/// Upload the textures loaded since the last frame. Return true once all are done
+bool updateTextures() {
+	deque<pair<int, TextureCache::Image>> decoded;
+	bool done = false;
+	{
+		lock_guard<mutex> lock(TextureMutex);
+		decoded.swap(TexturesDecoded);
+		TexturesPending -= static_cast<int>(decoded.size());
+		done = TextureJobsClosed && TexturesPending == 0;
+	}
+
+	for (size_t i = 0; i < decoded.size(); ++i) {
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		GLuint texture = TextureCache::instance().acquire(decoded[i].second);
+		UploadTime += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+		if (texture != 0) {
+			MaterialTextures[decoded[i].first] = texture;
+		}
+		else {
+			// Fall back to a white texel so the mesh stays visible
+			unsigned char white[3] = { 255, 255, 255 };
+			createColorTexture(decoded[i].first, white);
+		}
+	}
+
+	if (!decoded.empty())
+		glutPostRedisplay();
+
+	if (done) {
+		for (size_t i = 0; i < TextureWorkers.size(); ++i)
+			TextureWorkers[i].join();
+		TextureWorkers.clear();
+
+		TextureCache::Statistics stats = TextureCache::instance().getStatistics();
+		cout << "loading times: parse " << ParseTime << " ms, decode " << DecodeTime
+			<< " ms on " << max(1u, thread::hardware_concurrency()) << " threads, upload "
+			<< UploadTime << " ms, total "
+			<< chrono::duration<double, milli>(chrono::steady_clock::now() - LoadStart).count()
+			<< " ms" << endl;
+		cout << "texture cache: " << stats.misses << " misses, " << stats.hits << " hits, "
+			<< stats.contentHits << " shared contents, " << stats.bakedLoads << " baked, "
+			<< stats.textures << " textures, " << stats.residentBytes / 1024 << " KB" << endl;
+	}
+
+	return done;
+} /* updateTextures() */
+
+
+/// Create a 1x1 texture of the given RGB color for a material
+void createColorTexture(int material, const unsigned char* color) {
+	GLuint texture = 0;
+	glGenTextures(1, &texture);
+	MaterialTextures[material] = texture;
+
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);	// RGB rows aren't 4-byte aligned
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, color);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+} /* createColorTexture() */
+
+
+/// Bake the mip chains of every texture of the model offline, so that the first run
+/// doesn't decode any PNG. Return the exit code
+int bakeTextures() {
+	if (!Model.import("House-Model\\House.obj")) {
+		cerr << "Error: cannot load model." << endl;
+		return -1;
+	}
+
+	int failed = 0;
+	for (int i = 0; i < Model.getNumberOfMaterials(); ++i) {
+		const string& filename = Model.getMaterial(i).colorMapFilename;
+		if (filename.empty())
+			continue;
+
+		float psnr = 0.0f;
+		if (TextureCache::instance().bake("House-Model\\" + filename, &psnr)) {
+			cout << "baked " << filename << ", PSNR " << psnr << " dB" << endl;
+		}
+		else {
+			cerr << "Error: cannot bake texture file " << filename << endl;
+			++failed;
+		}
+	}
+
+	return (failed == 0) ? 0 : -1;
+} /* bakeTextures() */
 
 
   /// Initialize shaders. Return false if initialization fail
@@ -507,4 +829,22 @@ void printString(float x, float y, string s) {
 	}
 }
 
+/// Set the format of a vertex attribute from a ModelOBJ vertex format
+void setVertexAttribute(GLint location, const ModelOBJ::VertexAttributeFormat& attribute, int stride) {
+	GLenum type = GL_FLOAT;
+	switch (attribute.type) {
+	case ModelOBJ::COMPONENT_HALF_FLOAT: type = GL_HALF_FLOAT; break;
+	case ModelOBJ::COMPONENT_SHORT: type = GL_SHORT; break;
+	case ModelOBJ::COMPONENT_UNSIGNED_SHORT: type = GL_UNSIGNED_SHORT; break;
+	default: type = GL_FLOAT; break;
+	}
+
+	const GLvoid* offset = reinterpret_cast<const GLvoid*>(static_cast<size_t>(attribute.offset));
+	if (attribute.integer)
+		glVertexAttribIPointer(location, attribute.components, type, stride, offset);
+	else
+		glVertexAttribPointer(location, attribute.components, type,
+			attribute.normalized ? GL_TRUE : GL_FALSE, stride, offset);
+}
+
   /* --- eof main.cpp --- */
\ No newline at end of file
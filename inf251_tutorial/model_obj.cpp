@@ -29,278 +29,3163 @@
 // The generateTangents() method is based on public source code from
 // http://www.terathon.com/code/tangent.php.
 //
-// The importGeometryFirstPass(), importGeometrySecondPass(), and
-// importMaterials() methods are based on source code from Nate Robins' OpenGL
-// Tutors programs (http://www.xmission.com/~nate/tutors.html).
+// The importMaterials() method is based on source code from Nate Robins'
+// OpenGL Tutors programs (http://www.xmission.com/~nate/tutors.html).
 //
 //-----------------------------------------------------------------------------
 
 #define _CRT_SECURE_NO_WARNINGS // suppress warnings for unsafe methods
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstddef>
+#include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <limits>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <utility>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "file_stamp.h"
 #include "model_obj.h"
 
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define MODEL_OBJ_USE_SSE2
+#include <emmintrin.h>
+#endif
+
 namespace
 {
     bool MeshCompFunc(const ModelOBJ::Mesh &lhs, const ModelOBJ::Mesh &rhs)
     {
-        return lhs.pMaterial->alpha > rhs.pMaterial->alpha;
+        return lhs.pMaterial->alpha > rhs.pMaterial->alpha;
+    }
+
+    //-------------------------------------------------------------------------
+    // Tokenizer helpers for the OBJ importer. They work on [p, pEnd) ranges
+    // of the mapped file and never depend on the C locale.
+    //-------------------------------------------------------------------------
+
+    enum FaceLayout
+    {
+        FACE_NONE = 0,
+        FACE_POS,                   // v
+        FACE_POS_TEXCOORD,          // v/vt
+        FACE_POS_NORMAL,            // v//vn
+        FACE_POS_TEXCOORD_NORMAL    // v/vt/vn
+    };
+
+    inline bool isEndOfLine(char c)
+    {
+        return c == '\n' || c == '\r';
+    }
+
+    inline bool isSpace(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\v' || c == '\f';
+    }
+
+    inline bool isDigit(char c)
+    {
+        return static_cast<unsigned>(c - '0') < 10u;
+    }
+
+    inline const char *skipSpaces(const char *p, const char *pEnd)
+    {
+        while (p < pEnd && isSpace(*p))
+            ++p;
+
+        return p;
+    }
+
+    inline const char *skipToken(const char *p, const char *pEnd)
+    {
+        while (p < pEnd && !isSpace(*p) && !isEndOfLine(*p))
+            ++p;
+
+        return p;
+    }
+
+    inline const char *skipLine(const char *p, const char *pEnd)
+    {
+        if (p >= pEnd)
+            return pEnd;
+
+        const char *pNewLine = static_cast<const char *>(memchr(p, '\n', pEnd - p));
+        return pNewLine ? pNewLine + 1 : pEnd;
+    }
+
+    inline bool matchKeyword(const char *pToken, size_t length, const char *pszKeyword)
+    {
+        return strlen(pszKeyword) == length && memcmp(pToken, pszKeyword, length) == 0;
+    }
+
+    inline const char *parseName(const char *p, const char *pEnd, std::string &name)
+    {
+        const char *pStart = p;
+
+        p = skipToken(p, pEnd);
+        name.assign(pStart, p);
+        return p;
+    }
+
+    // Parses a decimal integer. Values that don't fit into an int saturate
+    // to +-INT_MAX, which no face index or float exponent can use.
+    inline const char *parseInt(const char *p, const char *pEnd, int &value)
+    {
+        const int maxValue = std::numeric_limits<int>::max();
+        bool negative = false;
+        int result = 0;
+
+        if (p < pEnd && (*p == '-' || *p == '+'))
+            negative = (*p++ == '-');
+
+        for (; p < pEnd && isDigit(*p); ++p)
+        {
+            int digit = *p - '0';
+
+            result = (result > (maxValue - digit) / 10) ? maxValue : result * 10 + digit;
+        }
+
+        value = negative ? -result : result;
+        return p;
+    }
+
+    // Converts the token at p with strtof. The mapped file isn't terminated,
+    // so the token is copied first.
+    inline const char *parseFloatSlow(const char *p, const char *pEnd, float &value)
+    {
+        const char *pTokenEnd = skipToken(p, pEnd);
+        size_t length = static_cast<size_t>(pTokenEnd - p);
+        char buffer[64];
+        std::string longToken;
+        const char *pszToken = buffer;
+        char *pszStop = 0;
+
+        if (length < sizeof(buffer))
+        {
+            memcpy(buffer, p, length);
+            buffer[length] = '\0';
+        }
+        else
+        {
+            longToken.assign(p, pTokenEnd);
+            pszToken = longToken.c_str();
+        }
+
+        value = strtof(pszToken, &pszStop);
+        return p + (pszStop - pszToken);
+    }
+
+    // Parses a decimal floating point number. Mantissas that fit into a float
+    // combined with small exponents are converted exactly with a single
+    // division (Clinger's fast path), which gives the same correctly rounded
+    // result as strtof. Everything else, including nan and inf, is handed to
+    // strtof itself.
+    inline const char *parseFloat(const char *p, const char *pEnd, float &value)
+    {
+        static const float kPow10f[] =
+        {
+            1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+        };
+
+        const char *pStart = p;
+        bool negative = false;
+        unsigned long long mantissa = 0;
+        int numDigits = 0;
+        long long exponent = 0;
+
+        if (p < pEnd && (*p == '-' || *p == '+'))
+            negative = (*p++ == '-');
+
+        if (p == pEnd || !(isDigit(*p) || *p == '.'))
+            return parseFloatSlow(pStart, pEnd, value);
+
+        for (; p < pEnd && isDigit(*p); ++p)
+        {
+            if (numDigits < 19)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                numDigits += (mantissa != 0);
+            }
+            else
+            {
+                ++exponent;
+            }
+        }
+
+        if (p < pEnd && *p == '.')
+        {
+            for (++p; p < pEnd && isDigit(*p); ++p)
+            {
+                if (numDigits < 19)
+                {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    numDigits += (mantissa != 0);
+                    --exponent;
+                }
+            }
+        }
+
+        if (p < pEnd && (*p == 'e' || *p == 'E'))
+        {
+            int explicitExponent = 0;
+
+            p = parseInt(p + 1, pEnd, explicitExponent);
+            exponent += explicitExponent;
+        }
+
+        if (mantissa > (1ull << 24) || exponent < -10 || exponent > 10)
+            return parseFloatSlow(pStart, pEnd, value);
+
+        float result = static_cast<float>(mantissa);
+
+        result = (exponent < 0) ? result / kPow10f[-exponent] : result * kPow10f[exponent];
+        value = negative ? -result : result;
+        return p;
+    }
+
+    // Parses one face vertex in any of the v, v/vt, v//vn or v/vt/vn forms.
+    // Missing indices are returned as 0.
+    inline const char *parseFaceVertex(const char *p, const char *pEnd,
+                                       int &v, int &vt, int &vn, int &layout)
+    {
+        v = vt = vn = 0;
+        layout = FACE_NONE;
+
+        if (p == pEnd || !(isDigit(*p) || *p == '-' || *p == '+'))
+            return skipToken(p, pEnd);
+
+        p = parseInt(p, pEnd, v);
+        layout = FACE_POS;
+
+        if (p < pEnd && *p == '/')
+        {
+            ++p;
+
+            if (p < pEnd && *p != '/')
+            {
+                p = parseInt(p, pEnd, vt);
+                layout = FACE_POS_TEXCOORD;
+            }
+
+            if (p < pEnd && *p == '/')
+            {
+                p = parseInt(p + 1, pEnd, vn);
+                layout = (layout == FACE_POS_TEXCOORD) ? FACE_POS_TEXCOORD_NORMAL : FACE_POS_NORMAL;
+            }
+        }
+
+        return skipToken(p, pEnd);
+    }
+
+    // Converts a 1-based (or negative, relative) OBJ index into a 0-based one.
+    inline int resolveIndex(int index, int count)
+    {
+        if (index > 0)
+            return index - 1;
+
+        return (index < 0) ? count + index : -1;
+    }
+
+    inline bool isValidTriangle(const int indices[3], int count)
+    {
+        return indices[0] >= 0 && indices[0] < count
+            && indices[1] >= 0 && indices[1] < count
+            && indices[2] >= 0 && indices[2] < count;
+    }
+
+    inline unsigned int hashVertexIndices(int v, int vt, int vn)
+    {
+        unsigned int h = static_cast<unsigned int>(v) * 0x9E3779B1u;
+
+        h ^= static_cast<unsigned int>(vt) * 0x85EBCA77u;
+        h ^= static_cast<unsigned int>(vn) * 0xC2B2AE3Du;
+        h ^= h >> 15;
+        h *= 0x2C1B3C6Du;
+        h ^= h >> 13;
+        return h;
+    }
+
+    //-------------------------------------------------------------------------
+    // Binary mesh cache file layout (version 3). All values are stored in the
+    // native byte order of the machine that wrote the file:
+    //
+    //   CacheHeader
+    //   materials      14 floats + name, colorMapFilename, bumpMapFilename
+    //   libraries      MTL path, size and mtime for every loaded MTL file
+    //   meshes         startIndex, triangleCount, material index
+    //   LODs           numberOfMeshes + 1 level offsets and the levels, if
+    //                  CACHE_HAS_LODS is set
+    //   vertices       numberOfVertices * sizeof(Vertex), 16 byte aligned
+    //   indices        numberOfTriangles * 3 ints
+    //   LOD indices    numberOfLodIndices ints
+    //
+    // Strings are stored as a 32-bit length followed by the characters.
+    //-------------------------------------------------------------------------
+
+    const char CACHE_MAGIC[4] = {'M', 'O', 'B', 'J'};
+    const unsigned int CACHE_VERSION = 3;
+
+    enum CacheFlags
+    {
+        CACHE_HAS_POSITIONS = 1,
+        CACHE_HAS_TEXTURE_COORDS = 2,
+        CACHE_HAS_NORMALS = 4,
+        CACHE_HAS_TANGENTS = 8,
+        CACHE_REBUILT_NORMALS = 16,
+        CACHE_OPTIMIZED = 32,
+        CACHE_HAS_LODS = 64
+    };
+
+    struct CacheHeader
+    {
+        char magic[4];
+        unsigned int version;
+        unsigned int vertexSize;
+        unsigned int flags;
+
+        unsigned long long sourceSize;
+        long long sourceTime;
+        unsigned long long sourceHash;
+
+        int numberOfVertices;
+        int numberOfTriangles;
+        int numberOfMaterials;
+        int numberOfMeshes;
+        int numberOfLibraries;
+        int numberOfLodIndices;
+
+        float center[3];
+        float width;
+        float height;
+        float length;
+        float radius;
+        float padding;
+
+        unsigned long long verticesOffset;
+        unsigned long long indicesOffset;
+        unsigned long long fileSize;
+    };
+
+    void writeBytes(std::vector<char> &buffer, const void *pData, size_t size)
+    {
+        const char *pBytes = static_cast<const char *>(pData);
+        buffer.insert(buffer.end(), pBytes, pBytes + size);
+    }
+
+    void writeString(std::vector<char> &buffer, const std::string &str)
+    {
+        unsigned int length = static_cast<unsigned int>(str.size());
+
+        writeBytes(buffer, &length, sizeof(length));
+        writeBytes(buffer, str.data(), str.size());
+    }
+
+    bool readBytes(const char *&p, const char *pEnd, void *pData, size_t size)
+    {
+        if (static_cast<size_t>(pEnd - p) < size)
+            return false;
+
+        memcpy(pData, p, size);
+        p += size;
+        return true;
+    }
+
+    bool readString(const char *&p, const char *pEnd, std::string &str)
+    {
+        unsigned int length = 0;
+
+        if (!readBytes(p, pEnd, &length, sizeof(length)) || static_cast<size_t>(pEnd - p) < length)
+            return false;
+
+        str.assign(p, length);
+        p += length;
+        return true;
+    }
+
+    //-------------------------------------------------------------------------
+    // Vertex attribute encoders used by packVertices().
+    //-------------------------------------------------------------------------
+
+    // IEEE 754 binary32 to binary16 conversion with round to nearest even.
+    // Overflows become infinity, NaNs stay NaNs.
+    unsigned short floatToHalf(float value)
+    {
+        const unsigned int f32Infinity = 255u << 23;
+        const unsigned int f16Max = (127u + 16u) << 23;
+        const unsigned int denormMagicBits = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+        unsigned int bits = 0;
+        unsigned int result = 0;
+
+        memcpy(&bits, &value, sizeof(bits));
+
+        unsigned int sign = bits & 0x80000000u;
+        bits ^= sign;
+
+        if (bits >= f16Max)
+        {
+            result = (bits > f32Infinity) ? 0x7E00 : 0x7C00;
+        }
+        else if (bits < (113u << 23))
+        {
+            // Denormalized half. Let the FPU do the rounding.
+            float magnitude = 0.0f;
+            float denormMagic = 0.0f;
+
+            memcpy(&magnitude, &bits, sizeof(bits));
+            memcpy(&denormMagic, &denormMagicBits, sizeof(denormMagicBits));
+            magnitude += denormMagic;
+            memcpy(&bits, &magnitude, sizeof(bits));
+            result = bits - denormMagicBits;
+        }
+        else
+        {
+            unsigned int mantissaOdd = (bits >> 13) & 1;
+
+            bits += ((15u - 127u) << 23) + 0xFFF;
+            bits += mantissaOdd;
+            result = bits >> 13;
+        }
+
+        return static_cast<unsigned short>(result | (sign >> 16));
+    }
+
+    // Maps a unit vector onto the [-1, 1]^2 octahedral square.
+    void encodeOctahedral(const float v[3], float &x, float &y)
+    {
+        float l1 = fabsf(v[0]) + fabsf(v[1]) + fabsf(v[2]);
+
+        if (l1 == 0.0f)
+        {
+            x = y = 0.0f;
+            return;
+        }
+
+        x = v[0] / l1;
+        y = v[1] / l1;
+
+        if (v[2] < 0.0f)
+        {
+            float foldedX = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+            float foldedY = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+
+            x = foldedX;
+            y = foldedY;
+        }
+    }
+
+    short quantizeSnorm(float value, float maxValue)
+    {
+        value = std::min(1.0f, std::max(-1.0f, value));
+        return static_cast<short>(floorf(value * maxValue + 0.5f));
+    }
+
+    unsigned short quantizeUnorm16(float value)
+    {
+        value = std::min(1.0f, std::max(0.0f, value));
+        return static_cast<unsigned short>(floorf(value * 65535.0f + 0.5f));
+    }
+
+    // Meshlet file layout: a MeshletHeader followed by the meshlets, the
+    // meshlet vertex indices and the local triangle indices.
+
+    const char MESHLET_MAGIC[4] = {'M', 'L', 'E', 'T'};
+    const unsigned int MESHLET_VERSION = 1;
+
+    struct MeshletHeader
+    {
+        char magic[4];
+        unsigned int version;
+        unsigned int meshletSize;
+        unsigned int numberOfMeshlets;
+        unsigned int numberOfVertices;
+        unsigned int numberOfTriangles;
+    };
+
+    // Interleaves the lower 10 bits of x, y and z.
+    unsigned int mortonCode(unsigned int x, unsigned int y, unsigned int z)
+    {
+        unsigned int code = 0;
+
+        for (int i = 0; i < 10; ++i)
+        {
+            code |= ((x >> i) & 1) << (3 * i);
+            code |= ((y >> i) & 1) << (3 * i + 1);
+            code |= ((z >> i) & 1) << (3 * i + 2);
+        }
+
+        return code;
+    }
+
+    // Quadric error metric of Garland and Heckbert. A quadric sums the
+    // squared distances to a set of planes, weighted by triangle area. The
+    // weight is kept so that the error can be normalized to a distance.
+
+    struct Quadric
+    {
+        double a00, a11, a22, a01, a02, a12;
+        double b0, b1, b2;
+        double c;
+        double weight;
+    };
+
+    void addPlane(Quadric &q, const double normal[3], double d, double weight)
+    {
+        q.a00 += weight * normal[0] * normal[0];
+        q.a11 += weight * normal[1] * normal[1];
+        q.a22 += weight * normal[2] * normal[2];
+        q.a01 += weight * normal[0] * normal[1];
+        q.a02 += weight * normal[0] * normal[2];
+        q.a12 += weight * normal[1] * normal[2];
+        q.b0 += weight * normal[0] * d;
+        q.b1 += weight * normal[1] * d;
+        q.b2 += weight * normal[2] * d;
+        q.c += weight * d * d;
+    }
+
+    void addQuadric(Quadric &q, const Quadric &other)
+    {
+        q.a00 += other.a00;
+        q.a11 += other.a11;
+        q.a22 += other.a22;
+        q.a01 += other.a01;
+        q.a02 += other.a02;
+        q.a12 += other.a12;
+        q.b0 += other.b0;
+        q.b1 += other.b1;
+        q.b2 += other.b2;
+        q.c += other.c;
+        q.weight += other.weight;
+    }
+
+    // Returns the weighted squared distance of p to the planes of q.
+    double quadricError(const Quadric &q, const float p[3])
+    {
+        double x = p[0];
+        double y = p[1];
+        double z = p[2];
+        double error = q.a00 * x * x + q.a11 * y * y + q.a22 * z * z
+            + 2.0 * (q.a01 * x * y + q.a02 * x * z + q.a12 * y * z)
+            + 2.0 * (q.b0 * x + q.b1 * y + q.b2 * z) + q.c;
+
+        return (q.weight > 0.0) ? std::max(0.0, error / q.weight) : 0.0;
+    }
+
+    // Returns twice the area vector of the triangle p0 p1 p2.
+    void triangleNormal(const float *p0, const float *p1, const float *p2, double normal[3])
+    {
+        double edge1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+        double edge2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+
+        normal[0] = edge1[1] * edge2[2] - edge1[2] * edge2[1];
+        normal[1] = edge1[2] * edge2[0] - edge1[0] * edge2[2];
+        normal[2] = edge1[0] * edge2[1] - edge1[1] * edge2[0];
+    }
+
+    // Border planes are weighted up so that open borders keep their shape.
+    const double LOD_BORDER_WEIGHT = 10.0;
+
+    // Meshes with fewer triangles are not simplified any further.
+    const int LOD_MIN_TRIANGLES = 8;
+
+    struct LodEdge
+    {
+        int from;
+        int to;
+        double cost;
+
+        bool operator<(const LodEdge &other) const
+        {
+            if (cost != other.cost)
+                return cost < other.cost;
+
+            return (from != other.from) ? from < other.from : to < other.to;
+        }
+    };
+
+    // Vertex scoring for the Forsyth vertex cache optimizer. The scores are
+    // tabulated for the LRU cache positions and small valences.
+
+    const int FORSYTH_CACHE_SIZE = 32;
+    const int FORSYTH_MAX_VALENCE = 64;
+
+    float forsythVertexScore(int cachePosition, int remainingTriangles)
+    {
+        struct ScoreTables
+        {
+            float cache[FORSYTH_CACHE_SIZE];
+            float valence[FORSYTH_MAX_VALENCE];
+
+            ScoreTables()
+            {
+                // Last triangle score 0.75, cache decay power 1.5,
+                // valence boost scale 2.0 and power 0.5.
+
+                for (int i = 0; i < FORSYTH_CACHE_SIZE; ++i)
+                {
+                    cache[i] = (i < 3) ? 0.75f
+                        : powf(1.0f - (i - 3) / static_cast<float>(FORSYTH_CACHE_SIZE - 3), 1.5f);
+                }
+
+                for (int i = 0; i < FORSYTH_MAX_VALENCE; ++i)
+                    valence[i] = (i == 0) ? 0.0f : 2.0f / sqrtf(static_cast<float>(i));
+            }
+        };
+
+        static const ScoreTables tables;
+
+        if (remainingTriangles == 0)
+            return -1.0f;
+
+        float score = (cachePosition >= 0) ? tables.cache[cachePosition] : 0.0f;
+
+        if (remainingTriangles < FORSYTH_MAX_VALENCE)
+            score += tables.valence[remainingTriangles];
+        else
+            score += 2.0f / sqrtf(static_cast<float>(remainingTriangles));
+
+        return score;
+    }
+
+    // Counts the misses of a FIFO vertex cache over a triangle list. If
+    // pRestarts isn't null, it receives the triangles that miss on all
+    // three vertices. cacheTime has to be -1 for every vertex and is left
+    // that way.
+    int countCacheMisses(const int *pIndices, int triangleCount, int cacheSize,
+        std::vector<int> &cacheTime, std::vector<int> *pRestarts)
+    {
+        int insertions = 0;
+        int totalMisses = 0;
+
+        for (int i = 0; i < triangleCount; ++i)
+        {
+            int misses = 0;
+
+            for (int j = 0; j < 3; ++j)
+            {
+                int &time = cacheTime[pIndices[i * 3 + j]];
+
+                if (time < 0 || insertions - time >= cacheSize)
+                {
+                    time = insertions++;
+                    ++misses;
+                }
+            }
+
+            if (misses == 3 && pRestarts)
+                pRestarts->push_back(i);
+
+            totalMisses += misses;
+        }
+
+        for (int i = 0; i < triangleCount * 3; ++i)
+            cacheTime[pIndices[i]] = -1;
+
+        return totalMisses;
+    }
+
+    // Runs func(0) ... func(count - 1) on up to numThreads threads. The
+    // calling thread takes part in the work, so numThreads == 1 runs
+    // everything inline.
+    template <typename Func>
+    void parallelFor(int numThreads, int count, Func func)
+    {
+        std::atomic<int> next(0);
+        std::vector<std::thread> workers;
+
+        auto worker = [&]()
+        {
+            for (int i = next++; i < count; i = next++)
+                func(i);
+        };
+
+        for (int i = 1; i < std::min(numThreads, count); ++i)
+            workers.push_back(std::thread(worker));
+
+        worker();
+
+        for (size_t i = 0; i < workers.size(); ++i)
+            workers[i].join();
+    }
+
+    // An incremental import parses the OBJ file in chunks of about this
+    // many bytes and publishes new batches after each of them.
+    const size_t STREAM_CHUNK_SIZE = 256 * 1024;
+
+    // Threads compute triangle face normals and tangent frames in blocks of
+    // this many triangles, and sum them into blocks of this many vertices.
+    const int GENERATE_BLOCK_SIZE = 4096;
+
+    // Lists the triangles using each vertex in ascending order, so that
+    // summing over them adds in the same order as a serial triangle walk.
+    void buildVertexAdjacency(const int *pIndices, int totalTriangles,
+        int totalVertices, std::vector<int> &offsets, std::vector<int> &triangles)
+    {
+        offsets.assign(totalVertices + 1, 0);
+        triangles.resize(totalTriangles * 3);
+
+        for (int i = 0; i < totalTriangles * 3; ++i)
+            ++offsets[pIndices[i] + 1];
+
+        for (int i = 0; i < totalVertices; ++i)
+            offsets[i + 1] += offsets[i];
+
+        std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+
+        for (int i = 0; i < totalTriangles * 3; ++i)
+            triangles[fill[pIndices[i]]++] = i / 3;
+    }
+
+    void computeFaceNormal(const ModelOBJ::Vertex *pVertices,
+        const int *pTriangle, float normal[3])
+    {
+        const float *p0 = pVertices[pTriangle[0]].position;
+        const float *p1 = pVertices[pTriangle[1]].position;
+        const float *p2 = pVertices[pTriangle[2]].position;
+        float edge1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+        float edge2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+
+        normal[0] = (edge1[1] * edge2[2]) - (edge1[2] * edge2[1]);
+        normal[1] = (edge1[2] * edge2[0]) - (edge1[0] * edge2[2]);
+        normal[2] = (edge1[0] * edge2[1]) - (edge1[1] * edge2[0]);
+    }
+
+    // Triangles with degenerate texture coordinates get a fixed frame.
+    void computeFaceTangent(const ModelOBJ::Vertex *pVertices,
+        const int *pTriangle, float tangent[3], float bitangent[3])
+    {
+        const ModelOBJ::Vertex *pVertex0 = &pVertices[pTriangle[0]];
+        const ModelOBJ::Vertex *pVertex1 = &pVertices[pTriangle[1]];
+        const ModelOBJ::Vertex *pVertex2 = &pVertices[pTriangle[2]];
+        float edge1[3];
+        float edge2[3];
+        float texEdge1[2];
+        float texEdge2[2];
+
+        for (int k = 0; k < 3; ++k)
+        {
+            edge1[k] = pVertex1->position[k] - pVertex0->position[k];
+            edge2[k] = pVertex2->position[k] - pVertex0->position[k];
+        }
+
+        for (int k = 0; k < 2; ++k)
+        {
+            texEdge1[k] = pVertex1->texCoord[k] - pVertex0->texCoord[k];
+            texEdge2[k] = pVertex2->texCoord[k] - pVertex0->texCoord[k];
+        }
+
+        float det = texEdge1[0] * texEdge2[1] - texEdge2[0] * texEdge1[1];
+
+        if (fabs(det) < 1e-6f)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                tangent[k] = (k == 0) ? 1.0f : 0.0f;
+                bitangent[k] = (k == 1) ? 1.0f : 0.0f;
+            }
+        }
+        else
+        {
+            det = 1.0f / det;
+
+            for (int k = 0; k < 3; ++k)
+            {
+                tangent[k] = (texEdge2[1] * edge1[k] - texEdge1[1] * edge2[k]) * det;
+                bitangent[k] = (-texEdge2[0] * edge1[k] + texEdge1[0] * edge2[k]) * det;
+            }
+        }
+    }
+
+    // Face normals of triangles [first, last) written as structure of
+    // arrays. The SSE path computes four triangles at once with the same
+    // operations in the same order as the scalar path, so both produce
+    // identical results.
+    void computeFaceNormals(const ModelOBJ::Vertex *pVertices,
+        const int *pIndices, int first, int last, float *pNormals[3])
+    {
+        int i = first;
+
+#if defined(MODEL_OBJ_USE_SSE2)
+        for (; i + 4 <= last; i += 4)
+        {
+            const int *pTriangle = &pIndices[i * 3];
+            const float *p[4][3];
+
+            for (int j = 0; j < 4; ++j)
+            {
+                for (int k = 0; k < 3; ++k)
+                    p[j][k] = pVertices[pTriangle[j * 3 + k]].position;
+            }
+
+            __m128 edge1[3];
+            __m128 edge2[3];
+
+            for (int k = 0; k < 3; ++k)
+            {
+                __m128 p0 = _mm_setr_ps(p[0][0][k], p[1][0][k], p[2][0][k], p[3][0][k]);
+                __m128 p1 = _mm_setr_ps(p[0][1][k], p[1][1][k], p[2][1][k], p[3][1][k]);
+                __m128 p2 = _mm_setr_ps(p[0][2][k], p[1][2][k], p[2][2][k], p[3][2][k]);
+
+                edge1[k] = _mm_sub_ps(p1, p0);
+                edge2[k] = _mm_sub_ps(p2, p0);
+            }
+
+            _mm_storeu_ps(&pNormals[0][i], _mm_sub_ps(
+                _mm_mul_ps(edge1[1], edge2[2]), _mm_mul_ps(edge1[2], edge2[1])));
+            _mm_storeu_ps(&pNormals[1][i], _mm_sub_ps(
+                _mm_mul_ps(edge1[2], edge2[0]), _mm_mul_ps(edge1[0], edge2[2])));
+            _mm_storeu_ps(&pNormals[2][i], _mm_sub_ps(
+                _mm_mul_ps(edge1[0], edge2[1]), _mm_mul_ps(edge1[1], edge2[0])));
+        }
+#endif
+
+        for (; i < last; ++i)
+        {
+            float normal[3];
+
+            computeFaceNormal(pVertices, &pIndices[i * 3], normal);
+
+            for (int k = 0; k < 3; ++k)
+                pNormals[k][i] = normal[k];
+        }
+    }
+
+    // Face tangents and bitangents of triangles [first, last), as above.
+    void computeFaceTangents(const ModelOBJ::Vertex *pVertices,
+        const int *pIndices, int first, int last, float *pTangents[3],
+        float *pBitangents[3])
+    {
+        int i = first;
+
+#if defined(MODEL_OBJ_USE_SSE2)
+        const __m128 signMask = _mm_set1_ps(-0.0f);
+        const __m128 epsilon = _mm_set1_ps(1e-6f);
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 zero = _mm_setzero_ps();
+
+        for (; i + 4 <= last; i += 4)
+        {
+            const int *pTriangle = &pIndices[i * 3];
+            const ModelOBJ::Vertex *v[4][3];
+
+            for (int j = 0; j < 4; ++j)
+            {
+                for (int k = 0; k < 3; ++k)
+                    v[j][k] = &pVertices[pTriangle[j * 3 + k]];
+            }
+
+            __m128 edge1[3];
+            __m128 edge2[3];
+            __m128 texEdge1[2];
+            __m128 texEdge2[2];
+
+            for (int k = 0; k < 3; ++k)
+            {
+                __m128 p0 = _mm_setr_ps(v[0][0]->position[k], v[1][0]->position[k],
+                    v[2][0]->position[k], v[3][0]->position[k]);
+                __m128 p1 = _mm_setr_ps(v[0][1]->position[k], v[1][1]->position[k],
+                    v[2][1]->position[k], v[3][1]->position[k]);
+                __m128 p2 = _mm_setr_ps(v[0][2]->position[k], v[1][2]->position[k],
+                    v[2][2]->position[k], v[3][2]->position[k]);
+
+                edge1[k] = _mm_sub_ps(p1, p0);
+                edge2[k] = _mm_sub_ps(p2, p0);
+            }
+
+            for (int k = 0; k < 2; ++k)
+            {
+                __m128 t0 = _mm_setr_ps(v[0][0]->texCoord[k], v[1][0]->texCoord[k],
+                    v[2][0]->texCoord[k], v[3][0]->texCoord[k]);
+                __m128 t1 = _mm_setr_ps(v[0][1]->texCoord[k], v[1][1]->texCoord[k],
+                    v[2][1]->texCoord[k], v[3][1]->texCoord[k]);
+                __m128 t2 = _mm_setr_ps(v[0][2]->texCoord[k], v[1][2]->texCoord[k],
+                    v[2][2]->texCoord[k], v[3][2]->texCoord[k]);
+
+                texEdge1[k] = _mm_sub_ps(t1, t0);
+                texEdge2[k] = _mm_sub_ps(t2, t0);
+            }
+
+            __m128 det = _mm_sub_ps(_mm_mul_ps(texEdge1[0], texEdge2[1]),
+                _mm_mul_ps(texEdge2[0], texEdge1[1]));
+            __m128 degenerate = _mm_cmplt_ps(_mm_andnot_ps(signMask, det), epsilon);
+
+            det = _mm_div_ps(one, det);
+
+            for (int k = 0; k < 3; ++k)
+            {
+                __m128 tangent = _mm_mul_ps(_mm_sub_ps(
+                    _mm_mul_ps(texEdge2[1], edge1[k]),
+                    _mm_mul_ps(texEdge1[1], edge2[k])), det);
+                __m128 bitangent = _mm_mul_ps(_mm_add_ps(
+                    _mm_mul_ps(_mm_xor_ps(texEdge2[0], signMask), edge1[k]),
+                    _mm_mul_ps(texEdge1[0], edge2[k])), det);
+                __m128 fixedTangent = (k == 0) ? one : zero;
+                __m128 fixedBitangent = (k == 1) ? one : zero;
+
+                tangent = _mm_or_ps(_mm_and_ps(degenerate, fixedTangent),
+                    _mm_andnot_ps(degenerate, tangent));
+                bitangent = _mm_or_ps(_mm_and_ps(degenerate, fixedBitangent),
+                    _mm_andnot_ps(degenerate, bitangent));
+
+                _mm_storeu_ps(&pTangents[k][i], tangent);
+                _mm_storeu_ps(&pBitangents[k][i], bitangent);
+            }
+        }
+#endif
+
+        for (; i < last; ++i)
+        {
+            float tangent[3];
+            float bitangent[3];
+
+            computeFaceTangent(pVertices, &pIndices[i * 3], tangent, bitangent);
+
+            for (int k = 0; k < 3; ++k)
+            {
+                pTangents[k][i] = tangent[k];
+                pBitangents[k][i] = bitangent[k];
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Memory mapping of a whole file. The OBJ importer scans the mapped bytes
+// directly instead of going through stdio. Binary mesh caches are mapped
+// copy-on-write so that normalize() and friends can still modify the
+// vertices in place without touching the file on disk.
+//-----------------------------------------------------------------------------
+
+class ModelOBJ::MappedFile
+{
+public:
+    MappedFile() : m_pData(0), m_size(0)
+#if defined(_WIN32)
+        , m_hFile(INVALID_HANDLE_VALUE), m_hMapping(0)
+#endif
+    {
+    }
+
+    ~MappedFile()
+    {
+        close();
+    }
+
+    bool open(const char *pszFilename, bool copyOnWrite = false)
+    {
+        close();
+
+#if defined(_WIN32)
+        m_hFile = CreateFileA(pszFilename, GENERIC_READ,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0,
+            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+
+        if (m_hFile == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER fileSize;
+
+        if (!GetFileSizeEx(m_hFile, &fileSize))
+        {
+            close();
+            return false;
+        }
+
+        m_size = static_cast<size_t>(fileSize.QuadPart);
+
+        if (m_size == 0)
+            return true;
+
+        m_hMapping = CreateFileMappingA(m_hFile, 0,
+            copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, 0);
+
+        if (!m_hMapping)
+        {
+            close();
+            return false;
+        }
+
+        m_pData = static_cast<char *>(MapViewOfFile(m_hMapping,
+            copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0));
+#else
+        int fd = ::open(pszFilename, O_RDONLY);
+
+        if (fd < 0)
+            return false;
+
+        struct stat fileInfo;
+
+        if (fstat(fd, &fileInfo) != 0)
+        {
+            ::close(fd);
+            return false;
+        }
+
+        m_size = static_cast<size_t>(fileInfo.st_size);
+
+        if (m_size == 0)
+        {
+            ::close(fd);
+            return true;
+        }
+
+        int protection = copyOnWrite ? (PROT_READ | PROT_WRITE) : PROT_READ;
+        void *pMapping = mmap(0, m_size, protection, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+
+        if (pMapping != MAP_FAILED)
+        {
+            madvise(pMapping, m_size, MADV_SEQUENTIAL);
+            m_pData = static_cast<char *>(pMapping);
+        }
+#endif
+
+        if (!m_pData)
+        {
+            close();
+            return false;
+        }
+
+        return true;
+    }
+
+    void close()
+    {
+#if defined(_WIN32)
+        if (m_pData)
+            UnmapViewOfFile(m_pData);
+
+        if (m_hMapping)
+            CloseHandle(m_hMapping);
+
+        if (m_hFile != INVALID_HANDLE_VALUE)
+            CloseHandle(m_hFile);
+
+        m_hMapping = 0;
+        m_hFile = INVALID_HANDLE_VALUE;
+#else
+        if (m_pData)
+            munmap(m_pData, m_size);
+#endif
+
+        m_pData = 0;
+        m_size = 0;
+    }
+
+    char *data() const
+    { return m_pData; }
+
+    size_t size() const
+    { return m_size; }
+
+private:
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
+
+    char *m_pData;
+    size_t m_size;
+#if defined(_WIN32)
+    HANDLE m_hFile;
+    HANDLE m_hMapping;
+#endif
+};
+
+//-----------------------------------------------------------------------------
+// State shared between the main thread and the worker thread of an
+// incremental import. Batches are handed over under the mutex, everything
+// else in the model belongs to the worker until endImport().
+//-----------------------------------------------------------------------------
+
+struct ModelOBJ::ImportStream
+{
+    ImportStream(ImportCallback pCallback, void *pUserData)
+        : pCallback(pCallback), pUserData(pUserData), status(IMPORT_RUNNING),
+          cancelled(false), polledMaterials(0), publishedTriangles(0), publishedVertices(0)
+    {
+    }
+
+    ImportCallback pCallback;
+    void *pUserData;
+
+    std::thread worker;
+    std::atomic<int> status;
+    std::atomic<bool> cancelled;
+
+    std::mutex mutex;
+    std::deque<Batch> batches;
+    std::vector<Material> materials;
+    size_t polledMaterials;
+
+    // Only touched by the worker thread.
+    int publishedTriangles;
+    int publishedVertices;
+};
+
+ModelOBJ::ModelOBJ()
+{
+    m_hasPositions = false;
+    m_hasNormals = false;
+    m_hasTextureCoords = false;
+    m_hasTangents = false;
+
+    m_numberOfVertexCoords = 0;
+    m_numberOfTextureCoords = 0;
+    m_numberOfNormals = 0;
+    m_numberOfTriangles = 0;
+    m_numberOfMaterials = 0;
+    m_numberOfMeshes = 0;
+    m_numberOfVertices = 0;
+    m_numberOfLodIndices = 0;
+    m_vertexCacheSize = 0;
+
+    m_center[0] = m_center[1] = m_center[2] = 0.0f;
+    m_width = m_height = m_length = m_radius = 0.0f;
+
+    m_binaryCacheEnabled = true;
+    m_optimizeOnImport = false;
+    m_lodsOnImport = false;
+    m_pCacheFile = 0;
+    m_pImportStream = 0;
+    m_pVertices = 0;
+    m_pIndices = 0;
+    m_pLodIndices = 0;
+}
+
+ModelOBJ::~ModelOBJ()
+{
+    if (m_pImportStream)
+    {
+        cancelImport();
+        endImport();
+    }
+
+    destroy();
+}
+
+void ModelOBJ::bounds(float center[3], float &width, float &height,
+                      float &length, float &radius) const
+{
+    float xMax = std::numeric_limits<float>::min();
+    float yMax = std::numeric_limits<float>::min();
+    float zMax = std::numeric_limits<float>::min();
+
+    float xMin = std::numeric_limits<float>::max();
+    float yMin = std::numeric_limits<float>::max();
+    float zMin = std::numeric_limits<float>::max();
+
+    float x = 0.0f;
+    float y = 0.0f;
+    float z = 0.0f;
+
+    int numVerts = m_numberOfVertices;
+
+    for (int i = 0; i < numVerts; ++i)
+    {
+        x = m_pVertices[i].position[0];
+        y = m_pVertices[i].position[1];
+        z = m_pVertices[i].position[2];
+
+        if (x < xMin)
+            xMin = x;
+
+        if (x > xMax)
+            xMax = x;
+
+        if (y < yMin)
+            yMin = y;
+
+        if (y > yMax)
+            yMax = y;
+
+        if (z < zMin)
+            zMin = z;
+
+        if (z > zMax)
+            zMax = z;
+    }
+
+    center[0] = (xMin + xMax) / 2.0f;
+    center[1] = (yMin + yMax) / 2.0f;
+    center[2] = (zMin + zMax) / 2.0f;
+
+    width = xMax - xMin;
+    height = yMax - yMin;
+    length = zMax - zMin;
+
+    radius = std::max(std::max(width, height), length);
+}
+
+void ModelOBJ::boundMeshlet(Meshlet &meshlet, const MeshletBuffer &buffer) const
+{
+    const int *pVertices = &buffer.vertices[meshlet.vertexOffset];
+    const unsigned char *pTriangles = &buffer.triangles[meshlet.triangleOffset * 3];
+
+    // Bounding sphere around the center of the bounding box.
+
+    float boxMin[3] = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max()};
+    float boxMax[3] = {-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max()};
+    float radiusSquared = 0.0f;
+
+    for (int i = 0; i < meshlet.vertexCount; ++i)
+    {
+        const float *pPosition = m_pVertices[pVertices[i]].position;
+
+        for (int k = 0; k < 3; ++k)
+        {
+            boxMin[k] = std::min(boxMin[k], pPosition[k]);
+            boxMax[k] = std::max(boxMax[k], pPosition[k]);
+        }
+    }
+
+    for (int k = 0; k < 3; ++k)
+        meshlet.center[k] = (boxMin[k] + boxMax[k]) * 0.5f;
+
+    for (int i = 0; i < meshlet.vertexCount; ++i)
+    {
+        const float *pPosition = m_pVertices[pVertices[i]].position;
+        float dx = pPosition[0] - meshlet.center[0];
+        float dy = pPosition[1] - meshlet.center[1];
+        float dz = pPosition[2] - meshlet.center[2];
+
+        radiusSquared = std::max(radiusSquared, dx * dx + dy * dy + dz * dz);
+    }
+
+    meshlet.radius = sqrtf(radiusSquared);
+
+    // Normal cone around the average of the triangle face normals. The apex
+    // is moved back along the axis until every triangle plane is in front of
+    // it, and the cutoff is the sine of the widest angle to the axis.
+
+    std::vector<float> normals(meshlet.triangleCount * 3, 0.0f);
+    float axis[3] = {0.0f, 0.0f, 0.0f};
+
+    for (int i = 0; i < meshlet.triangleCount; ++i)
+    {
+        const float *p0 = m_pVertices[pVertices[pTriangles[i * 3]]].position;
+        const float *p1 = m_pVertices[pVertices[pTriangles[i * 3 + 1]]].position;
+        const float *p2 = m_pVertices[pVertices[pTriangles[i * 3 + 2]]].position;
+        float edge1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+        float edge2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+        float normal[3];
+
+        normal[0] = edge1[1] * edge2[2] - edge1[2] * edge2[1];
+        normal[1] = edge1[2] * edge2[0] - edge1[0] * edge2[2];
+        normal[2] = edge1[0] * edge2[1] - edge1[1] * edge2[0];
+
+        float length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+
+        // Degenerate triangles can't be seen from anywhere and keep a zero
+        // normal.
+        if (length == 0.0f)
+            continue;
+
+        for (int k = 0; k < 3; ++k)
+        {
+            normals[i * 3 + k] = normal[k] / length;
+            axis[k] += normals[i * 3 + k];
+        }
+    }
+
+    float axisLength = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    float minDot = 1.0f;
+
+    for (int k = 0; k < 3; ++k)
+    {
+        meshlet.coneAxis[k] = (axisLength > 0.0f) ? axis[k] / axisLength : 0.0f;
+        meshlet.coneApex[k] = meshlet.center[k];
+    }
+
+    for (int i = 0; i < meshlet.triangleCount; ++i)
+    {
+        const float *pNormal = &normals[i * 3];
+
+        if (pNormal[0] != 0.0f || pNormal[1] != 0.0f || pNormal[2] != 0.0f)
+        {
+            minDot = std::min(minDot, pNormal[0] * meshlet.coneAxis[0]
+                + pNormal[1] * meshlet.coneAxis[1] + pNormal[2] * meshlet.coneAxis[2]);
+        }
+    }
+
+    // Cones opening wider than about 84 degrees around the axis are useless.
+    if (axisLength == 0.0f || minDot <= 0.1f)
+    {
+        meshlet.coneCutoff = 2.0f;
+        return;
+    }
+
+    float maxT = 0.0f;
+
+    for (int i = 0; i < meshlet.triangleCount; ++i)
+    {
+        const float *p0 = m_pVertices[pVertices[pTriangles[i * 3]]].position;
+        const float *pNormal = &normals[i * 3];
+        float dc = (meshlet.center[0] - p0[0]) * pNormal[0]
+            + (meshlet.center[1] - p0[1]) * pNormal[1]
+            + (meshlet.center[2] - p0[2]) * pNormal[2];
+        float dn = meshlet.coneAxis[0] * pNormal[0] + meshlet.coneAxis[1] * pNormal[1]
+            + meshlet.coneAxis[2] * pNormal[2];
+
+        if (dn > 0.0f)
+            maxT = std::max(maxT, dc / dn);
+    }
+
+    for (int k = 0; k < 3; ++k)
+        meshlet.coneApex[k] = meshlet.center[k] - meshlet.coneAxis[k] * maxT;
+
+    meshlet.coneCutoff = sqrtf(1.0f - minDot * minDot);
+}
+
+void ModelOBJ::destroy()
+{
+    m_hasPositions = false;
+    m_hasTextureCoords = false;
+    m_hasNormals = false;
+    m_hasTangents = false;
+
+    m_numberOfVertexCoords = 0;
+    m_numberOfTextureCoords = 0;
+    m_numberOfNormals = 0;
+    m_numberOfTriangles = 0;
+    m_numberOfMaterials = 0;
+    m_numberOfMeshes = 0;
+    m_numberOfVertices = 0;
+    m_numberOfLodIndices = 0;
+
+    m_center[0] = m_center[1] = m_center[2] = 0.0f;
+    m_width = m_height = m_length = m_radius = 0.0f;
+
+    m_directoryPath.clear();
+    m_materialLibraries.clear();
+
+    delete m_pCacheFile;
+    m_pCacheFile = 0;
+    m_pVertices = 0;
+    m_pIndices = 0;
+    m_pLodIndices = 0;
+
+    m_meshes.clear();
+    m_materials.clear();
+    m_vertexBuffer.clear();
+    m_indexBuffer.clear();
+    m_attributeBuffer.clear();
+    m_lods.clear();
+    m_lodOffsets.clear();
+    m_lodIndexBuffer.clear();
+
+    m_vertexCoords.clear();
+    m_textureCoords.clear();
+    m_normals.clear();
+
+    m_materialCache.clear();
+    std::vector<VertexCacheEntry>().swap(m_vertexCache);
+    m_vertexCacheSize = 0;
+}
+
+bool ModelOBJ::import(const char *pszFilename, bool rebuildNormals, int numThreads)
+{
+    destroy();
+    return importFile(pszFilename, rebuildNormals, numThreads);
+}
+
+void ModelOBJ::beginImport(const char *pszFilename, bool rebuildNormals,
+                           int numThreads, ImportCallback pCallback, void *pUserData)
+{
+    if (m_pImportStream)
+    {
+        cancelImport();
+        endImport();
+    }
+
+    destroy();
+
+    std::string filename = pszFilename;
+
+    m_pImportStream = new ImportStream(pCallback, pUserData);
+    m_pImportStream->worker = std::thread([this, filename, rebuildNormals, numThreads]()
+    {
+        bool imported = importFile(filename.c_str(), rebuildNormals, numThreads);
+
+        if (imported)
+            m_pImportStream->status = IMPORT_FINISHED;
+        else if (m_pImportStream->cancelled)
+            m_pImportStream->status = IMPORT_CANCELLED;
+        else
+            m_pImportStream->status = IMPORT_FAILED;
+    });
+}
+
+bool ModelOBJ::pollBatch(Batch &batch)
+{
+    if (!m_pImportStream)
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_pImportStream->mutex);
+
+    if (m_pImportStream->batches.empty())
+        return false;
+
+    batch = std::move(m_pImportStream->batches.front());
+    m_pImportStream->batches.pop_front();
+    return true;
+}
+
+bool ModelOBJ::pollMaterial(Material &material)
+{
+    if (!m_pImportStream)
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_pImportStream->mutex);
+
+    if (m_pImportStream->polledMaterials == m_pImportStream->materials.size())
+        return false;
+
+    material = m_pImportStream->materials[m_pImportStream->polledMaterials++];
+    return true;
+}
+
+ModelOBJ::ImportStatus ModelOBJ::getImportStatus() const
+{
+    if (!m_pImportStream)
+        return IMPORT_IDLE;
+
+    return static_cast<ImportStatus>(m_pImportStream->status.load());
+}
+
+void ModelOBJ::cancelImport()
+{
+    if (m_pImportStream)
+        m_pImportStream->cancelled = true;
+}
+
+bool ModelOBJ::endImport()
+{
+    if (!m_pImportStream)
+        return false;
+
+    m_pImportStream->worker.join();
+
+    bool imported = (m_pImportStream->status == IMPORT_FINISHED);
+
+    delete m_pImportStream;
+    m_pImportStream = 0;
+
+    if (!imported)
+        destroy();
+
+    return imported;
+}
+
+bool ModelOBJ::importFile(const char *pszFilename, bool rebuildNormals, int numThreads)
+{
+    // Extract the directory the OBJ file is in from the file name.
+    // This directory path will be used to load the OBJ's associated MTL file.
+
+    std::string filename = pszFilename;
+    std::string::size_type offset = filename.find_last_of('\\');
+
+    if (offset != std::string::npos)
+    {
+        m_directoryPath = filename.substr(0, ++offset);
+    }
+    else
+    {
+        offset = filename.find_last_of('/');
+
+        if (offset != std::string::npos)
+            m_directoryPath = filename.substr(0, ++offset);
+    }
+
+    // Use the binary cache next to the OBJ file if it is still up to date.
+
+    std::string cacheFilename = filename + ".cache";
+
+    if (m_binaryCacheEnabled && importCache(cacheFilename.c_str(), pszFilename, rebuildNormals))
+    {
+        if (m_pImportStream)
+        {
+            std::lock_guard<std::mutex> lock(m_pImportStream->mutex);
+
+            m_pImportStream->materials = m_materials;
+
+            for (int i = 0; i < m_numberOfMeshes; ++i)
+            {
+                const Mesh &mesh = m_meshes[i];
+                Batch batch;
+
+                batch.material = static_cast<int>(mesh.pMaterial - &m_materials[0]);
+                batch.startIndex = mesh.startIndex;
+                batch.triangleCount = mesh.triangleCount;
+                batch.firstVertex = 0;
+                batch.indices.assign(m_pIndices + mesh.startIndex,
+                    m_pIndices + mesh.startIndex + mesh.triangleCount * 3);
+
+                if (i == 0)
+                    batch.vertices.assign(m_pVertices, m_pVertices + m_numberOfVertices);
+
+                m_pImportStream->batches.push_back(std::move(batch));
+            }
+        }
+
+        return true;
+    }
+
+    MappedFile file;
+
+    if (!file.open(pszFilename))
+        return false;
+
+    if (numThreads <= 0)
+        numThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+    // Import the OBJ file straight from the mapped file contents.
+
+    if (!importGeometry(file.data(), file.size(), numThreads))
+        return false;
+
+    m_pVertices = m_vertexBuffer.empty() ? 0 : &m_vertexBuffer[0];
+    m_pIndices = m_indexBuffer.empty() ? 0 : &m_indexBuffer[0];
+    m_numberOfVertices = static_cast<int>(m_vertexBuffer.size());
+
+    // Perform post import tasks.
+
+    buildMeshes();
+    bounds(m_center, m_width, m_height, m_length, m_radius);
+
+    // Build vertex normals if required.
+
+    if (rebuildNormals)
+    {
+        generateNormals(numThreads);
+    }
+    else
+    {
+        if (!hasNormals())
+            generateNormals(numThreads);
+    }
+
+    // Build tangents is required.
+
+    for (int i = 0; i < m_numberOfMaterials; ++i)
+    {
+        if (!m_materials[i].bumpMapFilename.empty())
+        {
+            generateTangents(numThreads);
+            break;
+        }
+    }
+
+    if (m_optimizeOnImport)
+        optimize();
+
+    if (m_lodsOnImport)
+        generateLods();
+
+    // Write a fresh binary cache for the next run. Failing to write it
+    // (e.g. a read-only directory) is not an error.
+
+    if (m_binaryCacheEnabled)
+    {
+        exportCache(cacheFilename.c_str(), pszFilename, rebuildNormals,
+            hashContents(file.data(), file.size()));
+    }
+
+    return true;
+}
+
+void ModelOBJ::normalize(float scaleTo, bool center)
+{
+    float width = 0.0f;
+    float height = 0.0f;
+    float length = 0.0f;
+    float radius = 0.0f;
+    float centerPos[3] = {0.0f};
+
+    bounds(centerPos, width, height, length, radius);
+
+    float scalingFactor = scaleTo / radius;
+    float offset[3] = {0.0f};
+
+    if (center)
+    {
+        offset[0] = -centerPos[0];
+        offset[1] = -centerPos[1];
+        offset[2] = -centerPos[2];
+    }
+    else
+    {
+        offset[0] = 0.0f;
+        offset[1] = 0.0f;
+        offset[2] = 0.0f;
+    }
+
+    scale(scalingFactor, offset);
+    bounds(m_center, m_width, m_height, m_length, m_radius);
+}
+
+bool ModelOBJ::createVertexFormat(VertexFormat &format,
+                                  AttributeEncoding position, AttributeEncoding texCoord,
+                                  AttributeEncoding normal, AttributeEncoding tangent)
+{
+    AttributeEncoding encodings[NUMBER_OF_ATTRIBUTES] = {position, texCoord, normal, tangent};
+    int offset = 0;
+
+    memset(&format, 0, sizeof(format));
+
+    for (int i = 0; i < NUMBER_OF_ATTRIBUTES; ++i)
+    {
+        VertexAttributeFormat &attribute = format.attributes[i];
+        int componentSize = 0;
+
+        attribute.encoding = encodings[i];
+        attribute.type = COMPONENT_FLOAT;
+        attribute.normalized = false;
+        attribute.integer = false;
+
+        switch (attribute.encoding)
+        {
+        case ENCODING_NONE:
+            break;
+
+        case ENCODING_FLOAT:
+            attribute.components = (i == ATTRIBUTE_TEXCOORD) ? 2 : ((i == ATTRIBUTE_TANGENT) ? 4 : 3);
+            componentSize = sizeof(float);
+            break;
+
+        case ENCODING_HALF:
+            if (i != ATTRIBUTE_TEXCOORD)
+                return false;
+
+            attribute.components = 2;
+            attribute.type = COMPONENT_HALF_FLOAT;
+            componentSize = sizeof(unsigned short);
+            break;
+
+        case ENCODING_UNORM16:
+            if (i != ATTRIBUTE_POSITION)
+                return false;
+
+            attribute.components = 3;
+            attribute.type = COMPONENT_UNSIGNED_SHORT;
+            attribute.normalized = true;
+            componentSize = sizeof(unsigned short);
+            break;
+
+        case ENCODING_OCTAHEDRAL:
+            if (i != ATTRIBUTE_NORMAL && i != ATTRIBUTE_TANGENT)
+                return false;
+
+            attribute.components = 2;
+            attribute.type = COMPONENT_SHORT;
+            attribute.normalized = (i == ATTRIBUTE_NORMAL);
+            attribute.integer = (i == ATTRIBUTE_TANGENT);
+            componentSize = sizeof(short);
+            break;
+
+        default:
+            return false;
+        }
+
+        // Keep every attribute 4 byte aligned.
+        attribute.offset = offset;
+        offset += (attribute.components * componentSize + 3) & ~3;
+    }
+
+    format.stride = offset;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        format.positionBias[i] = 0.0f;
+        format.positionScale[i] = 1.0f;
+    }
+
+    return true;
+}
+
+void ModelOBJ::packVertices(VertexFormat &format, std::vector<unsigned char> &buffer) const
+{
+    const VertexAttributeFormat &position = format.attributes[ATTRIBUTE_POSITION];
+    const VertexAttributeFormat &texCoord = format.attributes[ATTRIBUTE_TEXCOORD];
+    const VertexAttributeFormat &normal = format.attributes[ATTRIBUTE_NORMAL];
+    const VertexAttributeFormat &tangent = format.attributes[ATTRIBUTE_TANGENT];
+
+    // Quantized positions are stored relative to the model bounds.
+
+    float extent[3] = {m_width, m_height, m_length};
+
+    for (int i = 0; i < 3; ++i)
+    {
+        if (position.encoding == ENCODING_UNORM16)
+        {
+            format.positionBias[i] = m_center[i] - extent[i] * 0.5f;
+            format.positionScale[i] = (extent[i] > 0.0f) ? extent[i] : 1.0f;
+        }
+        else
+        {
+            format.positionBias[i] = 0.0f;
+            format.positionScale[i] = 1.0f;
+        }
+    }
+
+    buffer.assign(static_cast<size_t>(m_numberOfVertices) * format.stride, 0);
+
+    for (int i = 0; i < m_numberOfVertices; ++i)
+    {
+        const Vertex &vertex = m_pVertices[i];
+        unsigned char *pDest = &buffer[static_cast<size_t>(i) * format.stride];
+
+        if (position.encoding == ENCODING_FLOAT)
+        {
+            memcpy(pDest + position.offset, vertex.position, sizeof(vertex.position));
+        }
+        else if (position.encoding == ENCODING_UNORM16)
+        {
+            unsigned short packed[3];
+
+            for (int j = 0; j < 3; ++j)
+            {
+                packed[j] = quantizeUnorm16((vertex.position[j] - format.positionBias[j])
+                    / format.positionScale[j]);
+            }
+
+            memcpy(pDest + position.offset, packed, sizeof(packed));
+        }
+
+        if (texCoord.encoding == ENCODING_FLOAT)
+        {
+            memcpy(pDest + texCoord.offset, vertex.texCoord, sizeof(vertex.texCoord));
+        }
+        else if (texCoord.encoding == ENCODING_HALF)
+        {
+            unsigned short packed[2] =
+            {
+                floatToHalf(vertex.texCoord[0]),
+                floatToHalf(vertex.texCoord[1])
+            };
+
+            memcpy(pDest + texCoord.offset, packed, sizeof(packed));
+        }
+
+        if (normal.encoding == ENCODING_FLOAT)
+        {
+            memcpy(pDest + normal.offset, vertex.normal, sizeof(vertex.normal));
+        }
+        else if (normal.encoding == ENCODING_OCTAHEDRAL)
+        {
+            float x = 0.0f;
+            float y = 0.0f;
+
+            encodeOctahedral(vertex.normal, x, y);
+
+            short packed[2] = {quantizeSnorm(x, 32767.0f), quantizeSnorm(y, 32767.0f)};
+            memcpy(pDest + normal.offset, packed, sizeof(packed));
+        }
+
+        if (tangent.encoding == ENCODING_FLOAT)
+        {
+            memcpy(pDest + tangent.offset, vertex.tangent, sizeof(vertex.tangent));
+        }
+        else if (tangent.encoding == ENCODING_OCTAHEDRAL)
+        {
+            float x = 0.0f;
+            float y = 0.0f;
+
+            encodeOctahedral(vertex.tangent, x, y);
+
+            // 15 bits of x, the handedness in bit 0.
+            short packed[2] =
+            {
+                static_cast<short>(quantizeSnorm(x, 16383.0f) * 2 + (vertex.tangent[3] < 0.0f ? 1 : 0)),
+                quantizeSnorm(y, 32767.0f)
+            };
+
+            memcpy(pDest + tangent.offset, packed, sizeof(packed));
+        }
+    }
+}
+
+bool ModelOBJ::packIndices(std::vector<unsigned short> &indices,
+                           std::vector<IndexRange> &ranges, bool mergeMeshes) const
+{
+    // Gather the indices in mesh order and grow each range triangle by
+    // triangle while its vertices still fit into 16 bits.
+
+    const int maxSpan = 0xffff;
+    std::vector<int> meshIndices(m_numberOfTriangles * 3);
+    int rangeMin = 0;
+    int rangeMax = -1;
+    int numIndices = 0;
+
+    ranges.clear();
+
+    for (int i = 0; i < m_numberOfMeshes; ++i)
+    {
+        const Mesh &mesh = m_meshes[i];
+        const int *pTriangle = &m_pIndices[mesh.startIndex];
+
+        for (int j = 0; j < mesh.triangleCount; ++j, pTriangle += 3)
+        {
+            int triangleMin = std::min(pTriangle[0], std::min(pTriangle[1], pTriangle[2]));
+            int triangleMax = std::max(pTriangle[0], std::max(pTriangle[1], pTriangle[2]));
+
+            if (triangleMax - triangleMin > maxSpan)
+            {
+                indices.clear();
+                ranges.clear();
+                return false;
+            }
+
+            bool newMesh = (j == 0) && !mergeMeshes;
+
+            if (ranges.empty() || newMesh
+                || std::max(rangeMax, triangleMax) - std::min(rangeMin, triangleMin) > maxSpan)
+            {
+                IndexRange range = {i, 0, numIndices, 0, 0};
+
+                ranges.push_back(range);
+                rangeMin = triangleMin;
+                rangeMax = triangleMax;
+            }
+            else
+            {
+                rangeMin = std::min(rangeMin, triangleMin);
+                rangeMax = std::max(rangeMax, triangleMax);
+            }
+
+            IndexRange &range = ranges.back();
+
+            range.numberOfMeshes = i - range.firstMesh + 1;
+            range.indexCount += 3;
+            range.baseVertex = rangeMin;
+
+            meshIndices[numIndices++] = pTriangle[0];
+            meshIndices[numIndices++] = pTriangle[1];
+            meshIndices[numIndices++] = pTriangle[2];
+        }
+    }
+
+    indices.resize(numIndices);
+
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        const IndexRange &range = ranges[i];
+
+        for (int j = range.startIndex; j < range.startIndex + range.indexCount; ++j)
+            indices[j] = static_cast<unsigned short>(meshIndices[j] - range.baseVertex);
+    }
+
+    return true;
+}
+
+void ModelOBJ::buildMeshlets(const Mesh &mesh, MeshletBuffer &buffer,
+                             int maxVertices, int maxTriangles) const
+{
+    maxVertices = std::min(std::max(maxVertices, 3), 256);
+    maxTriangles = std::max(maxTriangles, 1);
+
+    const int *pIndices = &m_pIndices[mesh.startIndex];
+    int triangleCount = mesh.triangleCount;
+
+    if (triangleCount == 0)
+        return;
+
+    // Work on the span of vertices the mesh uses, which is small after
+    // optimize(), and list the triangles using each of them.
+
+    int baseVertex = *std::min_element(pIndices, pIndices + triangleCount * 3);
+    int numVertices = *std::max_element(pIndices, pIndices + triangleCount * 3) - baseVertex + 1;
+    std::vector<int> localIndices(pIndices, pIndices + triangleCount * 3);
+    std::vector<int> adjacencyOffset;
+    std::vector<int> adjacency;
+
+    for (size_t i = 0; i < localIndices.size(); ++i)
+        localIndices[i] -= baseVertex;
+
+    buildVertexAdjacency(&localIndices[0], triangleCount, numVertices,
+        adjacencyOffset, adjacency);
+
+    // Triangle centroids, and the triangles in Morton order of their
+    // centroids. New meshlets that aren't connected to the previous one
+    // start from the next unused triangle in that order.
+
+    std::vector<float> centroids(triangleCount * 3);
+    float boundsMin[3] = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max()};
+    float boundsMax[3] = {-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max()};
+
+    for (int i = 0; i < triangleCount; ++i)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            centroids[i * 3 + k] = (m_pVertices[pIndices[i * 3]].position[k]
+                + m_pVertices[pIndices[i * 3 + 1]].position[k]
+                + m_pVertices[pIndices[i * 3 + 2]].position[k]) / 3.0f;
+
+            boundsMin[k] = std::min(boundsMin[k], centroids[i * 3 + k]);
+            boundsMax[k] = std::max(boundsMax[k], centroids[i * 3 + k]);
+        }
+    }
+
+    std::vector<unsigned int> codes(triangleCount);
+    std::vector<int> order(triangleCount);
+
+    for (int i = 0; i < triangleCount; ++i)
+    {
+        unsigned int cell[3];
+
+        for (int k = 0; k < 3; ++k)
+        {
+            float extent = boundsMax[k] - boundsMin[k];
+            float t = (extent > 0.0f) ? (centroids[i * 3 + k] - boundsMin[k]) / extent : 0.0f;
+
+            cell[k] = static_cast<unsigned int>(t * 1023.0f + 0.5f);
+        }
+
+        codes[i] = mortonCode(cell[0], cell[1], cell[2]);
+        order[i] = i;
+    }
+
+    std::stable_sort(order.begin(), order.end(),
+        [&](int a, int b) { return codes[a] < codes[b]; });
+
+    // Grow each meshlet greedily. Of the unused triangles sharing a vertex
+    // with the meshlet, take the one adding the fewest new vertices, and of
+    // those the one closest to the meshlet centroid. A meshlet is finished
+    // when no connected triangle fits anymore.
+
+    std::vector<int> meshletIndex(numVertices, -1);
+    std::vector<char> used(triangleCount, 0);
+    std::vector<char> isCandidate(triangleCount, 0);
+    std::vector<int> candidates;
+    float centroid[3] = {0.0f, 0.0f, 0.0f};
+    float positionSum[3] = {0.0f, 0.0f, 0.0f};
+    int numUsed = 0;
+    int cursor = 0;
+
+    Meshlet meshlet = {};
+    meshlet.vertexOffset = static_cast<int>(buffer.vertices.size());
+    meshlet.triangleOffset = static_cast<int>(buffer.triangles.size() / 3);
+
+    while (numUsed < triangleCount)
+    {
+        int best = -1;
+        int bestNewVertices = 4;
+        float bestDistance = std::numeric_limits<float>::max();
+        size_t numCandidates = 0;
+
+        if (meshlet.triangleCount < maxTriangles)
+        {
+            for (size_t i = 0; i < candidates.size(); ++i)
+            {
+                int triangle = candidates[i];
+
+                if (used[triangle])
+                    continue;
+
+                candidates[numCandidates++] = triangle;
+
+                const int *pTriangle = &localIndices[triangle * 3];
+                int newVertices = (meshletIndex[pTriangle[0]] < 0)
+                    + (meshletIndex[pTriangle[1]] < 0) + (meshletIndex[pTriangle[2]] < 0);
+
+                if (meshlet.vertexCount + newVertices > maxVertices || newVertices > bestNewVertices)
+                    continue;
+
+                float dx = centroids[triangle * 3] - centroid[0];
+                float dy = centroids[triangle * 3 + 1] - centroid[1];
+                float dz = centroids[triangle * 3 + 2] - centroid[2];
+                float distance = dx * dx + dy * dy + dz * dz;
+
+                if (newVertices < bestNewVertices || distance < bestDistance)
+                {
+                    best = triangle;
+                    bestNewVertices = newVertices;
+                    bestDistance = distance;
+                }
+            }
+
+            candidates.resize(numCandidates);
+        }
+
+        if (best < 0)
+        {
+            while (used[order[cursor]])
+                ++cursor;
+
+            // Start a new meshlet if connected triangles are left over or
+            // the next one in spatial order doesn't fit either.
+
+            const int *pTriangle = &localIndices[order[cursor] * 3];
+            int newVertices = (meshletIndex[pTriangle[0]] < 0)
+                + (meshletIndex[pTriangle[1]] < 0) + (meshletIndex[pTriangle[2]] < 0);
+
+            if (meshlet.triangleCount > 0 && (numCandidates > 0
+                || meshlet.triangleCount >= maxTriangles
+                || meshlet.vertexCount + newVertices > maxVertices))
+            {
+                boundMeshlet(meshlet, buffer);
+                buffer.meshlets.push_back(meshlet);
+
+                for (int i = 0; i < meshlet.vertexCount; ++i)
+                    meshletIndex[buffer.vertices[meshlet.vertexOffset + i] - baseVertex] = -1;
+
+                meshlet = Meshlet();
+                meshlet.vertexOffset = static_cast<int>(buffer.vertices.size());
+                meshlet.triangleOffset = static_cast<int>(buffer.triangles.size() / 3);
+                positionSum[0] = positionSum[1] = positionSum[2] = 0.0f;
+                continue;
+            }
+
+            best = order[cursor];
+        }
+
+        // Add the triangle and queue its neighbours.
+
+        const int *pTriangle = &localIndices[best * 3];
+
+        for (int j = 0; j < 3; ++j)
+        {
+            int v = pTriangle[j];
+
+            if (meshletIndex[v] < 0)
+            {
+                const float *pPosition = m_pVertices[v + baseVertex].position;
+
+                meshletIndex[v] = meshlet.vertexCount++;
+                buffer.vertices.push_back(v + baseVertex);
+
+                positionSum[0] += pPosition[0];
+                positionSum[1] += pPosition[1];
+                positionSum[2] += pPosition[2];
+            }
+
+            buffer.triangles.push_back(static_cast<unsigned char>(meshletIndex[v]));
+
+            for (int k = adjacencyOffset[v]; k < adjacencyOffset[v + 1]; ++k)
+            {
+                int neighbour = adjacency[k];
+
+                if (!used[neighbour] && !isCandidate[neighbour])
+                {
+                    isCandidate[neighbour] = 1;
+                    candidates.push_back(neighbour);
+                }
+            }
+        }
+
+        for (int k = 0; k < 3; ++k)
+            centroid[k] = positionSum[k] / meshlet.vertexCount;
+
+        used[best] = 1;
+        ++meshlet.triangleCount;
+        ++numUsed;
+    }
+
+    boundMeshlet(meshlet, buffer);
+    buffer.meshlets.push_back(meshlet);
+}
+
+bool ModelOBJ::saveMeshlets(const char *pszFilename, const MeshletBuffer &buffer)
+{
+    MeshletHeader header;
+    std::vector<char> data;
+
+    memcpy(header.magic, MESHLET_MAGIC, sizeof(header.magic));
+    header.version = MESHLET_VERSION;
+    header.meshletSize = sizeof(Meshlet);
+    header.numberOfMeshlets = static_cast<unsigned int>(buffer.meshlets.size());
+    header.numberOfVertices = static_cast<unsigned int>(buffer.vertices.size());
+    header.numberOfTriangles = static_cast<unsigned int>(buffer.triangles.size() / 3);
+
+    writeBytes(data, &header, sizeof(header));
+
+    if (!buffer.meshlets.empty())
+        writeBytes(data, &buffer.meshlets[0], buffer.meshlets.size() * sizeof(Meshlet));
+
+    if (!buffer.vertices.empty())
+        writeBytes(data, &buffer.vertices[0], buffer.vertices.size() * sizeof(int));
+
+    if (!buffer.triangles.empty())
+        writeBytes(data, &buffer.triangles[0], buffer.triangles.size());
+
+    FILE *pFile = fopen(pszFilename, "wb");
+
+    if (!pFile)
+        return false;
+
+    bool written = fwrite(&data[0], 1, data.size(), pFile) == data.size();
+
+    return (fclose(pFile) == 0) && written;
+}
+
+bool ModelOBJ::loadMeshlets(const char *pszFilename, MeshletBuffer &buffer)
+{
+    MappedFile file;
+    MeshletHeader header;
+
+    buffer.meshlets.clear();
+    buffer.vertices.clear();
+    buffer.triangles.clear();
+
+    if (!file.open(pszFilename))
+        return false;
+
+    const char *p = file.data();
+    const char *pEnd = p + file.size();
+
+    if (!readBytes(p, pEnd, &header, sizeof(header))
+        || memcmp(header.magic, MESHLET_MAGIC, sizeof(header.magic)) != 0
+        || header.version != MESHLET_VERSION
+        || header.meshletSize != sizeof(Meshlet))
+    {
+        return false;
+    }
+
+    // The sizes are computed in 64 bits, so that no count in the header can
+    // wrap them into a size that matches the file.
+
+    unsigned long long meshletBytes =
+        static_cast<unsigned long long>(header.numberOfMeshlets) * sizeof(Meshlet);
+    unsigned long long vertexBytes =
+        static_cast<unsigned long long>(header.numberOfVertices) * sizeof(int);
+    unsigned long long triangleBytes =
+        static_cast<unsigned long long>(header.numberOfTriangles) * 3;
+
+    if (static_cast<unsigned long long>(pEnd - p) != meshletBytes + vertexBytes + triangleBytes)
+        return false;
+
+    buffer.meshlets.resize(static_cast<size_t>(header.numberOfMeshlets));
+    buffer.vertices.resize(static_cast<size_t>(header.numberOfVertices));
+    buffer.triangles.resize(static_cast<size_t>(triangleBytes));
+
+    if (!buffer.meshlets.empty())
+        readBytes(p, pEnd, &buffer.meshlets[0], buffer.meshlets.size() * sizeof(Meshlet));
+
+    if (!buffer.vertices.empty())
+        readBytes(p, pEnd, &buffer.vertices[0], buffer.vertices.size() * sizeof(int));
+
+    if (!buffer.triangles.empty())
+        readBytes(p, pEnd, &buffer.triangles[0], buffer.triangles.size());
+
+    // Reject meshlets that point outside of the buffers.
+
+    size_t numVertices = buffer.vertices.size();
+    size_t numTriangles = buffer.triangles.size() / 3;
+
+    for (size_t i = 0; i < buffer.meshlets.size(); ++i)
+    {
+        const Meshlet &meshlet = buffer.meshlets[i];
+        bool valid = meshlet.vertexOffset >= 0 && meshlet.vertexCount >= 0
+            && meshlet.vertexCount <= 256
+            && static_cast<size_t>(meshlet.vertexOffset) <= numVertices
+            && static_cast<size_t>(meshlet.vertexCount) <= numVertices - meshlet.vertexOffset
+            && meshlet.triangleOffset >= 0 && meshlet.triangleCount >= 0
+            && static_cast<size_t>(meshlet.triangleOffset) <= numTriangles
+            && static_cast<size_t>(meshlet.triangleCount) <= numTriangles - meshlet.triangleOffset;
+
+        for (size_t j = 0; valid && j < static_cast<size_t>(meshlet.triangleCount) * 3; ++j)
+            valid = buffer.triangles[static_cast<size_t>(meshlet.triangleOffset) * 3 + j] < meshlet.vertexCount;
+
+        if (!valid)
+        {
+            buffer.meshlets.clear();
+            buffer.vertices.clear();
+            buffer.triangles.clear();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void ModelOBJ::generateLods(int maxLevels, float reductionRatio)
+{
+    m_lods.clear();
+    m_lodOffsets.clear();
+    m_lodIndexBuffer.clear();
+    m_pLodIndices = 0;
+    m_numberOfLodIndices = 0;
+
+    if (m_numberOfMeshes == 0)
+        return;
+
+    reductionRatio = std::min(std::max(reductionRatio, 0.0f), 1.0f);
+
+    // Vertices that only differ in their texture coordinates or normals
+    // share a position. Positions used by more than one mesh lie on a
+    // material boundary.
+
+    std::vector<int> order(m_numberOfVertices);
+    std::vector<int> positionIds(m_numberOfVertices);
+    int numPositions = 0;
+
+    for (int i = 0; i < m_numberOfVertices; ++i)
+        order[i] = i;
+
+    std::sort(order.begin(), order.end(), [this](int a, int b)
+    {
+        const float *pA = m_pVertices[a].position;
+        const float *pB = m_pVertices[b].position;
+
+        return std::lexicographical_compare(pA, pA + 3, pB, pB + 3);
+    });
+
+    for (int i = 0; i < m_numberOfVertices; ++i)
+    {
+        const float *pPosition = m_pVertices[order[i]].position;
+
+        if (i > 0 && !std::equal(pPosition, pPosition + 3, m_pVertices[order[i - 1]].position))
+            ++numPositions;
+
+        positionIds[order[i]] = numPositions;
+    }
+
+    std::vector<int> positionMeshes(numPositions + 1, -1);
+
+    for (int i = 0; i < m_numberOfMeshes; ++i)
+    {
+        const int *pIndices = m_pIndices + m_meshes[i].startIndex;
+
+        for (int j = 0; j < m_meshes[i].triangleCount * 3; ++j)
+        {
+            int &owner = positionMeshes[positionIds[pIndices[j]]];
+            owner = (owner == -1 || owner == i) ? i : -2;
+        }
+    }
+
+    std::vector<int> localIndex(m_numberOfVertices, -1);
+    std::vector<int> localPosition(numPositions + 1, -1);
+
+    m_lodOffsets.push_back(0);
+
+    for (int i = 0; i < m_numberOfMeshes; ++i)
+    {
+        simplifyMesh(i, maxLevels, reductionRatio, positionIds, positionMeshes,
+            localIndex, localPosition);
+        m_lodOffsets.push_back(static_cast<int>(m_lods.size()));
+    }
+
+    m_pLodIndices = m_lodIndexBuffer.empty() ? 0 : &m_lodIndexBuffer[0];
+    m_numberOfLodIndices = static_cast<int>(m_lodIndexBuffer.size());
+}
+
+int ModelOBJ::selectLod(int mesh, float maxError) const
+{
+    // Errors grow from level to level.
+
+    int level = -1;
+
+    while (level + 1 < getNumberOfLods(mesh) && getLod(mesh, level + 1).error <= maxError)
+        ++level;
+
+    return level;
+}
+
+ModelOBJ::VertexCacheStatistics ModelOBJ::analyzeVertexCache(int cacheSize) const
+{
+    // Simulate a FIFO post-transform cache. A vertex is a hit if it was
+    // inserted within the last cacheSize insertions.
+
+    VertexCacheStatistics statistics = {0.0f, 0.0f};
+    std::vector<int> insertedAt(m_numberOfVertices, -1);
+    std::vector<char> referenced(m_numberOfVertices, 0);
+    int numberOfIndices = getNumberOfIndices();
+    int insertions = 0;
+    int misses = 0;
+    int numReferenced = 0;
+
+    for (int i = 0; i < numberOfIndices; ++i)
+    {
+        int index = m_pIndices[i];
+
+        if (insertedAt[index] < 0 || insertions - insertedAt[index] >= cacheSize)
+        {
+            insertedAt[index] = insertions++;
+            ++misses;
+        }
+
+        if (!referenced[index])
+        {
+            referenced[index] = 1;
+            ++numReferenced;
+        }
+    }
+
+    if (m_numberOfTriangles > 0)
+        statistics.acmr = static_cast<float>(misses) / m_numberOfTriangles;
+
+    if (numReferenced > 0)
+        statistics.atvr = static_cast<float>(misses) / numReferenced;
+
+    return statistics;
+}
+
+void ModelOBJ::optimize(float overdrawThreshold)
+{
+    // Reorder the triangles of each mesh for the vertex cache, then regroup
+    // them for overdraw, and finally order the vertices by first use so
+    // that vertex fetches are mostly sequential.
+
+    std::vector<int> localIndex(m_numberOfVertices, -1);
+
+    for (int i = 0; i < m_numberOfMeshes; ++i)
+    {
+        int *pIndices = m_pIndices + m_meshes[i].startIndex;
+        int triangleCount = m_meshes[i].triangleCount;
+
+        optimizeVertexCache(pIndices, triangleCount, localIndex);
+
+        if (overdrawThreshold > 0.0f)
+            optimizeOverdraw(pIndices, triangleCount, overdrawThreshold, localIndex);
+    }
+
+    optimizeVertexFetch();
+
+    // The levels of detail refer to the old vertex order.
+
+    m_lods.clear();
+    m_lodOffsets.clear();
+    m_lodIndexBuffer.clear();
+    m_pLodIndices = 0;
+    m_numberOfLodIndices = 0;
+}
+
+void ModelOBJ::optimizeVertexCache(int *pIndices, int triangleCount,
+                                   std::vector<int> &localIndex) const
+{
+    // Tom Forsyth's "Linear-Speed Vertex Cache Optimisation". Triangles are
+    // emitted greedily by the sum of their vertex scores. Vertex scores
+    // favour vertices that are recently used and have few triangles left.
+
+    if (triangleCount < 2)
+        return;
+
+    int numberOfIndices = triangleCount * 3;
+    std::vector<int> vertices;
+
+    // Map the mesh's vertices to a compact local range.
+
+    std::vector<int> indices(pIndices, pIndices + numberOfIndices);
+
+    for (int i = 0; i < numberOfIndices; ++i)
+    {
+        int &local = localIndex[indices[i]];
+
+        if (local < 0)
+        {
+            local = static_cast<int>(vertices.size());
+            vertices.push_back(indices[i]);
+        }
+
+        indices[i] = local;
+    }
+
+    int numVertices = static_cast<int>(vertices.size());
+
+    for (int i = 0; i < numVertices; ++i)
+        localIndex[vertices[i]] = -1;
+
+    // Build the vertex to triangle adjacency.
+
+    std::vector<int> remaining(numVertices, 0);
+    std::vector<int> adjacencyOffset(numVertices + 1, 0);
+    std::vector<int> adjacency(numberOfIndices);
+
+    for (int i = 0; i < numberOfIndices; ++i)
+        ++remaining[indices[i]];
+
+    for (int i = 0; i < numVertices; ++i)
+        adjacencyOffset[i + 1] = adjacencyOffset[i] + remaining[i];
+
+    std::vector<int> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+
+    for (int i = 0; i < numberOfIndices; ++i)
+        adjacency[fill[indices[i]]++] = i / 3;
+
+    std::vector<float> vertexScore(numVertices, 0.0f);
+    std::vector<float> triangleScore(triangleCount, 0.0f);
+    std::vector<char> emitted(triangleCount, 0);
+
+    for (int i = 0; i < numVertices; ++i)
+        vertexScore[i] = forsythVertexScore(-1, remaining[i]);
+
+    for (int i = 0; i < triangleCount; ++i)
+    {
+        triangleScore[i] = vertexScore[indices[i * 3]]
+            + vertexScore[indices[i * 3 + 1]]
+            + vertexScore[indices[i * 3 + 2]];
+    }
+
+    int cache[FORSYTH_CACHE_SIZE + 3];
+    int cacheCount = 0;
+    int bestTriangle = -1;
+    int scanCursor = 0;
+
+    for (int output = 0; output < triangleCount; ++output)
+    {
+        // Fall back to the first unemitted triangle when nothing in the
+        // cache has triangles left.
+
+        if (bestTriangle < 0)
+        {
+            while (emitted[scanCursor])
+                ++scanCursor;
+
+            bestTriangle = scanCursor;
+        }
+
+        const int *pTriangle = &indices[bestTriangle * 3];
+
+        pIndices[output * 3] = vertices[pTriangle[0]];
+        pIndices[output * 3 + 1] = vertices[pTriangle[1]];
+        pIndices[output * 3 + 2] = vertices[pTriangle[2]];
+        emitted[bestTriangle] = 1;
+
+        // Push the triangle's vertices to the front of the LRU cache and
+        // detach the triangle from their adjacency.
+
+        int newCache[FORSYTH_CACHE_SIZE + 3];
+        int newCacheCount = 0;
+
+        for (int j = 0; j < 3; ++j)
+        {
+            int v = pTriangle[j];
+            int *pBegin = &adjacency[adjacencyOffset[v]];
+            int *pEnd = pBegin + remaining[v];
+
+            *std::find(pBegin, pEnd, bestTriangle) = *(pEnd - 1);
+            --remaining[v];
+
+            // Degenerate triangles list a vertex more than once.
+            if (std::find(newCache, newCache + newCacheCount, v) == newCache + newCacheCount)
+                newCache[newCacheCount++] = v;
+        }
+
+        for (int j = 0; j < cacheCount; ++j)
+        {
+            int v = cache[j];
+
+            if (v != pTriangle[0] && v != pTriangle[1] && v != pTriangle[2])
+                newCache[newCacheCount++] = v;
+        }
+
+        // Update the scores of everything that was or is in the cache and
+        // pick the best triangle touching one of those vertices.
+
+        float bestScore = -1.0f;
+        bestTriangle = -1;
+
+        for (int j = 0; j < newCacheCount; ++j)
+        {
+            int v = newCache[j];
+            int position = (j < FORSYTH_CACHE_SIZE) ? j : -1;
+
+            float score = forsythVertexScore(position, remaining[v]);
+            float delta = score - vertexScore[v];
+
+            vertexScore[v] = score;
+
+            for (int k = 0; k < remaining[v]; ++k)
+            {
+                int triangle = adjacency[adjacencyOffset[v] + k];
+
+                triangleScore[triangle] += delta;
+
+                if (triangleScore[triangle] > bestScore)
+                {
+                    bestScore = triangleScore[triangle];
+                    bestTriangle = triangle;
+                }
+            }
+        }
+
+        cacheCount = std::min(newCacheCount, static_cast<int>(FORSYTH_CACHE_SIZE));
+        std::copy(newCache, newCache + cacheCount, cache);
+    }
+}
+
+void ModelOBJ::optimizeOverdraw(int *pIndices, int triangleCount, float threshold,
+                                std::vector<int> &cacheTime) const
+{
+    // Sander et al. "Fast Triangle Reordering for Vertex Locality and
+    // Reduced Overdraw". The cache optimized sequence is cut into clusters
+    // wherever the cache restarts anyway (hard boundaries) or the running
+    // ACMR of a cluster is within threshold of the mesh ACMR (soft
+    // boundaries). The clusters are then sorted so that those facing away
+    // from the mesh center are drawn first and occlude the rest. The new
+    // order is only kept if it doesn't cost any vertex cache misses.
+
+    if (triangleCount < 2)
+        return;
+
+    const int cacheSize = 16;
+    int numberOfIndices = triangleCount * 3;
+    std::vector<int> clusters;
+    int totalMisses = countCacheMisses(pIndices, triangleCount, cacheSize, cacheTime, &clusters);
+    float meshACMR = static_cast<float>(totalMisses) / triangleCount;
+    std::vector<int> splitClusters;
+    int insertions = 0;
+
+    for (size_t c = 0; c < clusters.size(); ++c)
+    {
+        int begin = clusters[c];
+        int end = (c + 1 < clusters.size()) ? clusters[c + 1] : triangleCount;
+        int clusterMisses = 0;
+
+        insertions += cacheSize;
+        splitClusters.push_back(begin);
+
+        for (int i = begin; i < end; ++i)
+        {
+            for (int j = 0; j < 3; ++j)
+            {
+                int &time = cacheTime[pIndices[i * 3 + j]];
+
+                if (time < 0 || insertions - time >= cacheSize)
+                {
+                    time = insertions++;
+                    ++clusterMisses;
+                }
+            }
+
+            int clusterSize = i + 1 - splitClusters.back();
+
+            if (i + 1 < end && clusterSize >= 8
+                && static_cast<float>(clusterMisses) / clusterSize <= meshACMR * threshold)
+            {
+                splitClusters.push_back(i + 1);
+                clusterMisses = 0;
+                insertions += cacheSize;
+            }
+        }
+    }
+
+    for (int i = 0; i < numberOfIndices; ++i)
+        cacheTime[pIndices[i]] = -1;
+
+    // Sort key: how much a cluster faces away from the mesh centroid.
+
+    int numClusters = static_cast<int>(splitClusters.size());
+    float meshCentroid[3] = {0.0f, 0.0f, 0.0f};
+    std::vector<float> clusterCentroids(numClusters * 3, 0.0f);
+    std::vector<float> clusterNormals(numClusters * 3, 0.0f);
+    std::vector<float> clusterAreas(numClusters, 0.0f);
+    float totalArea = 0.0f;
+
+    for (int c = 0; c < numClusters; ++c)
+    {
+        int begin = splitClusters[c];
+        int end = (c + 1 < numClusters) ? splitClusters[c + 1] : triangleCount;
+
+        for (int i = begin; i < end; ++i)
+        {
+            const float *p0 = m_pVertices[pIndices[i * 3]].position;
+            const float *p1 = m_pVertices[pIndices[i * 3 + 1]].position;
+            const float *p2 = m_pVertices[pIndices[i * 3 + 2]].position;
+            float edge1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+            float edge2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+            float normal[3] =
+            {
+                edge1[1] * edge2[2] - edge1[2] * edge2[1],
+                edge1[2] * edge2[0] - edge1[0] * edge2[2],
+                edge1[0] * edge2[1] - edge1[1] * edge2[0]
+            };
+            float area = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+
+            for (int k = 0; k < 3; ++k)
+            {
+                float centroid = (p0[k] + p1[k] + p2[k]) / 3.0f;
+
+                clusterCentroids[c * 3 + k] += centroid * area;
+                clusterNormals[c * 3 + k] += normal[k];
+                meshCentroid[k] += centroid * area;
+            }
+
+            clusterAreas[c] += area;
+            totalArea += area;
+        }
+    }
+
+    std::vector<std::pair<float, int> > order(numClusters);
+
+    for (int c = 0; c < numClusters; ++c)
+    {
+        float dot = 0.0f;
+
+        for (int k = 0; k < 3; ++k)
+        {
+            float centroid = (clusterAreas[c] > 0.0f) ? clusterCentroids[c * 3 + k] / clusterAreas[c] : 0.0f;
+            float center = (totalArea > 0.0f) ? meshCentroid[k] / totalArea : 0.0f;
+
+            dot += (centroid - center) * clusterNormals[c * 3 + k];
+        }
+
+        order[c] = std::make_pair(-dot, c);
+    }
+
+    std::stable_sort(order.begin(), order.end());
+
+    std::vector<int> sorted;
+    sorted.reserve(numberOfIndices);
+
+    for (int c = 0; c < numClusters; ++c)
+    {
+        int cluster = order[c].second;
+        int begin = splitClusters[cluster];
+        int end = (cluster + 1 < numClusters) ? splitClusters[cluster + 1] : triangleCount;
+
+        sorted.insert(sorted.end(), pIndices + begin * 3, pIndices + end * 3);
     }
+
+    if (countCacheMisses(&sorted[0], triangleCount, cacheSize, cacheTime, 0) <= totalMisses)
+        std::copy(sorted.begin(), sorted.end(), pIndices);
 }
 
-ModelOBJ::ModelOBJ()
+void ModelOBJ::optimizeVertexFetch()
 {
-    m_hasPositions = false;
-    m_hasNormals = false;
-    m_hasTextureCoords = false;
-    m_hasTangents = false;
+    // Renumber the vertices in the order the meshes first use them when
+    // drawn in turn, which also keeps the vertices of each mesh close
+    // together for packIndices(). Unreferenced vertices keep their
+    // relative order at the end.
 
-    m_numberOfVertexCoords = 0;
-    m_numberOfTextureCoords = 0;
-    m_numberOfNormals = 0;
-    m_numberOfTriangles = 0;
-    m_numberOfMaterials = 0;
-    m_numberOfMeshes = 0;
+    std::vector<int> remap(m_numberOfVertices, -1);
+    int next = 0;
 
-    m_center[0] = m_center[1] = m_center[2] = 0.0f;
-    m_width = m_height = m_length = m_radius = 0.0f;
+    for (int i = 0; i < m_numberOfMeshes; ++i)
+    {
+        int *pIndices = m_pIndices + m_meshes[i].startIndex;
+
+        for (int j = 0; j < m_meshes[i].triangleCount * 3; ++j)
+        {
+            int &index = remap[pIndices[j]];
+
+            if (index < 0)
+                index = next++;
+
+            pIndices[j] = index;
+        }
+    }
+
+    for (int i = 0; i < m_numberOfVertices; ++i)
+    {
+        if (remap[i] < 0)
+            remap[i] = next++;
+    }
+
+    std::vector<Vertex> vertices(m_pVertices, m_pVertices + m_numberOfVertices);
+
+    for (int i = 0; i < m_numberOfVertices; ++i)
+        m_pVertices[remap[i]] = vertices[i];
 }
 
-ModelOBJ::~ModelOBJ()
+void ModelOBJ::reverseWinding()
 {
-    destroy();
+    int swap = 0;
+
+    // Reverse face winding.
+    for (int i = 0; i < getNumberOfIndices(); i += 3)
+    {
+        swap = m_pIndices[i + 1];
+        m_pIndices[i + 1] = m_pIndices[i + 2];
+        m_pIndices[i + 2] = swap;
+    }
+
+    for (int i = 0; i < m_numberOfLodIndices; i += 3)
+    {
+        swap = m_pLodIndices[i + 1];
+        m_pLodIndices[i + 1] = m_pLodIndices[i + 2];
+        m_pLodIndices[i + 2] = swap;
+    }
+
+    float *pNormal = 0;
+    float *pTangent = 0;
+
+    // Invert normals and tangents.
+    for (int i = 0; i < m_numberOfVertices; ++i)
+    {
+        pNormal = m_pVertices[i].normal;
+        pNormal[0] = -pNormal[0];
+        pNormal[1] = -pNormal[1];
+        pNormal[2] = -pNormal[2];
+
+        pTangent = m_pVertices[i].tangent;
+        pTangent[0] = -pTangent[0];
+        pTangent[1] = -pTangent[1];
+        pTangent[2] = -pTangent[2];
+    }
 }
 
-void ModelOBJ::bounds(float center[3], float &width, float &height,
-                      float &length, float &radius) const
+void ModelOBJ::scale(float scaleFactor, float offset[3])
 {
-    float xMax = std::numeric_limits<float>::min();
-    float yMax = std::numeric_limits<float>::min();
-    float zMax = std::numeric_limits<float>::min();
+    float *pPosition = 0;
 
-    float xMin = std::numeric_limits<float>::max();
-    float yMin = std::numeric_limits<float>::max();
-    float zMin = std::numeric_limits<float>::max();
+    for (int i = 0; i < m_numberOfVertices; ++i)
+    {
+        pPosition = m_pVertices[i].position;
 
-    float x = 0.0f;
-    float y = 0.0f;
-    float z = 0.0f;
+        pPosition[0] += offset[0];
+        pPosition[1] += offset[1];
+        pPosition[2] += offset[2];
+
+        pPosition[0] *= scaleFactor;
+        pPosition[1] *= scaleFactor;
+        pPosition[2] *= scaleFactor;
+    }
 
-    int numVerts = static_cast<int>(m_vertexBuffer.size());
+    for (size_t i = 0; i < m_lods.size(); ++i)
+        m_lods[i].error *= scaleFactor;
+}
 
-    for (int i = 0; i < numVerts; ++i)
+void ModelOBJ::simplifyMesh(int mesh, int maxLevels, float reductionRatio,
+                            const std::vector<int> &positionIds,
+                            const std::vector<int> &positionMeshes,
+                            std::vector<int> &localIndex, std::vector<int> &localPosition)
+{
+    enum
     {
-        x = m_vertexBuffer[i].position[0];
-        y = m_vertexBuffer[i].position[1];
-        z = m_vertexBuffer[i].position[2];
+        LOD_LOCKED = 1,
+        LOD_BORDER = 2,
+        LOD_TOUCHED = 4
+    };
 
-        if (x < xMin)
-            xMin = x;
+    const int *pIndices = m_pIndices + m_meshes[mesh].startIndex;
+    int numberOfIndices = m_meshes[mesh].triangleCount * 3;
 
-        if (x > xMax)
-            xMax = x;
+    if (m_meshes[mesh].triangleCount < LOD_MIN_TRIANGLES * 2)
+        return;
 
-        if (y < yMin)
-            yMin = y;
+    // Map the mesh's vertices and their positions to compact local ranges.
+    // Edges are collapsed between positions, the vertices at a position
+    // follow along.
 
-        if (y > yMax)
-            yMax = y;
+    std::vector<int> vertices;
+    std::vector<int> vertexPositions;
+    std::vector<int> positions;
+    std::vector<int> triangles(numberOfIndices);
 
-        if (z < zMin)
-            zMin = z;
+    for (int i = 0; i < numberOfIndices; ++i)
+    {
+        int &local = localIndex[pIndices[i]];
 
-        if (z > zMax)
-            zMax = z;
+        if (local < 0)
+        {
+            int &position = localPosition[positionIds[pIndices[i]]];
+
+            if (position < 0)
+            {
+                position = static_cast<int>(positions.size());
+                positions.push_back(pIndices[i]);
+            }
+
+            local = static_cast<int>(vertices.size());
+            vertices.push_back(pIndices[i]);
+            vertexPositions.push_back(position);
+        }
+
+        triangles[i] = local;
     }
 
-    center[0] = (xMin + xMax) / 2.0f;
-    center[1] = (yMin + yMax) / 2.0f;
-    center[2] = (zMin + zMax) / 2.0f;
+    int numVertices = static_cast<int>(vertices.size());
+    int numPositions = static_cast<int>(positions.size());
 
-    width = xMax - xMin;
-    height = yMax - yMin;
-    length = zMax - zMin;
+    for (int i = 0; i < numVertices; ++i)
+        localIndex[vertices[i]] = -1;
 
-    radius = std::max(std::max(width, height), length);
-}
+    for (int i = 0; i < numPositions; ++i)
+        localPosition[positionIds[positions[i]]] = -1;
 
-void ModelOBJ::destroy()
-{
-    m_hasPositions = false;
-    m_hasTextureCoords = false;
-    m_hasNormals = false;
-    m_hasTangents = false;
+    // Triangles that are degenerate in position are invisible, drop them.
 
-    m_numberOfVertexCoords = 0;
-    m_numberOfTextureCoords = 0;
-    m_numberOfNormals = 0;
-    m_numberOfTriangles = 0;
-    m_numberOfMaterials = 0;
-    m_numberOfMeshes = 0;
+    int current = 0;
 
-    m_center[0] = m_center[1] = m_center[2] = 0.0f;
-    m_width = m_height = m_length = m_radius = 0.0f;
+    for (int i = 0; i < numberOfIndices; i += 3)
+    {
+        int p0 = vertexPositions[triangles[i]];
+        int p1 = vertexPositions[triangles[i + 1]];
+        int p2 = vertexPositions[triangles[i + 2]];
 
-    m_directoryPath.clear();
+        if (p0 != p1 && p1 != p2 && p2 != p0)
+        {
+            for (int k = 0; k < 3; ++k)
+                triangles[current * 3 + k] = triangles[i + k];
 
-    m_meshes.clear();
-    m_materials.clear();
-    m_vertexBuffer.clear();
-    m_indexBuffer.clear();
-    m_attributeBuffer.clear();
+            ++current;
+        }
+    }
 
-    m_vertexCoords.clear();
-    m_textureCoords.clear();
-    m_normals.clear();
+    triangles.resize(current * 3);
 
-    m_materialCache.clear();
-    m_vertexCache.clear();
-}
+    std::vector<int> trianglePositions;
+    std::vector<int> adjacencyOffset;
+    std::vector<int> adjacency;
+    std::vector<std::pair<long long, int> > edges;
 
-bool ModelOBJ::import(const char *pszFilename, bool rebuildNormals)
-{
-    FILE *pFile = fopen(pszFilename, "r");
+    // Lists the position of every triangle corner, the triangles around
+    // every position and the edges sorted by their end points.
+    auto buildTopology = [&]()
+    {
+        trianglePositions.resize(triangles.size());
 
-    if (!pFile)
-        return false;
+        for (size_t i = 0; i < triangles.size(); ++i)
+            trianglePositions[i] = vertexPositions[triangles[i]];
 
-    // Extract the directory the OBJ file is in from the file name.
-    // This directory path will be used to load the OBJ's associated MTL file.
+        buildVertexAdjacency(trianglePositions.empty() ? 0 : &trianglePositions[0],
+            current, numPositions, adjacencyOffset, adjacency);
 
-    m_directoryPath.clear();
+        edges.clear();
 
-    std::string filename = pszFilename;
-    std::string::size_type offset = filename.find_last_of('\\');
+        for (int i = 0; i < current; ++i)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                long long a = trianglePositions[i * 3 + k];
+                long long b = trianglePositions[i * 3 + (k + 1) % 3];
 
-    if (offset != std::string::npos)
+                edges.push_back(std::make_pair((std::min(a, b) << 32) | std::max(a, b), i));
+            }
+        }
+
+        std::sort(edges.begin(), edges.end());
+    };
+
+    auto position = [&](int p) { return m_pVertices[positions[p]].position; };
+
+    auto corner = [&](int triangle, int p) -> int
     {
-        m_directoryPath = filename.substr(0, ++offset);
+        const int *pPositions = &trianglePositions[triangle * 3];
+        return (pPositions[0] == p) ? 0 : (pPositions[1] == p) ? 1 : (pPositions[2] == p) ? 2 : -1;
+    };
+
+    // Every triangle adds its plane to the quadrics of its corners. Open
+    // borders add a plane through the edge perpendicular to the triangle.
+
+    std::vector<Quadric> quadrics(numPositions);
+    std::vector<unsigned char> flags(numPositions, 0);
+
+    for (int i = 0; i < numPositions; ++i)
+    {
+        if (positionMeshes[positionIds[positions[i]]] != mesh)
+            flags[i] = LOD_LOCKED;
     }
-    else
+
+    buildTopology();
+
+    for (int i = 0; i < current; ++i)
     {
-        offset = filename.find_last_of('/');
+        const int *pPositions = &trianglePositions[i * 3];
+        double normal[3];
 
-        if (offset != std::string::npos)
-            m_directoryPath = filename.substr(0, ++offset);
-    }
+        triangleNormal(position(pPositions[0]), position(pPositions[1]),
+            position(pPositions[2]), normal);
 
-    // Import the OBJ file.
+        double length = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
 
-    importGeometryFirstPass(pFile);
-    rewind(pFile);
-    importGeometrySecondPass(pFile);
-    fclose(pFile);
+        if (length == 0.0)
+            continue;
 
-    // Perform post import tasks.
+        for (int k = 0; k < 3; ++k)
+            normal[k] /= length;
 
-    buildMeshes();
-    bounds(m_center, m_width, m_height, m_length, m_radius);
+        const float *p0 = position(pPositions[0]);
+        double d = -(normal[0] * p0[0] + normal[1] * p0[1] + normal[2] * p0[2]);
 
-    // Build vertex normals if required.
+        for (int k = 0; k < 3; ++k)
+        {
+            addPlane(quadrics[pPositions[k]], normal, d, length * 0.5);
+            quadrics[pPositions[k]].weight += length * 0.5;
+        }
+    }
 
-    if (rebuildNormals)
+    for (size_t i = 0; i < edges.size(); ++i)
     {
-        generateNormals();
+        bool single = (i == 0 || edges[i - 1].first != edges[i].first)
+            && (i + 1 == edges.size() || edges[i + 1].first != edges[i].first);
+
+        if (!single)
+            continue;
+
+        int a = static_cast<int>(edges[i].first >> 32);
+        int b = static_cast<int>(edges[i].first & 0xFFFFFFFF);
+        const int *pPositions = &trianglePositions[edges[i].second * 3];
+        const float *pA = position(a);
+        const float *pB = position(b);
+        double normal[3];
+        double edge[3] = {pB[0] - pA[0], pB[1] - pA[1], pB[2] - pA[2]};
+        double plane[3];
+
+        triangleNormal(position(pPositions[0]), position(pPositions[1]),
+            position(pPositions[2]), normal);
+
+        plane[0] = edge[1] * normal[2] - edge[2] * normal[1];
+        plane[1] = edge[2] * normal[0] - edge[0] * normal[2];
+        plane[2] = edge[0] * normal[1] - edge[1] * normal[0];
+
+        double length = sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+
+        if (length == 0.0)
+            continue;
+
+        for (int k = 0; k < 3; ++k)
+            plane[k] /= length;
+
+        double d = -(plane[0] * pA[0] + plane[1] * pA[1] + plane[2] * pA[2]);
+        double weight = (edge[0] * edge[0] + edge[1] * edge[1] + edge[2] * edge[2]) * LOD_BORDER_WEIGHT;
+
+        addPlane(quadrics[a], plane, d, weight);
+        addPlane(quadrics[b], plane, d, weight);
+        quadrics[a].weight += weight;
+        quadrics[b].weight += weight;
     }
-    else
+
+    // Collapsing from onto to moves every vertex at from onto the vertex at
+    // to it shares a triangle with. That keeps seams intact but requires
+    // that such a vertex exists and is unique. Collapses that flip a
+    // remaining triangle are rejected.
+
+    std::vector<int> match(numVertices, -1);
+    std::vector<int> moved;
+
+    auto evaluate = [&](int from, int to, bool borderEdge, double &cost) -> bool
     {
-        if (!hasNormals())
-            generateNormals();
-    }
+        if ((flags[from] & LOD_LOCKED) != 0 || ((flags[from] & LOD_BORDER) != 0 && !borderEdge))
+            return false;
 
-    // Build tangents is required.
+        bool valid = true;
+
+        for (int j = adjacencyOffset[from]; j < adjacencyOffset[from + 1]; ++j)
+        {
+            int triangle = adjacency[j];
+            int cornerTo = corner(triangle, to);
+
+            if (cornerTo >= 0)
+            {
+                int &target = match[triangles[triangle * 3 + corner(triangle, from)]];
+                int vertex = triangles[triangle * 3 + cornerTo];
+
+                if (target >= 0 && target != vertex)
+                    valid = false;
+
+                target = vertex;
+            }
+        }
+
+        for (int j = adjacencyOffset[from]; valid && j < adjacencyOffset[from + 1]; ++j)
+        {
+            int triangle = adjacency[j];
+            int cornerFrom = corner(triangle, from);
+
+            if (corner(triangle, to) >= 0)
+                continue;
+
+            if (match[triangles[triangle * 3 + cornerFrom]] < 0)
+            {
+                valid = false;
+                break;
+            }
+
+            const float *p[3];
+            double before[3];
+            double after[3];
+
+            for (int k = 0; k < 3; ++k)
+                p[k] = position(trianglePositions[triangle * 3 + k]);
+
+            triangleNormal(p[0], p[1], p[2], before);
+            p[cornerFrom] = position(to);
+            triangleNormal(p[0], p[1], p[2], after);
+
+            valid = before[0] * after[0] + before[1] * after[1] + before[2] * after[2] > 0.0;
+        }
+
+        for (int j = adjacencyOffset[from]; j < adjacencyOffset[from + 1]; ++j)
+            match[triangles[adjacency[j] * 3 + corner(adjacency[j], from)]] = -1;
+
+        if (valid)
+        {
+            Quadric quadric = quadrics[from];
+
+            addQuadric(quadric, quadrics[to]);
+            cost = quadricError(quadric, position(to));
+        }
+
+        return valid;
+    };
+
+    // Each level continues from the previous one. Every pass collapses the
+    // cheapest edges whose neighbourhoods don't overlap, until the target
+    // is met or no edge can be collapsed.
+
+    std::vector<LodEdge> candidates;
+    bool topologyValid = true;
+    double maxCost = 0.0;
+    int previous = current;
+
+    for (int level = 0; level < maxLevels; ++level)
+    {
+        int target = static_cast<int>(previous * reductionRatio);
+
+        if (target < LOD_MIN_TRIANGLES)
+            break;
+
+        while (current > target)
+        {
+            if (!topologyValid)
+                buildTopology();
+
+            candidates.clear();
+
+            for (int i = 0; i < numPositions; ++i)
+                flags[i] &= LOD_LOCKED;
+
+            for (size_t i = 0, j = 0; i < edges.size(); i = j)
+            {
+                while (j < edges.size() && edges[j].first == edges[i].first)
+                    ++j;
+
+                int a = static_cast<int>(edges[i].first >> 32);
+                int b = static_cast<int>(edges[i].first & 0xFFFFFFFF);
+
+                if (j - i == 1)
+                {
+                    flags[a] |= LOD_BORDER;
+                    flags[b] |= LOD_BORDER;
+                }
+                else if (j - i > 2)
+                {
+                    flags[a] |= LOD_LOCKED;
+                    flags[b] |= LOD_LOCKED;
+                }
+            }
+
+            for (size_t i = 0, j = 0; i < edges.size(); i = j)
+            {
+                while (j < edges.size() && edges[j].first == edges[i].first)
+                    ++j;
+
+                int a = static_cast<int>(edges[i].first >> 32);
+                int b = static_cast<int>(edges[i].first & 0xFFFFFFFF);
+                LodEdge forward = {a, b, 0.0};
+                LodEdge backward = {b, a, 0.0};
+                bool canForward = evaluate(a, b, j - i == 1, forward.cost);
+                bool canBackward = evaluate(b, a, j - i == 1, backward.cost);
+
+                if (canForward && (!canBackward || forward.cost <= backward.cost))
+                    candidates.push_back(forward);
+                else if (canBackward)
+                    candidates.push_back(backward);
+            }
+
+            std::sort(candidates.begin(), candidates.end());
+
+            int collapsed = 0;
+
+            for (size_t i = 0; i < candidates.size() && current > target; ++i)
+            {
+                int from = candidates[i].from;
+                int to = candidates[i].to;
+
+                if (((flags[from] | flags[to]) & LOD_TOUCHED) != 0)
+                    continue;
+
+                moved.clear();
+
+                for (int j = adjacencyOffset[from]; j < adjacencyOffset[from + 1]; ++j)
+                {
+                    int triangle = adjacency[j];
+                    int cornerTo = corner(triangle, to);
+
+                    if (cornerTo >= 0)
+                    {
+                        int vertex = triangles[triangle * 3 + corner(triangle, from)];
+
+                        match[vertex] = triangles[triangle * 3 + cornerTo];
+                        moved.push_back(vertex);
+                    }
+                }
+
+                for (int j = adjacencyOffset[from]; j < adjacencyOffset[from + 1]; ++j)
+                {
+                    int triangle = adjacency[j];
+                    int cornerFrom = corner(triangle, from);
+
+                    for (int k = 0; k < 3; ++k)
+                        flags[trianglePositions[triangle * 3 + k]] |= LOD_TOUCHED;
+
+                    if (corner(triangle, to) >= 0)
+                    {
+                        triangles[triangle * 3] = -1;
+                        --current;
+                    }
+                    else
+                    {
+                        int &vertex = triangles[triangle * 3 + cornerFrom];
+
+                        vertex = match[vertex];
+                        trianglePositions[triangle * 3 + cornerFrom] = to;
+                    }
+                }
 
-    for (int i = 0; i < m_numberOfMaterials; ++i)
-    {
-        if (!m_materials[i].bumpMapFilename.empty())
-        {
-            generateTangents();
-            break;
-        }
-    }
+                for (size_t j = 0; j < moved.size(); ++j)
+                    match[moved[j]] = -1;
 
-    return true;
-}
+                addQuadric(quadrics[to], quadrics[from]);
+                maxCost = std::max(maxCost, candidates[i].cost);
+                ++collapsed;
+            }
 
-void ModelOBJ::normalize(float scaleTo, bool center)
-{
-    float width = 0.0f;
-    float height = 0.0f;
-    float length = 0.0f;
-    float radius = 0.0f;
-    float centerPos[3] = {0.0f};
+            // Drop the collapsed triangles.
 
-    bounds(centerPos, width, height, length, radius);
+            int kept = 0;
 
-    float scalingFactor = scaleTo / radius;
-    float offset[3] = {0.0f};
+            for (size_t i = 0; i < triangles.size(); i += 3)
+            {
+                if (triangles[i] < 0)
+                    continue;
 
-    if (center)
-    {
-        offset[0] = -centerPos[0];
-        offset[1] = -centerPos[1];
-        offset[2] = -centerPos[2];
-    }
-    else
-    {
-        offset[0] = 0.0f;
-        offset[1] = 0.0f;
-        offset[2] = 0.0f;
-    }
+                for (int k = 0; k < 3; ++k)
+                    triangles[kept * 3 + k] = triangles[i + k];
 
-    scale(scalingFactor, offset);
-    bounds(m_center, m_width, m_height, m_length, m_radius);
-}
+                ++kept;
+            }
 
-void ModelOBJ::reverseWinding()
-{
-    int swap = 0;
+            triangles.resize(kept * 3);
+            topologyValid = false;
 
-    // Reverse face winding.
-    for (int i = 0; i < static_cast<int>(m_indexBuffer.size()); i += 3)
-    {
-        swap = m_indexBuffer[i + 1];
-        m_indexBuffer[i + 1] = m_indexBuffer[i + 2];
-        m_indexBuffer[i + 2] = swap;
-    }
+            if (collapsed == 0)
+                break;
+        }
 
-    float *pNormal = 0;
-    float *pTangent = 0;
+        // Stop once simplification stalls.
 
-    // Invert normals and tangents.
-    for (int i = 0; i < static_cast<int>(m_vertexBuffer.size()); ++i)
-    {
-        pNormal = m_vertexBuffer[i].normal;
-        pNormal[0] = -pNormal[0];
-        pNormal[1] = -pNormal[1];
-        pNormal[2] = -pNormal[2];
+        if (current > previous - previous / 8)
+            break;
 
-        pTangent = m_vertexBuffer[i].tangent;
-        pTangent[0] = -pTangent[0];
-        pTangent[1] = -pTangent[1];
-        pTangent[2] = -pTangent[2];
-    }
-}
+        LevelOfDetail lod;
 
-void ModelOBJ::scale(float scaleFactor, float offset[3])
-{
-    float *pPosition = 0;
+        lod.startIndex = static_cast<int>(m_lodIndexBuffer.size());
+        lod.triangleCount = current;
+        lod.error = static_cast<float>(sqrt(maxCost));
 
-    for (int i = 0; i < static_cast<int>(m_vertexBuffer.size()); ++i)
-    {
-        pPosition = m_vertexBuffer[i].position;
+        for (int i = 0; i < current * 3; ++i)
+            m_lodIndexBuffer.push_back(vertices[triangles[i]]);
 
-        pPosition[0] += offset[0];
-        pPosition[1] += offset[1];
-        pPosition[2] += offset[2];
+        optimizeVertexCache(&m_lodIndexBuffer[lod.startIndex], current, localIndex);
+        m_lods.push_back(lod);
 
-        pPosition[0] *= scaleFactor;
-        pPosition[1] *= scaleFactor;
-        pPosition[2] *= scaleFactor;
+        previous = current;
     }
 }
 
@@ -318,17 +3203,17 @@ void ModelOBJ::addTrianglePos(int index, int material, int v0, int v1, int v2)
     vertex.position[0] = m_vertexCoords[v0 * 3];
     vertex.position[1] = m_vertexCoords[v0 * 3 + 1];
     vertex.position[2] = m_vertexCoords[v0 * 3 + 2];
-    m_indexBuffer[index * 3] = addVertex(v0, &vertex);
+    m_indexBuffer[index * 3] = addVertex(v0, -1, -1, &vertex);
 
     vertex.position[0] = m_vertexCoords[v1 * 3];
     vertex.position[1] = m_vertexCoords[v1 * 3 + 1];
     vertex.position[2] = m_vertexCoords[v1 * 3 + 2];
-    m_indexBuffer[index * 3 + 1] = addVertex(v1, &vertex);
+    m_indexBuffer[index * 3 + 1] = addVertex(v1, -1, -1, &vertex);
 
     vertex.position[0] = m_vertexCoords[v2 * 3];
     vertex.position[1] = m_vertexCoords[v2 * 3 + 1];
     vertex.position[2] = m_vertexCoords[v2 * 3 + 2];
-    m_indexBuffer[index * 3 + 2] = addVertex(v2, &vertex);
+    m_indexBuffer[index * 3 + 2] = addVertex(v2, -1, -1, &vertex);
 }
 
 void ModelOBJ::addTrianglePosNormal(int index, int material, int v0, int v1,
@@ -350,7 +3235,7 @@ void ModelOBJ::addTrianglePosNormal(int index, int material, int v0, int v1,
     vertex.normal[0] = m_normals[vn0 * 3];
     vertex.normal[1] = m_normals[vn0 * 3 + 1];
     vertex.normal[2] = m_normals[vn0 * 3 + 2];
-    m_indexBuffer[index * 3] = addVertex(v0, &vertex);
+    m_indexBuffer[index * 3] = addVertex(v0, -1, vn0, &vertex);
 
     vertex.position[0] = m_vertexCoords[v1 * 3];
     vertex.position[1] = m_vertexCoords[v1 * 3 + 1];
@@ -358,7 +3243,7 @@ void ModelOBJ::addTrianglePosNormal(int index, int material, int v0, int v1,
     vertex.normal[0] = m_normals[vn1 * 3];
     vertex.normal[1] = m_normals[vn1 * 3 + 1];
     vertex.normal[2] = m_normals[vn1 * 3 + 2];
-    m_indexBuffer[index * 3 + 1] = addVertex(v1, &vertex);
+    m_indexBuffer[index * 3 + 1] = addVertex(v1, -1, vn1, &vertex);
 
     vertex.position[0] = m_vertexCoords[v2 * 3];
     vertex.position[1] = m_vertexCoords[v2 * 3 + 1];
@@ -366,7 +3251,7 @@ void ModelOBJ::addTrianglePosNormal(int index, int material, int v0, int v1,
     vertex.normal[0] = m_normals[vn2 * 3];
     vertex.normal[1] = m_normals[vn2 * 3 + 1];
     vertex.normal[2] = m_normals[vn2 * 3 + 2];
-    m_indexBuffer[index * 3 + 2] = addVertex(v2, &vertex);
+    m_indexBuffer[index * 3 + 2] = addVertex(v2, -1, vn2, &vertex);
 }
 
 void ModelOBJ::addTrianglePosTexCoord(int index, int material, int v0, int v1,
@@ -387,21 +3272,21 @@ void ModelOBJ::addTrianglePosTexCoord(int index, int material, int v0, int v1,
     vertex.position[2] = m_vertexCoords[v0 * 3 + 2];
     vertex.texCoord[0] = m_textureCoords[vt0 * 2];
     vertex.texCoord[1] = m_textureCoords[vt0 * 2 + 1];
-    m_indexBuffer[index * 3] = addVertex(v0, &vertex);
+    m_indexBuffer[index * 3] = addVertex(v0, vt0, -1, &vertex);
 
     vertex.position[0] = m_vertexCoords[v1 * 3];
     vertex.position[1] = m_vertexCoords[v1 * 3 + 1];
     vertex.position[2] = m_vertexCoords[v1 * 3 + 2];
     vertex.texCoord[0] = m_textureCoords[vt1 * 2];
     vertex.texCoord[1] = m_textureCoords[vt1 * 2 + 1];
-    m_indexBuffer[index * 3 + 1] = addVertex(v1, &vertex);
+    m_indexBuffer[index * 3 + 1] = addVertex(v1, vt1, -1, &vertex);
 
     vertex.position[0] = m_vertexCoords[v2 * 3];
     vertex.position[1] = m_vertexCoords[v2 * 3 + 1];
     vertex.position[2] = m_vertexCoords[v2 * 3 + 2];
     vertex.texCoord[0] = m_textureCoords[vt2 * 2];
     vertex.texCoord[1] = m_textureCoords[vt2 * 2 + 1];
-    m_indexBuffer[index * 3 + 2] = addVertex(v2, &vertex);
+    m_indexBuffer[index * 3 + 2] = addVertex(v2, vt2, -1, &vertex);
 }
 
 void ModelOBJ::addTrianglePosTexCoordNormal(int index, int material, int v0,
@@ -426,7 +3311,7 @@ void ModelOBJ::addTrianglePosTexCoordNormal(int index, int material, int v0,
     vertex.normal[0] = m_normals[vn0 * 3];
     vertex.normal[1] = m_normals[vn0 * 3 + 1];
     vertex.normal[2] = m_normals[vn0 * 3 + 2];
-    m_indexBuffer[index * 3] = addVertex(v0, &vertex);
+    m_indexBuffer[index * 3] = addVertex(v0, vt0, vn0, &vertex);
 
     vertex.position[0] = m_vertexCoords[v1 * 3];
     vertex.position[1] = m_vertexCoords[v1 * 3 + 1];
@@ -436,7 +3321,7 @@ void ModelOBJ::addTrianglePosTexCoordNormal(int index, int material, int v0,
     vertex.normal[0] = m_normals[vn1 * 3];
     vertex.normal[1] = m_normals[vn1 * 3 + 1];
     vertex.normal[2] = m_normals[vn1 * 3 + 2];
-    m_indexBuffer[index * 3 + 1] = addVertex(v1, &vertex);
+    m_indexBuffer[index * 3 + 1] = addVertex(v1, vt1, vn1, &vertex);
 
     vertex.position[0] = m_vertexCoords[v2 * 3];
     vertex.position[1] = m_vertexCoords[v2 * 3 + 1];
@@ -446,51 +3331,79 @@ void ModelOBJ::addTrianglePosTexCoordNormal(int index, int material, int v0,
     vertex.normal[0] = m_normals[vn2 * 3];
     vertex.normal[1] = m_normals[vn2 * 3 + 1];
     vertex.normal[2] = m_normals[vn2 * 3 + 2];
-    m_indexBuffer[index * 3 + 2] = addVertex(v2, &vertex);
+    m_indexBuffer[index * 3 + 2] = addVertex(v2, vt2, vn2, &vertex);
 }
 
-int ModelOBJ::addVertex(int hash, const Vertex *pVertex)
+int ModelOBJ::addVertex(int v, int vt, int vn, const Vertex *pVertex)
 {
-    int index = -1;
-    std::map<int, std::vector<int> >::const_iterator iter = m_vertexCache.find(hash);
+    // Vertices are welded on their (v, vt, vn) index triple. The cache is a
+    // flat open addressing table with linear probing. It is kept at most
+    // half full, so probe sequences stay short.
 
-    if (iter == m_vertexCache.end())
-    {
-        // Vertex hash doesn't exist in the cache.
+    if (m_vertexCacheSize * 2 >= static_cast<int>(m_vertexCache.size()))
+        reserveVertexCache(std::max(64, m_vertexCacheSize * 2));
 
-        index = static_cast<int>(m_vertexBuffer.size());
-        m_vertexBuffer.push_back(*pVertex);
-        m_vertexCache.insert(std::make_pair(hash, std::vector<int>(1, index)));
-    }
-    else
-    {
-        // One or more vertices have been hashed to this entry in the cache.
+    unsigned int mask = static_cast<unsigned int>(m_vertexCache.size()) - 1;
+    unsigned int slot = hashVertexIndices(v, vt, vn) & mask;
 
-        const std::vector<int> &vertices = iter->second;
-        const Vertex *pCachedVertex = 0;
-        bool found = false;
+    while (true)
+    {
+        VertexCacheEntry &entry = m_vertexCache[slot];
 
-        for (std::vector<int>::const_iterator i = vertices.begin(); i != vertices.end(); ++i)
+        if (entry.index < 0)
         {
-            index = *i;
-            pCachedVertex = &m_vertexBuffer[index];
-
-            if (memcmp(pCachedVertex, pVertex, sizeof(Vertex)) == 0)
-            {
-                found = true;
-                break;
-            }
-        }
+            // Vertex doesn't exist in the cache.
 
-        if (!found)
-        {
-            index = static_cast<int>(m_vertexBuffer.size());
+            entry.v = v;
+            entry.vt = vt;
+            entry.vn = vn;
+            entry.index = static_cast<int>(m_vertexBuffer.size());
             m_vertexBuffer.push_back(*pVertex);
-            m_vertexCache[hash].push_back(index);
+            ++m_vertexCacheSize;
+            return entry.index;
         }
+
+        if (entry.v == v && entry.vt == vt && entry.vn == vn)
+            return entry.index;
+
+        slot = (slot + 1) & mask;
     }
+}
+
+void ModelOBJ::reserveVertexCache(int numVertices)
+{
+    // Round the table up to a power of two with room for twice the number
+    // of vertices, then re-insert whatever is already cached.
+
+    size_t capacity = 64;
+
+    while (capacity < static_cast<size_t>(numVertices) * 2)
+        capacity *= 2;
+
+    if (capacity <= m_vertexCache.size())
+        return;
+
+    VertexCacheEntry empty = {0, 0, 0, -1};
+    std::vector<VertexCacheEntry> oldCache(capacity, empty);
+
+    oldCache.swap(m_vertexCache);
+
+    unsigned int mask = static_cast<unsigned int>(capacity) - 1;
+
+    for (size_t i = 0; i < oldCache.size(); ++i)
+    {
+        const VertexCacheEntry &entry = oldCache[i];
+
+        if (entry.index < 0)
+            continue;
+
+        unsigned int slot = hashVertexIndices(entry.v, entry.vt, entry.vn) & mask;
 
-    return index;
+        while (m_vertexCache[slot].index >= 0)
+            slot = (slot + 1) & mask;
+
+        m_vertexCache[slot] = entry;
+    }
 }
 
 void ModelOBJ::buildMeshes()
@@ -517,281 +3430,662 @@ void ModelOBJ::buildMeshes()
     numMeshes = 0;
     materialId = -1;
 
-    // Build the meshes. One mesh for each unique material.
-    for (int i = 0; i < static_cast<int>(m_attributeBuffer.size()); ++i)
+    // Build the meshes. One mesh for each unique material.
+    for (int i = 0; i < static_cast<int>(m_attributeBuffer.size()); ++i)
+    {
+        if (m_attributeBuffer[i] != materialId)
+        {
+            materialId = m_attributeBuffer[i];
+            pMesh = &m_meshes[numMeshes++];            
+            pMesh->pMaterial = &m_materials[materialId];
+            pMesh->startIndex = i * 3;
+            ++pMesh->triangleCount;
+        }
+        else
+        {
+            ++pMesh->triangleCount;
+        }
+    }
+
+    // Sort the meshes based on its material alpha. Fully opaque meshes
+    // towards the front and fully transparent towards the back.
+    std::sort(m_meshes.begin(), m_meshes.end(), MeshCompFunc);
+}
+
+bool ModelOBJ::exportCache(const char *pszCacheFilename, const char *pszFilename,
+                           bool rebuildNormals, unsigned long long sourceHash) const
+{
+    CacheHeader header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_VERSION;
+    header.vertexSize = sizeof(Vertex);
+    header.sourceHash = sourceHash;
+
+    if (!getFileStamp(pszFilename, header.sourceSize, header.sourceTime))
+        return false;
+
+    header.flags = (m_hasPositions ? CACHE_HAS_POSITIONS : 0)
+        | (m_hasTextureCoords ? CACHE_HAS_TEXTURE_COORDS : 0)
+        | (m_hasNormals ? CACHE_HAS_NORMALS : 0)
+        | (m_hasTangents ? CACHE_HAS_TANGENTS : 0)
+        | (rebuildNormals ? CACHE_REBUILT_NORMALS : 0)
+        | (m_optimizeOnImport ? CACHE_OPTIMIZED : 0)
+        | (m_lodsOnImport ? CACHE_HAS_LODS : 0);
+
+    header.numberOfVertices = m_numberOfVertices;
+    header.numberOfTriangles = m_numberOfTriangles;
+    header.numberOfMaterials = static_cast<int>(m_materials.size());
+    header.numberOfMeshes = m_numberOfMeshes;
+    header.numberOfLibraries = static_cast<int>(m_materialLibraries.size());
+    header.numberOfLodIndices = m_lodsOnImport ? m_numberOfLodIndices : 0;
+
+    memcpy(header.center, m_center, sizeof(header.center));
+    header.width = m_width;
+    header.height = m_height;
+    header.length = m_length;
+    header.radius = m_radius;
+
+    // Everything but the vertex and index buffers is small, so it is
+    // assembled in memory first.
+
+    std::vector<char> buffer;
+
+    writeBytes(buffer, &header, sizeof(header));
+
+    for (size_t i = 0; i < m_materials.size(); ++i)
+    {
+        const Material &material = m_materials[i];
+
+        writeBytes(buffer, material.ambient, sizeof(material.ambient));
+        writeBytes(buffer, material.diffuse, sizeof(material.diffuse));
+        writeBytes(buffer, material.specular, sizeof(material.specular));
+        writeBytes(buffer, &material.shininess, sizeof(material.shininess));
+        writeBytes(buffer, &material.alpha, sizeof(material.alpha));
+        writeString(buffer, material.name);
+        writeString(buffer, material.colorMapFilename);
+        writeString(buffer, material.bumpMapFilename);
+    }
+
+    for (size_t i = 0; i < m_materialLibraries.size(); ++i)
+    {
+        unsigned long long size = 0;
+        long long time = 0;
+
+        if (!getFileStamp(m_materialLibraries[i].c_str(), size, time))
+            return false;
+
+        writeString(buffer, m_materialLibraries[i]);
+        writeBytes(buffer, &size, sizeof(size));
+        writeBytes(buffer, &time, sizeof(time));
+    }
+
+    for (int i = 0; i < m_numberOfMeshes; ++i)
+    {
+        int mesh[3] =
+        {
+            m_meshes[i].startIndex,
+            m_meshes[i].triangleCount,
+            static_cast<int>(m_meshes[i].pMaterial - &m_materials[0])
+        };
+
+        writeBytes(buffer, mesh, sizeof(mesh));
+    }
+
+    if (m_lodsOnImport)
+    {
+        writeBytes(buffer, &m_lodOffsets[0], m_lodOffsets.size() * sizeof(int));
+
+        if (!m_lods.empty())
+            writeBytes(buffer, &m_lods[0], m_lods.size() * sizeof(LevelOfDetail));
+    }
+
+    buffer.resize((buffer.size() + 15) & ~static_cast<size_t>(15), 0);
+
+    size_t verticesSize = static_cast<size_t>(m_numberOfVertices) * sizeof(Vertex);
+    size_t indicesSize = static_cast<size_t>(getNumberOfIndices()) * sizeof(int);
+    size_t lodIndicesSize = static_cast<size_t>(header.numberOfLodIndices) * sizeof(int);
+
+    CacheHeader *pHeader = reinterpret_cast<CacheHeader *>(&buffer[0]);
+    pHeader->verticesOffset = buffer.size();
+    pHeader->indicesOffset = pHeader->verticesOffset + verticesSize;
+    pHeader->fileSize = pHeader->indicesOffset + indicesSize + lodIndicesSize;
+
+    // Write to a temporary file first so that a concurrent or interrupted
+    // run never sees a half written cache.
+
+    std::string tempFilename = std::string(pszCacheFilename) + ".tmp";
+    FILE *pFile = fopen(tempFilename.c_str(), "wb");
+
+    if (!pFile)
+        return false;
+
+    bool written = fwrite(&buffer[0], 1, buffer.size(), pFile) == buffer.size()
+        && fwrite(m_pVertices, 1, verticesSize, pFile) == verticesSize
+        && fwrite(m_pIndices, 1, indicesSize, pFile) == indicesSize
+        && (lodIndicesSize == 0
+            || fwrite(m_pLodIndices, 1, lodIndicesSize, pFile) == lodIndicesSize);
+
+    written = (fclose(pFile) == 0) && written;
+
+    // Replace the old cache in a single step. rename() does that on POSIX
+    // systems, but fails on Windows if the target exists.
+
+#if defined(_WIN32)
+    bool replaced = written
+        && MoveFileExA(tempFilename.c_str(), pszCacheFilename, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    bool replaced = written && rename(tempFilename.c_str(), pszCacheFilename) == 0;
+#endif
+
+    if (!replaced)
+    {
+        remove(tempFilename.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+void ModelOBJ::generateNormals(int numThreads)
+{
+    int totalVertices = getNumberOfVertices();
+    int totalTriangles = getNumberOfTriangles();
+    int triangleBlocks = (totalTriangles + GENERATE_BLOCK_SIZE - 1) / GENERATE_BLOCK_SIZE;
+    int vertexBlocks = (totalVertices + GENERATE_BLOCK_SIZE - 1) / GENERATE_BLOCK_SIZE;
+
+    // Calculate the triangle face normals and accumulate them. A single
+    // thread scatters each face normal into its vertices in triangle order.
+    // Several threads first compute all face normals with SSE, then each
+    // gathers the triangles of its own vertices in the same order, so
+    // there are no shared accumulators and the sums match the serial ones
+    // exactly.
+    if (numThreads <= 1)
+    {
+        for (int i = 0; i < totalVertices; ++i)
+        {
+            m_pVertices[i].normal[0] = 0.0f;
+            m_pVertices[i].normal[1] = 0.0f;
+            m_pVertices[i].normal[2] = 0.0f;
+        }
+
+        for (int i = 0; i < totalTriangles; ++i)
+        {
+            const int *pTriangle = &m_pIndices[i * 3];
+            float normal[3];
+
+            computeFaceNormal(m_pVertices, pTriangle, normal);
+
+            for (int j = 0; j < 3; ++j)
+            {
+                Vertex *pVertex = &m_pVertices[pTriangle[j]];
+
+                pVertex->normal[0] += normal[0];
+                pVertex->normal[1] += normal[1];
+                pVertex->normal[2] += normal[2];
+            }
+        }
+    }
+    else
+    {
+        std::vector<float> faceNormals(totalTriangles * 3);
+        float *pFaceNormals[3] =
+        {
+            faceNormals.data(),
+            faceNormals.data() + totalTriangles,
+            faceNormals.data() + totalTriangles * 2
+        };
+
+        parallelFor(numThreads, triangleBlocks, [&](int block)
+        {
+            int first = block * GENERATE_BLOCK_SIZE;
+            int last = std::min(first + GENERATE_BLOCK_SIZE, totalTriangles);
+
+            computeFaceNormals(m_pVertices, m_pIndices, first, last, pFaceNormals);
+        });
+
+        std::vector<int> adjacencyOffset;
+        std::vector<int> adjacency;
+
+        buildVertexAdjacency(m_pIndices, totalTriangles, totalVertices,
+            adjacencyOffset, adjacency);
+
+        parallelFor(numThreads, vertexBlocks, [&](int block)
+        {
+            int first = block * GENERATE_BLOCK_SIZE;
+            int last = std::min(first + GENERATE_BLOCK_SIZE, totalVertices);
+
+            for (int i = first; i < last; ++i)
+            {
+                float normal[3] = {0.0f, 0.0f, 0.0f};
+
+                for (int j = adjacencyOffset[i]; j < adjacencyOffset[i + 1]; ++j)
+                {
+                    normal[0] += pFaceNormals[0][adjacency[j]];
+                    normal[1] += pFaceNormals[1][adjacency[j]];
+                    normal[2] += pFaceNormals[2][adjacency[j]];
+                }
+
+                m_pVertices[i].normal[0] = normal[0];
+                m_pVertices[i].normal[1] = normal[1];
+                m_pVertices[i].normal[2] = normal[2];
+            }
+        });
+    }
+
+    // Normalize the vertex normals.
+    parallelFor(numThreads, vertexBlocks, [&](int block)
+    {
+        int first = block * GENERATE_BLOCK_SIZE;
+        int last = std::min(first + GENERATE_BLOCK_SIZE, totalVertices);
+
+        for (int i = first; i < last; ++i)
+        {
+            Vertex *pVertex0 = &m_pVertices[i];
+
+            float length = 1.0f / sqrtf(pVertex0->normal[0] * pVertex0->normal[0] +
+                pVertex0->normal[1] * pVertex0->normal[1] +
+                pVertex0->normal[2] * pVertex0->normal[2]);
+
+            pVertex0->normal[0] *= length;
+            pVertex0->normal[1] *= length;
+            pVertex0->normal[2] *= length;
+        }
+    });
+
+    m_hasNormals = true;
+}
+
+void ModelOBJ::generateTangents(int numThreads)
+{
+    int totalVertices = getNumberOfVertices();
+    int totalTriangles = getNumberOfTriangles();
+    int triangleBlocks = (totalTriangles + GENERATE_BLOCK_SIZE - 1) / GENERATE_BLOCK_SIZE;
+    int vertexBlocks = (totalVertices + GENERATE_BLOCK_SIZE - 1) / GENERATE_BLOCK_SIZE;
+
+    // Calculate the triangle face tangents and bitangents and accumulate
+    // them the same way as the normals.
+    if (numThreads <= 1)
+    {
+        for (int i = 0; i < totalVertices; ++i)
+        {
+            Vertex *pVertex = &m_pVertices[i];
+
+            for (int k = 0; k < 3; ++k)
+            {
+                pVertex->tangent[k] = 0.0f;
+                pVertex->bitangent[k] = 0.0f;
+            }
+        }
+
+        for (int i = 0; i < totalTriangles; ++i)
+        {
+            const int *pTriangle = &m_pIndices[i * 3];
+            float tangent[3];
+            float bitangent[3];
+
+            computeFaceTangent(m_pVertices, pTriangle, tangent, bitangent);
+
+            for (int j = 0; j < 3; ++j)
+            {
+                Vertex *pVertex = &m_pVertices[pTriangle[j]];
+
+                for (int k = 0; k < 3; ++k)
+                {
+                    pVertex->tangent[k] += tangent[k];
+                    pVertex->bitangent[k] += bitangent[k];
+                }
+            }
+        }
+    }
+    else
+    {
+        std::vector<float> faceFrames(totalTriangles * 6);
+        float *pFaceTangents[3] =
+        {
+            faceFrames.data(),
+            faceFrames.data() + totalTriangles,
+            faceFrames.data() + totalTriangles * 2
+        };
+        float *pFaceBitangents[3] =
+        {
+            faceFrames.data() + totalTriangles * 3,
+            faceFrames.data() + totalTriangles * 4,
+            faceFrames.data() + totalTriangles * 5
+        };
+
+        parallelFor(numThreads, triangleBlocks, [&](int block)
+        {
+            int first = block * GENERATE_BLOCK_SIZE;
+            int last = std::min(first + GENERATE_BLOCK_SIZE, totalTriangles);
+
+            computeFaceTangents(m_pVertices, m_pIndices, first, last,
+                pFaceTangents, pFaceBitangents);
+        });
+
+        std::vector<int> adjacencyOffset;
+        std::vector<int> adjacency;
+
+        buildVertexAdjacency(m_pIndices, totalTriangles, totalVertices,
+            adjacencyOffset, adjacency);
+
+        parallelFor(numThreads, vertexBlocks, [&](int block)
+        {
+            int first = block * GENERATE_BLOCK_SIZE;
+            int last = std::min(first + GENERATE_BLOCK_SIZE, totalVertices);
+
+            for (int i = first; i < last; ++i)
+            {
+                float tangent[3] = {0.0f, 0.0f, 0.0f};
+                float bitangent[3] = {0.0f, 0.0f, 0.0f};
+
+                for (int j = adjacencyOffset[i]; j < adjacencyOffset[i + 1]; ++j)
+                {
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        tangent[k] += pFaceTangents[k][adjacency[j]];
+                        bitangent[k] += pFaceBitangents[k][adjacency[j]];
+                    }
+                }
+
+                for (int k = 0; k < 3; ++k)
+                {
+                    m_pVertices[i].tangent[k] = tangent[k];
+                    m_pVertices[i].bitangent[k] = bitangent[k];
+                }
+            }
+        });
+    }
+
+    // Orthogonalize and normalize the vertex tangents.
+    parallelFor(numThreads, vertexBlocks, [&](int block)
     {
-        if (m_attributeBuffer[i] != materialId)
-        {
-            materialId = m_attributeBuffer[i];
-            pMesh = &m_meshes[numMeshes++];            
-            pMesh->pMaterial = &m_materials[materialId];
-            pMesh->startIndex = i * 3;
-            ++pMesh->triangleCount;
-        }
-        else
+        int first = block * GENERATE_BLOCK_SIZE;
+        int last = std::min(first + GENERATE_BLOCK_SIZE, totalVertices);
+
+        for (int i = first; i < last; ++i)
         {
-            ++pMesh->triangleCount;
+            Vertex *pVertex0 = &m_pVertices[i];
+            float bitangent[3] = {0.0f, 0.0f, 0.0f};
+            float nDotT = 0.0f;
+            float bDotB = 0.0f;
+            float length = 0.0f;
+
+            // Gram-Schmidt orthogonalize tangent with normal.
+
+            nDotT = pVertex0->normal[0] * pVertex0->tangent[0] +
+                    pVertex0->normal[1] * pVertex0->tangent[1] +
+                    pVertex0->normal[2] * pVertex0->tangent[2];
+
+            pVertex0->tangent[0] -= pVertex0->normal[0] * nDotT;
+            pVertex0->tangent[1] -= pVertex0->normal[1] * nDotT;
+            pVertex0->tangent[2] -= pVertex0->normal[2] * nDotT;
+
+            // Normalize the tangent.
+
+            length = 1.0f / sqrtf(pVertex0->tangent[0] * pVertex0->tangent[0] +
+                                  pVertex0->tangent[1] * pVertex0->tangent[1] +
+                                  pVertex0->tangent[2] * pVertex0->tangent[2]);
+
+            pVertex0->tangent[0] *= length;
+            pVertex0->tangent[1] *= length;
+            pVertex0->tangent[2] *= length;
+
+            // Calculate the handedness of the local tangent space.
+            // The bitangent vector is the cross product between the triangle face
+            // normal vector and the calculated tangent vector. The resulting
+            // bitangent vector should be the same as the bitangent vector
+            // calculated from the set of linear equations above. If they point in
+            // different directions then we need to invert the cross product
+            // calculated bitangent vector. We store this scalar multiplier in the
+            // tangent vector's 'w' component so that the correct bitangent vector
+            // can be generated in the normal mapping shader's vertex shader.
+            //
+            // Normal maps have a left handed coordinate system with the origin
+            // located at the top left of the normal map texture. The x coordinates
+            // run horizontally from left to right. The y coordinates run
+            // vertically from top to bottom. The z coordinates run out of the
+            // normal map texture towards the viewer. Our handedness calculations
+            // must take this fact into account as well so that the normal mapping
+            // shader's vertex shader will generate the correct bitangent vectors.
+            // Some normal map authoring tools such as Crazybump
+            // (http://www.crazybump.com/) includes options to allow you to control
+            // the orientation of the normal map normal's y-axis.
+
+            bitangent[0] = (pVertex0->normal[1] * pVertex0->tangent[2]) -
+                           (pVertex0->normal[2] * pVertex0->tangent[1]);
+            bitangent[1] = (pVertex0->normal[2] * pVertex0->tangent[0]) -
+                           (pVertex0->normal[0] * pVertex0->tangent[2]);
+            bitangent[2] = (pVertex0->normal[0] * pVertex0->tangent[1]) -
+                           (pVertex0->normal[1] * pVertex0->tangent[0]);
+
+            bDotB = bitangent[0] * pVertex0->bitangent[0] +
+                    bitangent[1] * pVertex0->bitangent[1] +
+                    bitangent[2] * pVertex0->bitangent[2];
+
+            pVertex0->tangent[3] = (bDotB < 0.0f) ? 1.0f : -1.0f;
+
+            pVertex0->bitangent[0] = bitangent[0];
+            pVertex0->bitangent[1] = bitangent[1];
+            pVertex0->bitangent[2] = bitangent[2];
         }
-    }
-
-    // Sort the meshes based on its material alpha. Fully opaque meshes
-    // towards the front and fully transparent towards the back.
-    std::sort(m_meshes.begin(), m_meshes.end(), MeshCompFunc);
+    });
 }
 
-void ModelOBJ::generateNormals()
+bool ModelOBJ::importCache(const char *pszCacheFilename, const char *pszFilename,
+                           bool rebuildNormals)
 {
-    const int *pTriangle = 0;
-    Vertex *pVertex0 = 0;
-    Vertex *pVertex1 = 0;
-    Vertex *pVertex2 = 0;
-    float edge1[3] = {0.0f, 0.0f, 0.0f};
-    float edge2[3] = {0.0f, 0.0f, 0.0f};
-    float normal[3] = {0.0f, 0.0f, 0.0f};
-    float length = 0.0f;
-    int totalVertices = getNumberOfVertices();
-    int totalTriangles = getNumberOfTriangles();
+    unsigned long long sourceSize = 0;
+    long long sourceTime = 0;
 
-    // Initialize all the vertex normals.
-    for (int i = 0; i < totalVertices; ++i)
-    {
-        pVertex0 = &m_vertexBuffer[i];
-        pVertex0->normal[0] = 0.0f;
-        pVertex0->normal[1] = 0.0f;
-        pVertex0->normal[2] = 0.0f;
-    }
+    if (!getFileStamp(pszFilename, sourceSize, sourceTime))
+        return false;
 
-    // Calculate the vertex normals.
-    for (int i = 0; i < totalTriangles; ++i)
-    {
-        pTriangle = &m_indexBuffer[i * 3];
+    // Map the cache copy-on-write. The vertex and index buffers are used in
+    // place, only the small sections are copied into the model.
 
-        pVertex0 = &m_vertexBuffer[pTriangle[0]];
-        pVertex1 = &m_vertexBuffer[pTriangle[1]];
-        pVertex2 = &m_vertexBuffer[pTriangle[2]];
+    MappedFile *pFile = new MappedFile;
 
-        // Calculate triangle face normal.
+    if (!pFile->open(pszCacheFilename, true) || pFile->size() < sizeof(CacheHeader))
+    {
+        delete pFile;
+        return false;
+    }
 
-        edge1[0] = pVertex1->position[0] - pVertex0->position[0];
-        edge1[1] = pVertex1->position[1] - pVertex0->position[1];
-        edge1[2] = pVertex1->position[2] - pVertex0->position[2];
+    const char *p = pFile->data();
+    const char *pEnd = p + pFile->size();
+    CacheHeader header;
+
+    readBytes(p, pEnd, &header, sizeof(header));
+
+    bool valid = memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) == 0
+        && header.version == CACHE_VERSION
+        && header.vertexSize == sizeof(Vertex)
+        && header.fileSize == pFile->size()
+        && header.sourceSize == sourceSize
+        && ((header.flags & CACHE_REBUILT_NORMALS) != 0) == rebuildNormals
+        && ((header.flags & CACHE_OPTIMIZED) != 0) == m_optimizeOnImport
+        && ((header.flags & CACHE_HAS_LODS) != 0) == m_lodsOnImport
+        && header.numberOfVertices >= 0
+        && header.numberOfTriangles >= 0
+        && header.numberOfMaterials > 0
+        && header.numberOfMeshes >= 0
+        && header.numberOfLibraries >= 0
+        && header.numberOfLodIndices >= 0
+        && header.verticesOffset % 16 == 0
+        && header.indicesOffset == header.verticesOffset
+            + static_cast<unsigned long long>(header.numberOfVertices) * sizeof(Vertex)
+        && header.fileSize == header.indicesOffset
+            + (static_cast<unsigned long long>(header.numberOfTriangles) * 3
+            + header.numberOfLodIndices) * sizeof(int);
+
+    // A changed timestamp alone (e.g. after a fresh checkout) doesn't
+    // invalidate the cache as long as the contents are the same.
+
+    if (valid && header.sourceTime != sourceTime)
+    {
+        MappedFile source;
 
-        edge2[0] = pVertex2->position[0] - pVertex0->position[0];
-        edge2[1] = pVertex2->position[1] - pVertex0->position[1];
-        edge2[2] = pVertex2->position[2] - pVertex0->position[2];
+        valid = source.open(pszFilename)
+            && hashContents(source.data(), source.size()) == header.sourceHash;
 
-        normal[0] = (edge1[1] * edge2[2]) - (edge1[2] * edge2[1]);
-        normal[1] = (edge1[2] * edge2[0]) - (edge1[0] * edge2[2]);
-        normal[2] = (edge1[0] * edge2[1]) - (edge1[1] * edge2[0]);
+        // Remember the new timestamp so that the next run can skip the hash.
 
-        // Accumulate the normals.
+        FILE *pCache = valid ? fopen(pszCacheFilename, "r+b") : 0;
 
-        pVertex0->normal[0] += normal[0];
-        pVertex0->normal[1] += normal[1];
-        pVertex0->normal[2] += normal[2];
+        if (pCache)
+        {
+            fseek(pCache, static_cast<long>(offsetof(CacheHeader, sourceTime)), SEEK_SET);
+            fwrite(&sourceTime, sizeof(sourceTime), 1, pCache);
+            fclose(pCache);
+        }
+    }
 
-        pVertex1->normal[0] += normal[0];
-        pVertex1->normal[1] += normal[1];
-        pVertex1->normal[2] += normal[2];
+    std::vector<Material> materials(valid ? header.numberOfMaterials : 0);
+    std::vector<std::string> libraries(valid ? header.numberOfLibraries : 0);
+    std::vector<Mesh> meshes(valid ? header.numberOfMeshes : 0);
+    std::vector<int> meshMaterials(meshes.size());
 
-        pVertex2->normal[0] += normal[0];
-        pVertex2->normal[1] += normal[1];
-        pVertex2->normal[2] += normal[2];
+    for (size_t i = 0; valid && i < materials.size(); ++i)
+    {
+        Material &material = materials[i];
+
+        valid = readBytes(p, pEnd, material.ambient, sizeof(material.ambient))
+            && readBytes(p, pEnd, material.diffuse, sizeof(material.diffuse))
+            && readBytes(p, pEnd, material.specular, sizeof(material.specular))
+            && readBytes(p, pEnd, &material.shininess, sizeof(material.shininess))
+            && readBytes(p, pEnd, &material.alpha, sizeof(material.alpha))
+            && readString(p, pEnd, material.name)
+            && readString(p, pEnd, material.colorMapFilename)
+            && readString(p, pEnd, material.bumpMapFilename);
     }
 
-    // Normalize the vertex normals.
-    for (int i = 0; i < totalVertices; ++i)
+    for (size_t i = 0; valid && i < libraries.size(); ++i)
     {
-        pVertex0 = &m_vertexBuffer[i];
-
-        length = 1.0f / sqrtf(pVertex0->normal[0] * pVertex0->normal[0] +
-            pVertex0->normal[1] * pVertex0->normal[1] +
-            pVertex0->normal[2] * pVertex0->normal[2]);
-
-        pVertex0->normal[0] *= length;
-        pVertex0->normal[1] *= length;
-        pVertex0->normal[2] *= length;
+        unsigned long long cachedSize = 0;
+        long long cachedTime = 0;
+        unsigned long long size = 0;
+        long long time = 0;
+
+        valid = readString(p, pEnd, libraries[i])
+            && readBytes(p, pEnd, &cachedSize, sizeof(cachedSize))
+            && readBytes(p, pEnd, &cachedTime, sizeof(cachedTime))
+            && getFileStamp(libraries[i].c_str(), size, time)
+            && size == cachedSize
+            && time == cachedTime;
     }
 
-    m_hasNormals = true;
-}
+    for (size_t i = 0; valid && i < meshes.size(); ++i)
+    {
+        int mesh[3] = {0};
+
+        valid = readBytes(p, pEnd, mesh, sizeof(mesh))
+            && mesh[0] >= 0 && mesh[0] % 3 == 0 && mesh[1] >= 0
+            && mesh[0] / 3 <= header.numberOfTriangles
+            && mesh[1] <= header.numberOfTriangles - mesh[0] / 3
+            && mesh[2] >= 0 && mesh[2] < header.numberOfMaterials;
+
+        meshes[i].startIndex = mesh[0];
+        meshes[i].triangleCount = mesh[1];
+        meshes[i].pMaterial = 0;
+        meshMaterials[i] = mesh[2];
+    }
 
-void ModelOBJ::generateTangents()
-{
-    const int *pTriangle = 0;
-    Vertex *pVertex0 = 0;
-    Vertex *pVertex1 = 0;
-    Vertex *pVertex2 = 0;
-    float edge1[3] = {0.0f, 0.0f, 0.0f};
-    float edge2[3] = {0.0f, 0.0f, 0.0f};
-    float texEdge1[2] = {0.0f, 0.0f};
-    float texEdge2[2] = {0.0f, 0.0f};
-    float tangent[3] = {0.0f, 0.0f, 0.0f};
-    float bitangent[3] = {0.0f, 0.0f, 0.0f};
-    float det = 0.0f;
-    float nDotT = 0.0f;
-    float bDotB = 0.0f;
-    float length = 0.0f;
-    int totalVertices = getNumberOfVertices();
-    int totalTriangles = getNumberOfTriangles();
+    std::vector<int> lodOffsets((valid && m_lodsOnImport) ? header.numberOfMeshes + 1 : 0);
+    std::vector<LevelOfDetail> lods;
 
-    // Initialize all the vertex tangents and bitangents.
-    for (int i = 0; i < totalVertices; ++i)
+    if (!lodOffsets.empty())
     {
-        pVertex0 = &m_vertexBuffer[i];
+        valid = readBytes(p, pEnd, &lodOffsets[0], lodOffsets.size() * sizeof(int))
+            && lodOffsets[0] == 0;
 
-        pVertex0->tangent[0] = 0.0f;
-        pVertex0->tangent[1] = 0.0f;
-        pVertex0->tangent[2] = 0.0f;
-        pVertex0->tangent[3] = 0.0f;
+        // The levels are stored between the offsets and the vertices.
 
-        pVertex0->bitangent[0] = 0.0f;
-        pVertex0->bitangent[1] = 0.0f;
-        pVertex0->bitangent[2] = 0.0f;
-    }
+        unsigned long long lodsOffset = static_cast<unsigned long long>(p - pFile->data());
+        unsigned long long maxLods = (lodsOffset <= header.verticesOffset)
+            ? (header.verticesOffset - lodsOffset) / sizeof(LevelOfDetail) : 0;
 
-    // Calculate the vertex tangents and bitangents.
-    for (int i = 0; i < totalTriangles; ++i)
-    {
-        pTriangle = &m_indexBuffer[i * 3];
+        for (int i = 0; valid && i < header.numberOfMeshes; ++i)
+        {
+            valid = lodOffsets[i + 1] >= lodOffsets[i]
+                && static_cast<unsigned long long>(lodOffsets[i + 1]) <= maxLods;
+        }
 
-        pVertex0 = &m_vertexBuffer[pTriangle[0]];
-        pVertex1 = &m_vertexBuffer[pTriangle[1]];
-        pVertex2 = &m_vertexBuffer[pTriangle[2]];
+        lods.resize(valid ? lodOffsets.back() : 0);
 
-        // Calculate the triangle face tangent and bitangent.
+        if (!lods.empty())
+            valid = readBytes(p, pEnd, &lods[0], lods.size() * sizeof(LevelOfDetail));
 
-        edge1[0] = pVertex1->position[0] - pVertex0->position[0];
-        edge1[1] = pVertex1->position[1] - pVertex0->position[1];
-        edge1[2] = pVertex1->position[2] - pVertex0->position[2];
+        for (size_t i = 0; valid && i < lods.size(); ++i)
+        {
+            valid = lods[i].startIndex >= 0 && lods[i].startIndex % 3 == 0
+                && lods[i].triangleCount >= 0
+                && lods[i].startIndex <= header.numberOfLodIndices
+                && lods[i].triangleCount <= header.numberOfLodIndices / 3 - lods[i].startIndex / 3;
+        }
+    }
 
-        edge2[0] = pVertex2->position[0] - pVertex0->position[0];
-        edge2[1] = pVertex2->position[1] - pVertex0->position[1];
-        edge2[2] = pVertex2->position[2] - pVertex0->position[2];
+    // Every index, including the LOD indices behind the triangles, has to
+    // refer to a cached vertex. A damaged cache would otherwise make the
+    // renderer read past the vertex buffer.
 
-        texEdge1[0] = pVertex1->texCoord[0] - pVertex0->texCoord[0];
-        texEdge1[1] = pVertex1->texCoord[1] - pVertex0->texCoord[1];
+    if (valid)
+    {
+        const int *pIndex = reinterpret_cast<const int *>(pFile->data() + header.indicesOffset);
+        const int *pIndexEnd = pIndex
+            + static_cast<size_t>(header.numberOfTriangles) * 3 + header.numberOfLodIndices;
 
-        texEdge2[0] = pVertex2->texCoord[0] - pVertex0->texCoord[0];
-        texEdge2[1] = pVertex2->texCoord[1] - pVertex0->texCoord[1];
+        for (; valid && pIndex != pIndexEnd; ++pIndex)
+            valid = *pIndex >= 0 && *pIndex < header.numberOfVertices;
+    }
 
-        det = texEdge1[0] * texEdge2[1] - texEdge2[0] * texEdge1[1];
+    if (!valid || static_cast<unsigned long long>(p - pFile->data()) > header.verticesOffset)
+    {
+        delete pFile;
+        return false;
+    }
 
-        if (fabs(det) < 1e-6f)
-        {
-            tangent[0] = 1.0f;
-            tangent[1] = 0.0f;
-            tangent[2] = 0.0f;
+    // The cache is good. Take over its contents.
 
-            bitangent[0] = 0.0f;
-            bitangent[1] = 1.0f;
-            bitangent[2] = 0.0f;
-        }
-        else
-        {
-            det = 1.0f / det;
+    m_materials.swap(materials);
+    m_materialLibraries.swap(libraries);
+    m_meshes.swap(meshes);
+    m_lodOffsets.swap(lodOffsets);
+    m_lods.swap(lods);
 
-            tangent[0] = (texEdge2[1] * edge1[0] - texEdge1[1] * edge2[0]) * det;
-            tangent[1] = (texEdge2[1] * edge1[1] - texEdge1[1] * edge2[1]) * det;
-            tangent[2] = (texEdge2[1] * edge1[2] - texEdge1[1] * edge2[2]) * det;
+    for (size_t i = 0; i < m_materials.size(); ++i)
+        m_materialCache[m_materials[i].name] = static_cast<int>(i);
 
-            bitangent[0] = (-texEdge2[0] * edge1[0] + texEdge1[0] * edge2[0]) * det;
-            bitangent[1] = (-texEdge2[0] * edge1[1] + texEdge1[0] * edge2[1]) * det;
-            bitangent[2] = (-texEdge2[0] * edge1[2] + texEdge1[0] * edge2[2]) * det;
-        }
+    for (size_t i = 0; i < m_meshes.size(); ++i)
+        m_meshes[i].pMaterial = &m_materials[meshMaterials[i]];
 
-        // Accumulate the tangents and bitangents.
+    m_hasPositions = (header.flags & CACHE_HAS_POSITIONS) != 0;
+    m_hasTextureCoords = (header.flags & CACHE_HAS_TEXTURE_COORDS) != 0;
+    m_hasNormals = (header.flags & CACHE_HAS_NORMALS) != 0;
+    m_hasTangents = (header.flags & CACHE_HAS_TANGENTS) != 0;
 
-        pVertex0->tangent[0] += tangent[0];
-        pVertex0->tangent[1] += tangent[1];
-        pVertex0->tangent[2] += tangent[2];
-        pVertex0->bitangent[0] += bitangent[0];
-        pVertex0->bitangent[1] += bitangent[1];
-        pVertex0->bitangent[2] += bitangent[2];
+    m_numberOfVertices = header.numberOfVertices;
+    m_numberOfTriangles = header.numberOfTriangles;
+    m_numberOfMaterials = header.numberOfMaterials;
+    m_numberOfMeshes = header.numberOfMeshes;
+    m_numberOfLodIndices = header.numberOfLodIndices;
 
-        pVertex1->tangent[0] += tangent[0];
-        pVertex1->tangent[1] += tangent[1];
-        pVertex1->tangent[2] += tangent[2];
-        pVertex1->bitangent[0] += bitangent[0];
-        pVertex1->bitangent[1] += bitangent[1];
-        pVertex1->bitangent[2] += bitangent[2];
+    memcpy(m_center, header.center, sizeof(m_center));
+    m_width = header.width;
+    m_height = header.height;
+    m_length = header.length;
+    m_radius = header.radius;
 
-        pVertex2->tangent[0] += tangent[0];
-        pVertex2->tangent[1] += tangent[1];
-        pVertex2->tangent[2] += tangent[2];
-        pVertex2->bitangent[0] += bitangent[0];
-        pVertex2->bitangent[1] += bitangent[1];
-        pVertex2->bitangent[2] += bitangent[2];
-    }
+    m_pCacheFile = pFile;
+    m_pVertices = reinterpret_cast<Vertex *>(pFile->data() + header.verticesOffset);
+    m_pIndices = reinterpret_cast<int *>(pFile->data() + header.indicesOffset);
+    m_pLodIndices = (m_numberOfLodIndices > 0) ? m_pIndices + getNumberOfIndices() : 0;
 
-    // Orthogonalize and normalize the vertex tangents.
-    for (int i = 0; i < totalVertices; ++i)
-    {
-        pVertex0 = &m_vertexBuffer[i];
-
-        // Gram-Schmidt orthogonalize tangent with normal.
-
-        nDotT = pVertex0->normal[0] * pVertex0->tangent[0] +
-                pVertex0->normal[1] * pVertex0->tangent[1] +
-                pVertex0->normal[2] * pVertex0->tangent[2];
-
-        pVertex0->tangent[0] -= pVertex0->normal[0] * nDotT;
-        pVertex0->tangent[1] -= pVertex0->normal[1] * nDotT;
-        pVertex0->tangent[2] -= pVertex0->normal[2] * nDotT;
-
-        // Normalize the tangent.
-
-        length = 1.0f / sqrtf(pVertex0->tangent[0] * pVertex0->tangent[0] +
-                              pVertex0->tangent[1] * pVertex0->tangent[1] +
-                              pVertex0->tangent[2] * pVertex0->tangent[2]);
-
-        pVertex0->tangent[0] *= length;
-        pVertex0->tangent[1] *= length;
-        pVertex0->tangent[2] *= length;
-
-        // Calculate the handedness of the local tangent space.
-        // The bitangent vector is the cross product between the triangle face
-        // normal vector and the calculated tangent vector. The resulting
-        // bitangent vector should be the same as the bitangent vector
-        // calculated from the set of linear equations above. If they point in
-        // different directions then we need to invert the cross product
-        // calculated bitangent vector. We store this scalar multiplier in the
-        // tangent vector's 'w' component so that the correct bitangent vector
-        // can be generated in the normal mapping shader's vertex shader.
-        //
-        // Normal maps have a left handed coordinate system with the origin
-        // located at the top left of the normal map texture. The x coordinates
-        // run horizontally from left to right. The y coordinates run
-        // vertically from top to bottom. The z coordinates run out of the
-        // normal map texture towards the viewer. Our handedness calculations
-        // must take this fact into account as well so that the normal mapping
-        // shader's vertex shader will generate the correct bitangent vectors.
-        // Some normal map authoring tools such as Crazybump
-        // (http://www.crazybump.com/) includes options to allow you to control
-        // the orientation of the normal map normal's y-axis.
-
-        bitangent[0] = (pVertex0->normal[1] * pVertex0->tangent[2]) - 
-                       (pVertex0->normal[2] * pVertex0->tangent[1]);
-        bitangent[1] = (pVertex0->normal[2] * pVertex0->tangent[0]) -
-                       (pVertex0->normal[0] * pVertex0->tangent[2]);
-        bitangent[2] = (pVertex0->normal[0] * pVertex0->tangent[1]) - 
-                       (pVertex0->normal[1] * pVertex0->tangent[0]);
-
-        bDotB = bitangent[0] * pVertex0->bitangent[0] + 
-                bitangent[1] * pVertex0->bitangent[1] + 
-                bitangent[2] * pVertex0->bitangent[2];
-
-        pVertex0->tangent[3] = (bDotB < 0.0f) ? 1.0f : -1.0f;
-
-        pVertex0->bitangent[0] = bitangent[0];
-        pVertex0->bitangent[1] = bitangent[1];
-        pVertex0->bitangent[2] = bitangent[2];
-    }
-
-    m_hasTangents = true;
+    return true;
 }
 
-void ModelOBJ::importGeometryFirstPass(FILE *pFile)
+bool ModelOBJ::importGeometry(const char *pData, size_t size, int numThreads)
 {
     m_hasTextureCoords = false;
     m_hasNormals = false;
@@ -801,105 +4095,50 @@ void ModelOBJ::importGeometryFirstPass(FILE *pFile)
     m_numberOfNormals = 0;
     m_numberOfTriangles = 0;
 
-    int v = 0;
-    int vt = 0;
-    int vn = 0;
-    char buffer[256] = {0};
-    std::string name;
+    // Split the file into chunks at line boundaries. Several chunks per
+    // thread keep the workers busy when record density varies over the file.
 
-    while (fscanf(pFile, "%s", buffer) != EOF)
-    {
-        switch (buffer[0])
-        {
-        case 'f':   // v, v//vn, v/vt, v/vt/vn.
-            fscanf(pFile, "%s", buffer);
+    std::vector<ImportChunk> chunks;
+    int numChunks = (numThreads == 1) ? 1 : numThreads * 4;
 
-            if (strstr(buffer, "//")) // v//vn
-            {
-                sscanf(buffer, "%d//%d", &v, &vn);
-                fscanf(pFile, "%d//%d", &v, &vn);
-                fscanf(pFile, "%d//%d", &v, &vn);
-                ++m_numberOfTriangles;
+    if (m_pImportStream)
+        numChunks = std::max(numChunks, static_cast<int>(size / STREAM_CHUNK_SIZE) + 1);
 
-                while (fscanf(pFile, "%d//%d", &v, &vn) > 0)
-                    ++m_numberOfTriangles;
-            }
-            else if (sscanf(buffer, "%d/%d/%d", &v, &vt, &vn) == 3) // v/vt/vn
-            {
-                fscanf(pFile, "%d/%d/%d", &v, &vt, &vn);
-                fscanf(pFile, "%d/%d/%d", &v, &vt, &vn);
-                ++m_numberOfTriangles;
+    const char *pEnd = pData + size;
+    const char *pChunkBegin = pData;
 
-                while (fscanf(pFile, "%d/%d/%d", &v, &vt, &vn) > 0)
-                    ++m_numberOfTriangles;
-            }
-            else if (sscanf(buffer, "%d/%d", &v, &vt) == 2) // v/vt
-            {
-                fscanf(pFile, "%d/%d", &v, &vt);
-                fscanf(pFile, "%d/%d", &v, &vt);
-                ++m_numberOfTriangles;
+    for (int i = 1; i <= numChunks && pChunkBegin < pEnd; ++i)
+    {
+        const char *pChunkEnd = (i == numChunks) ? pEnd
+            : skipLine(std::max(pChunkBegin, pData + size / numChunks * i), pEnd);
 
-                while (fscanf(pFile, "%d/%d", &v, &vt) > 0)
-                    ++m_numberOfTriangles;
-            }
-            else // v
-            {
-                fscanf(pFile, "%d", &v);
-                fscanf(pFile, "%d", &v);
-                ++m_numberOfTriangles;
+        ImportChunk chunk = ImportChunk();
+        chunk.pBegin = pChunkBegin;
+        chunk.pEnd = pChunkEnd;
+        chunks.push_back(chunk);
 
-                while (fscanf(pFile, "%d", &v) > 0)
-                    ++m_numberOfTriangles;
-            }
-            break;
+        pChunkBegin = pChunkEnd;
+    }
 
-        case 'm':   // mtllib
-            fgets(buffer, sizeof(buffer), pFile);
-            sscanf(buffer, "%s %s", buffer, buffer);
-            name = m_directoryPath;
-            name += buffer;
-            importMaterials(name.c_str());
-            break;
+    numChunks = static_cast<int>(chunks.size());
 
-        case 'v':   // v, vt, or vn
-            switch (buffer[1])
-            {
-            case '\0':
-                fgets(buffer, sizeof(buffer), pFile);
-                ++m_numberOfVertexCoords;
-                break;
+    // Pass 1: count the records of every chunk.
 
-            case 'n':
-                fgets(buffer, sizeof(buffer), pFile);
-                ++m_numberOfNormals;
-                break;
+    parallelFor(numThreads, numChunks, [&](int i) { countChunk(chunks[i]); });
 
-            case 't':
-                fgets(buffer, sizeof(buffer), pFile);
-                ++m_numberOfTextureCoords;
+    // Material libraries are loaded in file order. The material that is
+    // active at the start of each chunk is the last one selected by any of
+    // the preceding chunks.
 
-            default:
-                break;
-            }
-            break;
+    int activeMaterial = 0;
+    std::map<std::string, int>::const_iterator iter;
 
-        default:
-            fgets(buffer, sizeof(buffer), pFile);
-            break;
-        }
+    for (int i = 0; i < numChunks; ++i)
+    {
+        for (size_t j = 0; j < chunks[i].materialLibraries.size(); ++j)
+            importMaterials((m_directoryPath + chunks[i].materialLibraries[j]).c_str());
     }
 
-    m_hasPositions = m_numberOfVertexCoords > 0;
-    m_hasNormals = m_numberOfNormals > 0;
-    m_hasTextureCoords = m_numberOfTextureCoords > 0;
-
-    // Allocate memory for the OBJ model data.
-    m_vertexCoords.resize(m_numberOfVertexCoords * 3);
-    m_textureCoords.resize(m_numberOfTextureCoords * 2);
-    m_normals.resize(m_numberOfNormals * 3);
-    m_indexBuffer.resize(m_numberOfTriangles * 3);
-    m_attributeBuffer.resize(m_numberOfTriangles);
-
     // Define a default material if no materials were loaded.
     if (m_numberOfMaterials == 0)
     {
@@ -918,203 +4157,341 @@ void ModelOBJ::importGeometryFirstPass(FILE *pFile)
         m_materials.push_back(defaultMaterial);
         m_materialCache[defaultMaterial.name] = 0;
     }
-}
 
-void ModelOBJ::importGeometrySecondPass(FILE *pFile)
-{
-    int v[3] = {0};
-    int vt[3] = {0};
-    int vn[3] = {0};
-    int numVertices = 0;
-    int numTexCoords = 0;
-    int numNormals = 0;
-    int numTriangles = 0;
-    int activeMaterial = 0;
-    char buffer[256] = {0};
-    std::string name;
-    std::map<std::string, int>::const_iterator iter;
+    if (m_pImportStream)
+    {
+        std::lock_guard<std::mutex> lock(m_pImportStream->mutex);
+        m_pImportStream->materials = m_materials;
+    }
 
-    while (fscanf(pFile, "%s", buffer) != EOF)
+    for (int i = 0; i < numChunks; ++i)
     {
-        switch (buffer[0])
+        ImportChunk &chunk = chunks[i];
+
+        chunk.firstVertexCoord = m_numberOfVertexCoords;
+        chunk.firstTextureCoord = m_numberOfTextureCoords;
+        chunk.firstNormal = m_numberOfNormals;
+        chunk.initialMaterial = activeMaterial;
+
+        m_numberOfVertexCoords += chunk.numVertexCoords;
+        m_numberOfTextureCoords += chunk.numTextureCoords;
+        m_numberOfNormals += chunk.numNormals;
+
+        if (chunk.hasMaterial)
         {
-        case 'f': // v, v//vn, v/vt, or v/vt/vn.
-            v[0]  = v[1]  = v[2]  = 0;
-            vt[0] = vt[1] = vt[2] = 0;
-            vn[0] = vn[1] = vn[2] = 0;
+            iter = m_materialCache.find(chunk.lastMaterial);
+            activeMaterial = (iter == m_materialCache.end()) ? 0 : iter->second;
+        }
+    }
 
-            fscanf(pFile, "%s", buffer);
+    // Pass 2: parse the chunks. Vertex data is written straight into its
+    // final place, faces are collected per chunk with global indices.
+    // Triangles are then built in file order so that vertex welding
+    // produces the same vertex buffer no matter how many threads were used.
+    // An incremental import works through the chunks numThreads at a time
+    // and publishes the triangles of every group of chunks.
 
-            if (strstr(buffer, "//")) // v//vn
-            {
-                sscanf(buffer, "%d//%d", &v[0], &vn[0]);
-                fscanf(pFile, "%d//%d", &v[1], &vn[1]);
-                fscanf(pFile, "%d//%d", &v[2], &vn[2]);
+    m_vertexCoords.resize(m_numberOfVertexCoords * 3);
+    m_textureCoords.resize(m_numberOfTextureCoords * 2);
+    m_normals.resize(m_numberOfNormals * 3);
 
-                v[0] = (v[0] < 0) ? v[0] + numVertices - 1 : v[0] - 1;
-                v[1] = (v[1] < 0) ? v[1] + numVertices - 1 : v[1] - 1;
-                v[2] = (v[2] < 0) ? v[2] + numVertices - 1 : v[2] - 1;
+    // Most exporters emit roughly one unique vertex per attribute record,
+    // which makes the largest attribute count a good first guess.
 
-                vn[0] = (vn[0] < 0) ? vn[0] + numNormals - 1 : vn[0] - 1;
-                vn[1] = (vn[1] < 0) ? vn[1] + numNormals - 1 : vn[1] - 1;
-                vn[2] = (vn[2] < 0) ? vn[2] + numNormals - 1 : vn[2] - 1;
+    int expectedVertices = std::max(m_numberOfVertexCoords,
+        std::max(m_numberOfTextureCoords, m_numberOfNormals));
 
-                addTrianglePosNormal(numTriangles++, activeMaterial,
-                    v[0], v[1], v[2], vn[0], vn[1], vn[2]);
+    m_vertexCacheSize = 0;
+    m_vertexCache.clear();
+    reserveVertexCache(expectedVertices);
+    m_vertexBuffer.reserve(expectedVertices);
 
-                v[1] = v[2];
-                vn[1] = vn[2];
+    int groupSize = m_pImportStream ? numThreads : numChunks;
+    int numTriangles = 0;
 
-                while (fscanf(pFile, "%d//%d", &v[2], &vn[2]) > 0)
-                {
-                    v[2] = (v[2] < 0) ? v[2] + numVertices - 1 : v[2] - 1;
-                    vn[2] = (vn[2] < 0) ? vn[2] + numNormals - 1 : vn[2] - 1;
+    for (int first = 0; first < numChunks; first += groupSize)
+    {
+        int last = std::min(first + groupSize, numChunks);
+        int groupTriangles = 0;
+
+        parallelFor(numThreads, last - first, [&](int i) { parseChunk(chunks[first + i]); });
+
+        for (int i = first; i < last; ++i)
+            groupTriangles += static_cast<int>(chunks[i].triangles.size());
 
-                    addTrianglePosNormal(numTriangles++, activeMaterial,
-                        v[0], v[1], v[2], vn[0], vn[1], vn[2]);
+        m_indexBuffer.resize((numTriangles + groupTriangles) * 3);
+        m_attributeBuffer.resize(numTriangles + groupTriangles);
+
+        for (int i = first; i < last; ++i)
+        {
+            const std::vector<ImportTriangle> &triangles = chunks[i].triangles;
+
+            for (size_t j = 0; j < triangles.size(); ++j)
+            {
+                const ImportTriangle &t = triangles[j];
 
-                    v[1] = v[2];
-                    vn[1] = vn[2];
+                switch (t.layout)
+                {
+                case FACE_POS_NORMAL:
+                    addTrianglePosNormal(numTriangles++, t.material,
+                        t.v[0], t.v[1], t.v[2], t.vn[0], t.vn[1], t.vn[2]);
+                    break;
+
+                case FACE_POS_TEXCOORD_NORMAL:
+                    addTrianglePosTexCoordNormal(numTriangles++, t.material,
+                        t.v[0], t.v[1], t.v[2], t.vt[0], t.vt[1], t.vt[2],
+                        t.vn[0], t.vn[1], t.vn[2]);
+                    break;
+
+                case FACE_POS_TEXCOORD:
+                    addTrianglePosTexCoord(numTriangles++, t.material,
+                        t.v[0], t.v[1], t.v[2], t.vt[0], t.vt[1], t.vt[2]);
+                    break;
+
+                default:
+                    addTrianglePos(numTriangles++, t.material, t.v[0], t.v[1], t.v[2]);
+                    break;
                 }
             }
-            else if (sscanf(buffer, "%d/%d/%d", &v[0], &vt[0], &vn[0]) == 3) // v/vt/vn
-            {
-                fscanf(pFile, "%d/%d/%d", &v[1], &vt[1], &vn[1]);
-                fscanf(pFile, "%d/%d/%d", &v[2], &vt[2], &vn[2]);
 
-                v[0] = (v[0] < 0) ? v[0] + numVertices - 1 : v[0] - 1;
-                v[1] = (v[1] < 0) ? v[1] + numVertices - 1 : v[1] - 1;
-                v[2] = (v[2] < 0) ? v[2] + numVertices - 1 : v[2] - 1;
+            std::vector<ImportTriangle>().swap(chunks[i].triangles);
+        }
 
-                vt[0] = (vt[0] < 0) ? vt[0] + numTexCoords - 1 : vt[0] - 1;
-                vt[1] = (vt[1] < 0) ? vt[1] + numTexCoords - 1 : vt[1] - 1;
-                vt[2] = (vt[2] < 0) ? vt[2] + numTexCoords - 1 : vt[2] - 1;
+        if (m_pImportStream)
+        {
+            ImportStream &stream = *m_pImportStream;
+            float progress = static_cast<float>(chunks[last - 1].pEnd - pData) / size;
 
-                vn[0] = (vn[0] < 0) ? vn[0] + numNormals - 1 : vn[0] - 1;
-                vn[1] = (vn[1] < 0) ? vn[1] + numNormals - 1 : vn[1] - 1;
-                vn[2] = (vn[2] < 0) ? vn[2] + numNormals - 1 : vn[2] - 1;
+            publishBatches(numTriangles);
 
-                addTrianglePosTexCoordNormal(numTriangles++, activeMaterial,
-                    v[0], v[1], v[2], vt[0], vt[1], vt[2], vn[0], vn[1], vn[2]);
+            if (stream.pCallback && !stream.pCallback(progress, stream.pUserData))
+                stream.cancelled = true;
 
-                v[1] = v[2];
-                vt[1] = vt[2];
-                vn[1] = vn[2];
+            if (stream.cancelled)
+                return false;
+        }
+    }
 
-                while (fscanf(pFile, "%d/%d/%d", &v[2], &vt[2], &vn[2]) > 0)
-                {
-                    v[2] = (v[2] < 0) ? v[2] + numVertices - 1 : v[2] - 1;
-                    vt[2] = (vt[2] < 0) ? vt[2] + numTexCoords - 1 : vt[2] - 1;
-                    vn[2] = (vn[2] < 0) ? vn[2] + numNormals - 1 : vn[2] - 1;
+    m_numberOfTriangles = numTriangles;
 
-                    addTrianglePosTexCoordNormal(numTriangles++, activeMaterial,
-                        v[0], v[1], v[2], vt[0], vt[1], vt[2], vn[0], vn[1], vn[2]);
+    // The cache is only needed while welding.
+    std::vector<VertexCacheEntry>().swap(m_vertexCache);
+    m_vertexCacheSize = 0;
 
-                    v[1] = v[2];
-                    vt[1] = vt[2];
-                    vn[1] = vn[2];
-                }
-            }
-            else if (sscanf(buffer, "%d/%d", &v[0], &vt[0]) == 2) // v/vt
-            {
-                fscanf(pFile, "%d/%d", &v[1], &vt[1]);
-                fscanf(pFile, "%d/%d", &v[2], &vt[2]);
+    m_hasPositions = m_numberOfVertexCoords > 0;
+    m_hasNormals = m_numberOfNormals > 0;
+    m_hasTextureCoords = m_numberOfTextureCoords > 0;
 
-                v[0] = (v[0] < 0) ? v[0] + numVertices - 1 : v[0] - 1;
-                v[1] = (v[1] < 0) ? v[1] + numVertices - 1 : v[1] - 1;
-                v[2] = (v[2] < 0) ? v[2] + numVertices - 1 : v[2] - 1;
+    return true;
+}
 
-                vt[0] = (vt[0] < 0) ? vt[0] + numTexCoords - 1 : vt[0] - 1;
-                vt[1] = (vt[1] < 0) ? vt[1] + numTexCoords - 1 : vt[1] - 1;
-                vt[2] = (vt[2] < 0) ? vt[2] + numTexCoords - 1 : vt[2] - 1;
+void ModelOBJ::countChunk(ImportChunk &chunk) const
+{
+    const char *p = chunk.pBegin;
+    const char *pEnd = chunk.pEnd;
 
-                addTrianglePosTexCoord(numTriangles++, activeMaterial,
-                    v[0], v[1], v[2], vt[0], vt[1], vt[2]);
+    chunk.numVertexCoords = 0;
+    chunk.numTextureCoords = 0;
+    chunk.numNormals = 0;
+    chunk.hasMaterial = false;
 
-                v[1] = v[2];
-                vt[1] = vt[2];
+    while (p < pEnd)
+    {
+        p = skipSpaces(p, pEnd);
 
-                while (fscanf(pFile, "%d/%d", &v[2], &vt[2]) > 0)
-                {
-                    v[2] = (v[2] < 0) ? v[2] + numVertices - 1 : v[2] - 1;
-                    vt[2] = (vt[2] < 0) ? vt[2] + numTexCoords - 1 : vt[2] - 1;
+        const char *pKeyword = p;
+        p = skipToken(p, pEnd);
+        size_t keywordLength = static_cast<size_t>(p - pKeyword);
+
+        if (keywordLength == 1 && pKeyword[0] == 'v')
+        {
+            ++chunk.numVertexCoords;
+        }
+        else if (keywordLength == 2 && pKeyword[0] == 'v')
+        {
+            if (pKeyword[1] == 't')
+                ++chunk.numTextureCoords;
+            else if (pKeyword[1] == 'n')
+                ++chunk.numNormals;
+        }
+        else if (matchKeyword(pKeyword, keywordLength, "usemtl"))
+        {
+            p = parseName(skipSpaces(p, pEnd), pEnd, chunk.lastMaterial);
+            chunk.hasMaterial = true;
+        }
+        else if (matchKeyword(pKeyword, keywordLength, "mtllib"))
+        {
+            std::string name;
+
+            p = parseName(skipSpaces(p, pEnd), pEnd, name);
+            chunk.materialLibraries.push_back(name);
+        }
 
-                    addTrianglePosTexCoord(numTriangles++, activeMaterial,
-                        v[0], v[1], v[2], vt[0], vt[1], vt[2]);
+        p = skipLine(p, pEnd);
+    }
+}
 
-                    v[1] = v[2];
-                    vt[1] = vt[2];
-                }
-            }
-            else // v
+void ModelOBJ::parseChunk(ImportChunk &chunk)
+{
+    const char *p = chunk.pBegin;
+    const char *pEnd = chunk.pEnd;
+    float *pVertexCoords = m_vertexCoords.empty() ? 0 : &m_vertexCoords[0];
+    float *pTextureCoords = m_textureCoords.empty() ? 0 : &m_textureCoords[0];
+    float *pNormals = m_normals.empty() ? 0 : &m_normals[0];
+    int numVertexCoords = chunk.firstVertexCoord;
+    int numTextureCoords = chunk.firstTextureCoord;
+    int numNormals = chunk.firstNormal;
+    int activeMaterial = chunk.initialMaterial;
+    ImportTriangle triangle;
+    std::string name;
+    std::map<std::string, int>::const_iterator iter;
+
+    // A little under one triangle per 40 bytes is typical for SketchUp and
+    // Blender exports.
+    chunk.triangles.reserve(static_cast<size_t>(pEnd - p) / 40);
+
+    while (p < pEnd)
+    {
+        p = skipSpaces(p, pEnd);
+
+        const char *pKeyword = p;
+        p = skipToken(p, pEnd);
+        size_t keywordLength = static_cast<size_t>(p - pKeyword);
+
+        if (keywordLength == 1 && pKeyword[0] == 'v') // v
+        {
+            float *pXYZ = &pVertexCoords[3 * numVertexCoords++];
+
+            p = parseFloat(skipSpaces(p, pEnd), pEnd, pXYZ[0]);
+            p = parseFloat(skipSpaces(p, pEnd), pEnd, pXYZ[1]);
+            p = parseFloat(skipSpaces(p, pEnd), pEnd, pXYZ[2]);
+        }
+        else if (keywordLength == 2 && pKeyword[0] == 'v' && pKeyword[1] == 't') // vt
+        {
+            float *pUV = &pTextureCoords[2 * numTextureCoords++];
+
+            p = parseFloat(skipSpaces(p, pEnd), pEnd, pUV[0]);
+            p = parseFloat(skipSpaces(p, pEnd), pEnd, pUV[1]);
+        }
+        else if (keywordLength == 2 && pKeyword[0] == 'v' && pKeyword[1] == 'n') // vn
+        {
+            float *pXYZ = &pNormals[3 * numNormals++];
+
+            p = parseFloat(skipSpaces(p, pEnd), pEnd, pXYZ[0]);
+            p = parseFloat(skipSpaces(p, pEnd), pEnd, pXYZ[1]);
+            p = parseFloat(skipSpaces(p, pEnd), pEnd, pXYZ[2]);
+        }
+        else if (keywordLength == 1 && pKeyword[0] == 'f') // v, v//vn, v/vt, or v/vt/vn.
+        {
+            // The layout of the first vertex decides the layout of the whole
+            // face. The face is triangulated as a fan around that vertex.
+
+            int *v = triangle.v;
+            int *vt = triangle.vt;
+            int *vn = triangle.vn;
+            int numFaceVertices = 0;
+
+            triangle.material = activeMaterial;
+            triangle.layout = FACE_NONE;
+
+            while (true)
             {
-                sscanf(buffer, "%d", &v[0]);
-                fscanf(pFile, "%d", &v[1]);
-                fscanf(pFile, "%d", &v[2]);
+                p = skipSpaces(p, pEnd);
 
-                v[0] = (v[0] < 0) ? v[0] + numVertices - 1 : v[0] - 1;
-                v[1] = (v[1] < 0) ? v[1] + numVertices - 1 : v[1] - 1;
-                v[2] = (v[2] < 0) ? v[2] + numVertices - 1 : v[2] - 1;
+                if (p == pEnd || isEndOfLine(*p) || *p == '#')
+                    break;
 
-                addTrianglePos(numTriangles++, activeMaterial, v[0], v[1], v[2]);
+                int slot = (numFaceVertices < 2) ? numFaceVertices : 2;
+                int vertexLayout = FACE_NONE;
 
-                v[1] = v[2];
+                p = parseFaceVertex(p, pEnd, v[slot], vt[slot], vn[slot], vertexLayout);
 
-                while (fscanf(pFile, "%d", &v[2]) > 0)
-                {
-                    v[2] = (v[2] < 0) ? v[2] + numVertices - 1 : v[2] - 1;
+                if (vertexLayout == FACE_NONE)
+                    break;
+
+                if (numFaceVertices == 0)
+                    triangle.layout = vertexLayout;
+
+                v[slot] = resolveIndex(v[slot], numVertexCoords);
+                vt[slot] = resolveIndex(vt[slot], numTextureCoords);
+                vn[slot] = resolveIndex(vn[slot], numNormals);
+
+                if (++numFaceVertices < 3)
+                    continue;
+
+                // Skip triangles that reference vertex data that isn't there.
 
-                    addTrianglePos(numTriangles++, activeMaterial, v[0], v[1], v[2]);
+                int layout = triangle.layout;
+                bool hasTexCoords = (layout == FACE_POS_TEXCOORD || layout == FACE_POS_TEXCOORD_NORMAL);
+                bool hasNormals = (layout == FACE_POS_NORMAL || layout == FACE_POS_TEXCOORD_NORMAL);
 
-                    v[1] = v[2];
+                if (isValidTriangle(v, numVertexCoords)
+                    && (!hasTexCoords || isValidTriangle(vt, numTextureCoords))
+                    && (!hasNormals || isValidTriangle(vn, numNormals)))
+                {
+                    chunk.triangles.push_back(triangle);
                 }
-            }
-            break;
 
-        case 'u': // usemtl
-            fgets(buffer, sizeof(buffer), pFile);
-            sscanf(buffer, "%s %s", buffer, buffer);
-            name = buffer;
-            iter = m_materialCache.find(buffer);
+                v[1] = v[2];
+                vt[1] = vt[2];
+                vn[1] = vn[2];
+            }
+        }
+        else if (matchKeyword(pKeyword, keywordLength, "usemtl"))
+        {
+            p = parseName(skipSpaces(p, pEnd), pEnd, name);
+            iter = m_materialCache.find(name);
             activeMaterial = (iter == m_materialCache.end()) ? 0 : iter->second;
-            break;
+        }
 
-        case 'v': // v, vn, or vt.
-            switch (buffer[1])
-            {
-            case '\0': // v
-                fscanf(pFile, "%f %f %f",
-                    &m_vertexCoords[3 * numVertices],
-                    &m_vertexCoords[3 * numVertices + 1],
-                    &m_vertexCoords[3 * numVertices + 2]);
-                ++numVertices;
-                break;
+        p = skipLine(p, pEnd);
+    }
+}
 
-            case 'n': // vn
-                fscanf(pFile, "%f %f %f",
-                    &m_normals[3 * numNormals],
-                    &m_normals[3 * numNormals + 1],
-                    &m_normals[3 * numNormals + 2]);
-                ++numNormals;
-                break;
+void ModelOBJ::publishBatches(int numTriangles)
+{
+    // Split the new triangles into runs of the same material. Vertices are
+    // appended in order of first use, so the vertices new to a run are the
+    // ones past the highest index of all earlier runs.
 
-            case 't': // vt
-                fscanf(pFile, "%f %f",
-                    &m_textureCoords[2 * numTexCoords],
-                    &m_textureCoords[2 * numTexCoords + 1]);
-                ++numTexCoords;
-                break;
+    ImportStream &stream = *m_pImportStream;
+    std::vector<Batch> batches;
+    int start = stream.publishedTriangles;
 
-            default:
-                break;
-            }
-            break;
+    while (start < numTriangles)
+    {
+        int material = m_attributeBuffer[start];
+        int end = start + 1;
 
-        default:
-            fgets(buffer, sizeof(buffer), pFile);
-            break;
-        }
+        while (end < numTriangles && m_attributeBuffer[end] == material)
+            ++end;
+
+        Batch batch;
+        int vertexEnd = stream.publishedVertices;
+
+        batch.material = material;
+        batch.startIndex = start * 3;
+        batch.triangleCount = end - start;
+        batch.firstVertex = stream.publishedVertices;
+        batch.indices.assign(m_indexBuffer.begin() + start * 3, m_indexBuffer.begin() + end * 3);
+
+        for (size_t i = 0; i < batch.indices.size(); ++i)
+            vertexEnd = std::max(vertexEnd, batch.indices[i] + 1);
+
+        batch.vertices.assign(m_vertexBuffer.begin() + batch.firstVertex,
+            m_vertexBuffer.begin() + vertexEnd);
+
+        stream.publishedVertices = vertexEnd;
+        batches.push_back(std::move(batch));
+        start = end;
     }
+
+    stream.publishedTriangles = numTriangles;
+
+    std::lock_guard<std::mutex> lock(stream.mutex);
+
+    for (size_t i = 0; i < batches.size(); ++i)
+        stream.batches.push_back(std::move(batches[i]));
 }
 
 bool ModelOBJ::importMaterials(const char *pszFilename)
@@ -1281,6 +4658,7 @@ bool ModelOBJ::importMaterials(const char *pszFilename)
     }
 
     fclose(pFile);
+    m_materialLibraries.push_back(pszFilename);
     return true;
 }
 
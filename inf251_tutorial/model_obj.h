@@ -76,14 +76,285 @@ public:
         const Material *pMaterial;
     };
 
+    //-------------------------------------------------------------------------
+    // Compact vertex layouts.
+    //
+    // A VertexFormat describes which attributes packVertices() emits and how
+    // each of them is encoded. The per attribute offsets, component counts
+    // and types map 1:1 onto glVertexAttribPointer/glVertexAttribIPointer.
+    //
+    // ENCODING_UNORM16 positions are quantized to the model bounds and must
+    // be expanded with positionBias + positionScale * attribute, e.g. by
+    // folding a translation and scaling into the model matrix.
+    //
+    // ENCODING_OCTAHEDRAL normals are two normalized shorts in octahedral
+    // mapping. Tangents are two integer shorts: x holds the octahedral x in
+    // its upper 15 bits and the handedness (1 = negative w) in bit 0, y
+    // holds the octahedral y. To decode in GLSL:
+    //
+    //   vec3 octDecode(vec2 e)
+    //   {
+    //       vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    //       if (n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * sign(n.xy);
+    //       return normalize(n);
+    //   }
+    //
+    //   tangent.xyz = octDecode(vec2(t.x >> 1, t.y) / vec2(16383.0, 32767.0));
+    //   tangent.w = ((t.x & 1) != 0) ? -1.0 : 1.0;
+    //-------------------------------------------------------------------------
+
+    enum VertexAttribute
+    {
+        ATTRIBUTE_POSITION,
+        ATTRIBUTE_TEXCOORD,
+        ATTRIBUTE_NORMAL,
+        ATTRIBUTE_TANGENT,
+        NUMBER_OF_ATTRIBUTES
+    };
+
+    enum AttributeEncoding
+    {
+        ENCODING_NONE,          // attribute is not emitted
+        ENCODING_FLOAT,         // 32-bit floats, tangents include w
+        ENCODING_HALF,          // 16-bit floats (texture coordinates)
+        ENCODING_UNORM16,       // 16-bit quantized positions, see above
+        ENCODING_OCTAHEDRAL     // 2 x 16 bits (normals and tangents)
+    };
+
+    enum ComponentType
+    {
+        COMPONENT_FLOAT,
+        COMPONENT_HALF_FLOAT,
+        COMPONENT_SHORT,
+        COMPONENT_UNSIGNED_SHORT
+    };
+
+    struct VertexAttributeFormat
+    {
+        AttributeEncoding encoding;
+        int components;
+        ComponentType type;
+        bool normalized;
+        bool integer;           // use glVertexAttribIPointer
+        int offset;
+    };
+
+    struct VertexFormat
+    {
+        VertexAttributeFormat attributes[NUMBER_OF_ATTRIBUTES];
+        int stride;
+        float positionBias[3];
+        float positionScale[3];
+    };
+
+    // A range of 16-bit indices from packIndices(), covering the meshes
+    // [firstMesh, firstMesh + numberOfMeshes). startIndex is the offset of
+    // the range in the packed index buffer. Its indices are relative to
+    // baseVertex, e.g. for glDrawElementsBaseVertex().
+    struct IndexRange
+    {
+        int firstMesh;
+        int numberOfMeshes;
+        int startIndex;
+        int indexCount;
+        int baseVertex;
+    };
+
+    //-------------------------------------------------------------------------
+    // Meshlets.
+    //
+    // buildMeshlets() splits the triangles of a mesh into small spatially
+    // coherent clusters for culling and streaming. Each meshlet references
+    // up to vertexCount entries of MeshletBuffer::vertices, starting at
+    // vertexOffset, which hold indices into the model's vertex buffer. Its
+    // triangles are triangleCount triples of local (8-bit) indices into that
+    // list, starting at MeshletBuffer::triangles[triangleOffset * 3].
+    //
+    // The bounding sphere encloses all meshlet vertices. The normal cone
+    // allows backface culling of the whole meshlet: it faces away from a
+    // camera at position eye if
+    //
+    //   dot(normalize(coneApex - eye), coneAxis) >= coneCutoff
+    //
+    // A coneCutoff above 1 means the triangles face too many directions for
+    // the meshlet to ever be culled that way.
+    //-------------------------------------------------------------------------
+
+    struct Meshlet
+    {
+        int vertexOffset;
+        int triangleOffset;
+        int vertexCount;
+        int triangleCount;
+        float center[3];
+        float radius;
+        float coneApex[3];
+        float coneAxis[3];
+        float coneCutoff;
+    };
+
+    struct MeshletBuffer
+    {
+        std::vector<Meshlet> meshlets;
+        std::vector<int> vertices;
+        std::vector<unsigned char> triangles;
+    };
+
+    //-------------------------------------------------------------------------
+    // Levels of detail.
+    //
+    // generateLods() simplifies every mesh into a chain of coarser index
+    // buffers by collapsing edges in order of their quadric error. Each
+    // level is simplified from the one before it and indexes the model's
+    // vertex buffer, so all levels draw with the same vertices. Vertices on
+    // material boundaries are never moved, and UV and normal seams are only
+    // collapsed along the seam, so no cracks open between meshes or charts.
+    //
+    // error estimates how far (in model units) a level deviates from the
+    // full mesh. A renderer picks a level by projecting it to screen space,
+    // e.g. with a perspective projection:
+    //
+    //   maxError = pixels * distance * 2 * tan(fovy / 2) / viewportHeight
+    //-------------------------------------------------------------------------
+
+    struct LevelOfDetail
+    {
+        int startIndex;         // offset into the LOD index buffer
+        int triangleCount;
+        float error;
+    };
+
+    struct VertexCacheStatistics
+    {
+        float acmr;             // cache misses per triangle, 0.5 is ideal
+        float atvr;             // cache misses per vertex, 1.0 is ideal
+    };
+
+    //-------------------------------------------------------------------------
+    // Incremental import.
+    //
+    // beginImport() returns right away and imports the model on a worker
+    // thread. Whenever a part of the OBJ file has been parsed, its triangles
+    // are published as batches, one for each run of triangles that share a
+    // material. pollBatch() hands them out in file order, e.g. once per
+    // frame from the main loop, so partial geometry can be drawn while the
+    // rest streams in. A model loaded from the binary cache publishes one
+    // batch per mesh right away.
+    //
+    // A batch carries copies of its indices and of the vertices it uses for
+    // the first time. The indices refer to the whole vertex buffer: appending
+    // the vertices of every batch at firstVertex rebuilds the vertex buffer
+    // as it is before normals, tangents and optimize() are applied.
+    //
+    // pollMaterial() hands out the materials in index order as soon as the
+    // material libraries have been loaded, which is before the first batch
+    // is published, so that textures can be loaded while the geometry is
+    // still being parsed.
+    //
+    // The callback runs on the worker thread with the fraction of the file
+    // processed so far. Returning false cancels the import. endImport()
+    // waits for the worker and returns whether the model was imported. No
+    // other method of the model may be called until then.
+    //-------------------------------------------------------------------------
+
+    enum ImportStatus
+    {
+        IMPORT_IDLE,
+        IMPORT_RUNNING,
+        IMPORT_FINISHED,
+        IMPORT_CANCELLED,
+        IMPORT_FAILED
+    };
+
+    typedef bool (*ImportCallback)(float progress, void *pUserData);
+
+    struct Batch
+    {
+        int material;
+        int startIndex;         // offset of the batch in the import order
+        int triangleCount;
+        int firstVertex;
+        std::vector<Vertex> vertices;
+        std::vector<int> indices;
+    };
+
     ModelOBJ();
     ~ModelOBJ();
 
     void destroy();
-    bool import(const char *pszFilename, bool rebuildNormals = false);
+    // numThreads > 1 parses the OBJ file and generates normals and tangents
+    // on that many threads, 0 uses every hardware thread. The result is
+    // identical for any count.
+    bool import(const char *pszFilename, bool rebuildNormals = false, int numThreads = 1);
+    void beginImport(const char *pszFilename, bool rebuildNormals = false,
+        int numThreads = 1, ImportCallback pCallback = 0, void *pUserData = 0);
+    bool pollBatch(Batch &batch);
+    bool pollMaterial(Material &material);
+    ImportStatus getImportStatus() const;
+    void cancelImport();
+    bool endImport();
     void normalize(float scaleTo = 1.0f, bool center = true);
     void reverseWinding();
 
+    // When enabled (the default) import() writes the finished model to a
+    // versioned binary <file>.cache next to the OBJ file. Later imports map
+    // that file and use its vertex and index buffers in place as long as
+    // the OBJ and MTL files haven't changed.
+    void setBinaryCacheEnabled(bool enable);
+    bool isBinaryCacheEnabled() const;
+    bool isLoadedFromCache() const;
+
+    // Builds a vertex format. Returns false if an encoding isn't supported
+    // for its attribute (e.g. ENCODING_HALF normals).
+    static bool createVertexFormat(VertexFormat &format,
+        AttributeEncoding position, AttributeEncoding texCoord,
+        AttributeEncoding normal = ENCODING_NONE,
+        AttributeEncoding tangent = ENCODING_NONE);
+
+    // Packs the vertex buffer into format.stride sized vertices and fills in
+    // the position dequantization parameters of the format.
+    void packVertices(VertexFormat &format, std::vector<unsigned char> &buffer) const;
+
+    // Packs the index buffer into 16-bit indices, mesh by mesh. Every mesh
+    // is split into ranges whose vertices lie within 65536 of the range's
+    // base vertex. With mergeMeshes consecutive meshes share ranges while
+    // they fit, for renderers that draw several meshes with the same state.
+    // Returns false if a single triangle spans more than that many
+    // vertices, in which case the 32-bit index buffer has to be used.
+    bool packIndices(std::vector<unsigned short> &indices,
+        std::vector<IndexRange> &ranges, bool mergeMeshes = false) const;
+
+    // Appends the meshlets of a mesh to buffer. maxVertices is capped at 256
+    // so that local indices fit into a byte.
+    void buildMeshlets(const Mesh &mesh, MeshletBuffer &buffer,
+        int maxVertices = 64, int maxTriangles = 124) const;
+    static bool saveMeshlets(const char *pszFilename, const MeshletBuffer &buffer);
+    static bool loadMeshlets(const char *pszFilename, MeshletBuffer &buffer);
+
+    // Reorders the triangles of every mesh for the post-transform vertex
+    // cache and then for overdraw, and renumbers the vertices in order of
+    // first use. overdrawThreshold is the factor by which the ACMR of a
+    // triangle cluster may exceed the mesh ACMR when the mesh is cut into
+    // clusters for the overdraw order. A mesh keeps its overdraw order only
+    // if that doesn't raise its ACMR. 0 keeps the pure vertex cache order.
+    void optimize(float overdrawThreshold = 0.0f);
+    void setOptimizeOnImport(bool enable);
+
+    // Builds up to maxLevels levels per mesh, each with about reductionRatio
+    // times the triangles of the level before it. The chain ends early when
+    // a mesh can't be simplified any further. optimize() and destroy()
+    // discard the levels. With setLodsOnImport() import() generates them
+    // with the default arguments and keeps them in the binary cache.
+    void generateLods(int maxLevels = 8, float reductionRatio = 0.5f);
+    void setLodsOnImport(bool enable);
+
+    // Returns the coarsest level of a mesh whose error is at most maxError,
+    // or -1 if only the full mesh is accurate enough.
+    int selectLod(int mesh, float maxError) const;
+
+    // Simulates a FIFO post-transform vertex cache over the index buffer.
+    VertexCacheStatistics analyzeVertexCache(int cacheSize = 16) const;
+
     // Getter methods.
 
     void getCenter(float &x, float &y, float &z) const;
@@ -95,10 +366,14 @@ public:
     const int *getIndexBuffer() const;
     int getIndexSize() const;
 
+    const int *getLodIndexBuffer() const;
+    const LevelOfDetail &getLod(int mesh, int level) const;
     const Material &getMaterial(int i) const;
     const Mesh &getMesh(int i) const;
 
     int getNumberOfIndices() const;
+    int getNumberOfLodIndices() const;
+    int getNumberOfLods(int mesh) const;
     int getNumberOfMaterials() const;
     int getNumberOfMeshes() const;
     int getNumberOfTriangles() const;
@@ -116,6 +391,45 @@ public:
     bool hasTextureCoords() const;
 
 private:
+    class MappedFile;
+    struct ImportStream;
+
+    struct VertexCacheEntry
+    {
+        int v;
+        int vt;
+        int vn;
+        int index;              // -1 marks an empty slot
+    };
+
+    struct ImportTriangle
+    {
+        int material;
+        int layout;
+        int v[3];
+        int vt[3];
+        int vn[3];
+    };
+
+    struct ImportChunk
+    {
+        const char *pBegin;
+        const char *pEnd;
+
+        int numVertexCoords;
+        int numTextureCoords;
+        int numNormals;
+        int firstVertexCoord;
+        int firstTextureCoord;
+        int firstNormal;
+        int initialMaterial;
+
+        bool hasMaterial;
+        std::string lastMaterial;
+        std::vector<std::string> materialLibraries;
+        std::vector<ImportTriangle> triangles;
+    };
+
     void addTrianglePos(int index, int material,
         int v0, int v1, int v2);
     void addTrianglePosNormal(int index, int material,
@@ -128,16 +442,33 @@ private:
         int v0, int v1, int v2,
         int vt0, int vt1, int vt2,
         int vn0, int vn1, int vn2);
-    int addVertex(int hash, const Vertex *pVertex);
+    int addVertex(int v, int vt, int vn, const Vertex *pVertex);
     void bounds(float center[3], float &width, float &height,
         float &length, float &radius) const;
+    void boundMeshlet(Meshlet &meshlet, const MeshletBuffer &buffer) const;
     void buildMeshes();
-    void generateNormals();
-    void generateTangents();
-    void importGeometryFirstPass(FILE *pFile);
-    void importGeometrySecondPass(FILE *pFile);
+    bool exportCache(const char *pszCacheFilename, const char *pszFilename,
+        bool rebuildNormals, unsigned long long sourceHash) const;
+    void generateNormals(int numThreads = 1);
+    void generateTangents(int numThreads = 1);
+    void countChunk(ImportChunk &chunk) const;
+    void parseChunk(ImportChunk &chunk);
+    void reserveVertexCache(int numVertices);
+    bool importCache(const char *pszCacheFilename, const char *pszFilename,
+        bool rebuildNormals);
+    bool importFile(const char *pszFilename, bool rebuildNormals, int numThreads);
+    bool importGeometry(const char *pData, size_t size, int numThreads);
     bool importMaterials(const char *pszFilename);
+    void optimizeOverdraw(int *pIndices, int triangleCount, float threshold,
+        std::vector<int> &cacheTime) const;
+    void optimizeVertexCache(int *pIndices, int triangleCount,
+        std::vector<int> &localIndex) const;
+    void optimizeVertexFetch();
+    void publishBatches(int numTriangles);
     void scale(float scaleFactor, float offset[3]);
+    void simplifyMesh(int mesh, int maxLevels, float reductionRatio,
+        const std::vector<int> &positionIds, const std::vector<int> &positionMeshes,
+        std::vector<int> &localIndex, std::vector<int> &localPosition);
 
     bool m_hasPositions;
     bool m_hasTextureCoords;
@@ -150,6 +481,8 @@ private:
     int m_numberOfTriangles;
     int m_numberOfMaterials;
     int m_numberOfMeshes;
+    int m_numberOfVertices;
+    int m_numberOfLodIndices;
 
     float m_center[3];
     float m_width;
@@ -158,18 +491,35 @@ private:
     float m_radius;
 
     std::string m_directoryPath;
+    std::vector<std::string> m_materialLibraries;
+
+    // The vertex and index buffers used after import. They point either
+    // into m_vertexBuffer/m_indexBuffer or into the mapped binary cache.
+    Vertex *m_pVertices;
+    int *m_pIndices;
+    int *m_pLodIndices;
+
+    bool m_binaryCacheEnabled;
+    bool m_optimizeOnImport;
+    bool m_lodsOnImport;
+    MappedFile *m_pCacheFile;
+    ImportStream *m_pImportStream;
 
     std::vector<Mesh> m_meshes;
     std::vector<Material> m_materials;
     std::vector<Vertex> m_vertexBuffer;
     std::vector<int> m_indexBuffer;
     std::vector<int> m_attributeBuffer;
+    std::vector<LevelOfDetail> m_lods;
+    std::vector<int> m_lodOffsets;
+    std::vector<int> m_lodIndexBuffer;
     std::vector<float> m_vertexCoords;
     std::vector<float> m_textureCoords;
     std::vector<float> m_normals;
 
     std::map<std::string, int> m_materialCache;
-    std::map<int, std::vector<int> > m_vertexCache;
+    std::vector<VertexCacheEntry> m_vertexCache;
+    int m_vertexCacheSize;
 };
 
 //-----------------------------------------------------------------------------
@@ -190,11 +540,17 @@ inline float ModelOBJ::getRadius() const
 { return m_radius; }
 
 inline const int *ModelOBJ::getIndexBuffer() const
-{ return &m_indexBuffer[0]; }
+{ return m_pIndices; }
 
 inline int ModelOBJ::getIndexSize() const
 { return static_cast<int>(sizeof(int)); }
 
+inline const int *ModelOBJ::getLodIndexBuffer() const
+{ return m_pLodIndices; }
+
+inline const ModelOBJ::LevelOfDetail &ModelOBJ::getLod(int mesh, int level) const
+{ return m_lods[m_lodOffsets[mesh] + level]; }
+
 inline const ModelOBJ::Material &ModelOBJ::getMaterial(int i) const
 { return m_materials[i]; }
 
@@ -204,6 +560,12 @@ inline const ModelOBJ::Mesh &ModelOBJ::getMesh(int i) const
 inline int ModelOBJ::getNumberOfIndices() const
 { return m_numberOfTriangles * 3; }
 
+inline int ModelOBJ::getNumberOfLodIndices() const
+{ return m_numberOfLodIndices; }
+
+inline int ModelOBJ::getNumberOfLods(int mesh) const
+{ return m_lodOffsets.empty() ? 0 : m_lodOffsets[mesh + 1] - m_lodOffsets[mesh]; }
+
 inline int ModelOBJ::getNumberOfMaterials() const
 { return m_numberOfMaterials; }
 
@@ -214,16 +576,16 @@ inline int ModelOBJ::getNumberOfTriangles() const
 { return m_numberOfTriangles; }
 
 inline int ModelOBJ::getNumberOfVertices() const
-{ return static_cast<int>(m_vertexBuffer.size()); }
+{ return m_numberOfVertices; }
 
 inline const std::string &ModelOBJ::getPath() const
 { return m_directoryPath; }
 
 inline const ModelOBJ::Vertex &ModelOBJ::getVertex(int i) const
-{ return m_vertexBuffer[i]; }
+{ return m_pVertices[i]; }
 
 inline const ModelOBJ::Vertex *ModelOBJ::getVertexBuffer() const
-{ return &m_vertexBuffer[0]; }
+{ return m_pVertices; }
 
 inline int ModelOBJ::getVertexSize() const
 { return static_cast<int>(sizeof(Vertex)); }
@@ -240,6 +602,21 @@ inline bool ModelOBJ::hasTangents() const
 inline bool ModelOBJ::hasTextureCoords() const
 { return m_hasTextureCoords; }
 
+inline void ModelOBJ::setBinaryCacheEnabled(bool enable)
+{ m_binaryCacheEnabled = enable; }
+
+inline bool ModelOBJ::isBinaryCacheEnabled() const
+{ return m_binaryCacheEnabled; }
+
+inline bool ModelOBJ::isLoadedFromCache() const
+{ return m_pCacheFile != 0; }
+
+inline void ModelOBJ::setOptimizeOnImport(bool enable)
+{ m_optimizeOnImport = enable; }
+
+inline void ModelOBJ::setLodsOnImport(bool enable)
+{ m_lodsOnImport = enable; }
+
 
 #undef _CRT_SECURE_NO_WARNINGS
 
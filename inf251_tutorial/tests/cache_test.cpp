@@ -0,0 +1,322 @@
+//-----------------------------------------------------------------------------
+// Test for the binary mesh cache of ModelOBJ.
+//
+// Imports each OBJ file given on the command line (House.obj and
+// capsule.obj by default) once to write its cache, without and with
+// levels of detail, and checks that
+//
+//   - a second import maps the cache and gives the same model, and
+//   - a cache with a damaged mesh range, level range or level offset is
+//     rejected, so that the import falls back to the OBJ file instead of
+//     handing out ranges past the end of the index buffers.
+//
+// model_obj.cpp is compiled into this test to reach the cache layout.
+// Needs no GL. Build and run from inf251_tutorial/:
+//
+//   g++ -std=c++11 -O2 -I. tests/cache_test.cpp -pthread
+//-----------------------------------------------------------------------------
+
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "model_obj.cpp"
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const char *pszFilename, const char *pszWhat)
+    {
+        if (!condition)
+        {
+            std::printf("%s: %s\n", pszFilename, pszWhat);
+            ++failures;
+        }
+    }
+
+    bool readFile(const std::string &filename, std::vector<char> &contents)
+    {
+        FILE *pFile = fopen(filename.c_str(), "rb");
+
+        if (!pFile)
+            return false;
+
+        char buffer[65536];
+        size_t size = 0;
+
+        contents.clear();
+
+        while ((size = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+            contents.insert(contents.end(), buffer, buffer + size);
+
+        fclose(pFile);
+        return !contents.empty();
+    }
+
+    bool writeFile(const std::string &filename, const std::vector<char> &contents)
+    {
+        FILE *pFile = fopen(filename.c_str(), "wb");
+
+        if (!pFile)
+            return false;
+
+        bool written = fwrite(&contents[0], 1, contents.size(), pFile) == contents.size();
+
+        return fclose(pFile) == 0 && written;
+    }
+
+    // Returns the offset of the mesh section, which follows the header, the
+    // materials and the MTL libraries.
+    size_t findMeshes(const std::vector<char> &cache)
+    {
+        const char *p = &cache[0];
+        const char *pEnd = p + cache.size();
+        CacheHeader header;
+        bool valid = readBytes(p, pEnd, &header, sizeof(header));
+
+        for (int i = 0; valid && i < header.numberOfMaterials; ++i)
+        {
+            ModelOBJ::Material material;
+
+            valid = readBytes(p, pEnd, material.ambient, sizeof(material.ambient))
+                && readBytes(p, pEnd, material.diffuse, sizeof(material.diffuse))
+                && readBytes(p, pEnd, material.specular, sizeof(material.specular))
+                && readBytes(p, pEnd, &material.shininess, sizeof(material.shininess))
+                && readBytes(p, pEnd, &material.alpha, sizeof(material.alpha))
+                && readString(p, pEnd, material.name)
+                && readString(p, pEnd, material.colorMapFilename)
+                && readString(p, pEnd, material.bumpMapFilename);
+        }
+
+        for (int i = 0; valid && i < header.numberOfLibraries; ++i)
+        {
+            std::string library;
+            char stamp[sizeof(unsigned long long) + sizeof(long long)];
+
+            valid = readString(p, pEnd, library) && readBytes(p, pEnd, stamp, sizeof(stamp));
+        }
+
+        return valid ? static_cast<size_t>(p - &cache[0]) : 0;
+    }
+
+    bool validRange(int startIndex, int triangleCount, int numIndices)
+    {
+        return startIndex >= 0 && startIndex % 3 == 0 && triangleCount >= 0
+            && startIndex <= numIndices && triangleCount <= numIndices / 3 - startIndex / 3;
+    }
+
+    bool validRanges(const ModelOBJ &model)
+    {
+        for (int i = 0; i < model.getNumberOfMeshes(); ++i)
+        {
+            const ModelOBJ::Mesh &mesh = model.getMesh(i);
+
+            if (!validRange(mesh.startIndex, mesh.triangleCount, model.getNumberOfIndices()))
+                return false;
+
+            for (int j = 0; j < model.getNumberOfLods(i); ++j)
+            {
+                const ModelOBJ::LevelOfDetail &lod = model.getLod(i, j);
+
+                if (!validRange(lod.startIndex, lod.triangleCount, model.getNumberOfLodIndices()))
+                    return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool sameModel(const ModelOBJ &lhs, const ModelOBJ &rhs)
+    {
+        if (lhs.getNumberOfVertices() != rhs.getNumberOfVertices()
+            || lhs.getNumberOfTriangles() != rhs.getNumberOfTriangles()
+            || lhs.getNumberOfMeshes() != rhs.getNumberOfMeshes())
+        {
+            return false;
+        }
+
+        for (int i = 0; i < lhs.getNumberOfMeshes(); ++i)
+        {
+            if (lhs.getMesh(i).startIndex != rhs.getMesh(i).startIndex
+                || lhs.getMesh(i).triangleCount != rhs.getMesh(i).triangleCount
+                || lhs.getNumberOfLods(i) != rhs.getNumberOfLods(i))
+            {
+                return false;
+            }
+
+            for (int j = 0; j < lhs.getNumberOfLods(i); ++j)
+            {
+                if (lhs.getLod(i, j).startIndex != rhs.getLod(i, j).startIndex
+                    || lhs.getLod(i, j).triangleCount != rhs.getLod(i, j).triangleCount)
+                {
+                    return false;
+                }
+            }
+        }
+
+        return lhs.getNumberOfLodIndices() == rhs.getNumberOfLodIndices()
+            && memcmp(lhs.getIndexBuffer(), rhs.getIndexBuffer(),
+                lhs.getNumberOfIndices() * sizeof(int)) == 0
+            && (lhs.getNumberOfLodIndices() == 0 || memcmp(lhs.getLodIndexBuffer(),
+                rhs.getLodIndexBuffer(), lhs.getNumberOfLodIndices() * sizeof(int)) == 0);
+    }
+
+    // Writes the cache with one int replaced and checks that the import
+    // doesn't trust it.
+    void testCorruption(const char *pszFilename, const ModelOBJ &reference,
+                        const std::vector<char> &cache, size_t offset, int value,
+                        const char *pszWhat)
+    {
+        std::string cacheFilename = std::string(pszFilename) + ".cache";
+        std::vector<char> corrupt(cache);
+        ModelOBJ model;
+        std::string what;
+
+        model.setLodsOnImport(reference.getNumberOfLodIndices() > 0);
+        memcpy(&corrupt[offset], &value, sizeof(value));
+
+        if (!writeFile(cacheFilename, corrupt) || !model.import(pszFilename))
+        {
+            what = std::string("import failed with ") + pszWhat;
+            check(false, pszFilename, what.c_str());
+            return;
+        }
+
+        what = std::string("cache accepted with ") + pszWhat;
+        check(!model.isLoadedFromCache() && validRanges(model) && sameModel(reference, model),
+            pszFilename, what.c_str());
+    }
+
+    // Damages the level that starts last and the level offsets.
+    void testLodCorruption(const char *pszFilename, const ModelOBJ &reference,
+                           const std::vector<char> &cache, size_t meshes)
+    {
+        int numMeshes = reference.getNumberOfMeshes();
+        int numLodIndices = reference.getNumberOfLodIndices();
+        size_t offsets = meshes + numMeshes * 3 * sizeof(int);
+        size_t lods = offsets + (numMeshes + 1) * sizeof(int);
+        int numLods = 0;
+        int last = -1;
+        int lastStart = -1;
+
+        for (int i = 0; i < numMeshes; ++i)
+        {
+            for (int j = 0; j < reference.getNumberOfLods(i); ++j, ++numLods)
+            {
+                if (reference.getLod(i, j).startIndex > lastStart)
+                {
+                    last = numLods;
+                    lastStart = reference.getLod(i, j).startIndex;
+                }
+            }
+        }
+
+        if (last < 0)
+            return;
+
+        size_t start = lods + last * sizeof(ModelOBJ::LevelOfDetail);
+        size_t count = start + sizeof(int);
+        size_t lastOffset = offsets + numMeshes * sizeof(int);
+
+        testCorruption(pszFilename, reference, cache, count, INT_MAX,
+            "a level triangle count of INT_MAX");
+        testCorruption(pszFilename, reference, cache, count,
+            numLodIndices / 3 - lastStart / 3 + 1, "a level one triangle too long");
+        testCorruption(pszFilename, reference, cache, start, numLodIndices + 3,
+            "a level starting past the last LOD index");
+        testCorruption(pszFilename, reference, cache, lastOffset, numLodIndices,
+            "the number of LOD indices as the number of levels");
+        testCorruption(pszFilename, reference, cache, lastOffset, INT_MAX,
+            "a level offset of INT_MAX");
+    }
+
+    void testModel(const char *pszFilename, bool lods)
+    {
+        std::string cacheFilename = std::string(pszFilename) + ".cache";
+        ModelOBJ reference;
+        ModelOBJ cached;
+        std::vector<char> cache;
+        int before = failures;
+
+        reference.setLodsOnImport(lods);
+        cached.setLodsOnImport(lods);
+        remove(cacheFilename.c_str());
+
+        if (!reference.import(pszFilename) || !readFile(cacheFilename, cache)
+            || !cached.import(pszFilename))
+        {
+            std::printf("%s: import failed\n", pszFilename);
+            ++failures;
+            remove(cacheFilename.c_str());
+            return;
+        }
+
+        check(cached.isLoadedFromCache(), pszFilename, "cache not used");
+        check(sameModel(reference, cached), pszFilename, "cached model differs");
+
+        size_t meshes = findMeshes(cache);
+
+        check(meshes != 0, pszFilename, "cache layout not recognized");
+
+        if (meshes != 0 && reference.getNumberOfMeshes() > 0)
+        {
+            // Damage the mesh that starts last, so that a range check
+            // computed as start + count overflows.
+
+            int last = 0;
+
+            for (int i = 1; i < reference.getNumberOfMeshes(); ++i)
+            {
+                if (reference.getMesh(i).startIndex > reference.getMesh(last).startIndex)
+                    last = i;
+            }
+
+            const ModelOBJ::Mesh &mesh = reference.getMesh(last);
+            size_t start = meshes + last * 3 * sizeof(int);
+            size_t count = start + sizeof(int);
+            int numTriangles = reference.getNumberOfTriangles();
+
+            testCorruption(pszFilename, reference, cache, count, INT_MAX,
+                "a mesh triangle count of INT_MAX");
+            testCorruption(pszFilename, reference, cache, count,
+                numTriangles - mesh.startIndex / 3 + 1, "a mesh one triangle too long");
+            testCorruption(pszFilename, reference, cache, count, -1,
+                "a negative mesh triangle count");
+            testCorruption(pszFilename, reference, cache, start, 3 * (numTriangles + 1),
+                "a mesh starting past the last triangle");
+            testCorruption(pszFilename, reference, cache, start, mesh.startIndex + 1,
+                "a mesh starting inside a triangle");
+
+            if (lods)
+                testLodCorruption(pszFilename, reference, cache, meshes);
+        }
+
+        remove(cacheFilename.c_str());
+
+        std::printf("%s: %d meshes, %s, %s\n", pszFilename, reference.getNumberOfMeshes(),
+            lods ? "with LODs" : "without LODs", failures == before ? "ok" : "FAILED");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            testModel(argv[i], false);
+            testModel(argv[i], true);
+        }
+    }
+    else
+    {
+        testModel("House-Model/House.obj", false);
+        testModel("House-Model/House.obj", true);
+        testModel("capsule/capsule.obj", false);
+        testModel("capsule/capsule.obj", true);
+    }
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+//-----------------------------------------------------------------------------
+// Test for lodepng's frame encoder.
+//
+// Encodes random frames of random sizes in every color type the encoder
+// takes, decodes them again with lodepng_decode and compares the pixels.
+// An encoder for a width or height of 0 has to fail every frame with error
+// 93 and return no PNG.
+//
+// Build and run from inf251_tutorial/:
+//
+//   g++ -std=c++11 -O2 -I. tests/frame_encoder_test.cpp lodepng.cpp -pthread
+//-----------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "lodepng.h"
+
+namespace
+{
+    const int NUMBER_OF_ENCODERS = 300;
+    const int FRAMES_PER_ENCODER = 3;
+
+    struct ColorType
+    {
+        LodePNGColorType colortype;
+        unsigned bitdepth;
+    };
+
+    const ColorType COLOR_TYPES[] =
+    {
+        {LCT_GREY, 1}, {LCT_GREY, 2}, {LCT_GREY, 4}, {LCT_GREY, 8}, {LCT_GREY, 16},
+        {LCT_GREY_ALPHA, 8}, {LCT_RGB, 8}, {LCT_RGB, 16}, {LCT_RGBA, 8}, {LCT_RGBA, 16}
+    };
+
+    const int NUMBER_OF_COLOR_TYPES = sizeof(COLOR_TYPES) / sizeof(COLOR_TYPES[0]);
+
+    int failures = 0;
+
+    LodePNGColorMode getColorMode(const ColorType &type)
+    {
+        LodePNGColorMode mode;
+
+        lodepng_color_mode_init(&mode);
+        mode.colortype = type.colortype;
+        mode.bitdepth = type.bitdepth;
+        return mode;
+    }
+
+    void testEmpty(unsigned w, unsigned h, const ColorType &type)
+    {
+        LodePNGFrameEncoder *pEncoder = lodepng_frame_encoder_new(w, h, type.colortype, type.bitdepth);
+        unsigned char pixel[8] = {0};
+
+        for (int frame = 0; pEncoder && frame < 2; ++frame)
+        {
+            const unsigned char *pPng = pixel;
+            size_t pngSize = 1;
+            unsigned error = lodepng_frame_encode(pEncoder, &pPng, &pngSize, pixel);
+
+            if (error != 93 || pPng != 0 || pngSize != 0)
+            {
+                std::printf("%ux%u, color type %d, bit depth %u: error %u instead of 93\n",
+                    w, h, type.colortype, type.bitdepth, error);
+                ++failures;
+            }
+        }
+
+        lodepng_frame_encoder_delete(pEncoder);
+    }
+
+    void testRoundTrip(unsigned w, unsigned h, const ColorType &type)
+    {
+        LodePNGFrameEncoder *pEncoder = lodepng_frame_encoder_new(w, h, type.colortype, type.bitdepth);
+        LodePNGColorMode mode = getColorMode(type);
+        size_t size = lodepng_get_raw_size(w, h, &mode);
+
+        // The bits after the last pixel of a packed image aren't stored.
+
+        size_t lastBits = (static_cast<size_t>(w) * h * lodepng_get_bpp(&mode)) % 8;
+        size_t compared = lastBits ? size - 1 : size;
+
+        if (!pEncoder)
+        {
+            std::printf("out of memory\n");
+            ++failures;
+            return;
+        }
+
+        for (int frame = 0; frame < FRAMES_PER_ENCODER; ++frame)
+        {
+            std::vector<unsigned char> image(size);
+            int pattern = rand() % 3;
+
+            // Noise, ramps and mostly flat frames with a few changed bytes.
+
+            for (size_t i = 0; i < size; ++i)
+            {
+                if (pattern == 0)
+                    image[i] = static_cast<unsigned char>(rand());
+                else if (pattern == 1)
+                    image[i] = static_cast<unsigned char>(i / 7);
+                else
+                    image[i] = (rand() % 8 == 0) ? static_cast<unsigned char>(rand()) : 0;
+            }
+
+            const unsigned char *pPng = 0;
+            size_t pngSize = 0;
+            unsigned error = lodepng_frame_encode(pEncoder, &pPng, &pngSize, &image[0]);
+            unsigned char *pDecoded = 0;
+            unsigned decodedWidth = 0;
+            unsigned decodedHeight = 0;
+
+            if (!error)
+            {
+                error = lodepng_decode_memory(&pDecoded, &decodedWidth, &decodedHeight,
+                    pPng, pngSize, type.colortype, type.bitdepth);
+            }
+
+            if (error || decodedWidth != w || decodedHeight != h
+                || memcmp(pDecoded, &image[0], compared) != 0
+                || (lastBits && (pDecoded[size - 1] ^ image[size - 1]) >> (8 - lastBits) != 0))
+            {
+                std::printf("%ux%u, color type %d, bit depth %u: %s\n", w, h, type.colortype,
+                    type.bitdepth, error ? lodepng_error_text(error) : "decoded frame differs");
+                ++failures;
+            }
+
+            free(pDecoded);
+        }
+
+        lodepng_frame_encoder_delete(pEncoder);
+    }
+}
+
+int main()
+{
+    srand(5);
+
+    for (int i = 0; i < NUMBER_OF_COLOR_TYPES; ++i)
+    {
+        testEmpty(0, 16, COLOR_TYPES[i]);
+        testEmpty(16, 0, COLOR_TYPES[i]);
+        testEmpty(0, 0, COLOR_TYPES[i]);
+    }
+
+    for (int i = 0; i < NUMBER_OF_ENCODERS; ++i)
+    {
+        unsigned w = 1 + rand() % 90;
+        unsigned h = 1 + rand() % 40;
+
+        testRoundTrip(w, h, COLOR_TYPES[rand() % NUMBER_OF_COLOR_TYPES]);
+    }
+
+    std::printf("%d encoders, %d frames each: %s\n", NUMBER_OF_ENCODERS, FRAMES_PER_ENCODER,
+        failures == 0 ? "ok" : "FAILED");
+    return failures == 0 ? 0 : 1;
+}
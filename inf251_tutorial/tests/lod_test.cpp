@@ -0,0 +1,292 @@
+//-----------------------------------------------------------------------------
+// Test for ModelOBJ::generateLods and selectLod.
+//
+// Simplifies each OBJ file given on the command line (House.obj and
+// capsule.obj by default) and checks for every mesh that
+//
+//   - the triangle counts fall from level to level, by at least an eighth
+//     and not much further than the reduction ratio asks for,
+//   - the errors grow from level to level,
+//   - no vertex of the full mesh is further from a level than
+//     MAX_DEVIATION_RATIO times the error of that level, give or take a
+//     hundredth of the model radius,
+//   - selectLod picks the coarsest level within a given error, and
+//   - the levels read back from the binary cache are the same.
+//
+// Needs no GL. Build and run from inf251_tutorial/:
+//
+//   g++ -std=c++11 -O2 -I. tests/lod_test.cpp model_obj.cpp -pthread
+//-----------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "model_obj.h"
+
+namespace
+{
+    const float REDUCTION_RATIO = 0.5f;
+
+    // A pass may collapse a few edges past the target.
+    const float REDUCTION_SLACK = 0.9f;
+
+    // The error of a level is an area weighted RMS distance of the moved
+    // vertices to the planes of their original triangles, so it estimates
+    // rather than bounds the distance of the full mesh. On House.obj and
+    // capsule.obj the distance is at most about 2.3 times the error.
+    const float MAX_DEVIATION_RATIO = 2.5f;
+
+    int failures = 0;
+
+    void check(bool condition, const char *pszFilename, int mesh, int level, const char *pszWhat)
+    {
+        if (!condition)
+        {
+            std::printf("%s mesh %d level %d: %s\n", pszFilename, mesh, level, pszWhat);
+            ++failures;
+        }
+    }
+
+    float dot(const float a[3], const float b[3])
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    // Squared distance from p to triangle abc (Ericson, "Real-Time Collision
+    // Detection", 5.1.5).
+    float distanceSquared(const float p[3], const float a[3], const float b[3], const float c[3])
+    {
+        float ab[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+        float ac[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+        float ap[3] = {p[0] - a[0], p[1] - a[1], p[2] - a[2]};
+        float bp[3] = {p[0] - b[0], p[1] - b[1], p[2] - b[2]};
+        float cp[3] = {p[0] - c[0], p[1] - c[1], p[2] - c[2]};
+        float d1 = dot(ab, ap), d2 = dot(ac, ap);
+        float d3 = dot(ab, bp), d4 = dot(ac, bp);
+        float d5 = dot(ab, cp), d6 = dot(ac, cp);
+        float v = 0.0f, w = 0.0f;
+
+        if (d1 <= 0.0f && d2 <= 0.0f)
+            return dot(ap, ap);
+
+        if (d3 >= 0.0f && d4 <= d3)
+            return dot(bp, bp);
+
+        if (d6 >= 0.0f && d5 <= d6)
+            return dot(cp, cp);
+
+        float vc = d1 * d4 - d3 * d2;
+        float vb = d5 * d2 - d1 * d6;
+        float va = d3 * d6 - d5 * d4;
+
+        if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+        {
+            v = d1 / (d1 - d3);
+        }
+        else if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+        {
+            w = d2 / (d2 - d6);
+        }
+        else if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+        {
+            w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+            v = 1.0f - w;
+        }
+        else
+        {
+            float denom = 1.0f / (va + vb + vc);
+
+            v = vb * denom;
+            w = vc * denom;
+        }
+
+        float q[3];
+
+        for (int k = 0; k < 3; ++k)
+            q[k] = ap[k] - ab[k] * v - ac[k] * w;
+
+        return dot(q, q);
+    }
+
+    // Largest distance of a vertex of the full mesh to the triangles of a level.
+    float maxDeviation(const ModelOBJ &model, int mesh, const ModelOBJ::LevelOfDetail &lod)
+    {
+        const ModelOBJ::Mesh &m = model.getMesh(mesh);
+        const int *pIndices = model.getIndexBuffer() + m.startIndex;
+        const int *pLodIndices = model.getLodIndexBuffer() + lod.startIndex;
+        std::vector<int> vertices(pIndices, pIndices + m.triangleCount * 3);
+        float result = 0.0f;
+
+        std::sort(vertices.begin(), vertices.end());
+        vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+
+        for (size_t i = 0; i < vertices.size(); ++i)
+        {
+            const float *p = model.getVertex(vertices[i]).position;
+            float best = HUGE_VALF;
+
+            for (int j = 0; j < lod.triangleCount && best > 0.0f; ++j)
+            {
+                best = std::min(best, distanceSquared(p,
+                    model.getVertex(pLodIndices[j * 3]).position,
+                    model.getVertex(pLodIndices[j * 3 + 1]).position,
+                    model.getVertex(pLodIndices[j * 3 + 2]).position));
+            }
+
+            result = std::max(result, best);
+        }
+
+        return sqrtf(result);
+    }
+
+    bool equalLods(const ModelOBJ &lhs, const ModelOBJ &rhs)
+    {
+        if (lhs.getNumberOfMeshes() != rhs.getNumberOfMeshes()
+            || lhs.getNumberOfLodIndices() != rhs.getNumberOfLodIndices()
+            || !std::equal(lhs.getLodIndexBuffer(), lhs.getLodIndexBuffer() + lhs.getNumberOfLodIndices(),
+                rhs.getLodIndexBuffer()))
+        {
+            return false;
+        }
+
+        for (int i = 0; i < lhs.getNumberOfMeshes(); ++i)
+        {
+            if (lhs.getNumberOfLods(i) != rhs.getNumberOfLods(i))
+                return false;
+
+            for (int j = 0; j < lhs.getNumberOfLods(i); ++j)
+            {
+                const ModelOBJ::LevelOfDetail &a = lhs.getLod(i, j);
+                const ModelOBJ::LevelOfDetail &b = rhs.getLod(i, j);
+
+                if (a.startIndex != b.startIndex || a.triangleCount != b.triangleCount || a.error != b.error)
+                    return false;
+            }
+        }
+
+        return true;
+    }
+
+    void testMesh(const ModelOBJ &model, const char *pszFilename, int mesh, float &worstRatio)
+    {
+        int numLods = model.getNumberOfLods(mesh);
+        int previous = model.getMesh(mesh).triangleCount;
+        float previousError = 0.0f;
+
+        for (int level = 0; level < numLods; ++level)
+        {
+            const ModelOBJ::LevelOfDetail &lod = model.getLod(mesh, level);
+            int target = static_cast<int>(previous * REDUCTION_RATIO * REDUCTION_SLACK);
+
+            check(lod.triangleCount > 0 && lod.triangleCount <= previous - previous / 8,
+                pszFilename, mesh, level, "triangle count doesn't fall by an eighth");
+            check(lod.triangleCount >= target, pszFilename, mesh, level,
+                "triangle count falls far below the reduction ratio");
+            check(lod.error >= previousError && lod.error < HUGE_VALF, pszFilename, mesh, level,
+                "error doesn't grow");
+            bool inside = lod.startIndex >= 0 && lod.startIndex % 3 == 0
+                && lod.startIndex + lod.triangleCount * 3 <= model.getNumberOfLodIndices();
+
+            check(inside, pszFilename, mesh, level, "level range is outside the LOD index buffer");
+
+            if (!inside)
+                return;
+
+            const int *pLodIndices = model.getLodIndexBuffer() + lod.startIndex;
+
+            for (int i = 0; i < lod.triangleCount * 3; ++i)
+            {
+                check(pLodIndices[i] >= 0 && pLodIndices[i] < model.getNumberOfVertices(),
+                    pszFilename, mesh, level, "LOD index out of range");
+            }
+
+            float deviation = maxDeviation(model, mesh, lod);
+            float bound = MAX_DEVIATION_RATIO * lod.error + 0.01f * model.getRadius();
+
+            check(deviation <= bound, pszFilename, mesh, level, "full mesh deviates more than the error");
+
+            worstRatio = std::max(worstRatio, deviation / bound);
+
+            // selectLod picks this level for its own error, unless the next
+            // level has the same error.
+
+            int selected = model.selectLod(mesh, lod.error);
+
+            check(selected >= level && (selected == level || model.getLod(mesh, selected).error == lod.error),
+                pszFilename, mesh, level, "selectLod doesn't pick the level for its error");
+
+            previous = lod.triangleCount;
+            previousError = lod.error;
+        }
+
+        check(model.selectLod(mesh, -1.0f) == -1, pszFilename, mesh, -1,
+            "selectLod doesn't keep the full mesh for a negative error");
+        check(model.selectLod(mesh, HUGE_VALF) == numLods - 1, pszFilename, mesh, -1,
+            "selectLod doesn't pick the coarsest level for an infinite error");
+    }
+
+    void testModel(const char *pszFilename)
+    {
+        std::string cacheFilename = std::string(pszFilename) + ".cache";
+        ModelOBJ model;
+        ModelOBJ cached;
+        int before = failures;
+
+        remove(cacheFilename.c_str());
+
+        // The first import simplifies and writes the cache, the second one
+        // reads the levels back from it.
+
+        model.setLodsOnImport(true);
+        cached.setLodsOnImport(true);
+
+        if (!model.import(pszFilename) || !cached.import(pszFilename))
+        {
+            std::printf("%s: import failed\n", pszFilename);
+            ++failures;
+            return;
+        }
+
+        FILE *pCache = fopen(cacheFilename.c_str(), "rb");
+
+        check(pCache != 0, pszFilename, -1, -1, "no cache written");
+        check(equalLods(model, cached), pszFilename, -1, -1, "cached levels differ");
+
+        if (pCache)
+            fclose(pCache);
+
+        remove(cacheFilename.c_str());
+
+        float worstRatio = 0.0f;
+        int numLods = 0;
+
+        for (int i = 0; i < model.getNumberOfMeshes(); ++i)
+        {
+            testMesh(model, pszFilename, i, worstRatio);
+            numLods += model.getNumberOfLods(i);
+        }
+
+        std::printf("%s: %d meshes, %d levels, deviation up to %.2f of the bound, %s\n",
+            pszFilename, model.getNumberOfMeshes(), numLods, worstRatio,
+            failures == before ? "ok" : "FAILED");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+    {
+        for (int i = 1; i < argc; ++i)
+            testModel(argv[i]);
+    }
+    else
+    {
+        testModel("House-Model/House.obj");
+        testModel("capsule/capsule.obj");
+    }
+
+    return failures == 0 ? 0 : 1;
+}
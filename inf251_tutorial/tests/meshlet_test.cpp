@@ -0,0 +1,367 @@
+//-----------------------------------------------------------------------------
+// Test for ModelOBJ::buildMeshlets, saveMeshlets and loadMeshlets.
+//
+// Splits every mesh of each OBJ file given on the command line (House.obj
+// and capsule.obj by default) into meshlets with several limits and checks
+// that
+//
+//   - no meshlet exceeds the vertex and triangle limits,
+//   - the meshlets hold exactly the triangles of the mesh with the same
+//     winding, each of them once,
+//   - every bounding sphere encloses the vertices of its meshlet,
+//   - every triangle normal lies inside the normal cone of its meshlet,
+//     a camera behind the cone culls the meshlet, one in front of it
+//     doesn't, and no camera culls a meshlet with a triangle facing it,
+//   - the meshlet buffer survives a save/load round trip unchanged, and
+//   - loadMeshlets rejects a file whose counts only match its size once
+//     they wrap around in 32 bits.
+//
+// Needs no GL. Build and run from inf251_tutorial/:
+//
+//   g++ -std=c++11 -O2 -I. tests/meshlet_test.cpp model_obj.cpp -pthread
+//-----------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "model_obj.h"
+
+namespace
+{
+    struct Triangle
+    {
+        int v[3];
+
+        bool operator<(const Triangle &other) const
+        {
+            return std::lexicographical_compare(v, v + 3, other.v, other.v + 3);
+        }
+
+        bool operator==(const Triangle &other) const
+        {
+            return std::equal(v, v + 3, other.v);
+        }
+    };
+
+    int failures = 0;
+
+    void check(bool condition, const char *pszFilename, int mesh, const char *pszWhat)
+    {
+        if (!condition)
+        {
+            std::printf("%s mesh %d: %s\n", pszFilename, mesh, pszWhat);
+            ++failures;
+        }
+    }
+
+    // Rotates the smallest index to the front, which keeps the winding.
+    Triangle makeTriangle(int a, int b, int c)
+    {
+        Triangle triangle = {{a, b, c}};
+
+        if (b < a && b <= c)
+        {
+            triangle.v[0] = b;
+            triangle.v[1] = c;
+            triangle.v[2] = a;
+        }
+        else if (c < a && c < b)
+        {
+            triangle.v[0] = c;
+            triangle.v[1] = a;
+            triangle.v[2] = b;
+        }
+
+        return triangle;
+    }
+
+    float dot(const float *a, const float *b)
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    bool isCulled(const ModelOBJ::Meshlet &meshlet, const float eye[3])
+    {
+        float view[3] = {meshlet.coneApex[0] - eye[0], meshlet.coneApex[1] - eye[1],
+            meshlet.coneApex[2] - eye[2]};
+        float length = sqrtf(dot(view, view));
+
+        return length > 0.0f && dot(view, meshlet.coneAxis) >= meshlet.coneCutoff * length;
+    }
+
+    // Checks the normal cone against the face normals of the meshlet and
+    // against cameras all around it.
+    void testCone(const ModelOBJ &model, const char *pszFilename, int mesh,
+        const ModelOBJ::Meshlet &meshlet, const int *pVertices, const unsigned char *pTriangles)
+    {
+        if (meshlet.coneCutoff > 1.0f)
+            return;
+
+        // A tolerance relative to the size of the meshlet absorbs rounding.
+        float minDot = sqrtf(std::max(0.0f, 1.0f - meshlet.coneCutoff * meshlet.coneCutoff));
+        float tolerance = 1e-4f * (meshlet.radius + 1.0f);
+        float distance = 4.0f * meshlet.radius + 1.0f;
+        unsigned int random = 12345u;
+
+        for (int j = 0; j < meshlet.triangleCount; ++j)
+        {
+            const float *p0 = model.getVertex(pVertices[pTriangles[j * 3]]).position;
+            const float *p1 = model.getVertex(pVertices[pTriangles[j * 3 + 1]]).position;
+            const float *p2 = model.getVertex(pVertices[pTriangles[j * 3 + 2]]).position;
+            float edge1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+            float edge2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+            float normal[3] = {edge1[1] * edge2[2] - edge1[2] * edge2[1],
+                edge1[2] * edge2[0] - edge1[0] * edge2[2], edge1[0] * edge2[1] - edge1[1] * edge2[0]};
+            float length = sqrtf(dot(normal, normal));
+
+            if (length == 0.0f)
+                continue;
+
+            for (int k = 0; k < 3; ++k)
+                normal[k] /= length;
+
+            check(dot(normal, meshlet.coneAxis) >= minDot - 1e-4f, pszFilename, mesh,
+                "triangle normal outside the normal cone");
+
+            // Every culling camera has to see the back of every triangle.
+
+            for (int e = 0; e < 16; ++e)
+            {
+                float eye[3];
+
+                for (int k = 0; k < 3; ++k)
+                {
+                    random = random * 1664525u + 1013904223u;
+                    eye[k] = meshlet.center[k] + distance * ((random >> 8) / 8388608.0f - 1.0f);
+                }
+
+                if (isCulled(meshlet, eye))
+                {
+                    float toEye[3] = {eye[0] - p0[0], eye[1] - p0[1], eye[2] - p0[2]};
+
+                    check(dot(toEye, normal) <= tolerance, pszFilename, mesh,
+                        "meshlet culled although a triangle faces the camera");
+                }
+            }
+        }
+
+        float behind[3];
+        float front[3];
+
+        for (int k = 0; k < 3; ++k)
+        {
+            behind[k] = meshlet.coneApex[k] - meshlet.coneAxis[k] * distance;
+            front[k] = meshlet.center[k] + meshlet.coneAxis[k] * distance;
+        }
+
+        check(isCulled(meshlet, behind), pszFilename, mesh, "camera behind the cone doesn't cull");
+        check(!isCulled(meshlet, front), pszFilename, mesh, "camera in front of the cone culls");
+    }
+
+    // A header whose triangle count times 3 wraps to 2 in 32 bits, followed
+    // by one meshlet that claims 256 vertices and 1000 triangles, the 256
+    // vertices and 2 bytes of triangles.
+    bool loadsWrappedFile(const char *pszMeshletFilename)
+    {
+        ModelOBJ::MeshletBuffer empty;
+        ModelOBJ::MeshletBuffer loaded;
+        std::vector<char> file;
+        char header[24];
+        FILE *pFile = 0;
+
+        if (!ModelOBJ::saveMeshlets(pszMeshletFilename, empty)
+            || (pFile = fopen(pszMeshletFilename, "rb")) == 0)
+        {
+            return true;
+        }
+
+        bool valid = fread(header, 1, sizeof(header), pFile) == sizeof(header);
+
+        fclose(pFile);
+
+        if (!valid)
+            return true;
+
+        // magic, version, meshletSize, numberOfMeshlets, numberOfVertices,
+        // numberOfTriangles
+        unsigned int counts[3] = {1, 256, 0x55555556u};
+        ModelOBJ::Meshlet meshlet;
+
+        memset(&meshlet, 0, sizeof(meshlet));
+        meshlet.vertexCount = 256;
+        meshlet.triangleCount = 1000;
+        memcpy(header + 12, counts, sizeof(counts));
+        file.assign(header, header + sizeof(header));
+        file.insert(file.end(), reinterpret_cast<const char *>(&meshlet),
+            reinterpret_cast<const char *>(&meshlet) + sizeof(meshlet));
+        file.insert(file.end(), 256 * sizeof(int) + 2, 0);
+
+        pFile = fopen(pszMeshletFilename, "wb");
+
+        if (!pFile)
+            return true;
+
+        fwrite(&file[0], 1, file.size(), pFile);
+        fclose(pFile);
+
+        bool loads = ModelOBJ::loadMeshlets(pszMeshletFilename, loaded);
+
+        remove(pszMeshletFilename);
+        return loads;
+    }
+
+    bool equalBuffers(const ModelOBJ::MeshletBuffer &lhs, const ModelOBJ::MeshletBuffer &rhs)
+    {
+        return lhs.meshlets.size() == rhs.meshlets.size()
+            && lhs.vertices == rhs.vertices
+            && lhs.triangles == rhs.triangles
+            && (lhs.meshlets.empty() || memcmp(&lhs.meshlets[0], &rhs.meshlets[0],
+                lhs.meshlets.size() * sizeof(ModelOBJ::Meshlet)) == 0);
+    }
+
+    void testMesh(const ModelOBJ &model, const char *pszFilename, int mesh,
+        int maxVertices, int maxTriangles, ModelOBJ::MeshletBuffer &all)
+    {
+        const ModelOBJ::Mesh &m = model.getMesh(mesh);
+        const int *pIndices = model.getIndexBuffer() + m.startIndex;
+        ModelOBJ::MeshletBuffer buffer;
+
+        model.buildMeshlets(m, buffer, maxVertices, maxTriangles);
+
+        std::vector<Triangle> expected;
+        std::vector<Triangle> actual;
+
+        for (int i = 0; i < m.triangleCount; ++i)
+            expected.push_back(makeTriangle(pIndices[i * 3], pIndices[i * 3 + 1], pIndices[i * 3 + 2]));
+
+        for (size_t i = 0; i < buffer.meshlets.size(); ++i)
+        {
+            const ModelOBJ::Meshlet &meshlet = buffer.meshlets[i];
+
+            check(meshlet.vertexCount > 0 && meshlet.vertexCount <= maxVertices,
+                pszFilename, mesh, "meshlet exceeds the vertex limit");
+            check(meshlet.triangleCount > 0 && meshlet.triangleCount <= maxTriangles,
+                pszFilename, mesh, "meshlet exceeds the triangle limit");
+
+            bool inside = meshlet.vertexOffset >= 0
+                && meshlet.vertexOffset + meshlet.vertexCount <= static_cast<int>(buffer.vertices.size())
+                && meshlet.triangleOffset >= 0
+                && (meshlet.triangleOffset + meshlet.triangleCount) * 3 <= static_cast<int>(buffer.triangles.size());
+
+            check(inside, pszFilename, mesh, "meshlet range is outside the buffer");
+
+            if (!inside)
+                return;
+
+            const int *pVertices = &buffer.vertices[meshlet.vertexOffset];
+            const unsigned char *pTriangles = &buffer.triangles[meshlet.triangleOffset * 3];
+
+            for (int j = 0; j < meshlet.triangleCount * 3; ++j)
+                check(pTriangles[j] < meshlet.vertexCount, pszFilename, mesh, "local index out of range");
+
+            for (int j = 0; j < meshlet.triangleCount; ++j)
+            {
+                actual.push_back(makeTriangle(pVertices[pTriangles[j * 3]],
+                    pVertices[pTriangles[j * 3 + 1]], pVertices[pTriangles[j * 3 + 2]]));
+            }
+
+            for (int j = 0; j < meshlet.vertexCount; ++j)
+            {
+                const float *p = model.getVertex(pVertices[j]).position;
+                float dx = p[0] - meshlet.center[0];
+                float dy = p[1] - meshlet.center[1];
+                float dz = p[2] - meshlet.center[2];
+
+                check(sqrtf(dx * dx + dy * dy + dz * dz) <= meshlet.radius * 1.0001f + 1e-5f,
+                    pszFilename, mesh, "vertex outside the bounding sphere");
+            }
+
+            testCone(model, pszFilename, mesh, meshlet, pVertices, pTriangles);
+        }
+
+        std::sort(expected.begin(), expected.end());
+        std::sort(actual.begin(), actual.end());
+        check(actual == expected, pszFilename, mesh, "meshlets don't cover the mesh triangles");
+
+        // Append to one buffer for the round trip, as a renderer would.
+
+        for (size_t i = 0; i < buffer.meshlets.size(); ++i)
+        {
+            ModelOBJ::Meshlet meshlet = buffer.meshlets[i];
+
+            meshlet.vertexOffset += static_cast<int>(all.vertices.size());
+            meshlet.triangleOffset += static_cast<int>(all.triangles.size() / 3);
+            all.meshlets.push_back(meshlet);
+        }
+
+        all.vertices.insert(all.vertices.end(), buffer.vertices.begin(), buffer.vertices.end());
+        all.triangles.insert(all.triangles.end(), buffer.triangles.begin(), buffer.triangles.end());
+    }
+
+    void testModel(const char *pszFilename)
+    {
+        static const int limits[][2] = { {64, 124}, {32, 16}, {256, 512}, {3, 1} };
+        ModelOBJ model;
+
+        model.setBinaryCacheEnabled(false);
+
+        if (!model.import(pszFilename))
+        {
+            std::printf("%s: import failed\n", pszFilename);
+            ++failures;
+            return;
+        }
+
+        for (size_t l = 0; l < sizeof(limits) / sizeof(limits[0]); ++l)
+        {
+            ModelOBJ::MeshletBuffer all;
+            ModelOBJ::MeshletBuffer loaded;
+            int before = failures;
+
+            for (int i = 0; i < model.getNumberOfMeshes(); ++i)
+                testMesh(model, pszFilename, i, limits[l][0], limits[l][1], all);
+
+            const char *pszMeshletFilename = "meshlet_test.meshlets";
+
+            check(ModelOBJ::saveMeshlets(pszMeshletFilename, all)
+                && ModelOBJ::loadMeshlets(pszMeshletFilename, loaded)
+                && equalBuffers(all, loaded), pszFilename, -1, "save/load round trip differs");
+            remove(pszMeshletFilename);
+
+            int numCullable = 0;
+
+            for (size_t i = 0; i < all.meshlets.size(); ++i)
+                numCullable += (all.meshlets[i].coneCutoff <= 1.0f);
+
+            check(numCullable > 0, pszFilename, -1, "no meshlet can be cone culled");
+
+            std::printf("%s: limits %d/%d, %d meshlets, %d cone cullable, %s\n", pszFilename,
+                limits[l][0], limits[l][1], static_cast<int>(all.meshlets.size()), numCullable,
+                failures == before ? "ok" : "FAILED");
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (loadsWrappedFile("meshlet_test.meshlets"))
+    {
+        std::printf("loadMeshlets accepts counts that wrap around\n");
+        ++failures;
+    }
+
+    if (argc > 1)
+    {
+        for (int i = 1; i < argc; ++i)
+            testModel(argv[i]);
+    }
+    else
+    {
+        testModel("House-Model/House.obj");
+        testModel("capsule/capsule.obj");
+    }
+
+    return failures == 0 ? 0 : 1;
+}
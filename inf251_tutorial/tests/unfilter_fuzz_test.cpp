@@ -0,0 +1,228 @@
+//-----------------------------------------------------------------------------
+// Differential fuzz test for the SSE2/SSSE3 unfilter kernels of lodepng.
+//
+// lodepng.cpp is compiled twice into this test: once as usual into
+// namespace simd, and once with LODEPNG_NO_SIMD into namespace scalar.
+// Random scanlines with every filter type, pixel size and length, with and
+// without a previous line and unfiltered in place or not, must come out
+// byte for byte the same from both builds, with the SSSE3 Paeth kernel
+// switched on and off. Whole images are compared the same way through
+// unfilter().
+//
+// Build and run from inf251_tutorial/. The scalar half is a separate
+// object file so that it can be built with LODEPNG_NO_SIMD:
+//
+//   g++ -std=c++11 -O2 -DLODEPNG_NO_SIMD -DUNFILTER_FUZZ_SCALAR -c tests/unfilter_fuzz_test.cpp -o unfilter_scalar.o
+//   g++ -std=c++11 -O2 tests/unfilter_fuzz_test.cpp unfilter_scalar.o -pthread
+//-----------------------------------------------------------------------------
+
+// Everything lodepng.cpp includes has to be included here first, so that
+// none of it ends up inside the namespaces below.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if !defined(LODEPNG_NO_SIMD) && (defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__))
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if defined(UNFILTER_FUZZ_SCALAR)
+namespace scalar
+#else
+namespace simd
+#endif
+{
+#include "../lodepng.cpp"
+
+    unsigned unfilterLine(unsigned char *pRecon, const unsigned char *pScanline,
+        const unsigned char *pPrecon, size_t bytewidth, unsigned char filterType,
+        size_t length, int ssse3)
+    {
+        return unfilterScanline(pRecon, pScanline, pPrecon, bytewidth, filterType, length, ssse3);
+    }
+
+    unsigned unfilterImage(unsigned char *pOut, const unsigned char *pIn,
+        unsigned w, unsigned h, unsigned bpp)
+    {
+        return unfilter(pOut, pIn, w, h, bpp);
+    }
+
+#if !defined(UNFILTER_FUZZ_SCALAR) && defined(LODEPNG_USE_SSE2)
+    bool hasSSSE3()
+    {
+        return cpuHasSSSE3() != 0;
+    }
+#else
+    bool hasSSSE3()
+    {
+        return false;
+    }
+#endif
+}
+
+#if !defined(UNFILTER_FUZZ_SCALAR)
+
+namespace scalar
+{
+    unsigned unfilterLine(unsigned char *pRecon, const unsigned char *pScanline,
+        const unsigned char *pPrecon, size_t bytewidth, unsigned char filterType,
+        size_t length, int ssse3);
+    unsigned unfilterImage(unsigned char *pOut, const unsigned char *pIn,
+        unsigned w, unsigned h, unsigned bpp);
+}
+
+namespace
+{
+    const int NUMBER_OF_LINES = 200000;
+    const int NUMBER_OF_IMAGES = 2000;
+
+    // xorshift32, so that every platform sees the same cases.
+    unsigned int nextRandom(unsigned int &state)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    // Random bytes, bytes from a few values (long runs for the Paeth ties)
+    // or a ramp, so that the predictors meet equal and wrapping neighbors.
+    void fillBytes(unsigned int &state, unsigned char *pData, size_t size)
+    {
+        unsigned int pattern = nextRandom(state) % 3;
+
+        for (size_t i = 0; i < size; ++i)
+        {
+            if (pattern == 0)
+                pData[i] = static_cast<unsigned char>(nextRandom(state));
+            else if (pattern == 1)
+                pData[i] = static_cast<unsigned char>((nextRandom(state) % 3) * 127);
+            else
+                pData[i] = static_cast<unsigned char>(i * 3 + 250);
+        }
+    }
+
+    int testLines(bool ssse3)
+    {
+        static const size_t BYTEWIDTHS[] = {1, 2, 3, 4, 6, 8};
+        unsigned int state = 12345;
+        int mismatches = 0;
+
+        for (int n = 0; n < NUMBER_OF_LINES; ++n)
+        {
+            size_t bytewidth = BYTEWIDTHS[nextRandom(state) % 6];
+            size_t length = bytewidth * (1 + nextRandom(state) % 80);
+            unsigned char filterType = static_cast<unsigned char>(nextRandom(state) % 5);
+            bool inPlace = (nextRandom(state) & 1) != 0;
+            bool hasPrecon = nextRandom(state) % 4 != 0;
+
+            // One spare byte behind every buffer catches kernels that write
+            // past the scanline.
+
+            std::vector<unsigned char> scanline(length + 1);
+            std::vector<unsigned char> precon(length + 1);
+            std::vector<unsigned char> expected(length + 1, 0xA5);
+            std::vector<unsigned char> actual(length + 1, 0xA5);
+
+            fillBytes(state, &scanline[0], length + 1);
+            fillBytes(state, &precon[0], length + 1);
+
+            std::vector<unsigned char> scalarIn(scanline);
+            std::vector<unsigned char> simdIn(scanline);
+            unsigned char *pExpected = inPlace ? &scalarIn[0] : &expected[0];
+            unsigned char *pActual = inPlace ? &simdIn[0] : &actual[0];
+            const unsigned char *pPrecon = hasPrecon ? &precon[0] : 0;
+
+            unsigned scalarError = scalar::unfilterLine(pExpected, &scalarIn[0], pPrecon,
+                bytewidth, filterType, length, 0);
+            unsigned simdError = simd::unfilterLine(pActual, &simdIn[0], pPrecon,
+                bytewidth, filterType, length, ssse3 ? 1 : 0);
+
+            if (scalarError != simdError || memcmp(pExpected, pActual, length + 1) != 0)
+            {
+                if (mismatches++ < 10)
+                {
+                    printf("scanline mismatch: filter %d, bytewidth %d, length %d, %s, %s, ssse3 %d\n",
+                        filterType, static_cast<int>(bytewidth), static_cast<int>(length),
+                        inPlace ? "in place" : "separate", hasPrecon ? "previous line" : "first line",
+                        ssse3 ? 1 : 0);
+                }
+            }
+        }
+
+        return mismatches;
+    }
+
+    int testImages()
+    {
+        static const unsigned BPPS[] = {1, 2, 4, 8, 16, 24, 32, 48, 64};
+        unsigned int state = 67890;
+        int mismatches = 0;
+
+        for (int n = 0; n < NUMBER_OF_IMAGES; ++n)
+        {
+            unsigned bpp = BPPS[nextRandom(state) % 9];
+            unsigned w = 1 + nextRandom(state) % 100;
+            unsigned h = 1 + nextRandom(state) % 20;
+            size_t linebytes = (static_cast<size_t>(w) * bpp + 7) / 8;
+            std::vector<unsigned char> in((linebytes + 1) * h);
+            std::vector<unsigned char> expected(linebytes * h);
+            std::vector<unsigned char> actual(linebytes * h);
+
+            fillBytes(state, &in[0], in.size());
+
+            for (unsigned y = 0; y < h; ++y)
+                in[(linebytes + 1) * y] = static_cast<unsigned char>(nextRandom(state) % 5);
+
+            unsigned scalarError = scalar::unfilterImage(&expected[0], &in[0], w, h, bpp);
+            unsigned simdError = simd::unfilterImage(&actual[0], &in[0], w, h, bpp);
+
+            if (scalarError != simdError || expected != actual)
+            {
+                if (mismatches++ < 10)
+                    printf("image mismatch: %ux%u, %u bpp\n", w, h, bpp);
+            }
+        }
+
+        return mismatches;
+    }
+}
+
+int main()
+{
+    int mismatches = testLines(false);
+
+    printf("%d scanlines without SSSE3: %d mismatches\n", NUMBER_OF_LINES, mismatches);
+
+    if (simd::hasSSSE3())
+    {
+        int ssse3Mismatches = testLines(true);
+
+        printf("%d scanlines with SSSE3: %d mismatches\n", NUMBER_OF_LINES, ssse3Mismatches);
+        mismatches += ssse3Mismatches;
+    }
+    else
+    {
+        printf("no SSSE3, skipped the SSSE3 kernels\n");
+    }
+
+    int imageMismatches = testImages();
+
+    printf("%d images: %d mismatches\n", NUMBER_OF_IMAGES, imageMismatches);
+    mismatches += imageMismatches;
+
+    return mismatches == 0 ? 0 : 1;
+}
+
+#endif
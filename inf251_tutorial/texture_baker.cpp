@@ -0,0 +1,785 @@
+#define _CRT_SECURE_NO_WARNINGS // suppress warnings for unsafe methods
+
+#include <gl/glew.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include "file_stamp.h"
+#include "texture_baker.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define TEXTURE_BAKER_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    const char BAKED_MAGIC[4] = {'T', 'M', 'I', 'P'};
+    const unsigned int BAKED_VERSION = 2;
+    const int BAKED_MAX_LEVELS = 32;
+    const unsigned int BAKED_MAX_SIZE = 65536;
+
+    struct BakedHeader
+    {
+        char magic[4];
+        unsigned int version;
+        unsigned int internalFormat;
+        unsigned int format;
+        unsigned int type;
+        unsigned int filter;
+        unsigned int numberOfLevels;
+        unsigned int compression;
+        unsigned int quality;
+        float psnr;
+
+        unsigned long long sourceSize;
+        long long sourceTime;
+        unsigned long long sourceHash;
+
+        unsigned long long dataOffset;
+        unsigned long long fileSize;
+    };
+
+    size_t alignData(size_t offset)
+    {
+        return (offset + 15) & ~static_cast<size_t>(15);
+    }
+
+    // Returns the size of a level as the GL expects it for the formats
+    // BakedTexture writes, or 0 for any other combination of enums.
+    unsigned long long getLevelSize(const BakedHeader &header, unsigned int width, unsigned int height)
+    {
+        unsigned long long texels = static_cast<unsigned long long>(width) * height;
+
+        if (header.type == GL_UNSIGNED_BYTE && header.format == header.internalFormat)
+        {
+            if (header.format == GL_RGB)
+                return texels * 3;
+
+            if (header.format == GL_RGBA)
+                return texels * 4;
+        }
+
+        if (header.format != 0 || header.type != 0)
+            return 0;
+
+        switch (header.internalFormat)
+        {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+            return getCompressedSize(BLOCK_FORMAT_BC1, width, height);
+
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+            return getCompressedSize(BLOCK_FORMAT_BC3, width, height);
+
+        case GL_COMPRESSED_RGBA_BPTC_UNORM:
+            return getCompressedSize(BLOCK_FORMAT_BC7, width, height);
+        }
+
+        return 0;
+    }
+
+    // Conversions between 8-bit sRGB and linear values. Linear values are
+    // encoded through a table with 16-bit precision, which resolves every
+    // sRGB step including the darkest ones.
+
+    struct ColorTables
+    {
+        float toLinear[256];
+        unsigned char fromLinear[65536];
+
+        ColorTables()
+        {
+            for (int i = 0; i < 256; ++i)
+            {
+                float value = i / 255.0f;
+
+                toLinear[i] = (value <= 0.04045f) ? value / 12.92f
+                    : powf((value + 0.055f) / 1.055f, 2.4f);
+            }
+
+            for (int i = 0; i < 65536; ++i)
+            {
+                float value = i / 65535.0f;
+
+                value = (value <= 0.0031308f) ? value * 12.92f
+                    : 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+                fromLinear[i] = static_cast<unsigned char>(value * 255.0f + 0.5f);
+            }
+        }
+    };
+
+    const ColorTables &colorTables()
+    {
+        static ColorTables tables;
+        return tables;
+    }
+
+    unsigned char encodeColor(const ColorTables &tables, float value)
+    {
+        value = std::min(std::max(value, 0.0f), 1.0f);
+        return tables.fromLinear[static_cast<int>(value * 65535.0f + 0.5f)];
+    }
+
+    unsigned char encodeAlpha(float value)
+    {
+        value = std::min(std::max(value, 0.0f), 1.0f);
+        return static_cast<unsigned char>(value * 255.0f + 0.5f);
+    }
+
+    //-------------------------------------------------------------------------
+    // Separable downsampling. Every destination texel along an axis reads a
+    // fixed number of source texels; unused taps have a weight of 0.
+    //-------------------------------------------------------------------------
+
+    const float KAISER_ALPHA = 4.0f;
+    const float KAISER_RADIUS = 1.5f;   // in destination texels
+
+    struct FilterTaps
+    {
+        int count;
+        std::vector<int> indices;
+        std::vector<float> weights;
+    };
+
+    float besselI0(float x)
+    {
+        float sum = 1.0f;
+        float term = 1.0f;
+
+        for (int k = 1; term > sum * 1e-7f; ++k)
+        {
+            float t = x / (2.0f * k);
+
+            term *= t * t;
+            sum += term;
+        }
+
+        return sum;
+    }
+
+    float kaiser(float x)
+    {
+        const float PI = 3.14159265f;
+
+        float t = x / KAISER_RADIUS;
+
+        if (t <= -1.0f || t >= 1.0f)
+            return 0.0f;
+
+        float sinc = (fabsf(x) < 1e-6f) ? 1.0f : sinf(PI * x) / (PI * x);
+
+        return sinc * besselI0(KAISER_ALPHA * sqrtf(1.0f - t * t)) / besselI0(KAISER_ALPHA);
+    }
+
+    void computeTaps(unsigned int sourceSize, unsigned int size, MipFilter filter,
+                     FilterTaps &taps)
+    {
+        float scale = static_cast<float>(sourceSize) / size;
+
+        if (filter == MIP_FILTER_BOX)
+            taps.count = static_cast<int>(ceilf(scale)) + 1;
+        else
+            taps.count = static_cast<int>(ceilf(2.0f * KAISER_RADIUS * scale)) + 1;
+
+        taps.indices.resize(size * taps.count);
+        taps.weights.resize(size * taps.count);
+
+        for (unsigned int i = 0; i < size; ++i)
+        {
+            int *pIndices = &taps.indices[i * taps.count];
+            float *pWeights = &taps.weights[i * taps.count];
+            float sum = 0.0f;
+
+            if (filter == MIP_FILTER_BOX)
+            {
+                // Weight the source texels by how much of them the
+                // destination texel covers.
+
+                float low = i * scale;
+                float high = low + scale;
+                int first = static_cast<int>(low);
+
+                for (int j = 0; j < taps.count; ++j)
+                {
+                    int index = first + j;
+                    float weight = std::min(high, index + 1.0f) - std::max(low, static_cast<float>(index));
+
+                    if (index >= static_cast<int>(sourceSize) || weight < 0.0f)
+                        weight = 0.0f;
+
+                    pIndices[j] = std::min(index, static_cast<int>(sourceSize) - 1);
+                    pWeights[j] = weight;
+                    sum += weight;
+                }
+            }
+            else
+            {
+                float center = (i + 0.5f) * scale;
+                int first = static_cast<int>(floorf(center - KAISER_RADIUS * scale));
+
+                for (int j = 0; j < taps.count; ++j)
+                {
+                    int index = first + j;
+                    float weight = kaiser((index + 0.5f - center) / scale);
+
+                    index %= static_cast<int>(sourceSize);
+
+                    if (index < 0)
+                        index += sourceSize;
+
+                    pIndices[j] = index;
+                    pWeights[j] = weight;
+                    sum += weight;
+                }
+            }
+
+            for (int j = 0; j < taps.count; ++j)
+                pWeights[j] /= sum;
+        }
+    }
+
+    // pDst[0..count-1] += pSrc[0..count-1] * weight
+    void accumulateRow(float *pDst, const float *pSrc, float weight, size_t count)
+    {
+        size_t i = 0;
+
+#if defined(TEXTURE_BAKER_USE_SSE2)
+        __m128 factor = _mm_set1_ps(weight);
+
+        for (; i + 4 <= count; i += 4)
+        {
+            _mm_storeu_ps(pDst + i, _mm_add_ps(_mm_loadu_ps(pDst + i),
+                _mm_mul_ps(_mm_loadu_ps(pSrc + i), factor)));
+        }
+#endif
+
+        for (; i < count; ++i)
+            pDst[i] += pSrc[i] * weight;
+    }
+
+    // Downsamples a linear RGBA image, first vertically into a single row and
+    // then horizontally from that row. Texels are 4 floats, so both passes
+    // work on whole texels with SSE.
+    void downsample(const std::vector<float> &source, unsigned int sourceWidth,
+                    unsigned int sourceHeight, unsigned int width, unsigned int height,
+                    MipFilter filter, std::vector<float> &result)
+    {
+        FilterTaps columns;
+        FilterTaps rows;
+
+        computeTaps(sourceWidth, width, filter, columns);
+        computeTaps(sourceHeight, height, filter, rows);
+
+        std::vector<float> row(sourceWidth * 4);
+
+        result.resize(width * height * 4);
+
+        for (unsigned int y = 0; y < height; ++y)
+        {
+            std::fill(row.begin(), row.end(), 0.0f);
+
+            for (int j = 0; j < rows.count; ++j)
+            {
+                float weight = rows.weights[y * rows.count + j];
+
+                if (weight != 0.0f)
+                {
+                    accumulateRow(&row[0], &source[rows.indices[y * rows.count + j] * sourceWidth * 4],
+                        weight, row.size());
+                }
+            }
+
+            float *pDst = &result[y * width * 4];
+
+            for (unsigned int x = 0; x < width; ++x, pDst += 4)
+            {
+                const int *pIndices = &columns.indices[x * columns.count];
+                const float *pWeights = &columns.weights[x * columns.count];
+
+#if defined(TEXTURE_BAKER_USE_SSE2)
+                __m128 sum = _mm_setzero_ps();
+
+                for (int j = 0; j < columns.count; ++j)
+                {
+                    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(&row[pIndices[j] * 4]),
+                        _mm_set1_ps(pWeights[j])));
+                }
+
+                _mm_storeu_ps(pDst, sum);
+#else
+                pDst[0] = pDst[1] = pDst[2] = pDst[3] = 0.0f;
+
+                for (int j = 0; j < columns.count; ++j)
+                {
+                    const float *pSrc = &row[pIndices[j] * 4];
+
+                    for (int k = 0; k < 4; ++k)
+                        pDst[k] += pSrc[k] * pWeights[j];
+                }
+#endif
+            }
+        }
+    }
+}
+
+BakedTexture::BakedTexture()
+    : m_pData(0), m_size(0), m_internalFormat(0), m_format(0), m_type(0),
+      m_filter(MIP_FILTER_BOX), m_compression(TEXTURE_COMPRESSION_NONE), m_quality(0),
+      m_psnr(HUGE_VALF), m_sourceSize(0), m_sourceTime(0), m_sourceHash(0),
+      m_pMapping(0), m_mappingSize(0)
+#if defined(_WIN32)
+      , m_hFile(INVALID_HANDLE_VALUE), m_hMapping(0)
+#endif
+{
+}
+
+BakedTexture::~BakedTexture()
+{
+    close();
+}
+
+void BakedTexture::build(const unsigned char *pPixels, unsigned int width,
+                         unsigned int height, unsigned int channels, MipFilter filter)
+{
+    close();
+
+    if (width == 0 || height == 0 || (channels != 3 && channels != 4))
+        return;
+
+    m_internalFormat = (channels == 4) ? GL_RGBA : GL_RGB;
+    m_format = m_internalFormat;
+    m_type = GL_UNSIGNED_BYTE;
+    m_filter = filter;
+    m_compression = TEXTURE_COMPRESSION_NONE;
+    m_quality = 0;
+    m_psnr = HUGE_VALF;
+
+    // Lay out the levels down to 1x1, halving and rounding down each
+    // dimension as GL does.
+
+    for (unsigned int w = width, h = height; ; w = std::max(1u, w / 2), h = std::max(1u, h / 2))
+    {
+        Level level;
+
+        level.width = w;
+        level.height = h;
+        level.offset = m_size;
+        level.size = static_cast<unsigned long long>(w) * h * channels;
+
+        m_levels.push_back(level);
+        m_size = alignData(m_size + static_cast<size_t>(level.size));
+
+        if (w == 1 && h == 1)
+            break;
+    }
+
+    m_data.resize(m_size);
+    m_pData = &m_data[0];
+    memcpy(&m_data[0], pPixels, static_cast<size_t>(m_levels[0].size));
+
+    // Filter every level from the linear values of the previous one, so
+    // rounding errors don't add up along the chain.
+
+    const ColorTables &tables = colorTables();
+    std::vector<float> image(width * height * 4);
+    std::vector<float> next;
+
+    for (unsigned int i = 0; i < width * height; ++i)
+    {
+        const unsigned char *pSrc = &pPixels[i * channels];
+        float *pDst = &image[i * 4];
+
+        pDst[0] = tables.toLinear[pSrc[0]];
+        pDst[1] = tables.toLinear[pSrc[1]];
+        pDst[2] = tables.toLinear[pSrc[2]];
+        pDst[3] = (channels == 4) ? pSrc[3] / 255.0f : 1.0f;
+    }
+
+    for (size_t i = 1; i < m_levels.size(); ++i)
+    {
+        const Level &source = m_levels[i - 1];
+        const Level &level = m_levels[i];
+
+        downsample(image, source.width, source.height, level.width, level.height, filter, next);
+        image.swap(next);
+
+        unsigned char *pDst = &m_data[static_cast<size_t>(level.offset)];
+
+        for (unsigned int j = 0; j < level.width * level.height; ++j, pDst += channels)
+        {
+            const float *pSrc = &image[j * 4];
+
+            pDst[0] = encodeColor(tables, pSrc[0]);
+            pDst[1] = encodeColor(tables, pSrc[1]);
+            pDst[2] = encodeColor(tables, pSrc[2]);
+
+            if (channels == 4)
+                pDst[3] = encodeAlpha(pSrc[3]);
+        }
+    }
+}
+
+float BakedTexture::compress(TextureCompression compression, int quality, int numThreads)
+{
+    if (compression == TEXTURE_COMPRESSION_NONE || m_levels.empty() || m_data.empty()
+        || m_format == 0)
+        return m_psnr;
+
+    // Textures whose alpha is 255 everywhere are stored without it.
+
+    unsigned int channels = (m_format == GL_RGBA) ? 4 : 3;
+    bool opaque = true;
+
+    for (unsigned long long i = 3; channels == 4 && i < m_levels[0].size && opaque; i += 4)
+        opaque = m_data[static_cast<size_t>(i)] == 255;
+
+    BlockFormat format = BLOCK_FORMAT_BC1;
+
+    if (!opaque)
+        format = (compression == TEXTURE_COMPRESSION_BC3) ? BLOCK_FORMAT_BC3 : BLOCK_FORMAT_BC7;
+
+    int errorChannels = opaque ? 3 : 4;
+    double squaredError = 0.0;
+    unsigned long long samples = 0;
+    std::vector<unsigned char> rgba;
+    std::vector<unsigned char> decoded;
+    std::vector<unsigned char> data;
+    size_t size = 0;
+
+    for (size_t i = 0; i < m_levels.size(); ++i)
+    {
+        Level &level = m_levels[i];
+        unsigned int texels = level.width * level.height;
+        const unsigned char *pSrc = &m_data[static_cast<size_t>(level.offset)];
+
+        rgba.resize(texels * 4);
+        decoded.resize(texels * 4);
+
+        for (unsigned int j = 0; j < texels; ++j)
+        {
+            rgba[j * 4 + 0] = pSrc[j * channels + 0];
+            rgba[j * 4 + 1] = pSrc[j * channels + 1];
+            rgba[j * 4 + 2] = pSrc[j * channels + 2];
+            rgba[j * 4 + 3] = (channels == 4) ? pSrc[j * channels + 3] : 255;
+        }
+
+        level.offset = size;
+        level.size = getCompressedSize(format, level.width, level.height);
+        size = alignData(size + static_cast<size_t>(level.size));
+        data.resize(size);
+
+        unsigned char *pBlocks = &data[static_cast<size_t>(level.offset)];
+
+        compressImage(&rgba[0], level.width, level.height, format, quality, numThreads, pBlocks);
+        decompressImage(pBlocks, level.width, level.height, format, &decoded[0]);
+
+        for (unsigned int j = 0; j < texels * 4; j += 4)
+        {
+            for (int c = 0; c < errorChannels; ++c)
+            {
+                double delta = static_cast<double>(rgba[j + c]) - decoded[j + c];
+                squaredError += delta * delta;
+            }
+        }
+
+        samples += static_cast<unsigned long long>(texels) * errorChannels;
+    }
+
+    m_data.swap(data);
+    m_pData = &m_data[0];
+    m_size = size;
+
+    switch (format)
+    {
+    case BLOCK_FORMAT_BC1:
+        m_internalFormat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        break;
+
+    case BLOCK_FORMAT_BC3:
+        m_internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        break;
+
+    case BLOCK_FORMAT_BC7:
+        m_internalFormat = GL_COMPRESSED_RGBA_BPTC_UNORM;
+        break;
+    }
+
+    m_format = 0;
+    m_type = 0;
+    m_compression = compression;
+    m_quality = quality;
+    m_psnr = (squaredError > 0.0)
+        ? static_cast<float>(10.0 * log10(255.0 * 255.0 * samples / squaredError)) : HUGE_VALF;
+
+    return m_psnr;
+}
+
+bool BakedTexture::open(const std::string &filename)
+{
+    close();
+
+#if defined(_WIN32)
+    // FILE_SHARE_DELETE lets save() replace the file while it is mapped.
+    m_hFile = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, 0,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+
+    if (m_hFile == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+
+    if (!GetFileSizeEx(m_hFile, &fileSize)
+        || fileSize.QuadPart < static_cast<LONGLONG>(sizeof(BakedHeader)))
+    {
+        close();
+        return false;
+    }
+
+    m_mappingSize = static_cast<size_t>(fileSize.QuadPart);
+    m_hMapping = CreateFileMappingA(m_hFile, 0, PAGE_READONLY, 0, 0, 0);
+
+    if (m_hMapping)
+        m_pMapping = MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY);
+
+    if (fd < 0)
+        return false;
+
+    struct stat fileInfo;
+
+    if (fstat(fd, &fileInfo) != 0 || fileInfo.st_size < static_cast<off_t>(sizeof(BakedHeader)))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    m_mappingSize = static_cast<size_t>(fileInfo.st_size);
+
+    void *pMapping = mmap(0, m_mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (pMapping != MAP_FAILED)
+        m_pMapping = pMapping;
+#endif
+
+    if (!m_pMapping)
+    {
+        close();
+        return false;
+    }
+
+    // Check the header, that the levels form a full mip chain in a format
+    // the GL knows, and that every level lies within the file.
+
+    const unsigned char *pFile = static_cast<const unsigned char *>(m_pMapping);
+    BakedHeader header;
+
+    memcpy(&header, pFile, sizeof(header));
+
+    bool valid = memcmp(header.magic, BAKED_MAGIC, sizeof(header.magic)) == 0
+        && header.version == BAKED_VERSION
+        && header.fileSize == m_mappingSize
+        && header.numberOfLevels > 0
+        && header.numberOfLevels <= BAKED_MAX_LEVELS
+        && header.filter <= MIP_FILTER_KAISER
+        && header.compression <= TEXTURE_COMPRESSION_BC7
+        && (header.compression == TEXTURE_COMPRESSION_NONE) == (header.format != 0)
+        && header.dataOffset >= sizeof(header) + header.numberOfLevels * sizeof(Level)
+        && header.dataOffset <= header.fileSize;
+
+    if (valid)
+    {
+        m_levels.resize(header.numberOfLevels);
+        memcpy(&m_levels[0], pFile + sizeof(header), m_levels.size() * sizeof(Level));
+
+        m_size = static_cast<size_t>(header.fileSize - header.dataOffset);
+
+        for (size_t i = 0; i < m_levels.size() && valid; ++i)
+        {
+            const Level &level = m_levels[i];
+            unsigned int width = (i == 0) ? level.width : std::max(1u, m_levels[i - 1].width / 2);
+            unsigned int height = (i == 0) ? level.height : std::max(1u, m_levels[i - 1].height / 2);
+
+            valid = level.width == width && level.height == height
+                && width > 0 && width <= BAKED_MAX_SIZE
+                && height > 0 && height <= BAKED_MAX_SIZE
+                && level.size == getLevelSize(header, width, height) && level.size > 0
+                && level.offset <= m_size
+                && level.size <= m_size - level.offset;
+        }
+
+        valid = valid && m_levels.back().width == 1 && m_levels.back().height == 1;
+    }
+
+    if (!valid)
+    {
+        close();
+        return false;
+    }
+
+    m_pData = pFile + header.dataOffset;
+    m_internalFormat = header.internalFormat;
+    m_format = header.format;
+    m_type = header.type;
+    m_filter = static_cast<MipFilter>(header.filter);
+    m_compression = static_cast<TextureCompression>(header.compression);
+    m_quality = static_cast<int>(header.quality);
+    m_psnr = header.psnr;
+    m_sourceSize = header.sourceSize;
+    m_sourceTime = header.sourceTime;
+    m_sourceHash = header.sourceHash;
+    return true;
+}
+
+bool BakedTexture::save(const std::string &filename) const
+{
+    if (m_levels.empty())
+        return false;
+
+    BakedHeader header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BAKED_MAGIC, sizeof(header.magic));
+    header.version = BAKED_VERSION;
+    header.internalFormat = m_internalFormat;
+    header.format = m_format;
+    header.type = m_type;
+    header.filter = m_filter;
+    header.numberOfLevels = static_cast<unsigned int>(m_levels.size());
+    header.compression = m_compression;
+    header.quality = static_cast<unsigned int>(m_quality);
+    header.psnr = m_psnr;
+    header.sourceSize = m_sourceSize;
+    header.sourceTime = m_sourceTime;
+    header.sourceHash = m_sourceHash;
+    header.dataOffset = alignData(sizeof(header) + m_levels.size() * sizeof(Level));
+    header.fileSize = header.dataOffset + m_size;
+
+    std::vector<unsigned char> buffer(static_cast<size_t>(header.dataOffset), 0);
+
+    memcpy(&buffer[0], &header, sizeof(header));
+    memcpy(&buffer[sizeof(header)], &m_levels[0], m_levels.size() * sizeof(Level));
+
+    // Write to a temporary file first so that a concurrent or interrupted
+    // run never sees a half written file. The name is unique to the
+    // process and thread, so concurrent writers don't share it.
+
+#if defined(_WIN32)
+    unsigned long processId = GetCurrentProcessId();
+#else
+    unsigned long processId = static_cast<unsigned long>(getpid());
+#endif
+
+    char suffix[64];
+    sprintf(suffix, ".%lu.%llx.tmp", processId, static_cast<unsigned long long>(
+        std::hash<std::thread::id>()(std::this_thread::get_id())));
+
+    std::string tempFilename = filename + suffix;
+    FILE *pFile = fopen(tempFilename.c_str(), "wb");
+
+    if (!pFile)
+        return false;
+
+    bool written = fwrite(&buffer[0], 1, buffer.size(), pFile) == buffer.size()
+        && fwrite(m_pData, 1, m_size, pFile) == m_size;
+
+    written = (fclose(pFile) == 0) && written;
+
+    // Move the new file over the old one in a single step, so that there is
+    // never a moment without a baked file. rename() does that on POSIX
+    // systems, but fails on Windows if the target exists.
+
+#if defined(_WIN32)
+    bool replaced = written
+        && MoveFileExA(tempFilename.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    bool replaced = written && rename(tempFilename.c_str(), filename.c_str()) == 0;
+#endif
+
+    if (!replaced)
+    {
+        remove(tempFilename.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+void BakedTexture::close()
+{
+#if defined(_WIN32)
+    if (m_pMapping)
+        UnmapViewOfFile(m_pMapping);
+
+    if (m_hMapping)
+        CloseHandle(m_hMapping);
+
+    if (m_hFile != INVALID_HANDLE_VALUE)
+        CloseHandle(m_hFile);
+
+    m_hMapping = 0;
+    m_hFile = INVALID_HANDLE_VALUE;
+#else
+    if (m_pMapping)
+        munmap(m_pMapping, m_mappingSize);
+#endif
+
+    m_pMapping = 0;
+    m_mappingSize = 0;
+
+    m_levels.clear();
+    m_data.clear();
+    m_pData = 0;
+    m_size = 0;
+}
+
+void BakedTexture::setSource(unsigned long long size, long long time, unsigned long long hash)
+{
+    m_sourceSize = size;
+    m_sourceTime = time;
+    m_sourceHash = hash;
+}
+
+bool BakedTexture::isBakedFrom(const std::string &source, unsigned long long size, long long time) const
+{
+    if (m_levels.empty() || size != m_sourceSize)
+        return false;
+
+    if (time == m_sourceTime)
+        return true;
+
+    FILE *pFile = fopen(source.c_str(), "rb");
+
+    if (!pFile)
+        return false;
+
+    unsigned char buffer[65536];
+    unsigned long long hash = HASH_SEED;
+    unsigned long long total = 0;
+    size_t count = 0;
+
+    while ((count = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+    {
+        hash = hashBytes(hash, buffer, count);
+        total += count;
+    }
+
+    fclose(pFile);
+    return total == size && hash == m_sourceHash;
+}
@@ -0,0 +1,171 @@
+#if !defined(TEXTURE_BAKER_H)
+#define TEXTURE_BAKER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "block_compression.h"
+
+//-----------------------------------------------------------------------------
+// Textures with their mip chain baked ahead of time.
+//
+// A BakedTexture holds every mip level of an 8-bit RGB or RGBA image, laid
+// out so that each level can be passed to glTexImage2D() as is: rows are
+// tightly packed and every level starts on a 16 byte boundary. The levels
+// are either built in memory from decoded pixels or mapped from a baked
+// file, so that loading a baked texture costs no decoding and no copies.
+//
+// The mip chain is filtered in linear space. The color channels are treated
+// as sRGB encoded, alpha as linear. Textures wrap around at their edges, as
+// with the default GL_REPEAT wrap mode.
+//
+// Built textures can then be block compressed. Opaque textures become BC1,
+// textures with alpha BC3 or BC7. Compression measures the PSNR of the
+// decoded levels against the uncompressed ones.
+//
+// Baked file layout (version 2). All values are stored in the native byte
+// order of the machine that wrote the file:
+//
+//   BakedHeader
+//   levels         numberOfLevels * Level, largest level first
+//   level data     starting at dataOffset, every level 16 byte aligned
+//-----------------------------------------------------------------------------
+
+enum MipFilter
+{
+    MIP_FILTER_BOX,         // average of the texels each texel covers
+    MIP_FILTER_KAISER       // Kaiser windowed sinc, sharper minification
+};
+
+enum TextureCompression
+{
+    TEXTURE_COMPRESSION_NONE,
+    TEXTURE_COMPRESSION_BC3,    // BC1 for opaque textures, BC3 with alpha
+    TEXTURE_COMPRESSION_BC7     // BC1 for opaque textures, BC7 with alpha
+};
+
+class BakedTexture
+{
+public:
+    struct Level
+    {
+        unsigned int width;
+        unsigned int height;
+        unsigned long long offset;  // from the start of the level data
+        unsigned long long size;
+    };
+
+    BakedTexture();
+    ~BakedTexture();
+
+    // Builds the full mip chain down to 1x1 from an image with 3 (RGB) or
+    // 4 (RGBA) channels.
+    void build(const unsigned char *pPixels, unsigned int width,
+        unsigned int height, unsigned int channels, MipFilter filter);
+
+    // Block compresses the levels of a built texture on up to numThreads
+    // threads and returns the PSNR in dB over all levels and the channels
+    // kept, infinite if nothing was lost. Mapped or already compressed
+    // textures are left as they are.
+    float compress(TextureCompression compression, int quality, int numThreads);
+
+    // Maps a baked file. Returns false if it is missing or malformed.
+    bool open(const std::string &filename);
+
+    // Writes the texture to a baked file, replacing it atomically.
+    bool save(const std::string &filename) const;
+
+    void close();
+
+    // Identifies the source file the texture was baked from, by the stamp
+    // and content hash from file_stamp.h.
+    void setSource(unsigned long long size, long long time, unsigned long long hash);
+
+    // Whether the texture was baked from the file source with the given
+    // stamp. A file with only a new modification time is hashed and still
+    // matches if its contents are the same.
+    bool isBakedFrom(const std::string &source, unsigned long long size, long long time) const;
+
+    bool isValid() const
+    { return !m_levels.empty(); }
+
+    unsigned int getWidth() const
+    { return m_levels.empty() ? 0 : m_levels[0].width; }
+
+    unsigned int getHeight() const
+    { return m_levels.empty() ? 0 : m_levels[0].height; }
+
+    int getNumberOfLevels() const
+    { return static_cast<int>(m_levels.size()); }
+
+    const Level &getLevel(int level) const
+    { return m_levels[level]; }
+
+    const unsigned char *getLevelData(int level) const
+    { return m_pData + m_levels[level].offset; }
+
+    // GL enums to upload the levels with. The format and type are 0 for
+    // compressed internal formats.
+    unsigned int getInternalFormat() const
+    { return m_internalFormat; }
+
+    unsigned int getFormat() const
+    { return m_format; }
+
+    unsigned int getType() const
+    { return m_type; }
+
+    MipFilter getFilter() const
+    { return m_filter; }
+
+    TextureCompression getCompression() const
+    { return m_compression; }
+
+    int getQuality() const
+    { return m_quality; }
+
+    float getPsnr() const
+    { return m_psnr; }
+
+    size_t getSize() const
+    { return m_size; }
+
+    unsigned long long getSourceSize() const
+    { return m_sourceSize; }
+
+    long long getSourceTime() const
+    { return m_sourceTime; }
+
+    unsigned long long getSourceHash() const
+    { return m_sourceHash; }
+
+private:
+    BakedTexture(const BakedTexture &);
+    BakedTexture &operator=(const BakedTexture &);
+
+    std::vector<Level> m_levels;
+    std::vector<unsigned char> m_data;  // levels built in memory
+    const unsigned char *m_pData;       // m_data or the mapped file
+    size_t m_size;                      // bytes of level data
+
+    unsigned int m_internalFormat;
+    unsigned int m_format;
+    unsigned int m_type;
+    MipFilter m_filter;
+    TextureCompression m_compression;
+    int m_quality;
+    float m_psnr;
+
+    unsigned long long m_sourceSize;
+    long long m_sourceTime;
+    unsigned long long m_sourceHash;
+
+    void *m_pMapping;
+    size_t m_mappingSize;
+#if defined(_WIN32)
+    void *m_hFile;
+    void *m_hMapping;
+#endif
+};
+
+#endif
@@ -0,0 +1,523 @@
+#define _CRT_SECURE_NO_WARNINGS // suppress warnings for unsafe methods
+
+#include <gl/glew.h>
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstdlib>
+#include <thread>
+#include "file_stamp.h"
+#include "lodepng.h"
+#include "texture_cache.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+namespace
+{
+    // lodepng's error code for a file that can't be opened.
+    const unsigned int ERROR_FILE_NOT_FOUND = 78;
+
+    // How textures are baked.
+    struct BakeSettings
+    {
+        MipFilter filter;
+        TextureCompression compression;
+        int quality;
+    };
+
+    // Maps the baked file of a PNG if it was baked from the current file
+    // with the given settings.
+    bool openBaked(const std::string &path, unsigned long long sourceSize,
+                   long long sourceTime, const BakeSettings &settings, BakedTexture &texture)
+    {
+        if (!texture.open(path + ".cache"))
+            return false;
+
+        // The settings are compared first, as matching the source may mean
+        // hashing it.
+
+        if (texture.getFilter() != settings.filter
+            || texture.getCompression() != settings.compression
+            || (settings.compression != TEXTURE_COMPRESSION_NONE
+                && texture.getQuality() != settings.quality)
+            || !texture.isBakedFrom(path, sourceSize, sourceTime))
+        {
+            texture.close();
+            return false;
+        }
+
+        return true;
+    }
+
+    // The arena lodepng decodes in on this thread. A thread loading one image
+    // after another then reuses the same memory instead of the heap.
+    struct DecodeArena
+    {
+        LodePNGArena *arena;
+
+        DecodeArena() : arena(lodepng_arena_new(0)) {}
+        ~DecodeArena() { lodepng_arena_delete(arena); }
+    };
+
+    // Decodes a PNG, builds its mip chain and compresses it. Images whose
+    // alpha is 255 everywhere are kept as RGB.
+    unsigned int decodeLevels(const std::vector<unsigned char> &contents,
+                              const BakeSettings &settings, int numThreads,
+                              BakedTexture &texture)
+    {
+        static thread_local DecodeArena decodeArena;
+
+        LodePNGState state;
+        lodepng_state_init(&state);
+
+        if (decodeArena.arena != NULL)
+            state.decoder.zlibsettings.allocator = lodepng_arena_allocator(decodeArena.arena);
+
+        std::vector<unsigned char> pixels;
+        unsigned char *image = NULL;
+        unsigned int width = 0;
+        unsigned int height = 0;
+        unsigned int error = lodepng_decode(&image, &width, &height, &state,
+                                            contents.empty() ? NULL : &contents[0], contents.size());
+
+        if (error == 0)
+            pixels.assign(image, image + lodepng_get_raw_size(width, height, &state.info_raw));
+
+        if (decodeArena.arena != NULL)
+            lodepng_arena_reset(decodeArena.arena);
+        else
+            free(image);
+
+        lodepng_state_cleanup(&state);
+
+        if (error != 0)
+            return error;
+
+        size_t texels = static_cast<size_t>(width) * height;
+        unsigned int channels = 3;
+
+        for (size_t i = 0; i < texels && channels == 3; ++i)
+        {
+            if (pixels[i * 4 + 3] != 255)
+                channels = 4;
+        }
+
+        if (channels == 3)
+        {
+            for (size_t i = 0; i < texels; ++i)
+            {
+                pixels[i * 3 + 0] = pixels[i * 4 + 0];
+                pixels[i * 3 + 1] = pixels[i * 4 + 1];
+                pixels[i * 3 + 2] = pixels[i * 4 + 2];
+            }
+        }
+
+        texture.build(&pixels[0], width, height, channels, settings.filter);
+        texture.compress(settings.compression, settings.quality, numThreads);
+        return 0;
+    }
+}
+
+TextureCache &TextureCache::instance()
+{
+    static TextureCache cache;
+    return cache;
+}
+
+TextureCache::TextureCache()
+{
+    m_statistics.hits = 0;
+    m_statistics.contentHits = 0;
+    m_statistics.misses = 0;
+    m_statistics.bakedLoads = 0;
+    m_statistics.evictions = 0;
+    m_statistics.textures = 0;
+    m_statistics.residentBytes = 0;
+    m_statistics.budgetBytes = 256 * 1024 * 1024;
+    m_baking = true;
+    m_filter = MIP_FILTER_KAISER;
+    m_compression = TEXTURE_COMPRESSION_BC7;
+    m_quality = 2;
+}
+
+std::string TextureCache::canonicalPath(const std::string &filename)
+{
+    // Resolve the path against the working directory and through symbolic
+    // links. Windows paths are case insensitive. Files that don't exist
+    // keep their name with uniform separators.
+
+#if defined(_WIN32)
+    std::string path = filename;
+    char buffer[MAX_PATH];
+    DWORD length = GetFullPathNameA(filename.c_str(), MAX_PATH, buffer, 0);
+
+    if (length > 0 && length < MAX_PATH)
+        path.assign(buffer, length);
+
+    std::replace(path.begin(), path.end(), '/', '\\');
+
+    for (size_t i = 0; i < path.size(); ++i)
+        path[i] = static_cast<char>(tolower(static_cast<unsigned char>(path[i])));
+
+    return path;
+#else
+    std::string path = filename;
+    char buffer[PATH_MAX];
+
+    std::replace(path.begin(), path.end(), '\\', '/');
+
+    if (realpath(path.c_str(), buffer))
+        path = buffer;
+
+    return path;
+#endif
+}
+
+bool TextureCache::load(const std::string &filename, Image &image)
+{
+    image.path = canonicalPath(filename);
+    image.hash = 0;
+    image.error = 0;
+    image.cached = false;
+    image.baked = false;
+    image.levels.reset();
+
+    unsigned long long sourceSize = 0;
+    long long sourceTime = 0;
+
+    if (!getFileStamp(image.path.c_str(), sourceSize, sourceTime))
+    {
+        image.error = ERROR_FILE_NOT_FOUND;
+        return false;
+    }
+
+    bool baking;
+    BakeSettings settings;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        baking = m_baking;
+        settings.filter = m_filter;
+        settings.compression = m_compression;
+        settings.quality = m_quality;
+    }
+
+    // An up to date baked file already knows the content hash, so the PNG
+    // isn't even read.
+
+    std::shared_ptr<BakedTexture> levels(new BakedTexture);
+    std::vector<unsigned char> contents;
+
+    if (baking && openBaked(image.path, sourceSize, sourceTime, settings, *levels))
+    {
+        image.hash = levels->getSourceHash();
+        image.baked = true;
+    }
+    else
+    {
+        lodepng::load_file(contents, image.path);
+
+        if (contents.empty())
+        {
+            image.error = ERROR_FILE_NOT_FOUND;
+            return false;
+        }
+
+        image.hash = hashContents(&contents[0], contents.size());
+    }
+
+    // Pin a cached texture until the image is acquired, so that it can't be
+    // evicted in between. Contents that another thread is decoding are
+    // waited for rather than decoded twice.
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    for (;;)
+    {
+        std::map<unsigned long long, Entry>::iterator iter = m_entries.find(image.hash);
+
+        if (iter != m_entries.end())
+        {
+            ++iter->second.references;
+            image.cached = true;
+            return true;
+        }
+
+        if (m_decoding.insert(image.hash).second)
+            break;
+
+        m_uploaded.wait(lock);
+    }
+
+    if (image.baked)
+        ++m_statistics.bakedLoads;
+
+    lock.unlock();
+
+    if (!image.baked)
+    {
+        // The loading threads already keep every core busy.
+        image.error = decodeLevels(contents, settings, 1, *levels);
+
+        if (image.error != 0)
+        {
+            lock.lock();
+            m_decoding.erase(image.hash);
+            m_uploaded.notify_all();
+            return false;
+        }
+
+        if (baking)
+        {
+            levels->setSource(sourceSize, sourceTime, image.hash);
+            levels->save(image.path + ".cache");
+        }
+    }
+
+    image.levels = levels;
+    return true;
+}
+
+unsigned int TextureCache::acquire(const Image &image)
+{
+    if (image.error != 0)
+        return 0;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::map<unsigned long long, Entry>::iterator iter = m_entries.find(image.hash);
+
+    if (!image.cached && m_decoding.erase(image.hash) != 0)
+        m_uploaded.notify_all();
+
+    if (iter != m_entries.end())
+    {
+        // A pinned image already holds its reference.
+
+        Entry &entry = iter->second;
+        std::map<std::string, unsigned long long>::iterator path = m_paths.find(image.path);
+
+        if (image.cached)
+            --entry.references;
+
+        if (path != m_paths.end() && path->second == image.hash)
+        {
+            ++m_statistics.hits;
+        }
+        else
+        {
+            ++m_statistics.contentHits;
+            m_paths[image.path] = image.hash;
+        }
+
+        ++entry.references;
+        m_lru.splice(m_lru.begin(), m_lru, entry.lru);
+        return entry.texture;
+    }
+
+    if (!image.levels || !image.levels->isValid())
+        return 0;
+
+    // Upload the levels straight from the baked layout. The format is 0 for
+    // compressed levels.
+
+    const BakedTexture &levels = *image.levels;
+    int numberOfLevels = levels.getNumberOfLevels();
+    Entry entry;
+
+    glGenTextures(1, &entry.texture);
+    glBindTexture(GL_TEXTURE_2D, entry.texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);  // RGB rows aren't 4-byte aligned
+
+    for (int i = 0; i < numberOfLevels; ++i)
+    {
+        const BakedTexture::Level &level = levels.getLevel(i);
+
+        if (levels.getFormat() != 0)
+        {
+            glTexImage2D(GL_TEXTURE_2D, i, levels.getInternalFormat(), level.width, level.height,
+                0, levels.getFormat(), levels.getType(), levels.getLevelData(i));
+        }
+        else
+        {
+            glCompressedTexImage2D(GL_TEXTURE_2D, i, levels.getInternalFormat(), level.width,
+                level.height, 0, static_cast<GLsizei>(level.size), levels.getLevelData(i));
+        }
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numberOfLevels - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+        (numberOfLevels > 1) ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    entry.references = 1;
+    entry.bytes = levels.getSize();
+    m_lru.push_front(image.hash);
+    entry.lru = m_lru.begin();
+
+    m_entries[image.hash] = entry;
+    m_paths[image.path] = image.hash;
+    m_textures[entry.texture] = image.hash;
+
+    ++m_statistics.misses;
+    ++m_statistics.textures;
+    m_statistics.residentBytes += entry.bytes;
+
+    evict();
+    return entry.texture;
+}
+
+void TextureCache::release(unsigned int texture)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::map<unsigned int, unsigned long long>::iterator iter = m_textures.find(texture);
+
+    if (iter == m_textures.end())
+        return;
+
+    Entry &entry = m_entries[iter->second];
+
+    if (entry.references > 0)
+        --entry.references;
+
+    evict();
+}
+
+void TextureCache::setBudget(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_statistics.budgetBytes = bytes;
+    evict();
+}
+
+void TextureCache::setBaking(bool enabled)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_baking = enabled;
+}
+
+void TextureCache::setMipFilter(MipFilter filter)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_filter = filter;
+}
+
+void TextureCache::setCompression(TextureCompression compression, int quality)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_compression = compression;
+    m_quality = std::min(std::max(quality, 0), BLOCK_QUALITY_MAX);
+}
+
+bool TextureCache::bake(const std::string &filename, float *pPsnr)
+{
+    std::string path = canonicalPath(filename);
+    unsigned long long sourceSize = 0;
+    long long sourceTime = 0;
+    BakeSettings settings;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        settings.filter = m_filter;
+        settings.compression = m_compression;
+        settings.quality = m_quality;
+    }
+
+    if (!getFileStamp(path.c_str(), sourceSize, sourceTime))
+        return false;
+
+    BakedTexture levels;
+
+    if (!openBaked(path, sourceSize, sourceTime, settings, levels))
+    {
+        std::vector<unsigned char> contents;
+        lodepng::load_file(contents, path);
+
+        int numThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+        if (contents.empty() || decodeLevels(contents, settings, numThreads, levels) != 0)
+            return false;
+
+        levels.setSource(sourceSize, sourceTime, hashContents(&contents[0], contents.size()));
+
+        if (!levels.save(path + ".cache"))
+            return false;
+    }
+
+    if (pPsnr)
+        *pPsnr = levels.getPsnr();
+
+    return true;
+}
+
+TextureCache::Statistics TextureCache::getStatistics() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_statistics;
+}
+
+void TextureCache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (std::map<unsigned long long, Entry>::iterator iter = m_entries.begin();
+        iter != m_entries.end(); ++iter)
+    {
+        glDeleteTextures(1, &iter->second.texture);
+    }
+
+    m_entries.clear();
+    m_paths.clear();
+    m_textures.clear();
+    m_lru.clear();
+
+    m_statistics.textures = 0;
+    m_statistics.residentBytes = 0;
+}
+
+void TextureCache::evict()
+{
+    // Walk from the least recently used end and delete unreferenced
+    // textures until the resident size fits the budget.
+
+    std::list<unsigned long long>::iterator iter = m_lru.end();
+
+    while (m_statistics.residentBytes > m_statistics.budgetBytes && iter != m_lru.begin())
+    {
+        --iter;
+
+        unsigned long long hash = *iter;
+        Entry &entry = m_entries[hash];
+
+        if (entry.references > 0)
+            continue;
+
+        glDeleteTextures(1, &entry.texture);
+        m_textures.erase(entry.texture);
+
+        for (std::map<std::string, unsigned long long>::iterator path = m_paths.begin();
+            path != m_paths.end();)
+        {
+            if (path->second == hash)
+                m_paths.erase(path++);
+            else
+                ++path;
+        }
+
+        m_statistics.residentBytes -= entry.bytes;
+        --m_statistics.textures;
+        ++m_statistics.evictions;
+
+        iter = m_lru.erase(iter);
+        m_entries.erase(hash);
+    }
+}
@@ -0,0 +1,127 @@
+#if !defined(TEXTURE_CACHE_H)
+#define TEXTURE_CACHE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include "texture_baker.h"
+
+//-----------------------------------------------------------------------------
+// Process-wide cache of mipmapped 2D textures loaded from PNG files.
+//
+// Entries are keyed by the content hash of the file, so that the same image
+// referenced through different paths, materials or models is decoded and
+// uploaded only once. Canonical paths map onto those entries.
+//
+// Loading is split in two steps. load() reads, hashes and, on a miss,
+// decodes a file, builds its mip chain and block compresses it. It may run
+// on any thread. acquire() then hands out the
+// GL texture and must run on the GL thread, as must release(),
+// setBudget() and clear(). Every texture returned by acquire() holds a
+// reference until it is released. Unreferenced textures stay resident
+// until the resident size exceeds the byte budget, at which point the
+// least recently used of them are deleted.
+//
+// With baking enabled, every decoded mip chain is written to a baked file
+// next to its PNG ("texture.png.cache"). Later loads map the baked file
+// instead of decoding the PNG, as long as the PNG's size and modification
+// time, the mip filter and the compression settings are unchanged.
+//-----------------------------------------------------------------------------
+
+class TextureCache
+{
+public:
+    struct Image
+    {
+        std::string path;       // canonical path of the file
+        unsigned long long hash;
+        unsigned int error;     // lodepng error code, 0 on success
+        bool cached;            // the texture is resident, nothing decoded
+        bool baked;             // the levels were mapped from a baked file
+        std::shared_ptr<BakedTexture> levels;
+    };
+
+    struct Statistics
+    {
+        int hits;               // path and content already cached
+        int contentHits;        // content cached under another path
+        int misses;             // decoded or mapped, and uploaded
+        int bakedLoads;         // mapped from a baked file
+        int evictions;
+        int textures;           // resident textures
+        size_t residentBytes;
+        size_t budgetBytes;
+    };
+
+    static TextureCache &instance();
+
+    // Reads the file and decodes it unless its contents are already cached.
+    // If another thread is decoding the same contents, waits for that
+    // texture instead. A cached texture is kept resident until the image is
+    // acquired, so every successfully loaded image must be passed to
+    // acquire(). Returns false if the file can't be read or decoded.
+    bool load(const std::string &filename, Image &image);
+
+    // Returns the texture of a loaded image with a new reference, creating
+    // it if necessary, or 0 if the image failed to load.
+    unsigned int acquire(const Image &image);
+    void release(unsigned int texture);
+
+    void setBudget(size_t bytes);
+
+    // Defaults to writing and reading baked files, with the Kaiser filter
+    // and BC1/BC7 compression at quality 2. Compression has to be turned
+    // off or down to BC3 if the GL doesn't support the formats.
+    void setBaking(bool enabled);
+    void setMipFilter(MipFilter filter);
+    void setCompression(TextureCompression compression, int quality);
+
+    // Writes the baked file of a PNG unless it is up to date, without
+    // creating a texture, compressing on all cores. Returns false if the
+    // file can't be decoded or the baked file can't be written. pPsnr
+    // receives the compression PSNR of the texture.
+    bool bake(const std::string &filename, float *pPsnr = 0);
+
+    Statistics getStatistics() const;
+
+    // Deletes every texture. References held by callers become invalid.
+    void clear();
+
+    static std::string canonicalPath(const std::string &filename);
+
+private:
+    struct Entry
+    {
+        unsigned int texture;
+        int references;         // callers and pending loads
+        size_t bytes;
+        std::list<unsigned long long>::iterator lru;
+    };
+
+    TextureCache();
+    TextureCache(const TextureCache &);
+    TextureCache &operator=(const TextureCache &);
+
+    void evict();
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_uploaded;
+    std::set<unsigned long long> m_decoding;
+    std::map<unsigned long long, Entry> m_entries;
+    std::map<std::string, unsigned long long> m_paths;
+    std::map<unsigned int, unsigned long long> m_textures;
+    std::list<unsigned long long> m_lru;   // most recently used first
+    Statistics m_statistics;
+    bool m_baking;
+    MipFilter m_filter;
+    TextureCompression m_compression;
+    int m_quality;
+};
+
+#endif